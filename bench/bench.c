@@ -0,0 +1,750 @@
+/**
+ * @file bench.c
+ * @brief 定时器引擎的基准测试
+ *
+ * 分别用单级时间轮、多级时间轮、最小堆和日历队列，在不同的负载和定时器数量下测量:\n
+ *	1.add/reset(mod)/del/expire的吞吐量，expire以EMBED方式一次处理所有到期的定时器\n
+ *	2.多个线程同时add时每次add的延迟分位数\n
+ *	3.定时器实际执行时间与预期到期时间之差(lateness)的分布\n
+ * 每个结果输出一行JSON，便于用脚本比较不同版本的结果
+ *
+ * 用法: bench [-n 1000,10000,...] [-e wheel|hwheel|heap|calendar] [-w uniform|bursty|churn|cancelled] [-t 线程数] [-l lateness定时器上限，0表示不测]
+ *
+ * @version 0.1
+ * @date 2012-07-02
+ */
+
+#define _GNU_SOURCE
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define NSEC_PER_SEC	1000000000ULL
+#define NSEC_PER_MSEC	1000000ULL
+
+///直方图每个2的幂区间再分成2^HIST_SUB_BITS个桶，相对误差不超过1/16
+#define HIST_SUB_BITS	4
+#define HIST_SUB	( 1 << HIST_SUB_BITS )
+#define HIST_BUCKETS	( ( 64 - HIST_SUB_BITS + 1 ) << HIST_SUB_BITS )
+
+///负载中最长的间隔(毫秒)，expire时把时间推进到它之后
+#define MAX_INTERVAL	60000
+#define DEFAULT_SIZES	"1000,10000,100000,1000000"
+
+struct hist {
+        uint64_t count[HIST_BUCKETS];
+        uint64_t total;
+        uint64_t max;
+};
+
+///把引擎的接口统一成同一种形式
+struct engine {
+        const char *name;
+        void *( *create )( unsigned int n );
+        void ( *start )( void *m, timer_start_type type );
+        timer_id( *add )( void *m, struct timer *t );
+        TIMER_BOOL( *del )( void *m, timer_id id );
+        TIMER_BOOL( *mod )( void *m, timer_id id, unsigned int interval );
+        unsigned int ( *expire )( void *m, const struct timespec *now );
+        void ( *destroy )( void *m );
+};
+
+struct workload {
+        const char *name;
+        ///第i个定时器的间隔(毫秒)
+        unsigned int ( *interval )( unsigned int i, uint64_t *seed );
+        ///每个定时器被reset的次数
+        int resets;
+        ///到期前被删除的比例(千分比)
+        unsigned int cancel_permille;
+};
+
+///lateness测试中每个定时器的预期到期时间
+struct lateness_rec {
+        uint64_t deadline;
+};
+
+static struct hist lateness_hist;
+static volatile unsigned long lateness_fired;
+static volatile unsigned long lateness_early;
+///最早提前了多少(纳秒)，时间轮按时间片计时，添加时当前时间片已经过去的部分会被算进interval
+static uint64_t lateness_early_max;
+
+/* ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  == */
+
+static inline uint64_t now_ns( void )
+{
+        struct timespec ts;
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return ( uint64_t )ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static inline uint64_t xorshift( uint64_t *seed )
+{
+        uint64_t x = *seed;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        return *seed = x;
+}
+
+static inline unsigned int hist_index( uint64_t v )
+{
+        unsigned int shift;
+
+        if( v < HIST_SUB ) {
+                return ( unsigned int )v;
+        }
+
+        shift = 63 - __builtin_clzll( v ) - HIST_SUB_BITS;
+        return ( shift << HIST_SUB_BITS ) + ( unsigned int )( v >> shift );
+}
+
+///桶内的最大值
+static inline uint64_t hist_value( unsigned int index )
+{
+        unsigned int shift;
+
+        if( index < HIST_SUB ) {
+                return index;
+        }
+
+        shift = ( index >> HIST_SUB_BITS ) - 1;
+        return ( ( ( uint64_t )( index & ( HIST_SUB - 1 ) ) + HIST_SUB + 1 ) << shift ) - 1;
+}
+
+static inline void hist_record( struct hist *h, uint64_t v )
+{
+        ++h->count[hist_index( v )];
+        ++h->total;
+
+        if( v > h->max ) {
+                h->max = v;
+        }
+}
+
+static void hist_merge( struct hist *to, const struct hist *from )
+{
+        int i;
+
+        for( i = 0; i < HIST_BUCKETS; i++ ) {
+                to->count[i] += from->count[i];
+        }
+
+        to->total += from->total;
+
+        if( from->max > to->max ) {
+                to->max = from->max;
+        }
+}
+
+static uint64_t hist_percentile( const struct hist *h, double p )
+{
+        uint64_t want = ( uint64_t )( h->total * p ), seen = 0;
+        int i;
+
+        for( i = 0; i < HIST_BUCKETS; i++ ) {
+                seen += h->count[i];
+
+                if( seen > want ) {
+                        return hist_value( i ) < h->max ? hist_value( i ) : h->max;
+                }
+        }
+
+        return h->max;
+}
+
+static void hist_print( const struct hist *h )
+{
+        printf( "\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu",
+                ( unsigned long long )hist_percentile( h, 0.5 ), ( unsigned long long )hist_percentile( h, 0.9 ),
+                ( unsigned long long )hist_percentile( h, 0.99 ), ( unsigned long long )hist_percentile( h, 0.999 ),
+                ( unsigned long long )h->max );
+}
+
+/* ==  ==  ==  ==  ==  ==  ==  == engines ==  ==  ==  ==  ==  ==  ==  ==  == */
+
+static void *wheel_create_type( unsigned int n, timer_wheel_type type )
+{
+        struct timer_manager_conf conf = {1, 4096, n, type, 0, TIMER_CLOCK_MONOTONIC};
+        TIMER_MANAGER *m = create_timer_manager();
+
+        if( m == NULL ) {
+                return NULL;
+        }
+
+        if( m->init( m, &conf ) == TIMER_FALSE ) {
+                destroy_timer_manager( m );
+                return NULL;
+        }
+
+        return m;
+}
+
+static void *wheel_create( unsigned int n )
+{
+        return wheel_create_type( n, TIMER_WHEEL_SINGLE );
+}
+
+static void *hwheel_create( unsigned int n )
+{
+        return wheel_create_type( n, TIMER_WHEEL_HIERARCHY );
+}
+
+static void wheel_start( void *m, timer_start_type type )
+{
+        ( ( TIMER_MANAGER * )m )->start( m, type );
+}
+
+static timer_id wheel_add( void *m, struct timer *t )
+{
+        return ( ( TIMER_MANAGER * )m )->add( m, t );
+}
+
+static TIMER_BOOL wheel_del( void *m, timer_id id )
+{
+        return ( ( TIMER_MANAGER * )m )->del( m, id );
+}
+
+static TIMER_BOOL wheel_mod( void *m, timer_id id, unsigned int interval )
+{
+        return ( ( TIMER_MANAGER * )m )->mod( m, id, interval );
+}
+
+static unsigned int wheel_expire( void *m, const struct timespec *now )
+{
+        return ( ( TIMER_MANAGER * )m )->process_expired( m, now );
+}
+
+static void wheel_destroy( void *m )
+{
+        ( ( TIMER_MANAGER * )m )->stop( m );
+        destroy_timer_manager( m );
+}
+
+static void *heap_create( unsigned int n )
+{
+        struct mh_timer_manager_conf conf = {( int )n, TIMER_CLOCK_MONOTONIC};
+        MH_TIMER_MANAGER *m = create_mh_timer_manager();
+
+        if( m == NULL ) {
+                return NULL;
+        }
+
+        if( m->init_conf( m, &conf ) == TIMER_FALSE ) {
+                destroy_mh_timer_manager( m );
+                return NULL;
+        }
+
+        return m;
+}
+
+static void heap_start( void *m, timer_start_type type )
+{
+        ( ( MH_TIMER_MANAGER * )m )->start( m, type );
+}
+
+static timer_id heap_add( void *m, struct timer *t )
+{
+        return ( ( MH_TIMER_MANAGER * )m )->push( m, t );
+}
+
+static TIMER_BOOL heap_del( void *m, timer_id id )
+{
+        return ( ( MH_TIMER_MANAGER * )m )->del( m, id );
+}
+
+static TIMER_BOOL heap_mod( void *m, timer_id id, unsigned int interval )
+{
+        return ( ( MH_TIMER_MANAGER * )m )->mod( m, id, interval );
+}
+
+static unsigned int heap_expire( void *m, const struct timespec *now )
+{
+        return ( ( MH_TIMER_MANAGER * )m )->process_expired( m, now );
+}
+
+static void heap_destroy( void *m )
+{
+        ( ( MH_TIMER_MANAGER * )m )->stop( m );
+        destroy_mh_timer_manager( m );
+}
+
+static void *cq_create( unsigned int n )
+{
+        struct cq_timer_manager_conf conf = {( int )n, TIMER_CLOCK_MONOTONIC};
+        CQ_TIMER_MANAGER *m = create_cq_timer_manager();
+
+        if( m == NULL ) {
+                return NULL;
+        }
+
+        if( m->init_conf( m, &conf ) == TIMER_FALSE ) {
+                destroy_cq_timer_manager( m );
+                return NULL;
+        }
+
+        return m;
+}
+
+static void cq_start( void *m, timer_start_type type )
+{
+        ( ( CQ_TIMER_MANAGER * )m )->start( m, type );
+}
+
+static timer_id cq_add( void *m, struct timer *t )
+{
+        return ( ( CQ_TIMER_MANAGER * )m )->push( m, t );
+}
+
+static TIMER_BOOL cq_del( void *m, timer_id id )
+{
+        return ( ( CQ_TIMER_MANAGER * )m )->del( m, id );
+}
+
+static TIMER_BOOL cq_mod( void *m, timer_id id, unsigned int interval )
+{
+        return ( ( CQ_TIMER_MANAGER * )m )->mod( m, id, interval );
+}
+
+static unsigned int cq_expire( void *m, const struct timespec *now )
+{
+        return ( ( CQ_TIMER_MANAGER * )m )->process_expired( m, now );
+}
+
+static void cq_destroy( void *m )
+{
+        ( ( CQ_TIMER_MANAGER * )m )->stop( m );
+        destroy_cq_timer_manager( m );
+}
+
+static const struct engine engines[] = {
+        {"wheel", wheel_create, wheel_start, wheel_add, wheel_del, wheel_mod, wheel_expire, wheel_destroy},
+        {"hwheel", hwheel_create, wheel_start, wheel_add, wheel_del, wheel_mod, wheel_expire, wheel_destroy},
+        {"heap", heap_create, heap_start, heap_add, heap_del, heap_mod, heap_expire, heap_destroy},
+        {"calendar", cq_create, cq_start, cq_add, cq_del, cq_mod, cq_expire, cq_destroy}
+};
+
+/* ==  ==  ==  ==  ==  ==  ==  == workloads ==  ==  ==  ==  ==  ==  ==  ==  = */
+
+///间隔在1ms~60s之间均匀分布
+static unsigned int uniform_interval( unsigned int i, uint64_t *seed )
+{
+        ( void )i;
+        return 1 + xorshift( seed ) % MAX_INTERVAL;
+}
+
+///每1024个连续添加的定时器几乎同时到期，模拟突发的连接
+static unsigned int bursty_interval( unsigned int i, uint64_t *seed )
+{
+        return 1000 + ( i >> 10 ) % 64 * 937 + xorshift( seed ) % 4;
+}
+
+///连接空闲超时: 间隔相同，收到数据时reset，多数连接在超时前关闭
+static unsigned int churn_interval( unsigned int i, uint64_t *seed )
+{
+        ( void )i;
+        ( void )seed;
+        return 30000;
+}
+
+static unsigned int cancelled_interval( unsigned int i, uint64_t *seed )
+{
+        ( void )i;
+        return 1000 + xorshift( seed ) % ( MAX_INTERVAL - 1000 );
+}
+
+static const struct workload workloads[] = {
+        {"uniform", uniform_interval, 1, 500},
+        {"bursty", bursty_interval, 1, 500},
+        {"churn", churn_interval, 3, 900},
+        {"cancelled", cancelled_interval, 1, 950}
+};
+
+/* ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  == */
+
+static void *noop_task( void *p )
+{
+        return p;
+}
+
+static void *lateness_task( void *p )
+{
+        struct lateness_rec *rec = ( struct lateness_rec * )p;
+        uint64_t now = now_ns();
+
+        ///DIRECT回调都在定时器线程中执行，直方图只有一个写者
+        if( now < rec->deadline ) {
+                __sync_fetch_and_add( &lateness_early, 1 );
+                hist_record( &lateness_hist, 0 );
+
+                if( rec->deadline - now > lateness_early_max ) {
+                        lateness_early_max = rec->deadline - now;
+                }
+        } else {
+                hist_record( &lateness_hist, now - rec->deadline );
+        }
+
+        __sync_fetch_and_add( &lateness_fired, 1 );
+        return NULL;
+}
+
+///按与n互质的步长遍历，删除顺序与添加顺序无关
+static unsigned int perm_step( unsigned int n )
+{
+        unsigned int step = ( unsigned int )( 2654435761ULL % n ), a, b, r;
+
+        for( ;; step++ ) {
+                for( a = n, b = step; b != 0; r = a % b, a = b, b = r );
+
+                if( a == 1 ) {
+                        return step;
+                }
+        }
+}
+
+static void report_op( const struct engine *e, const struct workload *w, unsigned int n, const char *op, unsigned long count, uint64_t ns )
+{
+        printf( "{\"bench\":\"throughput\",\"engine\":\"%s\",\"workload\":\"%s\",\"n\":%u,\"op\":\"%s\",\"count\":%lu,\"ns\":%llu,\"ns_per_op\":%.1f,\"mops\":%.3f}\n",
+                e->name, w->name, n, op, count, ( unsigned long long )ns,
+                count ? ( double )ns / count : 0.0, ns ? count * 1000.0 / ns : 0.0 );
+        fflush( stdout );
+}
+
+/**
+ * @brief	bench_throughput
+ *
+ * 以EMBED方式开启(没有定时器线程)，依次测量add、reset、按比例del，最后把时间推进到所有定时器之后一次处理
+ */
+static int bench_throughput( const struct engine *e, const struct workload *w, unsigned int n )
+{
+        struct timer t = {SINGLE_SHOT, DIRECT, 0, noop_task, NULL, 0};
+        timer_id *ids = malloc( sizeof( timer_id ) * n );
+        uint64_t seed = 0x9e3779b97f4a7c15ULL, start;
+        unsigned long count = 0;
+        unsigned int i, j, k, step;
+        struct timespec now;
+        int r;
+        void *m = e->create( n );
+
+        if( ids == NULL || m == NULL ) {
+                fprintf( stderr, "%s: create %u timers failed\n", e->name, n );
+                free( ids );
+                return -1;
+        }
+
+        e->start( m, TIMER_START_EMBED );
+        start = now_ns();
+
+        for( i = 0; i < n; i++ ) {
+                t.interval = w->interval( i, &seed );
+
+                if( ( ids[i] = e->add( m, &t ) ) != 0 ) {
+                        ++count;
+                }
+        }
+
+        report_op( e, w, n, "add", count, now_ns() - start );
+        count = 0;
+        start = now_ns();
+
+        for( r = 0; r < w->resets; r++ ) {
+                for( i = 0; i < n; i++ ) {
+                        if( e->mod( m, ids[i], w->interval( i, &seed ) ) == TIMER_TRUE ) {
+                                ++count;
+                        }
+                }
+        }
+
+        report_op( e, w, n, "reset", count, now_ns() - start );
+        k = ( unsigned int )( ( uint64_t )n * w->cancel_permille / 1000 );
+        step = perm_step( n );
+        count = 0;
+        start = now_ns();
+
+        for( j = 0; j < k; j++ ) {
+                i = ( unsigned int )( ( uint64_t )j * step % n );
+
+                if( e->del( m, ids[i] ) == TIMER_TRUE ) {
+                        ++count;
+                }
+        }
+
+        report_op( e, w, n, "del", count, now_ns() - start );
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        now.tv_sec += MAX_INTERVAL / 1000 + 1;
+        start = now_ns();
+        count = e->expire( m, &now );
+        report_op( e, w, n, "expire", count, now_ns() - start );
+        e->destroy( m );
+        free( ids );
+        return 0;
+}
+
+struct contention_arg {
+        const struct engine *e;
+        const struct workload *w;
+        void *m;
+        unsigned int begin;
+        unsigned int end;
+        timer_id *ids;
+        pthread_barrier_t *barrier;
+        struct hist h;
+        ///本线程开始第一次add和结束最后一次add的时间，吞吐量按所有线程中最早的开始和最晚的结束计算
+        uint64_t first;
+        uint64_t last;
+};
+
+static void *contention_entry( void *p )
+{
+        struct contention_arg *arg = ( struct contention_arg * )p;
+        struct timer t = {SINGLE_SHOT, DIRECT, 0, noop_task, NULL, 0};
+        uint64_t seed = 0x9e3779b97f4a7c15ULL ^ arg->begin, start, end;
+        unsigned int i;
+        pthread_barrier_wait( arg->barrier );
+        arg->first = now_ns();
+
+        for( i = arg->begin; i < arg->end; i++ ) {
+                ///让定时器都在测量结束后到期
+                t.interval = MAX_INTERVAL + arg->w->interval( i, &seed ) % MAX_INTERVAL;
+                start = now_ns();
+                arg->ids[i] = arg->e->add( arg->m, &t );
+                end = now_ns();
+                hist_record( &arg->h, end - start );
+        }
+
+        arg->last = now_ns();
+        return NULL;
+}
+
+/**
+ * @brief	bench_contention
+ *
+ * threads个线程同时向同一个管理对象add，记录每次add的延迟
+ */
+static int bench_contention( const struct engine *e, const struct workload *w, unsigned int n, int threads )
+{
+        struct contention_arg *args = calloc( threads, sizeof( struct contention_arg ) );
+        pthread_t *tids = calloc( threads, sizeof( pthread_t ) );
+        timer_id *ids = malloc( sizeof( timer_id ) * n );
+        pthread_barrier_t barrier;
+        struct hist *total = calloc( 1, sizeof( struct hist ) );
+        uint64_t first = UINT64_MAX, last = 0, ns;
+        int i;
+        void *m = e->create( n );
+
+        if( args == NULL || tids == NULL || ids == NULL || total == NULL || m == NULL ) {
+                fprintf( stderr, "%s: create %u timers failed\n", e->name, n );
+                free( args );
+                free( tids );
+                free( ids );
+                free( total );
+
+                if( m != NULL ) {
+                        e->destroy( m );
+                }
+
+                return -1;
+        }
+
+        e->start( m, TIMER_START_EMBED );
+        pthread_barrier_init( &barrier, NULL, threads + 1 );
+
+        for( i = 0; i < threads; i++ ) {
+                args[i].e = e;
+                args[i].w = w;
+                args[i].m = m;
+                args[i].begin = ( unsigned int )( ( uint64_t )n * i / threads );
+                args[i].end = ( unsigned int )( ( uint64_t )n * ( i + 1 ) / threads );
+                args[i].ids = ids;
+                args[i].barrier = &barrier;
+                pthread_create( &tids[i], NULL, contention_entry, &args[i] );
+        }
+
+        pthread_barrier_wait( &barrier );
+
+        for( i = 0; i < threads; i++ ) {
+                pthread_join( tids[i], NULL );
+                hist_merge( total, &args[i].h );
+                first = args[i].first < first ? args[i].first : first;
+                last = args[i].last > last ? args[i].last : last;
+        }
+
+        ns = last - first;
+        printf( "{\"bench\":\"add_latency\",\"engine\":\"%s\",\"workload\":\"%s\",\"n\":%u,\"threads\":%d,\"mops\":%.3f,",
+                e->name, w->name, n, threads, ns ? n * 1000.0 / ns : 0.0 );
+        hist_print( total );
+        printf( "}\n" );
+        fflush( stdout );
+        pthread_barrier_destroy( &barrier );
+        e->destroy( m );
+        free( args );
+        free( tids );
+        free( ids );
+        free( total );
+        return 0;
+}
+
+/**
+ * @brief	bench_lateness
+ *
+ * 开启定时器线程，间隔缩放到10~500ms，记录每个定时器实际执行时间与预期到期时间之差
+ */
+static int bench_lateness( const struct engine *e, const struct workload *w, unsigned int n )
+{
+        struct timer t = {SINGLE_SHOT, DIRECT, 0, lateness_task, NULL, sizeof( struct lateness_rec ), 0, TIMER_PARAM_REF};
+        struct lateness_rec *recs = malloc( sizeof( struct lateness_rec ) * n );
+        timer_id *ids = malloc( sizeof( timer_id ) * n );
+        uint64_t seed = 0x9e3779b97f4a7c15ULL, deadline;
+        unsigned long expected = 0;
+        unsigned int i, j, k, step;
+        void *m = e->create( n );
+
+        if( recs == NULL || ids == NULL || m == NULL ) {
+                fprintf( stderr, "%s: create %u timers failed\n", e->name, n );
+                free( recs );
+                free( ids );
+
+                if( m != NULL ) {
+                        e->destroy( m );
+                }
+
+                return -1;
+        }
+
+        memset( &lateness_hist, 0, sizeof( lateness_hist ) );
+        lateness_fired = 0;
+        lateness_early = 0;
+        lateness_early_max = 0;
+        e->start( m, TIMER_START_UNBLOCK );
+
+        for( i = 0; i < n; i++ ) {
+                t.interval = 10 + w->interval( i, &seed ) % 490;
+                t.param = &recs[i];
+                recs[i].deadline = now_ns() + t.interval * NSEC_PER_MSEC;
+
+                if( ( ids[i] = e->add( m, &t ) ) != 0 ) {
+                        ++expected;
+                }
+        }
+
+        k = ( unsigned int )( ( uint64_t )n * w->cancel_permille / 1000 );
+        step = perm_step( n );
+
+        for( j = 0; j < k; j++ ) {
+                i = ( unsigned int )( ( uint64_t )j * step % n );
+
+                if( e->del( m, ids[i] ) == TIMER_TRUE ) {
+                        --expected;
+                }
+        }
+
+        ///最长的间隔之后再等最多2秒
+        deadline = now_ns() + 2500 * NSEC_PER_MSEC;
+
+        while( __sync_fetch_and_add( &lateness_fired, 0 ) < expected && now_ns() < deadline ) {
+                usleep( 10000 );
+        }
+
+        e->destroy( m );
+        printf( "{\"bench\":\"lateness\",\"engine\":\"%s\",\"workload\":\"%s\",\"n\":%u,\"expected\":%lu,\"fired\":%lu,\"early\":%lu,\"early_max_ns\":%llu,",
+                e->name, w->name, n, expected, lateness_fired, lateness_early, ( unsigned long long )lateness_early_max );
+        hist_print( &lateness_hist );
+        printf( "}\n" );
+        fflush( stdout );
+        free( recs );
+        free( ids );
+        return 0;
+}
+
+static void usage( const char *name )
+{
+        fprintf( stderr, "usage: %s [-n sizes] [-e engine] [-w workload] [-t threads] [-l lateness_max]\n"
+                 "  -n  comma separated timer counts, default " DEFAULT_SIZES "\n"
+                 "  -e  wheel | hwheel | heap | calendar, default all\n"
+                 "  -w  uniform | bursty | churn | cancelled, default all\n"
+                 "  -t  threads for the add latency test, default min(4, cpus)\n"
+                 "  -l  max timers for the lateness test, 0 to skip, default 100000\n", name );
+}
+
+int main( int argc, char **argv )
+{
+        const char *sizes = DEFAULT_SIZES, *engine = NULL, *workload = NULL;
+        unsigned int n[32], lateness_max = 100000, count = 0, max = 0, i;
+        long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+        int threads = cpus > 4 || cpus <= 0 ? 4 : ( int )cpus, opt;
+        size_t ei, wi;
+        char *p, *end;
+
+        while( ( opt = getopt( argc, argv, "n:e:w:t:l:h" ) ) != -1 ) {
+                switch( opt ) {
+                        case 'n':
+                                sizes = optarg;
+                                break;
+                        case 'e':
+                                engine = optarg;
+                                break;
+                        case 'w':
+                                workload = optarg;
+                                break;
+                        case 't':
+                                threads = atoi( optarg );
+                                break;
+                        case 'l':
+                                lateness_max = ( unsigned int )strtoul( optarg, NULL, 10 );
+                                break;
+                        default:
+                                usage( argv[0] );
+                                return opt == 'h' ? 0 : 1;
+                }
+        }
+
+        for( p = ( char * )sizes; *p != '\0' && count < sizeof( n ) / sizeof( n[0] ); p = *end == ',' ? end + 1 : end ) {
+                n[count] = ( unsigned int )strtoul( p, &end, 10 );
+
+                if( end == p || n[count] == 0 ) {
+                        usage( argv[0] );
+                        return 1;
+                }
+
+                if( n[count] > max ) {
+                        max = n[count];
+                }
+
+                ++count;
+        }
+
+        if( count == 0 || threads <= 0 ) {
+                usage( argv[0] );
+                return 1;
+        }
+
+        for( ei = 0; ei < sizeof( engines ) / sizeof( engines[0] ); ei++ ) {
+                if( engine != NULL && strcmp( engine, engines[ei].name ) != 0 ) {
+                        continue;
+                }
+
+                for( wi = 0; wi < sizeof( workloads ) / sizeof( workloads[0] ); wi++ ) {
+                        if( workload != NULL && strcmp( workload, workloads[wi].name ) != 0 ) {
+                                continue;
+                        }
+
+                        for( i = 0; i < count; i++ ) {
+                                bench_throughput( &engines[ei], &workloads[wi], n[i] );
+                                bench_contention( &engines[ei], &workloads[wi], n[i], threads );
+                        }
+
+                        ///lateness要真实地等定时器到期，每种组合只测一次
+                        if( lateness_max > 0 ) {
+                                bench_lateness( &engines[ei], &workloads[wi], max < lateness_max ? max : lateness_max );
+                        }
+                }
+        }
+
+        return 0;
+}
@@ -39,7 +39,7 @@ int main()
         pthread_t id;
         struct timer_manager_conf conf = {1000, 30, 100};
         struct timer timer1 = {SINGLE_SHOT, DIRECT, 1000, timer1_task, NULL,  0},  timer2 = {REPEAT, DIRECT, 5000,  timer2_task, NULL, 0};
-        struct timer timer3 = {SINGLE_SHOT, DIRECT, 2, timer1_task, NULL,  0},  timer4 = {REPEAT, DIRECT, 3,  timer2_task, NULL, 0};
+        struct timer timer3 = {SINGLE_SHOT, DIRECT, 2000, timer1_task, NULL,  0},  timer4 = {REPEAT, DIRECT, 1500,  timer2_task, NULL, 0, 500000};
         TIMER_MANAGER *p = create_timer_manager();
         MH_TIMER_MANAGER *p1 = create_mh_timer_manager();
 
@@ -0,0 +1,1787 @@
+/*
+ * 日历队列定时器(Brown的calendar queue)：到期时间(纳秒)按宽度为2^width_shift的桶散列到
+ * bucket_num个桶中，桶号为(expires >> width_shift) & (bucket_num - 1)，每个桶是按到期时间排序的链表，
+ * 所有桶合起来是一"年"。游标指向当前桶，取最早的定时器时从游标开始只看落在这一年里的桶头。
+ *	1.定时器个数超过桶数的2倍时桶数加倍，少于一半时减半，重新分桶之前抽样估计桶宽度\n
+ *	2.桶宽度不合适时插入和取最小值遍历的节点会变多，平均代价过高时按相同桶数重新估计宽度\n
+ * 重新分桶的O(n)代价分摊到至少bucket_num次操作上，因此插入、删除和取最小值都是均摊O(1)
+ */
+#include "timer.h"
+#include "atomic.h"
+#include "list.h"
+#include "mempool.h"
+#include "executor.h"
+#include "clock.h"
+#include "stats.h"
+#include "trace.h"
+#include "snapshot.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+
+#define NSEC_PER_SEC	1000000000ULL
+#define NSEC_PER_MSEC	1000000ULL
+
+///桶数的下限，桶数总是2的幂
+#define CQ_MIN_BUCKETS		16
+///初始桶宽度约1ms，与毫秒定时器的常见间隔相当
+#define CQ_INIT_SHIFT		20
+///桶宽度的范围，1us ~ 约18分钟
+#define CQ_MIN_SHIFT		10
+#define CQ_MAX_SHIFT		40
+///估计桶宽度的样本个数，够CQ_SAMPLE_NUM个时停止访问新的桶，最多CQ_SAMPLE_MAX个
+#define CQ_SAMPLE_MIN		8
+#define CQ_SAMPLE_NUM		64
+#define CQ_SAMPLE_MAX		256
+///每次操作平均遍历的节点数超过该值时重新估计桶宽度
+#define CQ_MAX_COST			8
+
+///定时器结构
+struct cq_timer_internal {
+    timer_type type;
+    timer_run_type run_type;
+    unsigned int interval;
+    void*(*cb)(void *);
+    void *param;
+    int param_len;
+    unsigned int interval_ns;
+    timer_param_mode param_mode;
+    unsigned int slack;
+    timer_id id;
+    ///桶中按expires排序，它是nominal按slack对齐之后的值(纳秒)
+    uint64_t expires;
+    ///没有加上slack的到期时间，循环定时器从它开始计算下一次到期时间，不会累积slack
+    uint64_t nominal;
+    ///所在桶的链表
+    struct list_head list;
+    ///短param直接保存在节点内部
+    uint64_t param_buf[TIMER_INLINE_PARAM_SIZE / sizeof(uint64_t)];
+};
+
+///定时器的间隔，单位纳秒
+#define interval_ns(t)	((uint64_t)(t)->interval * NSEC_PER_MSEC + (t)->interval_ns)
+#define cq_width(this)	(1ULL << (this)->width_shift)
+#define cq_bucket(this, ns)	((unsigned int)((ns) >> (this)->width_shift) & (this)->bucket_mask)
+///ns所在的桶这一年的结束时间
+#define cq_top(this, ns)	((((ns) >> (this)->width_shift) + 1) << (this)->width_shift)
+
+///定时器管理单元的最原始结构
+struct cq_timer_s_internal {
+    TIMER_BOOL(*init)(CQ_TIMER_MANAGER *this, int max_size);
+    timer_id(*push)(CQ_TIMER_MANAGER *this, struct timer *timer);
+    TIMER_BOOL(*del)(CQ_TIMER_MANAGER *this, timer_id id);
+    TIMER_BOOL(*mod)(CQ_TIMER_MANAGER *this, timer_id id, unsigned int interval);
+    void (*enable)(CQ_TIMER_MANAGER *this);
+    void (*disable)(CQ_TIMER_MANAGER *this);
+    void (*start)(CQ_TIMER_MANAGER *this, timer_start_type type);
+    void (*stop)(CQ_TIMER_MANAGER *this);
+    void (*close)(CQ_TIMER_MANAGER *this);
+    void (*set_executor)(CQ_TIMER_MANAGER *this, TIMER_EXECUTOR *executor);
+    int (*get_fd)(CQ_TIMER_MANAGER *this);
+    unsigned int (*process_expired)(CQ_TIMER_MANAGER *this, const struct timespec *now);
+    void (*get_overrun)(CQ_TIMER_MANAGER *this, struct timer_overrun *overrun);
+    TIMER_BOOL(*init_conf)(CQ_TIMER_MANAGER *this, struct cq_timer_manager_conf *conf);
+    unsigned int (*push_batch)(CQ_TIMER_MANAGER *this, struct timer *timers, unsigned int n, timer_id *ids);
+    unsigned int (*del_batch)(CQ_TIMER_MANAGER *this, const timer_id *ids, unsigned int n);
+    void (*get_stats)(CQ_TIMER_MANAGER *this, struct timer_stats *stats);
+    TIMER_BOOL(*set_trace)(CQ_TIMER_MANAGER *this, unsigned int events);
+    TIMER_BOOL(*dump_trace)(CQ_TIMER_MANAGER *this, const char *path);
+    TIMER_BOOL(*snapshot)(CQ_TIMER_MANAGER *this, const char *path);
+    TIMER_BOOL(*restore)(CQ_TIMER_MANAGER *this, const char *path);
+
+    ///支持的最大定时器数量
+    int max_timer_num;
+    ///队列中的定时器个数，不包括正在执行回调的定时器
+    int cur_timer_num;
+
+    struct list_head *buckets;
+    ///桶数减1
+    unsigned int bucket_mask;
+    unsigned int width_shift;
+    ///当前桶和它这一年的结束时间，队列中所有定时器都不早于cursor_top减去桶宽度
+    unsigned int cursor;
+    uint64_t cursor_top;
+    ///上次调整桶之后的操作次数和遍历的节点数
+    unsigned int ops;
+    unsigned long long cost;
+    ///timerfd当前设置的到期时间，0表示没有设置
+    uint64_t armed;
+    ///cq_timer_internal节点的对象池
+    struct mem_pool pool;
+    ///以id为下标的定时器表，timer_id从1开始
+    struct cq_timer_internal **timers;
+    ///空闲id的环形队列，先释放的id先被复用，尽量推迟id的复用
+    timer_id *free_ids;
+    int free_head;
+    int free_num;
+    ///正在执行回调的定时器，回调期间被删除时置为NULL
+    struct cq_timer_internal *running;
+    ///回调期间被mod过，回调结束后按新的到期时间放回队列
+    int running_rearm;
+    ///THREAD类型回调的执行器
+    TIMER_EXECUTOR *executor;
+    ///循环定时器错过周期的统计
+    struct timer_overrun overrun;
+    ///操作计数、到期延迟和回调耗时的统计
+    struct timer_stats_internal stats;
+    ///生命周期事件的跟踪环，销毁时释放
+    struct timer_trace trace;
+
+    pthread_t tid;
+    atomic_t init_flag;
+    volatile int start_flag;
+    timer_start_type start_type;
+    int enable_flag;		//阻止push操作
+    pthread_rwlock_t lock;
+    pthread_mutex_t cq_lock;
+
+    int timerfd;
+    ///timerfd和定时器线程使用的时钟
+    clockid_t clock_id;
+    ///push/mod计算到期时间使用的时钟，只有选择了粗粒度时钟时与clock_id不同
+    clockid_t fast_clock_id;
+};
+
+
+static TIMER_BOOL ti_init(CQ_TIMER_MANAGER *this, int max_size);
+static TIMER_BOOL ti_init_conf(CQ_TIMER_MANAGER *this, struct cq_timer_manager_conf *conf);
+static timer_id ti_push(CQ_TIMER_MANAGER *this, struct timer *timer);
+static TIMER_BOOL ti_del(CQ_TIMER_MANAGER *this, timer_id id);
+static TIMER_BOOL ti_mod(CQ_TIMER_MANAGER *this, timer_id id, unsigned int interval);
+static void ti_stop(CQ_TIMER_MANAGER *this);
+static void ti_start(CQ_TIMER_MANAGER *this, timer_start_type type);
+static void ti_close(CQ_TIMER_MANAGER *this);
+static void ti_enable(CQ_TIMER_MANAGER *this);
+static void ti_disable(CQ_TIMER_MANAGER *this);
+static void ti_set_executor(CQ_TIMER_MANAGER *this, TIMER_EXECUTOR *executor);
+static int ti_get_fd(CQ_TIMER_MANAGER *this);
+static unsigned int ti_process_expired(CQ_TIMER_MANAGER *this, const struct timespec *now);
+static void ti_get_overrun(CQ_TIMER_MANAGER *this, struct timer_overrun *overrun);
+static unsigned int ti_push_batch(CQ_TIMER_MANAGER *this, struct timer *timers, unsigned int n, timer_id *ids);
+static unsigned int ti_del_batch(CQ_TIMER_MANAGER *this, const timer_id *ids, unsigned int n);
+static void ti_get_stats(CQ_TIMER_MANAGER *this, struct timer_stats *stats);
+static TIMER_BOOL ti_set_trace(CQ_TIMER_MANAGER *this, unsigned int events);
+static TIMER_BOOL ti_dump_trace(CQ_TIMER_MANAGER *this, const char *path);
+static TIMER_BOOL ti_snapshot(CQ_TIMER_MANAGER *this, const char *path);
+static TIMER_BOOL ti_restore(CQ_TIMER_MANAGER *this, const char *path);
+static void *entry(void *p);
+
+/* ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  == */
+
+static TIMER_BOOL repush(struct cq_timer_s_internal *this, struct cq_timer_internal *timer, uint64_t now);
+static void cq_link(struct cq_timer_s_internal *this, struct cq_timer_internal *timer);
+static void cq_unlink(struct cq_timer_s_internal *this, struct cq_timer_internal *timer);
+static struct cq_timer_internal *cq_peek(struct cq_timer_s_internal *this);
+static void cq_fit(struct cq_timer_s_internal *this);
+static void cq_resize(struct cq_timer_s_internal *this, unsigned int bucket_num);
+static unsigned int cq_sample_width(struct cq_timer_s_internal *this);
+static int cq_timer_remove(struct cq_timer_s_internal *this, struct cq_timer_internal *timer);
+static inline void cq_timer_set_expire(struct cq_timer_internal *timer, uint64_t from);
+static inline TIMER_BOOL cq_timer_param_init(struct cq_timer_internal *t, struct timer *timer);
+static inline timer_id cq_timer_id_pop(struct cq_timer_s_internal *this);
+static inline void cq_timer_id_push(struct cq_timer_s_internal *this, timer_id id);
+static inline struct cq_timer_internal *cq_timer_lookup(struct cq_timer_s_internal *this, timer_id id);
+static inline void cq_timer_free(struct cq_timer_s_internal *this, struct cq_timer_internal *timer);
+static TIMER_BOOL free_all_timers(struct cq_timer_s_internal *this);
+static void cq_arm(struct cq_timer_s_internal *this);
+static void cq_wakeup(struct cq_timer_s_internal *this);
+static unsigned int cq_expire(struct cq_timer_s_internal *this, struct timespec *now);
+
+
+/**
+ * @brief	create_cq_timer_manager
+ *
+ * 创建日历队列定时器管理对象
+ *
+ * @return	定时器管理对象指针
+ */
+CQ_TIMER_MANAGER *create_cq_timer_manager()
+{
+    struct cq_timer_s_internal *p = malloc(sizeof(struct cq_timer_s_internal));
+
+    if(p  ==  NULL) {
+        perror("malloc failed");
+        return NULL;
+    }
+
+    memset(p, 0, sizeof(struct cq_timer_s_internal));
+    p->init = ti_init;
+    p->push = ti_push;
+    p->del = ti_del;
+    p->mod = ti_mod;
+    p->enable = ti_enable;
+    p->disable = ti_disable;
+    p->stop = ti_stop;
+    p->start = ti_start;
+    p->close = ti_close;
+    p->set_executor = ti_set_executor;
+    p->get_fd = ti_get_fd;
+    p->process_expired = ti_process_expired;
+    p->get_overrun = ti_get_overrun;
+    p->init_conf = ti_init_conf;
+    p->push_batch = ti_push_batch;
+    p->del_batch = ti_del_batch;
+    p->get_stats = ti_get_stats;
+    p->set_trace = ti_set_trace;
+    p->dump_trace = ti_dump_trace;
+    p->snapshot = ti_snapshot;
+    p->restore = ti_restore;
+    pthread_rwlock_init(&p->lock, NULL);
+    pthread_mutex_init(&p->cq_lock, NULL);
+    atomic_set(&p->init_flag, 0);
+    p->start_flag = 0;
+    return (CQ_TIMER_MANAGER *)p;
+}
+
+/**
+ * @brief	destroy_cq_timer_manager
+ *
+ * 销毁日历队列定时器管理对象
+ *
+ * @param	this	定时器对象指针
+ */
+void destroy_cq_timer_manager(CQ_TIMER_MANAGER *this)
+{
+    struct cq_timer_s_internal *p = (struct cq_timer_s_internal *)this;
+    p->close(this);
+    pthread_mutex_destroy(&p->cq_lock);
+    pthread_rwlock_destroy(&p->lock);
+    timer_trace_free(&p->trace);
+    free((void *)this);
+}
+
+
+static TIMER_BOOL ti_init(CQ_TIMER_MANAGER *this, int max_size)
+{
+    struct cq_timer_manager_conf conf = {max_size, TIMER_CLOCK_MONOTONIC};
+    return ti_init_conf(this, &conf);
+}
+
+/**
+ * @brief	init_conf
+ *
+ * 按配置初始化日历队列，桶数从CQ_MIN_BUCKETS开始随定时器个数调整
+ *
+ * @param	this
+ * @param	conf
+ *
+ * @return	库的布尔值
+ */
+static TIMER_BOOL ti_init_conf(CQ_TIMER_MANAGER *this, struct cq_timer_manager_conf *conf)
+{
+    if(this  ==  NULL || conf == NULL || !check_clock_type(conf->clock_type)) {
+        return TIMER_FALSE;
+    }
+
+    struct cq_timer_s_internal *p = (struct cq_timer_s_internal *)this;
+    unsigned int i;
+    pthread_rwlock_wrlock(&p->lock);
+
+    if(atomic_read(&p->init_flag)  ==  1) {
+        fprintf(stderr, "timer has already init \n");
+        pthread_rwlock_unlock(&p->lock);
+        return TIMER_FALSE;
+    }
+
+    p->clock_id = timer_clock_id(conf->clock_type);
+    p->fast_clock_id = timer_fast_clock_id(conf->clock_type, 0);
+
+    if((p->timerfd = timerfd_create(p->clock_id, 0)) == -1) {
+        perror("create timerfd failed");
+        pthread_rwlock_unlock(&p->lock);
+        return TIMER_FALSE;
+    }
+
+    p->max_timer_num = conf->max_size <= 0 ? DEFAULT_TIMER_MAX_NUM : conf->max_size;
+    p->cur_timer_num = 0;
+    p->buckets = (struct list_head *)malloc(sizeof(struct list_head) * CQ_MIN_BUCKETS);
+    p->timers = (struct cq_timer_internal **)malloc(sizeof(void *) * (p->max_timer_num + 1));
+    p->free_ids = (timer_id *)malloc(sizeof(timer_id) * p->max_timer_num);
+
+    if(p->buckets == NULL || p->timers == NULL || p->free_ids == NULL
+            || mem_pool_init(&p->pool, sizeof(struct cq_timer_internal), p->max_timer_num) == -1) {
+        perror("malloc failed");
+        free(p->buckets);
+        free(p->timers);
+        free(p->free_ids);
+        p->buckets = NULL;
+        p->timers = NULL;
+        p->free_ids = NULL;
+        close(p->timerfd);
+        pthread_rwlock_unlock(&p->lock);
+        return TIMER_FALSE;
+    }
+
+    for(i = 0; i < CQ_MIN_BUCKETS; ++i) {
+        INIT_LIST_HEAD(&p->buckets[i]);
+    }
+
+    p->bucket_mask = CQ_MIN_BUCKETS - 1;
+    p->width_shift = CQ_INIT_SHIFT;
+    p->cursor = 0;
+    p->cursor_top = 0;
+    p->ops = 0;
+    p->cost = 0;
+    p->armed = 0;
+    memset(p->timers, 0, sizeof(void *) * (p->max_timer_num + 1));
+
+    for(p->free_num = 0; p->free_num < p->max_timer_num; ++p->free_num) {
+        p->free_ids[p->free_num] = p->free_num + 1;
+    }
+
+    p->free_head = 0;
+    p->running = NULL;
+    p->running_rearm = 0;
+    memset(&p->overrun, 0, sizeof(struct timer_overrun));
+    memset(&p->stats, 0, sizeof(struct timer_stats_internal));
+
+    atomic_set(&p->init_flag,  1);
+    p->enable_flag = 1;
+    pthread_rwlock_unlock(&p->lock);
+    return TIMER_TRUE;
+}
+
+
+/**
+ * @brief	push
+ *
+ * 添加定时器到定时器管理对象
+ *
+ * @param	this		定时器管理对象指针
+ * @param	timer		定时器对象指针
+ *
+ * @note
+ *	即便定时器管理对象没有运行，也可以添加定时器进去，只是interval的时间是从运行时开始算起
+ *
+ * @return	定时器的id，可以用于del和mod，失败返回0
+ */
+static timer_id ti_push(CQ_TIMER_MANAGER *this, struct timer *timer)
+{
+    if(this  ==  NULL) {
+        return 0;
+    }
+
+    struct cq_timer_s_internal *p = (struct cq_timer_s_internal *)this;
+    struct cq_timer_internal *t;
+    struct timespec now;
+    timer_id id;
+    void *param = NULL;
+    pthread_rwlock_rdlock(&p->lock);
+
+    if(atomic_read(&p->init_flag)  ==  0) {
+        fprintf(stderr, "TIMER Manager has not been init yet\n");
+        pthread_rwlock_unlock(&p->lock);
+        return 0;
+    }
+
+    if(p->enable_flag == 0) {
+        fprintf(stderr, "TIMER Manager has been disable\n");
+        pthread_rwlock_unlock(&p->lock);
+        return 0;
+    }
+
+    if(timer->interval == 0 && timer->interval_ns == 0) {
+        fprintf(stderr, "timer is illegal \n");
+        pthread_rwlock_unlock(&p->lock);
+        return 0;
+    }
+
+    ///只有超过节点内部空间的param才需要在锁外单独申请内存
+    if(timer->param_mode == TIMER_PARAM_COPY && timer->param_len > TIMER_INLINE_PARAM_SIZE) {
+        if((param = malloc(timer->param_len)) == NULL) {
+            perror("malloc failed\n");
+            pthread_rwlock_unlock(&p->lock);
+            return 0;
+        }
+
+        memcpy(param, timer->param, timer->param_len);
+    }
+
+    if(clock_gettime(p->fast_clock_id, &now) == -1) {
+        perror("push timer: get time failed");
+        pthread_rwlock_unlock(&p->lock);
+        free(param);
+        return 0;
+    }
+
+    pthread_mutex_lock(&p->cq_lock);
+
+    ///正在执行回调的定时器也占用id，因此以空闲id的个数为准
+    if(p->free_num == 0 || (t = mem_pool_alloc(&p->pool)) == NULL) {
+        fprintf(stderr, "ACHIEVE TIMER MAX NUMBER\n");
+        pthread_mutex_unlock(&p->cq_lock);
+        pthread_rwlock_unlock(&p->lock);
+        free(param);
+        return 0;
+    }
+
+    *(struct timer *)t = *timer;
+
+    if(param != NULL) {
+        t->param = param;
+    } else {
+        cq_timer_param_init(t, timer);
+    }
+
+    cq_timer_set_expire(t, (uint64_t)timer_timespec_ns(&now));
+    id = cq_timer_id_pop(p);
+    t->id = id;
+    p->timers[id] = t;
+    cq_link(p, t);
+    cq_fit(p);
+    timer_trace_record(&p->trace, TIMER_TRACE_ADD, id, timer->interval);
+
+    ///新的定时器比timerfd上设置的更早，需要提前唤醒
+    if(p->start_flag && (p->armed == 0 || t->expires < p->armed)) {
+        cq_arm(p);
+    }
+
+    pthread_mutex_unlock(&p->cq_lock);
+    pthread_rwlock_unlock(&p->lock);
+    timer_stat_add(p->stats.adds, 1);
+    return id;
+}
+
+
+/**
+ * @brief	del
+ *
+ * 删除定时器
+ *
+ * @param	this		定时器管理对象
+ * @param	id			push返回的定时器标志，为0表示删除所有定时器
+ *
+ * @return		库布尔值
+ */
+static TIMER_BOOL ti_del(CQ_TIMER_MANAGER *this, timer_id id)
+{
+    if(this  ==  NULL) {
+        return TIMER_FALSE;
+    }
+
+    TIMER_BOOL ret;
+    struct cq_timer_s_internal *p = (struct cq_timer_s_internal *)this;
+    struct cq_timer_internal *t;
+    pthread_rwlock_rdlock(&p->lock);
+
+    if(atomic_read(&p->init_flag)  ==  0) {
+        pthread_rwlock_unlock(&p->lock);
+        return TIMER_FALSE;
+    }
+
+    pthread_mutex_lock(&p->cq_lock);
+
+    if(id == 0) {
+        ret = free_all_timers(p);
+        timer_trace_record(&p->trace, TIMER_TRACE_DEL, 0, 0);
+
+        if(p->start_flag) {
+            cq_arm(p);
+        }
+
+        pthread_mutex_unlock(&p->cq_lock);
+        pthread_rwlock_unlock(&p->lock);
+        return ret;
+    }
+
+    if((t = cq_timer_lookup(p, id)) == NULL) {
+        pthread_mutex_unlock(&p->cq_lock);
+        pthread_rwlock_unlock(&p->lock);
+        return TIMER_FALSE;
+    }
+
+    if(cq_timer_remove(p, t) && p->start_flag) {
+        cq_arm(p);
+    }
+
+    timer_trace_record(&p->trace, TIMER_TRACE_DEL, id, 0);
+    pthread_mutex_unlock(&p->cq_lock);
+    pthread_rwlock_unlock(&p->lock);
+    timer_stat_add(p->stats.dels, 1);
+    return TIMER_TRUE;
+}
+
+/**
+ * @brief	cq_timer_remove
+ *
+ * 释放定时器的id并从桶中删除，调用者持有cq_lock
+ *
+ * @param	this
+ * @param	timer
+ *
+ * @return	删除的定时器不晚于timerfd上设置的时间时返回1，需要重新设置timerfd
+ */
+static int cq_timer_remove(struct cq_timer_s_internal *this, struct cq_timer_internal *timer)
+{
+    int rearm;
+    this->timers[timer->id] = NULL;
+    cq_timer_id_push(this, timer->id);
+
+    ///回调正在执行的定时器由定时器线程在回调结束后释放
+    if(timer == this->running) {
+        this->running = NULL;
+        return 0;
+    }
+
+    rearm = timer->expires <= this->armed;
+    cq_unlink(this, timer);
+    cq_timer_free(this, timer);
+    cq_fit(this);
+    return rearm;
+}
+
+/**
+ * @brief	push_batch
+ *
+ * 批量添加定时器，整个批次只获取一次锁、只读取一次时间，最后只重设一次timerfd
+ *
+ * @param	this		定时器管理对象指针
+ * @param	timers		定时器数组
+ * @param	n			定时器个数
+ * @param	ids			输出每个定时器的id，添加失败的为0，可以为NULL
+ *
+ * @return	添加成功的个数
+ */
+static unsigned int ti_push_batch(CQ_TIMER_MANAGER *this, struct timer *timers, unsigned int n, timer_id *ids)
+{
+    if(this  ==  NULL || timers == NULL) {
+        return 0;
+    }
+
+    struct cq_timer_s_internal *p = (struct cq_timer_s_internal *)this;
+    struct cq_timer_internal *t;
+    struct timer *timer;
+    struct timespec now;
+    unsigned int i, num = 0;
+    uint64_t first = 0;
+
+    if(ids != NULL) {
+        memset(ids, 0, sizeof(timer_id) * n);
+    }
+
+    pthread_rwlock_rdlock(&p->lock);
+
+    if(atomic_read(&p->init_flag)  ==  0) {
+        fprintf(stderr, "TIMER Manager has not been init yet\n");
+        pthread_rwlock_unlock(&p->lock);
+        return 0;
+    }
+
+    if(p->enable_flag == 0) {
+        fprintf(stderr, "TIMER Manager has been disable\n");
+        pthread_rwlock_unlock(&p->lock);
+        return 0;
+    }
+
+    if(clock_gettime(p->fast_clock_id, &now) == -1) {
+        perror("push timer: get time failed");
+        pthread_rwlock_unlock(&p->lock);
+        return 0;
+    }
+
+    pthread_mutex_lock(&p->cq_lock);
+
+    for(i = 0; i < n; ++i) {
+        timer = &timers[i];
+
+        if(timer->interval == 0 && timer->interval_ns == 0) {
+            fprintf(stderr, "timer is illegal \n");
+            continue;
+        }
+
+        if(p->free_num == 0 || (t = mem_pool_alloc(&p->pool)) == NULL) {
+            fprintf(stderr, "ACHIEVE TIMER MAX NUMBER\n");
+            break;
+        }
+
+        *(struct timer *)t = *timer;
+
+        if(cq_timer_param_init(t, timer) == TIMER_FALSE) {
+            perror("malloc failed\n");
+            mem_pool_free(&p->pool, t);
+            continue;
+        }
+
+        cq_timer_set_expire(t, (uint64_t)timer_timespec_ns(&now));
+        t->id = cq_timer_id_pop(p);
+        p->timers[t->id] = t;
+        cq_link(p, t);
+        cq_fit(p);
+
+        if(first == 0 || t->expires < first) {
+            first = t->expires;
+        }
+
+        if(ids != NULL) {
+            ids[i] = t->id;
+        }
+
+        timer_trace_record(&p->trace, TIMER_TRACE_ADD, t->id, t->interval);
+        ++num;
+    }
+
+    if(num > 0 && p->start_flag && (p->armed == 0 || first < p->armed)) {
+        cq_arm(p);
+    }
+
+    pthread_mutex_unlock(&p->cq_lock);
+    pthread_rwlock_unlock(&p->lock);
+    timer_stat_add(p->stats.adds, num);
+    return num;
+}
+
+/**
+ * @brief	del_batch
+ *
+ * 批量删除定时器，整个批次只获取一次锁，最多重设一次timerfd
+ *
+ * @param	this		定时器管理对象
+ * @param	ids			push返回的定时器标志数组，为0的项被忽略
+ * @param	n			个数
+ *
+ * @return	删除成功的个数
+ */
+static unsigned int ti_del_batch(CQ_TIMER_MANAGER *this, const timer_id *ids, unsigned int n)
+{
+    if(this  ==  NULL || ids == NULL) {
+        return 0;
+    }
+
+    struct cq_timer_s_internal *p = (struct cq_timer_s_internal *)this;
+    struct cq_timer_internal *t;
+    unsigned int i, num = 0;
+    int rearm = 0;
+    pthread_rwlock_rdlock(&p->lock);
+
+    if(atomic_read(&p->init_flag)  ==  0) {
+        pthread_rwlock_unlock(&p->lock);
+        return 0;
+    }
+
+    pthread_mutex_lock(&p->cq_lock);
+
+    for(i = 0; i < n; ++i) {
+        if(ids[i] != 0 && (t = cq_timer_lookup(p, ids[i])) != NULL) {
+            rearm |= cq_timer_remove(p, t);
+            timer_trace_record(&p->trace, TIMER_TRACE_DEL, ids[i], 0);
+            ++num;
+        }
+    }
+
+    if(rearm && p->start_flag) {
+        cq_arm(p);
+    }
+
+    pthread_mutex_unlock(&p->cq_lock);
+    pthread_rwlock_unlock(&p->lock);
+    timer_stat_add(p->stats.dels, num);
+    return num;
+}
+
+
+/**
+ * @brief	mod
+ *
+ * 重新设置定时器的到期时间为当前时间加上interval
+ *
+ * @param	this		定时器管理对象
+ * @param	id			push返回的定时器标志
+ * @param	interval	新的间隔(毫秒)，为0表示沿用原来的间隔
+ *
+ * @note
+ *		设置了新的间隔时interval_ns清零；定时器从原来的桶中摘下再放入新的桶
+ *
+ * @return		库布尔值
+ */
+static TIMER_BOOL ti_mod(CQ_TIMER_MANAGER *this, timer_id id, unsigned int interval)
+{
+    if(this  ==  NULL) {
+        return TIMER_FALSE;
+    }
+
+    struct timespec now;
+    struct cq_timer_s_internal *p = (struct cq_timer_s_internal *)this;
+    struct cq_timer_internal *t;
+    uint64_t old;
+
+    if(clock_gettime(p->fast_clock_id, &now) == -1) {
+        perror("mod timer: get time failed");
+        return TIMER_FALSE;
+    }
+
+    pthread_rwlock_rdlock(&p->lock);
+
+    if(atomic_read(&p->init_flag)  ==  0) {
+        pthread_rwlock_unlock(&p->lock);
+        return TIMER_FALSE;
+    }
+
+    pthread_mutex_lock(&p->cq_lock);
+
+    if((t = cq_timer_lookup(p, id)) == NULL) {
+        pthread_mutex_unlock(&p->cq_lock);
+        pthread_rwlock_unlock(&p->lock);
+        return TIMER_FALSE;
+    }
+
+    if(interval != 0) {
+        t->interval = interval;
+        t->interval_ns = 0;
+    }
+
+    old = t->expires;
+
+    if(t == p->running) {
+        cq_timer_set_expire(t, (uint64_t)timer_timespec_ns(&now));
+        p->running_rearm = 1;
+    } else {
+        cq_unlink(p, t);
+        cq_timer_set_expire(t, (uint64_t)timer_timespec_ns(&now));
+        cq_link(p, t);
+        cq_fit(p);
+
+        if(p->start_flag && (old <= p->armed || t->expires < p->armed)) {
+            cq_arm(p);
+        }
+    }
+
+    timer_trace_record(&p->trace, TIMER_TRACE_MOD, id, interval);
+    pthread_mutex_unlock(&p->cq_lock);
+    pthread_rwlock_unlock(&p->lock);
+    timer_stat_add(p->stats.mods, 1);
+    return TIMER_TRUE;
+}
+
+
+/**
+ * @brief	repush
+ *
+ * 循环定时器到期之后放回队列，调用者持有cq_lock
+ *
+ * @param	this		定时器内部管理对象指针
+ * @param	timer		定时器内部结构指针
+ * @param	now			当前时间(纳秒)
+ *
+ * @return	定时器已经停止时返回TIMER_FALSE，由调用者释放定时器
+ */
+static TIMER_BOOL repush(struct cq_timer_s_internal *this, struct cq_timer_internal *timer, uint64_t now)
+{
+    uint64_t missed, next;
+
+    if(this->start_flag == 0) {
+        return TIMER_FALSE;
+    }
+
+    ///从上一次的到期时间开始计算，避免累积误差；落后太多时从当前时间开始计算
+    next = timer->nominal + interval_ns(timer);
+
+    if(next <= now) {
+        ///错过的周期不再补执行，只记录下来
+        missed = (now - next) / interval_ns(timer) + 1;
+        ++this->overrun.events;
+        this->overrun.missed += missed;
+
+        if(missed > this->overrun.max_missed) {
+            this->overrun.max_missed = missed;
+        }
+
+        timer_trace_record(&this->trace, TIMER_TRACE_OVERRUN, timer->id, timer_trace_arg(missed));
+        cq_timer_set_expire(timer, now);
+    } else {
+        cq_timer_set_expire(timer, timer->nominal);
+    }
+
+    cq_link(this, timer);
+    return TIMER_TRUE;
+}
+
+/**
+ * @brief	cq_link
+ *
+ * 把定时器放入所在的桶，必要时把游标移回到它所在的桶
+ *
+ * @param	this
+ * @param	timer
+ *
+ * @note
+ *	比桶中所有定时器都早时直接放在头部，否则从尾部向前查找，到期时间相同或递增的定时器不需要遍历
+ */
+static void cq_link(struct cq_timer_s_internal *this, struct cq_timer_internal *timer)
+{
+    struct list_head *head = &this->buckets[cq_bucket(this, timer->expires)], *pos;
+
+    if(this->cur_timer_num == 0 || timer->expires < this->cursor_top - cq_width(this)) {
+        this->cursor = cq_bucket(this, timer->expires);
+        this->cursor_top = cq_top(this, timer->expires);
+    }
+
+    if(list_empty(head) || timer->expires < list_entry(head->next, struct cq_timer_internal, list)->expires) {
+        list_add(&timer->list, head);
+    } else {
+        for(pos = head->prev; list_entry(pos, struct cq_timer_internal, list)->expires > timer->expires; pos = pos->prev) {
+            ++this->cost;
+        }
+
+        list_add(&timer->list, pos);
+    }
+
+    ++this->cur_timer_num;
+    ++this->ops;
+}
+
+static void cq_unlink(struct cq_timer_s_internal *this, struct cq_timer_internal *timer)
+{
+    list_del(&timer->list);
+    --this->cur_timer_num;
+    ++this->ops;
+}
+
+/**
+ * @brief	cq_peek
+ *
+ * 从游标开始查找最早的定时器，并把游标移到它所在的桶
+ *
+ * @param	this
+ *
+ * @note
+ *	桶头的到期时间在这个桶这一年的范围内时就是最早的定时器；整整一年都没有找到时，
+ *	说明所有定时器都在一年以后，直接取各桶头中最早的一个
+ *
+ * @return	队列为空时返回NULL
+ */
+static struct cq_timer_internal *cq_peek(struct cq_timer_s_internal *this)
+{
+    struct cq_timer_internal *t, *min = NULL;
+    unsigned int i = this->cursor, n;
+    uint64_t top = this->cursor_top;
+
+    if(this->cur_timer_num == 0) {
+        return NULL;
+    }
+
+    for(n = 0; n <= this->bucket_mask; ++n) {
+        if(!list_empty(&this->buckets[i])) {
+            t = list_entry(this->buckets[i].next, struct cq_timer_internal, list);
+
+            if(t->expires < top) {
+                this->cursor = i;
+                this->cursor_top = top;
+                this->cost += n;
+                return t;
+            }
+
+            if(min == NULL || t->expires < min->expires) {
+                min = t;
+            }
+        }
+
+        i = (i + 1) & this->bucket_mask;
+        top += cq_width(this);
+    }
+
+    this->cost += n;
+    this->cursor = cq_bucket(this, min->expires);
+    this->cursor_top = cq_top(this, min->expires);
+    return min;
+}
+
+/**
+ * @brief	cq_fit
+ *
+ * 定时器个数超过桶数的2倍时桶数加倍，少于一半时减半；桶数不变但平均每次操作遍历的节点
+ * 超过CQ_MAX_COST时重新估计桶宽度。调用者持有cq_lock
+ *
+ * @param	this
+ */
+static void cq_fit(struct cq_timer_s_internal *this)
+{
+    unsigned int num = this->bucket_mask + 1, n = num;
+
+    while((unsigned int)this->cur_timer_num > 2 * n) {
+        n <<= 1;
+    }
+
+    while(n > CQ_MIN_BUCKETS && (unsigned int)this->cur_timer_num < n / 2) {
+        n >>= 1;
+    }
+
+    if(n != num) {
+        cq_resize(this, n);
+    } else if(this->ops >= num) {
+        ///按相同的桶数重新分桶，代价分摊到上次调整之后的操作上
+        if(this->cost > (unsigned long long)CQ_MAX_COST * this->ops) {
+            cq_resize(this, n);
+        } else {
+            this->ops = 0;
+            this->cost = 0;
+        }
+    }
+}
+
+/**
+ * @brief	cq_resize
+ *
+ * 按新估计的桶宽度把所有定时器放到bucket_num个新桶中
+ *
+ * @param	this
+ * @param	bucket_num	新的桶数，2的幂
+ */
+static void cq_resize(struct cq_timer_s_internal *this, unsigned int bucket_num)
+{
+    struct list_head *old = this->buckets, *buckets;
+    struct cq_timer_internal *t;
+    unsigned int i, old_num = this->bucket_mask + 1;
+
+    this->ops = 0;
+    this->cost = 0;
+
+    ///申请失败时继续使用原来的桶，只是操作会变慢
+    if((buckets = malloc(sizeof(struct list_head) * bucket_num)) == NULL) {
+        perror("malloc failed");
+        return;
+    }
+
+    for(i = 0; i < bucket_num; ++i) {
+        INIT_LIST_HEAD(&buckets[i]);
+    }
+
+    this->width_shift = cq_sample_width(this);
+    this->buckets = buckets;
+    this->bucket_mask = bucket_num - 1;
+    this->cur_timer_num = 0;
+
+    for(i = 0; i < old_num; ++i) {
+        while(!list_empty(&old[i])) {
+            t = list_entry(old[i].next, struct cq_timer_internal, list);
+            list_del(&t->list);
+            cq_link(this, t);
+        }
+    }
+
+    free(old);
+    this->ops = 0;
+    this->cost = 0;
+}
+
+/**
+ * @brief	cq_sample_width
+ *
+ * 按位反转的顺序访问桶(任意前缀都均匀分布在桶数组上)，收集其中所有定时器的到期时间，
+ * 这样的样本在时间轴上是均匀抽取的。中间一半的样本对应一半的定时器，由它们的跨度得到
+ * 密集区域的平均间隔，桶宽度取不超过平均间隔的2的幂，少数离得很远的定时器不影响结果
+ *
+ * @param	this
+ *
+ * @note
+ *	Brown原来的做法是取最早的若干个定时器，但定时器是陆续添加的，队列头部比其他地方稀疏得多，
+ *	估计出的宽度偏大，插入时要在很长的桶中查找位置；Brown取平均间隔的3倍是为了减少取最小值时扫描的空桶，
+ *	这里扫描空桶只是顺序读桶数组，而桶中每多一个定时器插入时就多一次缓存缺失，因此每个桶平均不超过一个定时器
+ *
+ * @return	新的width_shift，样本不够或者到期时间都相同时保持不变
+ */
+static unsigned int cq_sample_width(struct cq_timer_s_internal *this)
+{
+    uint64_t sample[CQ_SAMPLE_MAX], v, width;
+    struct cq_timer_internal *t;
+    unsigned int bits = __builtin_popcount(this->bucket_mask), i, j, k, m = 0, shift;
+
+    for(k = 0; k <= this->bucket_mask && m < CQ_SAMPLE_NUM; ++k) {
+        for(i = 0, j = 0; j < bits; ++j) {
+            i |= ((k >> j) & 1) << (bits - 1 - j);
+        }
+
+        list_for_each_entry(t, &this->buckets[i], list) {
+            if(m == CQ_SAMPLE_MAX) {
+                break;
+            }
+
+            ///插入排序，样本很少
+            for(v = t->expires, j = m++; j > 0 && sample[j - 1] > v; --j) {
+                sample[j] = sample[j - 1];
+            }
+
+            sample[j] = v;
+        }
+    }
+
+    if(m < CQ_SAMPLE_MIN) {
+        return this->width_shift;
+    }
+
+    width = (sample[m * 3 / 4] - sample[m / 4]) * 2 / this->cur_timer_num;
+
+    if(width == 0) {
+        return this->width_shift;
+    }
+
+    shift = 63 - __builtin_clzll(width);
+    return shift < CQ_MIN_SHIFT ? CQ_MIN_SHIFT : (shift > CQ_MAX_SHIFT ? CQ_MAX_SHIFT : shift);
+}
+
+/**
+ * @brief	cq_arm
+ *
+ * 以绝对时间把timerfd设置为最早的定时器的到期时间，队列为空时停止timerfd
+ *
+ * @param	this		定时器管理对象
+ *
+ * @note	调用者必须持有cq_lock
+ */
+static void cq_arm(struct cq_timer_s_internal *this)
+{
+    struct itimerspec new_value;
+    struct cq_timer_internal *t = cq_peek(this);
+    memset(&new_value, 0, sizeof(new_value));
+    this->armed = 0;
+
+    if(t != NULL) {
+        this->armed = t->expires;
+        new_value.it_value.tv_sec = t->expires / NSEC_PER_SEC;
+        new_value.it_value.tv_nsec = t->expires % NSEC_PER_SEC;
+    }
+
+    if(timerfd_settime(this->timerfd, TFD_TIMER_ABSTIME, &new_value, NULL) == -1) {
+        perror("cq timer: timer_set failed");
+    }
+}
+
+/**
+ * @brief	cq_wakeup
+ *
+ * 让timerfd立即到期，唤醒阻塞在read上的定时器线程(停止定时器时使用)
+ *
+ * @param	this		定时器管理对象
+ */
+static void cq_wakeup(struct cq_timer_s_internal *this)
+{
+    struct itimerspec new_value;
+    memset(&new_value, 0, sizeof(new_value));
+    new_value.it_value.tv_nsec = 1;
+    pthread_mutex_lock(&this->cq_lock);
+    this->armed = 0;
+    timerfd_settime(this->timerfd, 0, &new_value, NULL);
+    pthread_mutex_unlock(&this->cq_lock);
+}
+
+
+/**
+ * @brief	stop
+ *
+ * 停止定时器，UNBLOCK方式下等待定时器线程退出
+ *
+ * @param	this	定时器管理对象指针
+ */
+static void ti_stop(CQ_TIMER_MANAGER *this)
+{
+    if(this  ==  NULL) {
+        return;
+    }
+
+    struct cq_timer_s_internal *p = (struct cq_timer_s_internal *)this;
+    struct itimerspec new_value;
+    pthread_rwlock_rdlock(&p->lock);
+
+    if(p->start_flag == 0) {
+        pthread_rwlock_unlock(&p->lock);
+        return ;
+    }
+
+    p->start_flag = 0 ;
+
+    if(p->start_type == TIMER_START_EMBED) {
+        ///没有线程需要唤醒，停止timerfd即可
+        memset(&new_value, 0, sizeof(new_value));
+        pthread_mutex_lock(&p->cq_lock);
+        p->armed = 0;
+        timerfd_settime(p->timerfd, 0, &new_value, NULL);
+        pthread_mutex_unlock(&p->cq_lock);
+        pthread_rwlock_unlock(&p->lock);
+        return;
+    }
+
+    cq_wakeup(p);
+    pthread_rwlock_unlock(&p->lock);
+
+    ///BLOCK方式由start的调用者回收线程，在回调中stop时不能等待自己
+    if(p->start_type == TIMER_START_UNBLOCK) {
+        if(pthread_equal(pthread_self(), p->tid)) {
+            pthread_detach(p->tid);
+        } else {
+            pthread_join(p->tid, NULL);
+        }
+    }
+}
+
+
+/**
+ * @brief	start
+ *
+ * 以三种方式来开启定时器
+ *
+ * @param	this		定时器管理对象指针
+ * @param	type		开启方式
+ */
+static void ti_start(CQ_TIMER_MANAGER *this, timer_start_type type)
+{
+    if(this  ==  NULL) {
+        return;
+    }
+
+    struct cq_timer_s_internal *p = (struct cq_timer_s_internal *)this;
+    int flags;
+    pthread_rwlock_wrlock(&p->lock);
+
+    if(atomic_read(&p->init_flag) == 0 || p->start_flag  == 1) {
+        pthread_rwlock_unlock(&p->lock);
+        return;
+    }
+
+    p->start_flag = 1 ;
+    p->start_type = type;
+    ///只有EMBED方式下timerfd是非阻塞的，定时器线程需要阻塞在read上
+    flags = fcntl(p->timerfd, F_GETFL);
+
+    if(flags != -1) {
+        fcntl(p->timerfd, F_SETFL, type == TIMER_START_EMBED ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+    }
+
+    switch(type) {
+        case TIMER_START_UNBLOCK:
+        case TIMER_START_BLOCK:
+
+            if(pthread_create(&p->tid, NULL, entry, (void *)p) != 0) {
+                perror("create timer thread failed");
+                p->start_flag = 0 ;
+                pthread_rwlock_unlock(&p->lock);
+                return;
+            }
+
+            pthread_rwlock_unlock(&p->lock);
+
+            if(type == TIMER_START_BLOCK && pthread_join(p->tid, NULL) != 0) {
+                perror("block failed");
+            }
+
+            break;
+        case TIMER_START_EMBED:
+            ///由调用者的事件循环监听timerfd，按当前最早的定时器设置到期时间
+            pthread_mutex_lock(&p->cq_lock);
+            cq_arm(p);
+            pthread_mutex_unlock(&p->cq_lock);
+            pthread_rwlock_unlock(&p->lock);
+            break;
+        default:
+            p->start_flag = 0;
+            pthread_rwlock_unlock(&p->lock);
+            break;
+    }
+}
+
+/**
+ * @brief	cq_expire
+ *
+ * 取出并处理截止到now为止所有到期的定时器，之后按最早的定时器重新设置timerfd
+ *
+ * @param	this		定时器管理对象
+ * @param	now			当前时间
+ *
+ * @return	到期的定时器个数
+ */
+static unsigned int cq_expire(struct cq_timer_s_internal *this, struct timespec *now)
+{
+    struct cq_timer_internal *temp;
+    struct timer_dispatch_batch batch;
+    struct timespec start, end;
+    unsigned int num = 0;
+    uint64_t cur = (uint64_t)timer_timespec_ns(now);
+    int64_t elapsed = (int64_t)cur, late;
+    pthread_mutex_lock(&this->cq_lock);
+    timer_batch_init(&batch, this->executor);
+
+    ///一次取出所有已经到期的定时器
+    while(this->start_flag && (temp = cq_peek(this)) != NULL && temp->expires <= cur) {
+        if(timer_batch_full(&batch)) {
+            pthread_mutex_unlock(&this->cq_lock);
+            timer_executor_flush(&batch);
+            pthread_mutex_lock(&this->cq_lock);
+            continue;
+        }
+
+        cq_unlink(this, temp);
+        ++num;
+        ///前面的回调耗时也计入后面定时器的延迟
+        late = elapsed - (int64_t)temp->expires;
+        timer_histogram_record(&this->stats.lateness, late > 0 ? late : 0);
+        timer_trace_record(&this->trace, TIMER_TRACE_EXPIRE, temp->id, late > 0 ? timer_trace_arg(late / 1000) : 0);
+
+        ///异步执行的回调只放入批次，不需要释放锁；节点随后可能被释放，拷贝方式的参数由批次复制一份
+        if(temp->run_type == THREAD) {
+            timer_batch_add(&batch, temp->cb, temp->param, temp->param_mode == TIMER_PARAM_COPY && temp->param_len > 0 ? temp->param_len : 0);
+        } else {
+            this->running = temp;
+            pthread_mutex_unlock(&this->cq_lock);
+
+            if(temp->run_type == SIGNAL) {
+                kill(getpid(), SIGALRM);
+            } else if(clock_gettime(this->clock_id, &start) == 0) {
+                timer_trace_record(&this->trace, TIMER_TRACE_CB_START, temp->id, 0);
+                temp->cb(temp->param);
+                timer_trace_record(&this->trace, TIMER_TRACE_CB_END, temp->id, 0);
+                clock_gettime(this->clock_id, &end);
+                late = timer_timespec_ns(&end) - timer_timespec_ns(&start);
+                elapsed += late;
+                timer_histogram_record(&this->stats.callback, late);
+            } else {
+                timer_trace_record(&this->trace, TIMER_TRACE_CB_START, temp->id, 0);
+                temp->cb(temp->param);
+                timer_trace_record(&this->trace, TIMER_TRACE_CB_END, temp->id, 0);
+            }
+
+            pthread_mutex_lock(&this->cq_lock);
+
+            if(this->running == NULL) {
+                ///回调执行期间定时器已经被删除
+                cq_timer_free(this, temp);
+                this->running_rearm = 0;
+                cq_fit(this);
+                continue;
+            }
+        }
+
+        if(this->running_rearm) {
+            cq_link(this, temp);
+        } else if(temp->type != REPEAT || repush(this, temp, cur) == TIMER_FALSE) {
+            this->timers[temp->id] = NULL;
+            cq_timer_id_push(this, temp->id);
+            cq_timer_free(this, temp);
+        }
+
+        this->running = NULL;
+        this->running_rearm = 0;
+        cq_fit(this);
+    }
+
+    ///睡眠到最早的定时器的到期时间，没有定时器时不再唤醒
+    if(this->start_flag) {
+        cq_arm(this);
+    }
+
+    pthread_mutex_unlock(&this->cq_lock);
+    ///这一轮所有THREAD回调一次交给执行器
+    timer_executor_flush(&batch);
+    timer_stat_add(this->stats.expirations, num);
+    return num;
+}
+
+/**
+ * @brief	entry
+ *
+ * 定时器线程，处理到期的定时器后阻塞在timerfd上，stop把timerfd设置为立即到期来唤醒它
+ *
+ * @param	p
+ *
+ * @return
+ */
+static void *entry(void *p)
+{
+    struct cq_timer_s_internal *this = (struct cq_timer_s_internal *)p;
+    struct timespec now;
+    sigset_t sigmask;
+    uint64_t exp;
+
+    sigfillset(&sigmask);
+    pthread_sigmask(SIG_SETMASK, &sigmask, NULL);
+
+    while(this->start_flag) {
+        if(clock_gettime(this->clock_id, &now) == -1) {
+            perror("get clock time failed");
+            break;
+        }
+
+        cq_expire(this, &now);
+
+        if(read(this->timerfd, &exp, sizeof(uint64_t)) != sizeof(uint64_t)) {
+            perror("[cq timer exit abnormally] - read failed");
+            break;
+        }
+    }
+
+    this->start_flag = 0;
+    return NULL;
+}
+
+static void ti_close(CQ_TIMER_MANAGER *this)
+{
+    if(this  ==  NULL) {
+        return;
+    }
+
+    struct cq_timer_s_internal *p = (struct cq_timer_s_internal *)this;
+    ///先在锁外等待定时器线程退出，回调中可能还会调用push/del
+    ti_stop(this);
+    pthread_rwlock_wrlock(&p->lock);
+
+    if(atomic_read(&p->init_flag)  ==  0) {
+        pthread_rwlock_unlock(&p->lock);
+        return;
+    }
+
+    free_all_timers(p);
+    p->max_timer_num = 0;
+    free(p->buckets);
+    free(p->timers);
+    free(p->free_ids);
+    p->buckets = NULL;
+    p->timers = NULL;
+    p->free_ids = NULL;
+    mem_pool_destroy(&p->pool);
+
+    if(p->timerfd > 2) {
+        close(p->timerfd);
+    }
+
+    atomic_set(&p->init_flag,  0);
+    pthread_rwlock_unlock(&p->lock);
+}
+
+
+/* ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  HELPER FUNC ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  == = */
+static void ti_enable(CQ_TIMER_MANAGER *this)
+{
+    if(this  ==  NULL) {
+        return;
+    }
+
+    struct cq_timer_s_internal *p = (struct cq_timer_s_internal *)this;
+    pthread_rwlock_rdlock(&p->lock);
+    p->enable_flag = 1;
+    pthread_rwlock_unlock(&p->lock);
+}
+static void ti_disable(CQ_TIMER_MANAGER *this)
+{
+    if(this  ==  NULL) {
+        return;
+    }
+
+    struct cq_timer_s_internal *p = (struct cq_timer_s_internal *)this;
+    pthread_rwlock_rdlock(&p->lock);
+    p->enable_flag = 0;
+    pthread_rwlock_unlock(&p->lock);
+}
+static void ti_set_executor(CQ_TIMER_MANAGER *this, TIMER_EXECUTOR *executor)
+{
+    if(this  ==  NULL) {
+        return;
+    }
+
+    struct cq_timer_s_internal *p = (struct cq_timer_s_internal *)this;
+    pthread_mutex_lock(&p->cq_lock);
+    p->executor = executor;
+    pthread_mutex_unlock(&p->cq_lock);
+}
+
+static int ti_get_fd(CQ_TIMER_MANAGER *this)
+{
+    struct cq_timer_s_internal *p = (struct cq_timer_s_internal *)this;
+
+    if(this == NULL || atomic_read(&p->init_flag) == 0) {
+        return -1;
+    }
+
+    return p->timerfd;
+}
+
+/**
+ * @brief	process_expired
+ *
+ * EMBED方式下由调用者的事件循环驱动，处理截止到now为止到期的定时器
+ *
+ * @param	this		定时器管理对象指针
+ * @param	now			当前时间(clock_type对应的时钟)，为NULL时读取系统时间
+ *
+ * @return	到期的定时器个数
+ */
+static unsigned int ti_process_expired(CQ_TIMER_MANAGER *this, const struct timespec *now)
+{
+    struct cq_timer_s_internal *p = (struct cq_timer_s_internal *)this;
+    struct timespec cur;
+    uint64_t exp;
+
+    if(this == NULL || p->start_flag == 0 || p->start_type != TIMER_START_EMBED) {
+        return 0;
+    }
+
+    ///清除timerfd的可读状态，cq_expire会按最早的定时器重新设置
+    if(read(p->timerfd, &exp, sizeof(uint64_t)) != sizeof(uint64_t) && errno != EAGAIN) {
+        perror("read timerfd failed");
+    }
+
+    if(now != NULL) {
+        cur = *now;
+    } else if(clock_gettime(p->clock_id, &cur) == -1) {
+        return 0;
+    }
+
+    return cq_expire(p, &cur);
+}
+
+static void ti_get_overrun(CQ_TIMER_MANAGER *this, struct timer_overrun *overrun)
+{
+    struct cq_timer_s_internal *p = (struct cq_timer_s_internal *)this;
+
+    if(this == NULL || overrun == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&p->cq_lock);
+    *overrun = p->overrun;
+    pthread_mutex_unlock(&p->cq_lock);
+}
+
+/**
+ * @brief	get_stats
+ *
+ * busy_slots和max_slot_depth是非空的桶数和最长的桶，可以用来观察桶宽度是否合适
+ *
+ * @param	this
+ * @param	stats
+ */
+static void ti_get_stats(CQ_TIMER_MANAGER *this, struct timer_stats *stats)
+{
+    struct cq_timer_s_internal *p = (struct cq_timer_s_internal *)this;
+    struct list_head *pos;
+    unsigned int i, depth;
+
+    if(this == NULL || stats == NULL) {
+        return;
+    }
+
+    memset(stats, 0, sizeof(struct timer_stats));
+    timer_stats_copy(stats, &p->stats);
+    pthread_rwlock_rdlock(&p->lock);
+
+    if(atomic_read(&p->init_flag)  ==  0) {
+        pthread_rwlock_unlock(&p->lock);
+        return;
+    }
+
+    pthread_mutex_lock(&p->cq_lock);
+    stats->overrun = p->overrun;
+    stats->timers = p->cur_timer_num;
+
+    for(i = 0; i <= p->bucket_mask; ++i) {
+        depth = 0;
+
+        list_for_each(pos, &p->buckets[i]) {
+            ++depth;
+        }
+
+        if(depth > 0) {
+            ++stats->busy_slots;
+        }
+
+        if(depth > stats->max_slot_depth) {
+            stats->max_slot_depth = depth;
+        }
+    }
+
+    pthread_mutex_unlock(&p->cq_lock);
+    pthread_rwlock_unlock(&p->lock);
+}
+
+static TIMER_BOOL ti_set_trace(CQ_TIMER_MANAGER *this, unsigned int events)
+{
+    if(this == NULL) {
+        return TIMER_FALSE;
+    }
+
+    return timer_trace_set(&((struct cq_timer_s_internal *)this)->trace, events);
+}
+
+static TIMER_BOOL ti_dump_trace(CQ_TIMER_MANAGER *this, const char *path)
+{
+    if(this == NULL) {
+        return TIMER_FALSE;
+    }
+
+    return timer_trace_dump(&((struct cq_timer_s_internal *)this)->trace, path);
+}
+
+/**
+ * @brief	snapshot
+ *
+ * 按桶的顺序保存所有定时器，到期时间是没有加上slack的nominal，恢复时重新对齐
+ *
+ * @param	this
+ * @param	path
+ *
+ * @return	库布尔值
+ */
+static TIMER_BOOL ti_snapshot(CQ_TIMER_MANAGER *this, const char *path)
+{
+    if(this == NULL || path == NULL) {
+        return TIMER_FALSE;
+    }
+
+    struct cq_timer_s_internal *p = (struct cq_timer_s_internal *)this;
+    struct cq_timer_internal *t;
+    struct timer_snapshot s;
+    TIMER_BOOL ret = TIMER_TRUE;
+    unsigned int i;
+    pthread_rwlock_rdlock(&p->lock);
+
+    if(atomic_read(&p->init_flag)  ==  0) {
+        pthread_rwlock_unlock(&p->lock);
+        return TIMER_FALSE;
+    }
+
+    timer_snapshot_init(&s, p->clock_id);
+    pthread_mutex_lock(&p->cq_lock);
+
+    for(i = 0; i <= p->bucket_mask && ret == TIMER_TRUE; ++i) {
+        list_for_each_entry(t, &p->buckets[i], list) {
+            if((ret = timer_snapshot_add(&s, (struct timer *)t, (long long)t->nominal)) == TIMER_FALSE) {
+                break;
+            }
+        }
+    }
+
+    ///正在执行回调的循环定时器按下一个周期保存
+    if(ret == TIMER_TRUE && (t = p->running) != NULL && (t->type == REPEAT || p->running_rearm)) {
+        ret = timer_snapshot_add(&s, (struct timer *)t, (long long)(p->running_rearm ? t->nominal : t->nominal + interval_ns(t)));
+    }
+
+    pthread_mutex_unlock(&p->cq_lock);
+    pthread_rwlock_unlock(&p->lock);
+
+    if(ret == TIMER_FALSE) {
+        timer_snapshot_free(&s);
+        return TIMER_FALSE;
+    }
+
+    return timer_snapshot_write(&s, path);
+}
+
+/**
+ * @brief	restore
+ *
+ * 在一次加锁中按文件中的到期时间逐个放入队列，桶数随之加倍，均摊O(1)
+ *
+ * @param	this
+ * @param	path
+ *
+ * @return	全部添加成功时返回TIMER_TRUE
+ */
+static TIMER_BOOL ti_restore(CQ_TIMER_MANAGER *this, const char *path)
+{
+    if(this == NULL || path == NULL) {
+        return TIMER_FALSE;
+    }
+
+    struct cq_timer_s_internal *p = (struct cq_timer_s_internal *)this;
+    struct cq_timer_internal *t;
+    struct timer_snapshot_file f;
+    struct timer timer;
+    unsigned long long i, num = 0;
+    long long deadline;
+    uint64_t first = 0;
+
+    if(timer_snapshot_open(&f, path, p->clock_id) == TIMER_FALSE) {
+        return TIMER_FALSE;
+    }
+
+    pthread_rwlock_rdlock(&p->lock);
+
+    if(atomic_read(&p->init_flag)  ==  0 || p->enable_flag == 0) {
+        pthread_rwlock_unlock(&p->lock);
+        timer_snapshot_close(&f);
+        return TIMER_FALSE;
+    }
+
+    pthread_mutex_lock(&p->cq_lock);
+
+    for(i = 0; i < f.header->count; ++i) {
+        deadline = timer_snapshot_get(&f, i, &timer);
+
+        if((timer.interval == 0 && timer.interval_ns == 0) || timer.cb == NULL) {
+            fprintf(stderr, "timer is illegal \n");
+            continue;
+        }
+
+        if(p->free_num == 0 || (t = mem_pool_alloc(&p->pool)) == NULL) {
+            fprintf(stderr, "ACHIEVE TIMER MAX NUMBER\n");
+            break;
+        }
+
+        *(struct timer *)t = timer;
+
+        if(cq_timer_param_init(t, &timer) == TIMER_FALSE) {
+            perror("malloc failed\n");
+            mem_pool_free(&p->pool, t);
+            continue;
+        }
+
+        ///nominal为文件中的到期时间，已经过期的在下一次处理时到期
+        deadline = deadline > (long long)interval_ns(t) ? deadline - (long long)interval_ns(t) : 0;
+        cq_timer_set_expire(t, (uint64_t)deadline);
+        t->id = cq_timer_id_pop(p);
+        p->timers[t->id] = t;
+        cq_link(p, t);
+        cq_fit(p);
+
+        if(first == 0 || t->expires < first) {
+            first = t->expires;
+        }
+
+        timer_trace_record(&p->trace, TIMER_TRACE_ADD, t->id, t->interval);
+        ++num;
+    }
+
+    if(num > 0 && p->start_flag && (p->armed == 0 || first < p->armed)) {
+        cq_arm(p);
+    }
+
+    pthread_mutex_unlock(&p->cq_lock);
+    pthread_rwlock_unlock(&p->lock);
+    timer_stat_add(p->stats.adds, num);
+    i = f.header->count;
+    timer_snapshot_close(&f);
+    return num == i ? TIMER_TRUE : TIMER_FALSE;
+}
+
+/**
+ * @brief	cq_timer_set_expire 从from开始计算到期时间，并按slack对齐
+ *
+ * @param	timer
+ * @param	from	纳秒
+ */
+static inline void cq_timer_set_expire(struct cq_timer_internal *timer, uint64_t from)
+{
+    timer->nominal = from + interval_ns(timer);
+    timer->expires = timer->slack > 0 ? timer_apply_slack(timer->nominal, (uint64_t)timer->slack * NSEC_PER_MSEC) : timer->nominal;
+}
+
+/**
+ * @brief	cq_timer_param_init
+ *
+ * 按param_mode保存定时器的参数，短参数拷贝到节点内部，长参数另外申请内存
+ *
+ * @param	t
+ * @param	timer
+ *
+ * @return	申请内存失败返回TIMER_FALSE
+ */
+static inline TIMER_BOOL cq_timer_param_init(struct cq_timer_internal *t, struct timer *timer)
+{
+    if(timer->param_mode == TIMER_PARAM_REF) {
+        t->param = timer->param;
+    } else if(timer->param_len <= 0) {
+        t->param = NULL;
+    } else if(timer->param_len <= TIMER_INLINE_PARAM_SIZE) {
+        t->param = t->param_buf;
+        memcpy(t->param, timer->param, timer->param_len);
+    } else if((t->param = malloc(timer->param_len)) != NULL) {
+        memcpy(t->param, timer->param, timer->param_len);
+    } else {
+        return TIMER_FALSE;
+    }
+
+    return TIMER_TRUE;
+}
+
+/**
+ * @brief	cq_timer_id_pop
+ *
+ * 从空闲id队列头部取出一个id，调用者必须持有cq_lock且队列不为空
+ *
+ * @param	this
+ *
+ * @return
+ */
+static inline timer_id cq_timer_id_pop(struct cq_timer_s_internal *this)
+{
+    timer_id id = this->free_ids[this->free_head];
+
+    if(++this->free_head == this->max_timer_num) {
+        this->free_head = 0;
+    }
+
+    --this->free_num;
+    return id;
+}
+
+///将已用的id放回空闲id队列尾部
+static inline void cq_timer_id_push(struct cq_timer_s_internal *this, timer_id id)
+{
+    this->free_ids[(this->free_head + this->free_num) % this->max_timer_num] = id;
+    ++this->free_num;
+}
+
+static inline struct cq_timer_internal *cq_timer_lookup(struct cq_timer_s_internal *this, timer_id id)
+{
+    if(id == 0 || id > (timer_id)this->max_timer_num) {
+        return NULL;
+    }
+
+    return this->timers[id];
+}
+
+static inline void cq_timer_free(struct cq_timer_s_internal *this, struct cq_timer_internal *timer)
+{
+    if(timer->param_mode == TIMER_PARAM_COPY && timer->param != (void *)timer->param_buf) {
+        free(timer->param);
+    }
+
+    mem_pool_free(&this->pool, timer);
+}
+
+/**
+ * @brief	free_all_timers
+ *
+ * 释放所有定时器并把桶数恢复到CQ_MIN_BUCKETS，调用者必须持有cq_lock
+ *
+ * @param	this
+ *
+ * @return	原来有定时器返回TIMER_TRUE，否则TIMER_FALSE
+ */
+static TIMER_BOOL free_all_timers(struct cq_timer_s_internal *this)
+{
+    timer_id id = 1;
+    TIMER_BOOL ret = TIMER_FALSE;
+    struct cq_timer_internal *temp;
+    unsigned int i;
+
+    for(; id <= (timer_id)this->max_timer_num; ++id) {
+        if((temp = this->timers[id]) == NULL) {
+            continue;
+        }
+
+        this->timers[id] = NULL;
+        cq_timer_id_push(this, id);
+        ret = TIMER_TRUE;
+
+        ///正在执行回调的定时器由定时器线程释放
+        if(temp == this->running) {
+            this->running = NULL;
+        } else {
+            cq_timer_free(this, temp);
+        }
+    }
+
+    for(i = 0; i <= this->bucket_mask; ++i) {
+        INIT_LIST_HEAD(&this->buckets[i]);
+    }
+
+    this->cur_timer_num = 0;
+    cq_fit(this);
+    return ret;
+}
@@ -0,0 +1,113 @@
+/**
+ * @file clock.h
+ * @brief	定时器管理对象使用的时钟，供时间轮和最小堆内部使用
+ *
+ *	1.timerfd只支持CLOCK_REALTIME/CLOCK_MONOTONIC/CLOCK_BOOTTIME，粗粒度时钟的timerfd使用对应的精确时钟\n
+ *	2.add/push等热路径读取时间时，精度允许的情况下使用vDSO中的粗粒度时钟(不需要读硬件计数器)
+ *
+ * @author tangfu - abctangfuqiang2008@163.com
+ * @version 0.1
+ * @date 2012-06-30
+ */
+
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+#include <time.h>
+#include <stdint.h>
+#include "timer.h"
+
+#ifndef CLOCK_BOOTTIME
+#define CLOCK_BOOTTIME	7
+#endif
+
+///粗粒度时钟的分辨率不超过精度要求的1/TIMER_COARSE_RATIO时才使用
+#define TIMER_COARSE_RATIO	10
+
+#define check_clock_type(type)	((unsigned int)(type) <= TIMER_CLOCK_MONOTONIC_COARSE)
+
+/**
+ * @brief	timer_clock_id
+ *
+ * @param	type
+ *
+ * @return	timerfd和定时器线程使用的时钟
+ */
+static inline clockid_t timer_clock_id(timer_clock_type type)
+{
+    switch(type) {
+        case TIMER_CLOCK_REALTIME:
+            return CLOCK_REALTIME;
+        case TIMER_CLOCK_BOOTTIME:
+            return CLOCK_BOOTTIME;
+        default:
+            return CLOCK_MONOTONIC;
+    }
+}
+
+/**
+ * @brief	timer_fast_clock_id
+ *
+ * 热路径读取时间使用的时钟
+ *
+ * @param	type
+ * @param	precision_ns	需要的精度(纳秒)，为0时只在明确选择了粗粒度时钟时使用
+ *
+ * @return
+ */
+static inline clockid_t timer_fast_clock_id(timer_clock_type type, unsigned long long precision_ns)
+{
+    struct timespec res;
+    clockid_t coarse;
+
+    switch(type) {
+        case TIMER_CLOCK_MONOTONIC_COARSE:
+            return CLOCK_MONOTONIC_COARSE;
+        case TIMER_CLOCK_MONOTONIC:
+            coarse = CLOCK_MONOTONIC_COARSE;
+            break;
+        case TIMER_CLOCK_REALTIME:
+            coarse = CLOCK_REALTIME_COARSE;
+            break;
+        default:
+            return timer_clock_id(type);
+    }
+
+    if(precision_ns > 0 && clock_getres(coarse, &res) == 0
+            && ((unsigned long long)res.tv_sec * 1000000000ULL + res.tv_nsec) * TIMER_COARSE_RATIO <= precision_ns) {
+        return coarse;
+    }
+
+    return timer_clock_id(type);
+}
+
+///timespec换算成纳秒
+static inline int64_t timer_timespec_ns(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/**
+ * @brief	timer_apply_slack
+ *
+ * 与内核的apply_slack相同: 在[expires, expires + slack]内取低位尽量多为0的值，
+ * 到期时间相近的定时器会落到同一个值上，从而在同一次唤醒中处理
+ *
+ * @param	expires		到期时间(绝对值，单位由调用者决定)
+ * @param	slack		允许推迟的量
+ *
+ * @return	对齐后的到期时间
+ */
+static inline unsigned long long timer_apply_slack(unsigned long long expires, unsigned long long slack)
+{
+    unsigned long long limit = expires + slack, mask = expires ^ limit;
+
+    if(slack == 0 || mask == 0) {
+        return expires;
+    }
+
+    mask = (1ULL << (63 - __builtin_clzll(mask))) - 1;
+    return limit & ~mask;
+}
+
+#endif	/* __CLOCK_H__ */
@@ -0,0 +1,153 @@
+/**
+ * @file cmdring.h
+ * @brief	应用线程向tick线程提交定时器命令的无锁环形队列
+ *
+ *	1.有界的多生产者单消费者队列，每个单元带一个序号，生产者用CAS抢占tail，写完命令后再更新序号发布\n
+ *	2.同一时刻只有一个消费者(持有定时器管理单元写锁的线程)，因此出队不需要CAS\n
+ *	3.队列满时入队失败，由调用者退回到加锁的路径
+ *
+ * @author tangfu - abctangfuqiang2008@163.com
+ * @version 0.1
+ * @date 2012-06-16
+ */
+
+#ifndef __CMDRING_H__
+#define __CMDRING_H__
+
+#include <stdlib.h>
+#include "timer.h"
+
+enum timer_cmd_op {TIMER_CMD_ADD = 0, TIMER_CMD_DEL, TIMER_CMD_MOD};
+
+struct timer_cmd {
+    enum timer_cmd_op op;
+    timer_id id;
+    ///MOD命令的新间隔
+    unsigned int interval;
+    ///ADD命令已经分配好的定时器节点
+    void *timer;
+};
+
+struct cmd_cell {
+    volatile unsigned long seq;
+    struct timer_cmd cmd;
+};
+
+struct cmd_ring {
+    struct cmd_cell *cells;
+    unsigned long mask;
+    ///消费者的位置
+    unsigned long head;
+    ///生产者竞争的tail与head放在不同的cache line
+    char pad[64];
+    volatile unsigned long tail;
+};
+
+/**
+ * @brief	cmd_ring_init
+ *
+ * @param	ring
+ * @param	len		队列长度，向上取整为2的幂
+ *
+ * @return	成功返回0，失败返回-1
+ */
+static inline int cmd_ring_init(struct cmd_ring *ring, unsigned int len)
+{
+    unsigned long size = 2, i;
+
+    while(size < len) {
+        size <<= 1;
+    }
+
+    ring->cells = malloc(sizeof(struct cmd_cell) * size);
+
+    if(ring->cells == NULL) {
+        return -1;
+    }
+
+    for(i = 0; i < size; ++i) {
+        ring->cells[i].seq = i;
+    }
+
+    ring->mask = size - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    return 0;
+}
+
+static inline void cmd_ring_destroy(struct cmd_ring *ring)
+{
+    free(ring->cells);
+    ring->cells = NULL;
+    ring->mask = 0;
+}
+
+/**
+ * @brief	cmd_ring_push
+ *
+ * 多个生产者线程可以同时调用
+ *
+ * @param	ring
+ * @param	cmd
+ *
+ * @return	成功返回0，队列满返回-1
+ */
+static inline int cmd_ring_push(struct cmd_ring *ring, const struct timer_cmd *cmd)
+{
+    struct cmd_cell *cell;
+    unsigned long pos = ring->tail;
+    long dif;
+
+    for(;;) {
+        cell = &ring->cells[pos & ring->mask];
+        dif = (long)(cell->seq - pos);
+
+        if(dif == 0) {
+            if(__sync_bool_compare_and_swap(&ring->tail, pos, pos + 1)) {
+                break;
+            }
+
+            pos = ring->tail;
+        } else if(dif < 0) {
+            ///该单元还没有被消费者取走，队列已满
+            return -1;
+        } else {
+            pos = ring->tail;
+        }
+    }
+
+    cell->cmd = *cmd;
+    ///命令写完之后才能发布序号
+    __sync_synchronize();
+    cell->seq = pos + 1;
+    return 0;
+}
+
+/**
+ * @brief	cmd_ring_pop
+ *
+ * 只能由一个消费者调用
+ *
+ * @param	ring
+ * @param	cmd
+ *
+ * @return	成功返回0，队列为空(或者下一个单元还没有发布)返回-1
+ */
+static inline int cmd_ring_pop(struct cmd_ring *ring, struct timer_cmd *cmd)
+{
+    struct cmd_cell *cell = &ring->cells[ring->head & ring->mask];
+
+    if((long)(cell->seq - (ring->head + 1)) < 0) {
+        return -1;
+    }
+
+    __sync_synchronize();
+    *cmd = cell->cmd;
+    __sync_synchronize();
+    ///单元留给下一圈的生产者使用
+    cell->seq = ring->head + ring->mask + 1;
+    ++ring->head;
+    return 0;
+}
+
+#endif	/* __CMDRING_H__ */
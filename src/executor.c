@@ -0,0 +1,661 @@
+#include "timer.h"
+#include "executor.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sched.h>
+
+/*
+ * Chase-Lev工作窃取双端队列(定长): 所属工作线程在bottom端push/pop，
+ * 其他工作线程在top端用CAS窃取
+ */
+struct ws_deque {
+    volatile long top;
+    ///窃取者竞争的top与所属线程修改的bottom放在不同的cache line
+    char pad[64];
+    volatile long bottom;
+    long mask;
+    struct timer_task *tasks;
+};
+
+///工作线程
+struct ws_worker {
+    struct timer_executor_s *executor;
+    unsigned int index;
+    pthread_t pid;
+    ///以下只在工作窃取模式下使用
+    struct ws_deque deque;
+    ///tick线程投递的回调先放到inject队列，由所属线程批量移到deque中，空闲的线程也可以直接取走
+    pthread_mutex_t inject_lock;
+    struct timer_task *inject;
+    unsigned int inject_head;
+    unsigned int inject_num;
+};
+
+struct timer_executor_s {
+    timer_executor_type type;
+    timer_executor_policy policy;
+    struct ws_worker *workers;
+    unsigned int worker_num;
+    ///共享队列模式下是队列长度，工作窃取模式下是每个工作线程inject队列的长度
+    unsigned int queue_len;
+    ///共享队列模式的环形队列
+    struct timer_task *tasks;
+    unsigned int head;
+    unsigned int num;
+    ///工作窃取模式下下一段回调投递的工作线程
+    volatile unsigned int next;
+    ///工作窃取模式下已经投递但还没有开始执行的回调个数
+    volatile long pending;
+    ///等待回调的工作线程个数
+    volatile int sleepers;
+    ///因为队列满而等待的投递者个数
+    volatile int blocked;
+    ///因为队列满而丢弃的回调个数
+    unsigned long discarded;
+    int stop_flag;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+static void *worker_entry(void *arg);
+static void *ws_worker_entry(void *arg);
+static void executor_free(struct timer_executor_s *this);
+
+///执行回调并释放执行器持有的参数副本
+static inline void task_run(struct timer_task *task)
+{
+    task->cb(task->param);
+
+    if(task->own) {
+        free(task->param);
+    }
+}
+
+///丢弃还没有执行的回调
+static inline void task_drop(struct timer_task *tasks, unsigned int n)
+{
+    unsigned int i;
+
+    for(i = 0; i < n; ++i) {
+        if(tasks[i].own) {
+            free(tasks[i].param);
+        }
+    }
+}
+
+/**
+ * @brief	create_timer_executor
+ *
+ * 创建执行器并启动所有工作线程
+ *
+ * @param	conf	执行器配置，worker_num和queue_len都必须大于0
+ *
+ * @return	失败返回NULL
+ */
+TIMER_EXECUTOR *create_timer_executor(struct timer_executor_conf *conf)
+{
+    unsigned int i;
+    long size = 2;
+    struct timer_executor_s *p;
+    struct ws_worker *w;
+
+    if(conf == NULL || conf->worker_num == 0 || conf->queue_len == 0) {
+        fprintf(stderr, "executor_conf is illegal \n");
+        return NULL;
+    }
+
+    if((p = malloc(sizeof(struct timer_executor_s))) == NULL) {
+        perror("malloc failed");
+        return NULL;
+    }
+
+    memset(p, 0, sizeof(struct timer_executor_s));
+    p->type = conf->type;
+    p->policy = conf->policy;
+    p->queue_len = conf->queue_len;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->not_empty, NULL);
+    pthread_cond_init(&p->not_full, NULL);
+    p->workers = calloc(conf->worker_num, sizeof(struct ws_worker));
+
+    if(p->workers == NULL) {
+        perror("malloc failed");
+        executor_free(p);
+        return NULL;
+    }
+
+    if(p->type == TIMER_EXECUTOR_STEALING) {
+        while(size < (long)conf->queue_len) {
+            size <<= 1;
+        }
+
+        for(i = 0; i < conf->worker_num; ++i) {
+            w = &p->workers[i];
+            w->deque.tasks = malloc(sizeof(struct timer_task) * size);
+            w->deque.mask = size - 1;
+            w->inject = malloc(sizeof(struct timer_task) * p->queue_len);
+            pthread_mutex_init(&w->inject_lock, NULL);
+
+            if(w->deque.tasks == NULL || w->inject == NULL) {
+                perror("malloc failed");
+                p->worker_num = i + 1;
+                executor_free(p);
+                return NULL;
+            }
+        }
+    } else if((p->tasks = malloc(sizeof(struct timer_task) * p->queue_len)) == NULL) {
+        perror("malloc failed");
+        executor_free(p);
+        return NULL;
+    }
+
+    p->worker_num = conf->worker_num;
+
+    for(i = 0; i < conf->worker_num; ++i) {
+        w = &p->workers[i];
+        w->executor = p;
+        w->index = i;
+
+        if(pthread_create(&w->pid, NULL, p->type == TIMER_EXECUTOR_STEALING ? ws_worker_entry : worker_entry, (void *)w) != 0) {
+            perror("create executor worker failed");
+            break;
+        }
+    }
+
+    ///部分线程没有创建成功时，结束已经创建的线程；未启动线程的队列都是空的，窃取不到任何东西
+    if(i < conf->worker_num) {
+        pthread_mutex_lock(&p->lock);
+        p->stop_flag = 1;
+        pthread_cond_broadcast(&p->not_empty);
+        pthread_mutex_unlock(&p->lock);
+
+        while(i-- > 0) {
+            pthread_join(p->workers[i].pid, NULL);
+        }
+
+        executor_free(p);
+        return NULL;
+    }
+
+    return p;
+}
+
+/**
+ * @brief	destroy_timer_executor
+ *
+ * 执行完已经投递的回调后结束所有工作线程；调用前应该先停止所有使用它的定时器管理对象
+ *
+ * @param	this
+ */
+void destroy_timer_executor(TIMER_EXECUTOR *this)
+{
+    unsigned int i;
+
+    if(this == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&this->lock);
+    this->stop_flag = 1;
+    pthread_cond_broadcast(&this->not_empty);
+    pthread_cond_broadcast(&this->not_full);
+    pthread_mutex_unlock(&this->lock);
+
+    for(i = 0; i < this->worker_num; ++i) {
+        pthread_join(this->workers[i].pid, NULL);
+    }
+
+    executor_free(this);
+}
+
+unsigned long timer_executor_discarded(TIMER_EXECUTOR *this)
+{
+    unsigned long ret;
+
+    if(this == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&this->lock);
+    ret = this->discarded;
+    pthread_mutex_unlock(&this->lock);
+    return ret;
+}
+
+static void executor_free(struct timer_executor_s *this)
+{
+    unsigned int i;
+
+    if(this->workers != NULL && this->type == TIMER_EXECUTOR_STEALING) {
+        for(i = 0; i < this->worker_num; ++i) {
+            free(this->workers[i].deque.tasks);
+            free(this->workers[i].inject);
+            pthread_mutex_destroy(&this->workers[i].inject_lock);
+        }
+    }
+
+    pthread_cond_destroy(&this->not_full);
+    pthread_cond_destroy(&this->not_empty);
+    pthread_mutex_destroy(&this->lock);
+    free(this->tasks);
+    free(this->workers);
+    free(this);
+}
+
+/* ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  SHARED QUEUE ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  == = */
+
+/**
+ * @brief	shared_submit
+ *
+ * 在一次加锁中把一批回调放入共享队列
+ *
+ * @param	this
+ * @param	tasks
+ * @param	n
+ */
+static void shared_submit(struct timer_executor_s *this, struct timer_task *tasks, unsigned int n)
+{
+    unsigned int i = 0;
+    pthread_mutex_lock(&this->lock);
+
+    while(i < n) {
+        if(this->stop_flag) {
+            this->discarded += n - i;
+            task_drop(tasks + i, n - i);
+            break;
+        }
+
+        if(this->num < this->queue_len) {
+            this->tasks[(this->head + this->num) % this->queue_len] = tasks[i++];
+            ++this->num;
+            continue;
+        }
+
+        ///队列满时先唤醒工作线程处理已经放入的回调
+        pthread_cond_broadcast(&this->not_empty);
+
+        if(this->policy == TIMER_EXECUTOR_DISCARD) {
+            this->discarded += n - i;
+            task_drop(tasks + i, n - i);
+            break;
+        } else if(this->policy == TIMER_EXECUTOR_CALLER_RUNS) {
+            pthread_mutex_unlock(&this->lock);
+
+            for(; i < n; ++i) {
+                task_run(&tasks[i]);
+            }
+
+            return;
+        } else {
+            ///tick线程在这里等待，从而限制了到期回调的产生速度
+            pthread_cond_wait(&this->not_full, &this->lock);
+        }
+    }
+
+    if(n > 1) {
+        pthread_cond_broadcast(&this->not_empty);
+    } else {
+        pthread_cond_signal(&this->not_empty);
+    }
+
+    pthread_mutex_unlock(&this->lock);
+}
+
+static void *worker_entry(void *arg)
+{
+    struct timer_executor_s *this = ((struct ws_worker *)arg)->executor;
+    struct timer_task task;
+    sigset_t sigmask;
+    ///工作线程不处理任何信号，定时器的停止信号只发给tick线程
+    sigfillset(&sigmask);
+    pthread_sigmask(SIG_SETMASK, &sigmask, NULL);
+
+    for(;;) {
+        pthread_mutex_lock(&this->lock);
+
+        while(this->num == 0 && this->stop_flag == 0) {
+            pthread_cond_wait(&this->not_empty, &this->lock);
+        }
+
+        ///停止时先把队列中的回调执行完
+        if(this->num == 0) {
+            pthread_mutex_unlock(&this->lock);
+            break;
+        }
+
+        task = this->tasks[this->head];
+        this->head = (this->head + 1) % this->queue_len;
+        --this->num;
+        pthread_cond_signal(&this->not_full);
+        pthread_mutex_unlock(&this->lock);
+        task_run(&task);
+    }
+
+    return NULL;
+}
+
+/* ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  WORK STEALING ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  == = */
+
+///只能由所属线程调用，满时返回-1
+static inline int ws_push(struct ws_deque *d, struct timer_task *task)
+{
+    long b = d->bottom, t = d->top;
+
+    if(b - t > d->mask) {
+        return -1;
+    }
+
+    d->tasks[b & d->mask] = *task;
+    __sync_synchronize();
+    d->bottom = b + 1;
+    return 0;
+}
+
+///只能由所属线程调用，空时返回-1
+static inline int ws_pop(struct ws_deque *d, struct timer_task *task)
+{
+    long b = d->bottom - 1, t;
+    int ret = 0;
+    d->bottom = b;
+    __sync_synchronize();
+    t = d->top;
+
+    if(t > b) {
+        d->bottom = b + 1;
+        return -1;
+    }
+
+    *task = d->tasks[b & d->mask];
+
+    ///只剩最后一个时与窃取者竞争
+    if(t == b) {
+        if(!__sync_bool_compare_and_swap(&d->top, t, t + 1)) {
+            ret = -1;
+        }
+
+        d->bottom = b + 1;
+    }
+
+    return ret;
+}
+
+///任何线程都可以调用，空或者竞争失败时返回-1
+static inline int ws_steal(struct ws_deque *d, struct timer_task *task)
+{
+    long t = d->top, b;
+    __sync_synchronize();
+    b = d->bottom;
+
+    if(t >= b) {
+        return -1;
+    }
+
+    *task = d->tasks[t & d->mask];
+    return __sync_bool_compare_and_swap(&d->top, t, t + 1) ? 0 : -1;
+}
+
+///inject队列腾出空位后唤醒等待的投递者
+static inline void ws_wakeup_blocked(struct timer_executor_s *this)
+{
+    __sync_synchronize();
+
+    if(this->blocked > 0) {
+        pthread_mutex_lock(&this->lock);
+        pthread_cond_broadcast(&this->not_full);
+        pthread_mutex_unlock(&this->lock);
+    }
+}
+
+/**
+ * @brief	ws_take_inject
+ *
+ * 从w的inject队列取一个回调；own非0时是所属线程在取，顺便把剩余的回调移到自己的deque中供其他线程窃取
+ *
+ * @return	成功返回0
+ */
+static int ws_take_inject(struct ws_worker *w, struct timer_task *task, int own)
+{
+    struct timer_executor_s *this = w->executor;
+    pthread_mutex_lock(&w->inject_lock);
+
+    if(w->inject_num == 0) {
+        pthread_mutex_unlock(&w->inject_lock);
+        return -1;
+    }
+
+    *task = w->inject[w->inject_head];
+    w->inject_head = (w->inject_head + 1) % this->queue_len;
+    --w->inject_num;
+
+    while(own && w->inject_num > 0 && ws_push(&w->deque, &w->inject[w->inject_head]) == 0) {
+        w->inject_head = (w->inject_head + 1) % this->queue_len;
+        --w->inject_num;
+    }
+
+    pthread_mutex_unlock(&w->inject_lock);
+    ws_wakeup_blocked(this);
+    return 0;
+}
+
+///依次尝试窃取其他线程deque和inject队列中的回调
+static int ws_steal_other(struct ws_worker *self, struct timer_task *task)
+{
+    struct timer_executor_s *this = self->executor;
+    unsigned int i;
+    struct ws_worker *victim;
+
+    for(i = 1; i < this->worker_num; ++i) {
+        victim = &this->workers[(self->index + i) % this->worker_num];
+
+        if(ws_steal(&victim->deque, task) == 0 || ws_take_inject(victim, task, 0) == 0) {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief	ws_submit
+ *
+ * 把一批回调分段投递到各个工作线程的inject队列，所有队列都满时按策略处理
+ *
+ * @param	this
+ * @param	tasks
+ * @param	n
+ */
+static void ws_submit(struct timer_executor_s *this, struct timer_task *tasks, unsigned int n)
+{
+    unsigned int i = 0, tried, put, chunk = (n + this->worker_num - 1) / this->worker_num;
+    struct ws_worker *w;
+
+    while(i < n) {
+        for(tried = 0; tried < this->worker_num && i < n; ++tried) {
+            w = &this->workers[__sync_fetch_and_add(&this->next, 1) % this->worker_num];
+            pthread_mutex_lock(&w->inject_lock);
+
+            for(put = 0; put < chunk && i < n && w->inject_num < this->queue_len; ++put, ++i) {
+                w->inject[(w->inject_head + w->inject_num) % this->queue_len] = tasks[i];
+                ++w->inject_num;
+            }
+
+            pthread_mutex_unlock(&w->inject_lock);
+
+            if(put == 0) {
+                continue;
+            }
+
+            __sync_add_and_fetch(&this->pending, put);
+
+            if(this->sleepers > 0) {
+                pthread_mutex_lock(&this->lock);
+
+                if(put > 1) {
+                    pthread_cond_broadcast(&this->not_empty);
+                } else {
+                    pthread_cond_signal(&this->not_empty);
+                }
+
+                pthread_mutex_unlock(&this->lock);
+            }
+        }
+
+        if(i == n) {
+            break;
+        }
+
+        if(this->policy == TIMER_EXECUTOR_DISCARD) {
+            pthread_mutex_lock(&this->lock);
+            this->discarded += n - i;
+            pthread_mutex_unlock(&this->lock);
+            task_drop(tasks + i, n - i);
+            break;
+        } else if(this->policy == TIMER_EXECUTOR_CALLER_RUNS) {
+            for(; i < n; ++i) {
+                task_run(&tasks[i]);
+            }
+
+            break;
+        }
+
+        pthread_mutex_lock(&this->lock);
+        ++this->blocked;
+        __sync_synchronize();
+
+        ///登记之后再检查一次，避免错过工作线程的唤醒
+        for(tried = 0; tried < this->worker_num; ++tried) {
+            w = &this->workers[tried];
+            pthread_mutex_lock(&w->inject_lock);
+            put = w->inject_num < this->queue_len;
+            pthread_mutex_unlock(&w->inject_lock);
+
+            if(put) {
+                break;
+            }
+        }
+
+        if(tried == this->worker_num && this->stop_flag == 0) {
+            pthread_cond_wait(&this->not_full, &this->lock);
+        }
+
+        --this->blocked;
+
+        if(this->stop_flag) {
+            this->discarded += n - i;
+            pthread_mutex_unlock(&this->lock);
+            task_drop(tasks + i, n - i);
+            break;
+        }
+
+        pthread_mutex_unlock(&this->lock);
+    }
+}
+
+static void *ws_worker_entry(void *arg)
+{
+    struct ws_worker *self = (struct ws_worker *)arg;
+    struct timer_executor_s *this = self->executor;
+    struct timer_task task;
+    sigset_t sigmask;
+    sigfillset(&sigmask);
+    pthread_sigmask(SIG_SETMASK, &sigmask, NULL);
+
+    for(;;) {
+        if(ws_pop(&self->deque, &task) == 0 || ws_take_inject(self, &task, 1) == 0
+                || ws_steal_other(self, &task) == 0) {
+            __sync_sub_and_fetch(&this->pending, 1);
+            task_run(&task);
+            continue;
+        }
+
+        ///还有回调没有开始执行，只是暂时没有窃取到
+        if(this->pending > 0) {
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&this->lock);
+        ++this->sleepers;
+        __sync_synchronize();
+
+        while(this->pending == 0 && this->stop_flag == 0) {
+            pthread_cond_wait(&this->not_empty, &this->lock);
+        }
+
+        --this->sleepers;
+
+        ///停止时先把已经投递的回调执行完
+        if(this->pending == 0) {
+            pthread_mutex_unlock(&this->lock);
+            break;
+        }
+
+        pthread_mutex_unlock(&this->lock);
+    }
+
+    return NULL;
+}
+
+/* ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  DISPATCH ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  == = */
+
+///没有执行器时，持有参数副本的回调通过这里在分离线程中执行
+static void *task_thread_entry(void *arg)
+{
+    struct timer_task task = *(struct timer_task *)arg;
+    free(arg);
+    task_run(&task);
+    return NULL;
+}
+
+void timer_executor_flush(struct timer_dispatch_batch *batch)
+{
+    unsigned int i;
+    pthread_t id;
+    pthread_attr_t attr;
+    struct timer_task *task;
+
+    if(batch->num == 0) {
+        return;
+    }
+
+    if(batch->executor == NULL) {
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+        for(i = 0; i < batch->num; ++i) {
+            if(batch->tasks[i].own == 0) {
+                if(pthread_create(&id, &attr, batch->tasks[i].cb, batch->tasks[i].param) != 0) {
+                    perror("execute expiry func failed");
+                }
+
+                continue;
+            }
+
+            if((task = malloc(sizeof(struct timer_task))) == NULL) {
+                perror("malloc failed");
+                task_drop(&batch->tasks[i], 1);
+                continue;
+            }
+
+            *task = batch->tasks[i];
+
+            if(pthread_create(&id, &attr, task_thread_entry, task) != 0) {
+                perror("execute expiry func failed");
+                task_drop(task, 1);
+                free(task);
+            }
+        }
+
+        pthread_attr_destroy(&attr);
+    } else if(batch->executor->type == TIMER_EXECUTOR_STEALING) {
+        ws_submit(batch->executor, batch->tasks, batch->num);
+    } else {
+        shared_submit(batch->executor, batch->tasks, batch->num);
+    }
+
+    batch->num = 0;
+}
@@ -0,0 +1,91 @@
+/**
+ * @file executor.h
+ * @brief	THREAD类型定时器回调的执行器，供时间轮和最小堆内部使用
+ *
+ *	tick线程一次到期处理中产生的回调先放到批次中，处理完(或者批次满)后一次交给执行器
+ *
+ * @author tangfu - abctangfuqiang2008@163.com
+ * @version 0.1
+ * @date 2012-06-23
+ */
+
+#ifndef __EXECUTOR_H__
+#define __EXECUTOR_H__
+
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+///等待执行的回调
+struct timer_task {
+    void *(*cb)(void *);
+    void *param;
+    ///param是投递时拷贝的副本，回调执行完或者被丢弃后由执行器释放
+    int own;
+};
+
+#define TIMER_DISPATCH_BATCH	64
+
+struct timer_dispatch_batch {
+    ///为NULL时每个回调创建一个分离线程
+    TIMER_EXECUTOR *executor;
+    unsigned int num;
+    struct timer_task tasks[TIMER_DISPATCH_BATCH];
+};
+
+static inline void timer_batch_init(struct timer_dispatch_batch *batch, TIMER_EXECUTOR *executor)
+{
+    batch->executor = executor;
+    batch->num = 0;
+}
+
+static inline int timer_batch_full(struct timer_dispatch_batch *batch)
+{
+    return batch->num == TIMER_DISPATCH_BATCH;
+}
+
+/**
+ * @brief	timer_batch_add
+ *
+ * 调用者保证批次未满。回调在工作线程中执行时定时器节点可能已经被释放或复用，
+ * 所以拷贝方式的参数(len大于0)复制一份交给回调
+ *
+ * @param	batch
+ * @param	cb
+ * @param	param
+ * @param	len	param需要复制的长度，0表示直接传递param
+ *
+ * @return	复制参数时申请内存失败返回TIMER_FALSE，这次回调不会执行
+ */
+static inline TIMER_BOOL timer_batch_add(struct timer_dispatch_batch *batch, void *(*cb)(void *), const void *param, unsigned int len)
+{
+    struct timer_task *task = &batch->tasks[batch->num];
+    task->cb = cb;
+    task->own = len > 0;
+
+    if(task->own) {
+        if((task->param = malloc(len)) == NULL) {
+            perror("malloc failed");
+            return TIMER_FALSE;
+        }
+
+        memcpy(task->param, param, len);
+    } else {
+        task->param = (void *)param;
+    }
+
+    ++batch->num;
+    return TIMER_TRUE;
+}
+
+/**
+ * @brief	timer_executor_flush
+ *
+ * 把批次中的回调交给执行器并清空批次，调用者不能持有定时器管理对象的锁(执行器可能阻塞)
+ *
+ * @param	batch
+ */
+void timer_executor_flush(struct timer_dispatch_batch *batch);
+
+#endif	/* __EXECUTOR_H__ */
@@ -0,0 +1,150 @@
+/**
+ * @file mempool.h
+ * @brief	定长对象池
+ *
+ *	1.初始化时一次性申请obj_num个对象的空间，之后的分配和释放都是O(1)的空闲链表操作\n
+ *	2.未使用过的对象按顺序切分，因此大容量的对象池不会在初始化时就占用全部物理内存\n
+ *	3.对象池本身不加锁，由使用者的锁来保护\n
+ *	4.mem_pool_alloc_mt/mem_pool_free_mt用CAS维护空闲栈，可以在多个线程中不加锁地使用；
+ *	同一个对象池只能使用其中一组接口
+ *
+ * @author tangfu - abctangfuqiang2008@163.com
+ * @version 0.1
+ * @date 2012-06-09
+ */
+
+#ifndef __MEMPOOL_H__
+#define __MEMPOOL_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+
+struct mem_pool {
+    char *base;
+    ///已释放对象组成的空闲链表，链表指针保存在对象的头部
+    void *free_list;
+    size_t obj_size;
+    unsigned int obj_num;
+    ///从未分配过的对象的起始下标
+    volatile unsigned int next_unused;
+    ///多线程接口的空闲栈：高32位是每次修改加1的版本号，低32位是栈顶对象下标加1，0表示空
+    volatile uint64_t free_top;
+};
+
+/**
+ * @brief	mem_pool_init
+ *
+ * @param	pool
+ * @param	obj_size	对象大小
+ * @param	obj_num		对象个数
+ *
+ * @return	成功返回0，失败返回-1
+ */
+static inline int mem_pool_init(struct mem_pool *pool, size_t obj_size, unsigned int obj_num)
+{
+    if(obj_size < sizeof(void *)) {
+        obj_size = sizeof(void *);
+    }
+
+    ///保证每个对象都按指针大小对齐
+    obj_size = (obj_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    pool->base = malloc(obj_size * obj_num);
+
+    if(pool->base == NULL) {
+        return -1;
+    }
+
+    pool->free_list = NULL;
+    pool->obj_size = obj_size;
+    pool->obj_num = obj_num;
+    pool->next_unused = 0;
+    pool->free_top = 0;
+    return 0;
+}
+
+static inline void mem_pool_destroy(struct mem_pool *pool)
+{
+    free(pool->base);
+    pool->base = NULL;
+    pool->free_list = NULL;
+    pool->obj_num = 0;
+    pool->next_unused = 0;
+    pool->free_top = 0;
+}
+
+/**
+ * @brief	mem_pool_alloc
+ *
+ * @param	pool
+ *
+ * @return	对象指针，对象池用完时返回NULL
+ */
+static inline void *mem_pool_alloc(struct mem_pool *pool)
+{
+    void *obj = pool->free_list;
+
+    if(obj != NULL) {
+        pool->free_list = *(void **)obj;
+        return obj;
+    }
+
+    if(pool->next_unused < pool->obj_num) {
+        return pool->base + pool->obj_size * pool->next_unused++;
+    }
+
+    return NULL;
+}
+
+static inline void mem_pool_free(struct mem_pool *pool, void *obj)
+{
+    *(void **)obj = pool->free_list;
+    pool->free_list = obj;
+}
+
+/**
+ * @brief	mem_pool_alloc_mt
+ *
+ * 多线程版本的mem_pool_alloc，空闲对象的头部保存栈中下一个对象的下标加1
+ *
+ * @param	pool
+ *
+ * @note
+ *	读取栈顶对象头部时它可能已经被其他线程取走并改写，但此时栈顶的版本号已经变化，CAS会失败后重试
+ *
+ * @return	对象指针，对象池用完时返回NULL
+ */
+static inline void *mem_pool_alloc_mt(struct mem_pool *pool)
+{
+    uint64_t top;
+    unsigned int i;
+    char *obj;
+
+    while((i = (uint32_t)(top = pool->free_top)) != 0) {
+        obj = pool->base + pool->obj_size * (i - 1);
+
+        if(__sync_bool_compare_and_swap(&pool->free_top, top, (((top >> 32) + 1) << 32) | *(volatile uint32_t *)obj)) {
+            return obj;
+        }
+    }
+
+    while((i = pool->next_unused) < pool->obj_num) {
+        if(__sync_bool_compare_and_swap(&pool->next_unused, i, i + 1)) {
+            return pool->base + pool->obj_size * i;
+        }
+    }
+
+    return NULL;
+}
+
+static inline void mem_pool_free_mt(struct mem_pool *pool, void *obj)
+{
+    uint32_t i = (uint32_t)(((char *)obj - pool->base) / pool->obj_size) + 1;
+    uint64_t top;
+
+    do {
+        top = pool->free_top;
+        *(volatile uint32_t *)obj = (uint32_t)top;
+    } while(!__sync_bool_compare_and_swap(&pool->free_top, top, (((top >> 32) + 1) << 32) | i));
+}
+
+#endif	/* __MEMPOOL_H__ */
@@ -1,6 +1,12 @@
 #include "timer.h"
 #include "atomic.h"
 #include "list.h"
+#include "mempool.h"
+#include "executor.h"
+#include "clock.h"
+#include "stats.h"
+#include "trace.h"
+#include "snapshot.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
@@ -9,12 +15,16 @@
 #include <sys/timerfd.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <string.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdint.h>
 /* #include <math.h> */
 
+#define NSEC_PER_SEC	1000000000ULL
+#define NSEC_PER_MSEC	1000000ULL
+
 
 
 ///定时器结构
@@ -25,53 +35,116 @@ struct mh_timer_internal {
     void*(*cb)(void *);
     void *param;
     int param_len;
-    //timer_id id;
+    unsigned int interval_ns;
+    timer_param_mode param_mode;
+    unsigned int slack;
+    timer_id id;
+    int index;			///在堆中的位置，-1表示不在堆中
     unsigned int round;	///定时器维护圈数
+    ///堆中按expiretime排序，它是nominal按slack对齐之后的值
     struct timespec expiretime;
+    ///没有加上slack的到期时间，循环定时器从它开始计算下一次到期时间，不会累积slack
+    struct timespec nominal;
     //struct list_head list;
+    ///短param直接保存在节点内部
+    uint64_t param_buf[TIMER_INLINE_PARAM_SIZE / sizeof(uint64_t)];
 };
 
 
 
 
+///定时器的间隔，单位纳秒
+#define interval_ns(t)	((uint64_t)(t)->interval * NSEC_PER_MSEC + (t)->interval_ns)
+
 ///定时器管理单元的最原始结构
 struct mh_timer_s_internal {
     TIMER_BOOL(*init)(MH_TIMER_MANAGER *this, int max_size);
-    TIMER_BOOL(*push)(MH_TIMER_MANAGER *this, struct timer *timer);
+    timer_id(*push)(MH_TIMER_MANAGER *this, struct timer *timer);
+    TIMER_BOOL(*del)(MH_TIMER_MANAGER *this, timer_id id);
+    TIMER_BOOL(*mod)(MH_TIMER_MANAGER *this, timer_id id, unsigned int interval);
     void (*enable)(MH_TIMER_MANAGER *this);
     void (*disable)(MH_TIMER_MANAGER *this);
-    //TIMER_BOOL( *pop )( MH_TIMER_MANAGER *this );
-    //TIMER_BOOL (*reset) (MH_TIMER_MANAGER *this, timer_id id);
     void (*start)(MH_TIMER_MANAGER *this, timer_start_type type);
     void (*stop)(MH_TIMER_MANAGER *this);
     void (*close)(MH_TIMER_MANAGER *this);
-
+    void (*set_executor)(MH_TIMER_MANAGER *this, TIMER_EXECUTOR *executor);
+    int (*get_fd)(MH_TIMER_MANAGER *this);
+    unsigned int (*process_expired)(MH_TIMER_MANAGER *this, const struct timespec *now);
+    void (*get_overrun)(MH_TIMER_MANAGER *this, struct timer_overrun *overrun);
+    TIMER_BOOL(*init_conf)(MH_TIMER_MANAGER *this, struct mh_timer_manager_conf *conf);
+    unsigned int (*push_batch)(MH_TIMER_MANAGER *this, struct timer *timers, unsigned int n, timer_id *ids);
+    unsigned int (*del_batch)(MH_TIMER_MANAGER *this, const timer_id *ids, unsigned int n);
+    void (*get_stats)(MH_TIMER_MANAGER *this, struct timer_stats *stats);
+    TIMER_BOOL(*set_trace)(MH_TIMER_MANAGER *this, unsigned int events);
+    TIMER_BOOL(*dump_trace)(MH_TIMER_MANAGER *this, const char *path);
+    TIMER_BOOL(*snapshot)(MH_TIMER_MANAGER *this, const char *path);
+    TIMER_BOOL(*restore)(MH_TIMER_MANAGER *this, const char *path);
 
     ///支持的最大定时器数量
     int max_timer_num;
     int cur_timer_num;
 
     struct mh_timer_internal **queue;
+    ///mh_timer_internal节点的对象池
+    struct mem_pool pool;
+    ///以id为下标的定时器表，timer_id从1开始
+    struct mh_timer_internal **timers;
+    ///空闲id的环形队列，先释放的id先被复用，尽量推迟id的复用
+    timer_id *free_ids;
+    int free_head;
+    int free_num;
+    ///正在执行回调的定时器，回调期间被删除时置为NULL
+    struct mh_timer_internal *running;
+    ///回调期间被mod过，回调结束后按新的到期时间放回堆中
+    int running_rearm;
+    ///THREAD类型回调的执行器
+    TIMER_EXECUTOR *executor;
+    ///循环定时器错过周期的统计
+    struct timer_overrun overrun;
+    ///操作计数、到期延迟和回调耗时的统计
+    struct timer_stats_internal stats;
+    ///生命周期事件的跟踪环，销毁时释放
+    struct timer_trace trace;
 
     volatile pthread_t pid;
     atomic_t init_flag;
     volatile int start_flag;
+    timer_start_type start_type;
     int enable_flag;		//阻止push操作
     pthread_rwlock_t lock;
     pthread_mutex_t mh_lock;
 
     int timerfd;
-
+    ///timerfd和定时器线程使用的时钟
+    clockid_t clock_id;
+    ///push/mod计算到期时间使用的时钟，只有选择了粗粒度时钟时与clock_id不同
+    clockid_t fast_clock_id;
 };
 
 
+static inline void timespec_add_ns(struct timespec *ts, uint64_t ns);
+static inline void mh_timer_set_expire(struct mh_timer_internal *timer, struct timespec *from);
 static TIMER_BOOL ti_init(MH_TIMER_MANAGER *this, int max_size);
-static TIMER_BOOL ti_push(MH_TIMER_MANAGER *this, struct timer *timer);
+static TIMER_BOOL ti_init_conf(MH_TIMER_MANAGER *this, struct mh_timer_manager_conf *conf);
+static timer_id ti_push(MH_TIMER_MANAGER *this, struct timer *timer);
+static TIMER_BOOL ti_del(MH_TIMER_MANAGER *this, timer_id id);
+static TIMER_BOOL ti_mod(MH_TIMER_MANAGER *this, timer_id id, unsigned int interval);
 static void ti_stop(MH_TIMER_MANAGER *this);
 static void ti_start(MH_TIMER_MANAGER *this, timer_start_type type);
 static void ti_close(MH_TIMER_MANAGER *this);
 static void ti_enable(MH_TIMER_MANAGER *this);
 static void ti_disable(MH_TIMER_MANAGER *this);
+static void ti_set_executor(MH_TIMER_MANAGER *this, TIMER_EXECUTOR *executor);
+static int ti_get_fd(MH_TIMER_MANAGER *this);
+static unsigned int ti_process_expired(MH_TIMER_MANAGER *this, const struct timespec *now);
+static void ti_get_overrun(MH_TIMER_MANAGER *this, struct timer_overrun *overrun);
+static unsigned int ti_push_batch(MH_TIMER_MANAGER *this, struct timer *timers, unsigned int n, timer_id *ids);
+static unsigned int ti_del_batch(MH_TIMER_MANAGER *this, const timer_id *ids, unsigned int n);
+static void ti_get_stats(MH_TIMER_MANAGER *this, struct timer_stats *stats);
+static TIMER_BOOL ti_set_trace(MH_TIMER_MANAGER *this, unsigned int events);
+static TIMER_BOOL ti_dump_trace(MH_TIMER_MANAGER *this, const char *path);
+static TIMER_BOOL ti_snapshot(MH_TIMER_MANAGER *this, const char *path);
+static TIMER_BOOL ti_restore(MH_TIMER_MANAGER *this, const char *path);
 MH_TIMER_MANAGER *create_mh_timer_manager_();
 void destroy_mh_timer_manager(MH_TIMER_MANAGER *);
 static void catch_signal(int i);
@@ -79,7 +152,23 @@ static void *entry(void *p);
 
 /* ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  == */
 
-static TIMER_BOOL repush(struct mh_timer_s_internal *this, struct mh_timer_internal *timer);
+static TIMER_BOOL repush(struct mh_timer_s_internal *this, struct mh_timer_internal *timer, struct timespec *now);
+static void heap_sift_up(struct mh_timer_s_internal *this, int s, struct mh_timer_internal *timer);
+static void heap_sift_down(struct mh_timer_s_internal *this, int s, struct mh_timer_internal *timer);
+static struct mh_timer_internal *heap_pop(struct mh_timer_s_internal *this);
+static void heap_remove(struct mh_timer_s_internal *this, int s);
+static void heap_adjust(struct mh_timer_s_internal *this, int s, struct mh_timer_internal *timer);
+static void heap_build(struct mh_timer_s_internal *this);
+static int mh_timer_remove(struct mh_timer_s_internal *this, struct mh_timer_internal *timer);
+static inline timer_id mh_timer_id_pop(struct mh_timer_s_internal *this);
+static inline void mh_timer_id_push(struct mh_timer_s_internal *this, timer_id id);
+static inline struct mh_timer_internal *mh_timer_lookup(struct mh_timer_s_internal *this, timer_id id);
+static inline void mh_timer_free(struct mh_timer_s_internal *this, struct mh_timer_internal *timer);
+static inline TIMER_BOOL mh_timer_param_init(struct mh_timer_internal *t, struct timer *timer);
+static TIMER_BOOL free_all_timers(struct mh_timer_s_internal *this);
+static void heap_arm(struct mh_timer_s_internal *this);
+static void heap_wakeup(struct mh_timer_s_internal *this);
+static unsigned int heap_expire(struct mh_timer_s_internal *this, struct timespec *now);
 
 
 /**
@@ -101,11 +190,25 @@ MH_TIMER_MANAGER *create_mh_timer_manager()
     memset(p, 0, sizeof(struct mh_timer_s_internal));
     p->init = ti_init;
     p->push = ti_push;
+    p->del = ti_del;
+    p->mod = ti_mod;
     p->enable = ti_enable;
     p->disable = ti_disable;
     p->stop = ti_stop;
     p->start = ti_start;
     p->close = ti_close;
+    p->set_executor = ti_set_executor;
+    p->get_fd = ti_get_fd;
+    p->process_expired = ti_process_expired;
+    p->get_overrun = ti_get_overrun;
+    p->init_conf = ti_init_conf;
+    p->push_batch = ti_push_batch;
+    p->del_batch = ti_del_batch;
+    p->get_stats = ti_get_stats;
+    p->set_trace = ti_set_trace;
+    p->dump_trace = ti_dump_trace;
+    p->snapshot = ti_snapshot;
+    p->restore = ti_restore;
     pthread_rwlockattr_t attr;
     pthread_rwlockattr_init(&attr);
     pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
@@ -130,6 +233,7 @@ void destroy_mh_timer_manager(MH_TIMER_MANAGER *this)
     p->close(this);
     pthread_mutex_destroy(&p->mh_lock);
     pthread_rwlock_destroy(&p->lock);
+    timer_trace_free(&p->trace);
     free((void *)this);
 }
 
@@ -146,11 +250,28 @@ void destroy_mh_timer_manager(MH_TIMER_MANAGER *this)
  */
 static TIMER_BOOL ti_init(MH_TIMER_MANAGER *this, int max_size)
 {
-    if(this  ==  NULL) {
+    struct mh_timer_manager_conf conf = {max_size, TIMER_CLOCK_MONOTONIC};
+    return ti_init_conf(this, &conf);
+}
+
+/**
+ * @brief	init_conf
+ *
+ * 按配置初始化最小堆定时器
+ *
+ * @param	this
+ * @param	conf
+ *
+ * @return
+ */
+static TIMER_BOOL ti_init_conf(MH_TIMER_MANAGER *this, struct mh_timer_manager_conf *conf)
+{
+    if(this  ==  NULL || conf == NULL || !check_clock_type(conf->clock_type)) {
         return TIMER_FALSE;
     }
 
     struct mh_timer_s_internal *p = (struct mh_timer_s_internal *)this;
+    int max_size = conf->max_size;
     pthread_rwlock_wrlock(&p->lock);
 
     ///已经初始化了
@@ -160,7 +281,11 @@ static TIMER_BOOL ti_init(MH_TIMER_MANAGER *this, int max_size)
         return TIMER_FALSE;
     }
 
-    if((p->timerfd = timerfd_create(CLOCK_REALTIME, 0)) == -1) {
+    p->clock_id = timer_clock_id(conf->clock_type);
+    ///到期时间精确到纳秒，只有明确选择粗粒度时钟时才使用
+    p->fast_clock_id = timer_fast_clock_id(conf->clock_type, 0);
+
+    if((p->timerfd = timerfd_create(p->clock_id, 0)) == -1) {
         perror("create timerfd failed");
         pthread_rwlock_unlock(&p->lock);
         return TIMER_FALSE;
@@ -184,6 +309,35 @@ static TIMER_BOOL ti_init(MH_TIMER_MANAGER *this, int max_size)
         memset(p->queue, 0, sizeof(void *) *(p->max_timer_num));
     }
 
+    p->timers = (struct mh_timer_internal **)malloc(sizeof(void *) * (p->max_timer_num + 1));
+    p->free_ids = (timer_id *)malloc(sizeof(timer_id) * p->max_timer_num);
+
+    if(p->timers == NULL || p->free_ids == NULL
+            || mem_pool_init(&p->pool, sizeof(struct mh_timer_internal), p->max_timer_num) == -1) {
+        perror("malloc failed");
+        free(p->timers);
+        free(p->free_ids);
+        free(p->queue);
+        p->timers = NULL;
+        p->free_ids = NULL;
+        p->queue = NULL;
+        pthread_rwlock_unlock(&p->lock);
+        return TIMER_FALSE;
+    } else {
+        memset(p->timers, 0, sizeof(void *) * (p->max_timer_num + 1));
+
+        for(p->free_num = 0; p->free_num < p->max_timer_num; ++p->free_num) {
+            p->free_ids[p->free_num] = p->free_num + 1;
+        }
+
+        p->free_head = 0;
+    }
+
+    p->running = NULL;
+    p->running_rearm = 0;
+    memset(&p->overrun, 0, sizeof(struct timer_overrun));
+    memset(&p->stats, 0, sizeof(struct timer_stats_internal));
+
     atomic_set(&p->init_flag,  1);
     p->enable_flag = 1;
     pthread_rwlock_unlock(&p->lock);
@@ -206,442 +360,898 @@ static TIMER_BOOL ti_init(MH_TIMER_MANAGER *this, int max_size)
  *
  * 始终保持最小的interval总是位于链表最前面
  *
- * @return	库的布尔值
+ * @return	定时器的id，可以用于del和mod，失败返回0
  */
-static TIMER_BOOL ti_push(MH_TIMER_MANAGER *this, struct timer *timer)
+static timer_id ti_push(MH_TIMER_MANAGER *this, struct timer *timer)
 {
     if(this  ==  NULL) {
-        return TIMER_FALSE;
+        return 0;
     }
 
-    int s, parent;
     struct mh_timer_s_internal *p = (struct mh_timer_s_internal *)this;
-    struct mh_timer_internal *temp;
+    timer_id id;
     pthread_rwlock_rdlock(&p->lock);
 
     if(atomic_read(&p->init_flag)  ==  0) {
         fprintf(stderr, "TIMER Manager has not been init yet\n");
         pthread_rwlock_unlock(&p->lock);
-        return TIMER_FALSE;
+        return 0;
     }
 
     if(p->enable_flag == 0) {
-        fprintf(stderr, "TIMER Manager has not been disable\n");
+        fprintf(stderr, "TIMER Manager has been disable\n");
         pthread_rwlock_unlock(&p->lock);
-        return TIMER_TRUE;
+        return 0;
     }
 
-    if(timer->interval <= 0) {
+    if(timer->interval == 0 && timer->interval_ns == 0) {
         fprintf(stderr, "timer is illegal \n");
         pthread_rwlock_unlock(&p->lock);
-        return TIMER_FALSE;
+        return 0;
     }
 
-    struct mh_timer_internal *t = malloc(sizeof(struct mh_timer_internal));
-
-    if(t  ==  NULL) {
-        perror("malloc failed");
-        pthread_rwlock_unlock(&p->lock);
-        return TIMER_FALSE;
-    } else {
-        *(struct timer *)t = *timer;
-        t->param = malloc(t->param_len);
+    struct mh_timer_internal *t;
+    struct timespec expiretime;
+    void *param = NULL;
 
-        if(t->param == NULL) {
+    ///只有超过节点内部空间的param才需要在锁外单独申请内存
+    if(timer->param_mode == TIMER_PARAM_COPY && timer->param_len > TIMER_INLINE_PARAM_SIZE) {
+        if((param = malloc(timer->param_len)) == NULL) {
             perror("malloc failed\n");
             pthread_rwlock_unlock(&p->lock);
-            free(t);
-            return TIMER_FALSE;
+            return 0;
         }
 
-        memcpy(t->param, timer->param, t->param_len);
-
-        if(clock_gettime(CLOCK_REALTIME, &t->expiretime) == -1) {
-            perror("push timer: get time failed");
-            pthread_rwlock_unlock(&p->lock);
-            free(t);
-            return TIMER_FALSE;
-        } else {
-            t->expiretime.tv_sec += timer->interval;
-        }
+        memcpy(param, timer->param, timer->param_len);
+    }
 
-        //t->round = t->interval;
+    if(clock_gettime(p->fast_clock_id, &expiretime) == -1) {
+        perror("push timer: get time failed");
+        pthread_rwlock_unlock(&p->lock);
+        free(param);
+        return 0;
     }
 
     pthread_mutex_lock(&p->mh_lock);
 
-    if(p->cur_timer_num  >= p->max_timer_num) {
+    ///正在执行回调的定时器也占用id，因此以空闲id的个数为准
+    if(p->free_num == 0 || (t = mem_pool_alloc(&p->pool)) == NULL) {
         fprintf(stderr, "ACHIEVE TIMER MAX NUMBER\n");
         pthread_mutex_unlock(&p->mh_lock);
         pthread_rwlock_unlock(&p->lock);
-        return TIMER_FALSE;
+        free(param);
+        return 0;
     }
 
-    s = p->cur_timer_num++;
+    *(struct timer *)t = *timer;
 
-    while(s > 0) {
-        parent = (s - 1) / 2;
-        temp = p->queue[parent];
-
-        /*
-                        if( p->queue[parent]->round < t->round ) {
-                                break;
-                        }
-        */
-        if(less(temp->expiretime, t->expiretime)) {
-            //if( (temp->expiretime.tv_sec < t->expiretime.tv_sec) || ((temp->expiretime.tv_sec == t->expiretime.tv_sec) && (temp->expiretime.tv_nsec < t->expiretime.tv_nsec) )) {
-            break;
-        }
+    if(timer->param_mode == TIMER_PARAM_REF) {
+        t->param = timer->param;
+    } else if(timer->param_len <= 0) {
+        t->param = NULL;
+    } else if(param == NULL) {
+        t->param = t->param_buf;
+        memcpy(t->param, timer->param, timer->param_len);
+    } else {
+        t->param = param;
+    }
 
-        p->queue[s] = temp;
-        s = parent;
+    mh_timer_set_expire(t, &expiretime);
+    id = mh_timer_id_pop(p);
+    t->id = id;
+    p->timers[id] = t;
+    heap_sift_up(p, p->cur_timer_num++, t);
+    timer_trace_record(&p->trace, TIMER_TRACE_ADD, id, timer->interval);
+
+    ///新的定时器成为堆顶，需要提前唤醒定时器线程
+    if(p->queue[0] == t && p->start_flag) {
+        heap_arm(p);
     }
 
-    p->queue[s] = t;
     pthread_mutex_unlock(&p->mh_lock);
     pthread_rwlock_unlock(&p->lock);
-    return TIMER_TRUE;
+    timer_stat_add(p->stats.adds, 1);
+    return id;
 }
 
 
 /**
- * @brief	repush
+ * @brief	del
  *
- * 专门针对repeat timer的一个push重定义版本
+ * 删除定时器
  *
- * @param	this		定时器内部管理对象指针
- * @param	timer		定时器内部结构指针
+ * @param	this		定时器管理对象
+ * @param	id			push返回的定时器标志
  *
- * @return
+ * @note
+ *		id为0表示删除所有定时器
+ *
+ * @return		库布尔值
  */
-static TIMER_BOOL repush(struct mh_timer_s_internal *this, struct mh_timer_internal *timer)   //只会被调用，在被调用处会加锁
+static TIMER_BOOL ti_del(MH_TIMER_MANAGER *this, timer_id id)
 {
     if(this  ==  NULL) {
         return TIMER_FALSE;
     }
 
-    //pthread_rwlock_rdlock( &this->lock );
-    struct mh_timer_internal *temp;
+    TIMER_BOOL ret;
+    struct mh_timer_s_internal *p = (struct mh_timer_s_internal *)this;
+    struct mh_timer_internal *t;
+    pthread_rwlock_rdlock(&p->lock);
 
-    if(this->start_flag == 0) {
+    if(atomic_read(&p->init_flag)  ==  0) {
+        pthread_rwlock_unlock(&p->lock);
         return TIMER_FALSE;
     }
 
-    int s, parent ;
-    s = this->cur_timer_num++;
+    pthread_mutex_lock(&p->mh_lock);
+
+    if(id == 0) {
+        ret = free_all_timers(p);
+        timer_trace_record(&p->trace, TIMER_TRACE_DEL, 0, 0);
 
-    if(clock_gettime(CLOCK_REALTIME, &timer->expiretime) == -1) {
-        perror("push timer: get time failed");
+        if(p->start_flag) {
+            heap_arm(p);
+        }
+
+        pthread_mutex_unlock(&p->mh_lock);
+        pthread_rwlock_unlock(&p->lock);
+        return ret;
+    }
+
+    if((t = mh_timer_lookup(p, id)) == NULL) {
+        pthread_mutex_unlock(&p->mh_lock);
+        pthread_rwlock_unlock(&p->lock);
         return TIMER_FALSE;
-    } else {
-        timer->expiretime.tv_sec += timer->interval;
     }
 
-    while(s > 0) {
-        parent = (s - 1) / 2;
-        /*
-                        if( this->queue[parent]->round < timer->round ) {
-                                break;
-                        }
-        */
-        temp = this->queue[parent];
+    if(mh_timer_remove(p, t) && p->start_flag) {
+        heap_arm(p);
+    }
 
-        if(less(temp->expiretime, timer->expiretime)) {
-            //if( (temp->expiretime.tv_sec < timer->expiretime.tv_sec) || ((temp->expiretime.tv_sec == timer->expiretime.tv_sec) && (temp->expiretime.tv_nsec < timer->expiretime.tv_nsec) )) {
-            break;
-        }
+    timer_trace_record(&p->trace, TIMER_TRACE_DEL, id, 0);
 
-        this->queue[s] = this->queue[parent];
-        s = parent;
+    pthread_mutex_unlock(&p->mh_lock);
+    pthread_rwlock_unlock(&p->lock);
+    timer_stat_add(p->stats.dels, 1);
+    return TIMER_TRUE;
+}
+
+/**
+ * @brief	mh_timer_remove
+ *
+ * 释放定时器的id并从堆中删除，调用者持有mh_lock
+ *
+ * @param	this
+ * @param	timer
+ *
+ * @return	删除的是堆顶时返回1，需要重新设置timerfd
+ */
+static int mh_timer_remove(struct mh_timer_s_internal *this, struct mh_timer_internal *timer)
+{
+    int s;
+    this->timers[timer->id] = NULL;
+    mh_timer_id_push(this, timer->id);
+
+    ///回调正在执行的定时器由定时器线程在回调结束后释放
+    if(timer == this->running) {
+        this->running = NULL;
+        return 0;
     }
 
-    this->queue[s] = timer;
-    return TIMER_TRUE;
+    s = timer->index;
+    heap_remove(this, s);
+    mh_timer_free(this, timer);
+    return s == 0;
 }
+
 /**
- * @brief	pop
+ * @brief	push_batch
  *
- * 删除定时器
+ * 批量添加定时器，整个批次只获取一次锁、只读取一次时间
  *
- * @param	p		定时器管理对象
+ * @param	this		定时器管理对象指针
+ * @param	timers		定时器数组
+ * @param	n			定时器个数
+ * @param	ids			输出每个定时器的id，添加失败的为0，可以为NULL
  *
  * @note
+ *	新增的定时器不少于堆中原有的定时器时，先放到堆尾再整体建堆(O(n + m))，否则逐个上浮(O(m log n))
  *
- * @return		库布尔值
+ * @return	添加成功的个数
  */
-static TIMER_BOOL ti_pop(struct mh_timer_s_internal *p)		//只会被调用，在被调用处会加锁
+static unsigned int ti_push_batch(MH_TIMER_MANAGER *this, struct timer *timers, unsigned int n, timer_id *ids)
 {
-    if(p  ==  NULL) {
-        return TIMER_FALSE;
+    if(this  ==  NULL || timers == NULL) {
+        return 0;
     }
 
-    int s, i = 0, half, child, right;
-    struct mh_timer_internal *temp;
-    //pthread_rwlock_rdlock( &p->lock );
-    //pthread_mutex_lock(&p->mh_lock);
+    struct mh_timer_s_internal *p = (struct mh_timer_s_internal *)this;
+    struct mh_timer_internal *t, *top;
+    struct timer *timer;
+    struct timespec now;
+    unsigned int i, num = 0;
+    int base, heapify;
+
+    if(ids != NULL) {
+        memset(ids, 0, sizeof(timer_id) * n);
+    }
 
-    if(p->start_flag == 0) {
-        return TIMER_FALSE;
+    pthread_rwlock_rdlock(&p->lock);
+
+    if(atomic_read(&p->init_flag)  ==  0) {
+        fprintf(stderr, "TIMER Manager has not been init yet\n");
+        pthread_rwlock_unlock(&p->lock);
+        return 0;
     }
 
-    /*
-    if(p->cur_timer_num <= 0) {
-    	return TIMER_FALSE;
-    }*/
-    s = --p->cur_timer_num;
-    half = s / 2;
+    if(p->enable_flag == 0) {
+        fprintf(stderr, "TIMER Manager has been disable\n");
+        pthread_rwlock_unlock(&p->lock);
+        return 0;
+    }
 
-    while(i < half) {
-        child = 2 * i + 1;
-        right = child + 1;
-        /*
-                        if( right < s && p->queue[child]->round > p->queue[right]->round ) {
-                                child = right;
-                        }
+    if(clock_gettime(p->fast_clock_id, &now) == -1) {
+        perror("push timer: get time failed");
+        pthread_rwlock_unlock(&p->lock);
+        return 0;
+    }
 
-                        if( p->queue[s]->round < p->queue[child]->round ) {
-                                break;
-                        }
+    pthread_mutex_lock(&p->mh_lock);
+    base = p->cur_timer_num;
+    top = base > 0 ? p->queue[0] : NULL;
+    heapify = n >= (unsigned int)base;
 
-                        p->queue[i]->round = p->queue[child]->round;
-        */
-        temp = p->queue[child];
+    for(i = 0; i < n; ++i) {
+        timer = &timers[i];
 
-        if(right < s && great(temp->expiretime, p->queue[right]->expiretime)) {
-            child = right;
+        if(timer->interval == 0 && timer->interval_ns == 0) {
+            fprintf(stderr, "timer is illegal \n");
+            continue;
         }
 
-        if(less(p->queue[s]->expiretime , temp->expiretime)) {
+        if(p->free_num == 0 || (t = mem_pool_alloc(&p->pool)) == NULL) {
+            fprintf(stderr, "ACHIEVE TIMER MAX NUMBER\n");
             break;
         }
 
-        p->queue[i]->expiretime = p->queue[child]->expiretime;
-        i = child;
+        *(struct timer *)t = *timer;
+
+        if(mh_timer_param_init(t, timer) == TIMER_FALSE) {
+            perror("malloc failed\n");
+            mem_pool_free(&p->pool, t);
+            continue;
+        }
+
+        mh_timer_set_expire(t, &now);
+        t->id = mh_timer_id_pop(p);
+        p->timers[t->id] = t;
+
+        if(heapify) {
+            t->index = p->cur_timer_num;
+            p->queue[p->cur_timer_num++] = t;
+        } else {
+            heap_sift_up(p, p->cur_timer_num++, t);
+        }
+
+        if(ids != NULL) {
+            ids[i] = t->id;
+        }
+
+        timer_trace_record(&p->trace, TIMER_TRACE_ADD, t->id, t->interval);
+        ++num;
     }
 
-    p->queue[i] = p->queue[s];
-    p->queue[s] = NULL;
-    //pthread_mutex_unlock(&p->mh_lock);
-    //pthread_rwlock_unlock( &p->lock );
-    return TIMER_TRUE;
-}
+    if(heapify && num > 0) {
+        heap_build(p);
+    }
 
+    if(p->cur_timer_num > 0 && p->queue[0] != top && p->start_flag) {
+        heap_arm(p);
+    }
+
+    pthread_mutex_unlock(&p->mh_lock);
+    pthread_rwlock_unlock(&p->lock);
+    timer_stat_add(p->stats.adds, num);
+    return num;
+}
 
 /**
- * @brief	stop
+ * @brief	del_batch
  *
- * 停止定时器
+ * 批量删除定时器，整个批次只获取一次锁，堆顶被删除时只重设一次timerfd
  *
- * @param	this	定时器管理对象指针
+ * @param	this		定时器管理对象
+ * @param	ids			push返回的定时器标志数组，为0的项被忽略
+ * @param	n			个数
+ *
+ * @return	删除成功的个数
  */
-static void ti_stop(MH_TIMER_MANAGER *this)
+static unsigned int ti_del_batch(MH_TIMER_MANAGER *this, const timer_id *ids, unsigned int n)
 {
-    if(this  ==  NULL) {
-        return;
+    if(this  ==  NULL || ids == NULL) {
+        return 0;
     }
 
     struct mh_timer_s_internal *p = (struct mh_timer_s_internal *)this;
-    ///如果定时器并没有开始，直接结束
+    struct mh_timer_internal *t;
+    unsigned int i, num = 0;
+    int rearm = 0;
     pthread_rwlock_rdlock(&p->lock);
 
-    if(p->start_flag == 0) {
+    if(atomic_read(&p->init_flag)  ==  0) {
         pthread_rwlock_unlock(&p->lock);
-        return ;
+        return 0;
     }
 
-    p->start_flag = 0 ;
-    sleep(1);
+    pthread_mutex_lock(&p->mh_lock);
 
-    if(p->pid != 0) {
-        pthread_kill(p->pid, MH_TIMER_STOP_SIGNAL);
-        p->pid = 0;
+    for(i = 0; i < n; ++i) {
+        if(ids[i] != 0 && (t = mh_timer_lookup(p, ids[i])) != NULL) {
+            rearm |= mh_timer_remove(p, t);
+            timer_trace_record(&p->trace, TIMER_TRACE_DEL, ids[i], 0);
+            ++num;
+        }
+    }
+
+    if(rearm && p->start_flag) {
+        heap_arm(p);
     }
 
+    pthread_mutex_unlock(&p->mh_lock);
     pthread_rwlock_unlock(&p->lock);
+    timer_stat_add(p->stats.dels, num);
+    return num;
 }
 
 
 /**
- * @brief	start
+ * @brief	mod
  *
- * 以两种方式来开启定时器
+ * 重新设置定时器的到期时间为当前时间加上interval
  *
- * @param	this		定时器管理对象指针
- * @param	type		开启方式
+ * @param	this		定时器管理对象
+ * @param	id			push返回的定时器标志
+ * @param	interval	新的间隔(毫秒)，为0表示沿用原来的间隔
+ *
+ * @note
+ *		设置了新的间隔时interval_ns清零；定时器在堆中原地上浮或下沉，复杂度O(log n)
+ *
+ * @return		库布尔值
  */
-static void ti_start(MH_TIMER_MANAGER *this, timer_start_type type)
+static TIMER_BOOL ti_mod(MH_TIMER_MANAGER *this, timer_id id, unsigned int interval)
 {
     if(this  ==  NULL) {
-        return;
+        return TIMER_FALSE;
     }
 
+    int s;
+    struct timespec now;
     struct mh_timer_s_internal *p = (struct mh_timer_s_internal *)this;
-    pthread_rwlock_wrlock(&p->lock);
+    struct mh_timer_internal *t;
 
-    if(p->start_flag  == 1) {
-        pthread_rwlock_unlock(&p->lock);
-        return;
-    } else {
-        p->start_flag = 1 ;
+    if(clock_gettime(p->fast_clock_id, &now) == -1) {
+        perror("mod timer: get time failed");
+        return TIMER_FALSE;
     }
 
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
+    pthread_rwlock_rdlock(&p->lock);
 
-    switch(type) {
-        case TIMER_START_UNBLOCK:
-            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if(atomic_read(&p->init_flag)  ==  0) {
+        pthread_rwlock_unlock(&p->lock);
+        return TIMER_FALSE;
+    }
 
-            if(pthread_create((pthread_t *)(&p->pid), &attr, entry, (void *)p) != 0) {
-                p->start_flag = 0 ;
-                p->pid = 0;
-                pthread_rwlock_unlock(&p->lock);
-                return;
-            }
+    pthread_mutex_lock(&p->mh_lock);
 
-            pthread_rwlock_unlock(&p->lock);
-            break;
-        case TIMER_START_BLOCK:
+    if((t = mh_timer_lookup(p, id)) == NULL) {
+        pthread_mutex_unlock(&p->mh_lock);
+        pthread_rwlock_unlock(&p->lock);
+        return TIMER_FALSE;
+    }
 
-            if(pthread_create((pthread_t *)(&p->pid), NULL, entry, (void *)p) != 0) {
-                p->start_flag = 0 ;
-                p->pid = 0;
-                pthread_rwlock_unlock(&p->lock);
-                return;
-            }
+    if(interval != 0) {
+        t->interval = interval;
+        t->interval_ns = 0;
+    }
 
-            pthread_rwlock_unlock(&p->lock);
+    mh_timer_set_expire(t, &now);
 
-            if(pthread_join(p->pid, NULL) != 0) {
-                perror("block failed");
-            }
+    if(t == p->running) {
+        p->running_rearm = 1;
+    } else {
+        s = t->index;
+        heap_adjust(p, s, t);
 
-            break;
-        default:
-            break;
+        if((s == 0 || t->index == 0) && p->start_flag) {
+            heap_arm(p);
+        }
     }
+
+    timer_trace_record(&p->trace, TIMER_TRACE_MOD, id, interval);
+    pthread_mutex_unlock(&p->mh_lock);
+    pthread_rwlock_unlock(&p->lock);
+    timer_stat_add(p->stats.mods, 1);
+    return TIMER_TRUE;
 }
 
+
 /**
- * @brief	entry
+ * @brief	repush
  *
- * 定时器开启的入口函数, 完成定时器的全部工作
+ * 专门针对repeat timer的一个push重定义版本
  *
- * @param	p
+ * @param	this		定时器内部管理对象指针
+ * @param	timer		定时器内部结构指针
  *
  * @return
  */
-static void *entry(void *p)
+static TIMER_BOOL repush(struct mh_timer_s_internal *this, struct mh_timer_internal *timer, struct timespec *now)   //只会被调用，在被调用处会加锁
 {
-    if(p  ==  NULL) {
-        return NULL;
+    if(this  ==  NULL) {
+        return TIMER_FALSE;
     }
 
-    struct mh_timer_s_internal *this = (struct mh_timer_s_internal *)p;
-    pthread_t id;
-    pthread_attr_t attr;
-    sigset_t sigmask;
-    /* sigemptyset(&sigmask);
-    sigaddset(&sigmask, TIMER_STOP_SIGNAL);
-    pthread_sigmask(SIG_UNBLOCK, &sigmask, NULL);  */
-    sigfillset(&sigmask);
-    sigdelset(&sigmask, MH_TIMER_STOP_SIGNAL);
-    pthread_sigmask(SIG_SETMASK, &sigmask, NULL);
-    signal(MH_TIMER_STOP_SIGNAL, catch_signal);
-    struct itimerspec new_value;
-    struct timespec now, increment;
-    /* int timerfd; */
-    struct mh_timer_internal *temp;
-    uint64_t exp;
-    int replay = 0;
-    increment.tv_sec = 1;
-    increment.tv_nsec = 0;
-    new_value.it_value.tv_sec = increment.tv_sec;
-    new_value.it_value.tv_nsec = increment.tv_nsec;
-    new_value.it_interval.tv_sec = increment.tv_sec;
-    new_value.it_interval.tv_nsec = increment.tv_nsec;
-
-    if(timerfd_settime(this->timerfd, 0, &new_value, NULL) == -1) {
-        perror("[timer exit normally] - timer_set failed");
-        goto MH_END;
+    if(this->start_flag == 0) {
+        return TIMER_FALSE;
     }
 
-    while(this->start_flag) {
-        //gettimeofday(&now, NULL);
-        if(clock_gettime(CLOCK_REALTIME, &now) == -1) {
-            printf("get clock time failed\n");
-            goto MH_END;
+    uint64_t missed;
+    struct timespec next = timer->nominal;
+    ///从上一次的到期时间开始计算，避免累积误差；落后太多时从当前时间开始计算
+    timespec_add_ns(&next, interval_ns(timer));
+
+    if(!great(next, (*now))) {
+        ///错过的周期不再补执行，只记录下来
+        missed = (((uint64_t)(now->tv_sec - next.tv_sec)) * NSEC_PER_SEC + now->tv_nsec - next.tv_nsec) / interval_ns(timer) + 1;
+        ++this->overrun.events;
+        this->overrun.missed += missed;
+
+        if(missed > this->overrun.max_missed) {
+            this->overrun.max_missed = missed;
+        }
+
+        timer_trace_record(&this->trace, TIMER_TRACE_OVERRUN, timer->id, timer_trace_arg(missed));
+
+        mh_timer_set_expire(timer, now);
+    } else {
+        mh_timer_set_expire(timer, &timer->nominal);
+    }
+
+    heap_sift_up(this, this->cur_timer_num++, timer);
+    return TIMER_TRUE;
+}
+
+/**
+ * @brief	heap_sift_up
+ *
+ * 从s位置开始上浮，为timer找到合适的位置
+ *
+ * @param	this		定时器内部管理对象指针
+ * @param	s			起始位置(空位)
+ * @param	timer		待放入的定时器
+ */
+static void heap_sift_up(struct mh_timer_s_internal *this, int s, struct mh_timer_internal *timer)
+{
+    int parent;
+    struct mh_timer_internal *temp;
+
+    while(s > 0) {
+        parent = (s - 1) / 2;
+        temp = this->queue[parent];
+
+        if(!great(temp->expiretime, timer->expiretime)) {
+            break;
         }
 
-        pthread_mutex_lock(&this->mh_lock);
-        temp = this->queue[0];
-
-        if((temp != NULL) && gte(temp->expiretime, now)) {
-            switch(temp->run_type) {
-                case SIGNAL:
-                    kill(getpid(), SIGALRM);
-                    break;
-                case THREAD:
-                    pthread_attr_init(&attr);
-                    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-
-                    if(pthread_create(&id, &attr, temp->cb, (void *)temp->param)  ==  -1) {
-                        perror("[timer exit normally] - execute expiry func failed");
-                    }
-
-                    pthread_attr_destroy(&attr);
-                    break;
-                case DIRECT:
-                    temp->cb(temp->param);
-                default:
-                    break;
+        this->queue[s] = temp;
+        temp->index = s;
+        s = parent;
+    }
+
+    this->queue[s] = timer;
+    timer->index = s;
+}
+
+/**
+ * @brief	heap_sift_down
+ *
+ * 从s位置开始下沉，为timer找到合适的位置
+ *
+ * @param	this		定时器内部管理对象指针
+ * @param	s			起始位置(空位)
+ * @param	timer		待放入的定时器
+ */
+static void heap_sift_down(struct mh_timer_s_internal *this, int s, struct mh_timer_internal *timer)
+{
+    int child;
+
+    while((child = 2 * s + 1) < this->cur_timer_num) {
+        if(child + 1 < this->cur_timer_num && less(this->queue[child + 1]->expiretime, this->queue[child]->expiretime)) {
+            ++child;
+        }
+
+        if(!less(this->queue[child]->expiretime, timer->expiretime)) {
+            break;
+        }
+
+        this->queue[s] = this->queue[child];
+        this->queue[s]->index = s;
+        s = child;
+    }
+
+    this->queue[s] = timer;
+    timer->index = s;
+}
+
+/**
+ * @brief	heap_pop
+ *
+ * 取出堆顶定时器
+ *
+ * @param	this		定时器管理对象
+ *
+ * @note	调用者必须持有mh_lock且堆不为空
+ *
+ * @return	堆顶定时器
+ */
+static struct mh_timer_internal *heap_pop(struct mh_timer_s_internal *this)
+{
+    struct mh_timer_internal *top = this->queue[0];
+    heap_remove(this, 0);
+    return top;
+}
+
+/**
+ * @brief	heap_remove
+ *
+ * 从堆中删除s位置的定时器，用最后一个定时器填补空位
+ *
+ * @param	this		定时器管理对象
+ * @param	s			待删除定时器在堆中的位置
+ */
+static void heap_remove(struct mh_timer_s_internal *this, int s)
+{
+    struct mh_timer_internal *last;
+    this->queue[s]->index = -1;
+    last = this->queue[--this->cur_timer_num];
+    this->queue[this->cur_timer_num] = NULL;
+
+    if(s < this->cur_timer_num) {
+        heap_adjust(this, s, last);
+    }
+}
+
+/**
+ * @brief	heap_adjust
+ *
+ * 把timer放到s位置，并根据到期时间上浮或下沉
+ *
+ * @param	this		定时器管理对象
+ * @param	s			位置
+ * @param	timer		定时器
+ */
+static void heap_adjust(struct mh_timer_s_internal *this, int s, struct mh_timer_internal *timer)
+{
+    if(s > 0 && great(this->queue[(s - 1) / 2]->expiretime, timer->expiretime)) {
+        heap_sift_up(this, s, timer);
+    } else {
+        heap_sift_down(this, s, timer);
+    }
+}
+
+/**
+ * @brief	heap_build 自底向上建堆(Floyd)，从最后一个非叶子节点开始依次下沉
+ *
+ * @param	this
+ */
+static void heap_build(struct mh_timer_s_internal *this)
+{
+    int s;
+
+    for(s = this->cur_timer_num / 2 - 1; s >= 0; --s) {
+        heap_sift_down(this, s, this->queue[s]);
+    }
+}
+
+/**
+ * @brief	heap_arm
+ *
+ * 以绝对时间把timerfd设置为堆顶定时器的到期时间，堆为空时停止timerfd
+ *
+ * @param	this		定时器管理对象
+ *
+ * @note	调用者必须持有mh_lock
+ */
+static void heap_arm(struct mh_timer_s_internal *this)
+{
+    struct itimerspec new_value;
+    memset(&new_value, 0, sizeof(new_value));
+
+    if(this->cur_timer_num > 0) {
+        new_value.it_value = this->queue[0]->expiretime;
+    }
+
+    if(timerfd_settime(this->timerfd, TFD_TIMER_ABSTIME, &new_value, NULL) == -1) {
+        perror("mh timer: timer_set failed");
+    }
+}
+
+/**
+ * @brief	heap_wakeup
+ *
+ * 让timerfd立即到期，唤醒阻塞在read上的定时器线程(停止定时器时使用)
+ *
+ * @param	this		定时器管理对象
+ */
+static void heap_wakeup(struct mh_timer_s_internal *this)
+{
+    struct itimerspec new_value;
+    memset(&new_value, 0, sizeof(new_value));
+    new_value.it_value.tv_nsec = 1;
+    pthread_mutex_lock(&this->mh_lock);
+    timerfd_settime(this->timerfd, 0, &new_value, NULL);
+    pthread_mutex_unlock(&this->mh_lock);
+}
+
+
+/**
+ * @brief	stop
+ *
+ * 停止定时器
+ *
+ * @param	this	定时器管理对象指针
+ */
+static void ti_stop(MH_TIMER_MANAGER *this)
+{
+    if(this  ==  NULL) {
+        return;
+    }
+
+    struct mh_timer_s_internal *p = (struct mh_timer_s_internal *)this;
+    ///如果定时器并没有开始，直接结束
+    pthread_rwlock_rdlock(&p->lock);
+
+    if(p->start_flag == 0) {
+        pthread_rwlock_unlock(&p->lock);
+        return ;
+    }
+
+    p->start_flag = 0 ;
+
+    if(p->start_type == TIMER_START_EMBED) {
+        ///没有线程需要唤醒，停止timerfd即可
+        struct itimerspec new_value;
+        memset(&new_value, 0, sizeof(new_value));
+        pthread_mutex_lock(&p->mh_lock);
+        timerfd_settime(p->timerfd, 0, &new_value, NULL);
+        pthread_mutex_unlock(&p->mh_lock);
+        pthread_rwlock_unlock(&p->lock);
+        return;
+    }
+
+    heap_wakeup(p);
+    sleep(1);
+
+    if(p->pid != 0) {
+        pthread_kill(p->pid, MH_TIMER_STOP_SIGNAL);
+        p->pid = 0;
+    }
+
+    pthread_rwlock_unlock(&p->lock);
+}
+
+
+/**
+ * @brief	start
+ *
+ * 以两种方式来开启定时器
+ *
+ * @param	this		定时器管理对象指针
+ * @param	type		开启方式
+ */
+static void ti_start(MH_TIMER_MANAGER *this, timer_start_type type)
+{
+    if(this  ==  NULL) {
+        return;
+    }
+
+    struct mh_timer_s_internal *p = (struct mh_timer_s_internal *)this;
+    int flags;
+    pthread_rwlock_wrlock(&p->lock);
+
+    if(p->start_flag  == 1) {
+        pthread_rwlock_unlock(&p->lock);
+        return;
+    } else {
+        p->start_flag = 1 ;
+    }
+
+    p->start_type = type;
+    ///只有EMBED方式下timerfd是非阻塞的，定时器线程需要阻塞在read上
+    flags = fcntl(p->timerfd, F_GETFL);
+
+    if(flags != -1) {
+        fcntl(p->timerfd, F_SETFL, type == TIMER_START_EMBED ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+
+    switch(type) {
+        case TIMER_START_UNBLOCK:
+            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+            if(pthread_create((pthread_t *)(&p->pid), &attr, entry, (void *)p) != 0) {
+                p->start_flag = 0 ;
+                p->pid = 0;
+                pthread_rwlock_unlock(&p->lock);
+                return;
+            }
+
+            pthread_rwlock_unlock(&p->lock);
+            break;
+        case TIMER_START_BLOCK:
+
+            if(pthread_create((pthread_t *)(&p->pid), NULL, entry, (void *)p) != 0) {
+                p->start_flag = 0 ;
+                p->pid = 0;
+                pthread_rwlock_unlock(&p->lock);
+                return;
             }
 
-            switch(temp->type) {
-                case REPEAT:
+            pthread_rwlock_unlock(&p->lock);
 
-                    if(ti_pop(this) == TIMER_FALSE) {
-                        pthread_mutex_unlock(&this->mh_lock);
-                        goto MH_END;
-                    }
+            if(pthread_join(p->pid, NULL) != 0) {
+                perror("block failed");
+            }
 
-                    if(repush(this, temp) == TIMER_FALSE) {
-                        pthread_mutex_unlock(&this->mh_lock);
-                        goto MH_END;
-                    }
+            break;
+        case TIMER_START_EMBED:
+            ///由调用者的事件循环监听timerfd，按当前堆顶设置到期时间
+            pthread_mutex_lock(&p->mh_lock);
+            heap_arm(p);
+            pthread_mutex_unlock(&p->mh_lock);
+            pthread_rwlock_unlock(&p->lock);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief	heap_expire
+ *
+ * 取出并处理截止到now为止所有到期的定时器，之后按新的堆顶重新设置timerfd
+ *
+ * @param	this		定时器管理对象
+ * @param	now			当前时间
+ *
+ * @return	到期的定时器个数
+ */
+static unsigned int heap_expire(struct mh_timer_s_internal *this, struct timespec *now)
+{
+    struct mh_timer_internal *temp;
+    struct timer_dispatch_batch batch;
+    struct timespec start, end;
+    unsigned int num = 0;
+    int64_t elapsed = timer_timespec_ns(now), late;
+    pthread_mutex_lock(&this->mh_lock);
+    timer_batch_init(&batch, this->executor);
+
+    ///一次取出所有已经到期的定时器
+    while(this->start_flag && this->cur_timer_num > 0 && !great(this->queue[0]->expiretime, (*now))) {
+        if(timer_batch_full(&batch)) {
+            pthread_mutex_unlock(&this->mh_lock);
+            timer_executor_flush(&batch);
+            pthread_mutex_lock(&this->mh_lock);
+            continue;
+        }
 
-                    break;
-                case SINGLE_SHOT:
-                default:
+        temp = heap_pop(this);
+        ++num;
+        ///前面的回调耗时也计入后面定时器的延迟
+        late = elapsed - timer_timespec_ns(&temp->expiretime);
+        timer_histogram_record(&this->stats.lateness, late > 0 ? late : 0);
+        timer_trace_record(&this->trace, TIMER_TRACE_EXPIRE, temp->id, late > 0 ? timer_trace_arg(late / 1000) : 0);
 
-                    if(ti_pop(this) == TIMER_FALSE) {
-                        pthread_mutex_unlock(&this->mh_lock);
-                        goto MH_END;
-                    }
+        ///异步执行的回调只放入批次，不需要释放锁；节点随后可能被释放，拷贝方式的参数由批次复制一份
+        if(temp->run_type == THREAD) {
+            timer_batch_add(&batch, temp->cb, temp->param, temp->param_mode == TIMER_PARAM_COPY && temp->param_len > 0 ? temp->param_len : 0);
+        } else {
+            this->running = temp;
+            pthread_mutex_unlock(&this->mh_lock);
+
+            if(temp->run_type == SIGNAL) {
+                kill(getpid(), SIGALRM);
+            } else if(clock_gettime(this->clock_id, &start) == 0) {
+                timer_trace_record(&this->trace, TIMER_TRACE_CB_START, temp->id, 0);
+                temp->cb(temp->param);
+                timer_trace_record(&this->trace, TIMER_TRACE_CB_END, temp->id, 0);
+                clock_gettime(this->clock_id, &end);
+                late = timer_timespec_ns(&end) - timer_timespec_ns(&start);
+                elapsed += late;
+                timer_histogram_record(&this->stats.callback, late);
+            } else {
+                timer_trace_record(&this->trace, TIMER_TRACE_CB_START, temp->id, 0);
+                temp->cb(temp->param);
+                timer_trace_record(&this->trace, TIMER_TRACE_CB_END, temp->id, 0);
+            }
 
-                    if(temp->param_len != 0) {
-                        free(temp->param);
-                    }
+            pthread_mutex_lock(&this->mh_lock);
 
-                    free(temp);
-                    break;
+            if(this->running == NULL) {
+                ///回调执行期间定时器已经被删除
+                mh_timer_free(this, temp);
+                this->running_rearm = 0;
+                continue;
             }
         }
 
-        pthread_mutex_unlock(&this->mh_lock);
-        ///只对有定时器的节点进行时间检测，主要是防止直接调用函数，执行函数的时间超过一个time_slot
+        if(this->running_rearm) {
+            heap_sift_up(this, this->cur_timer_num++, temp);
+        } else if(temp->type != REPEAT || repush(this, temp, now) == TIMER_FALSE) {
+            this->timers[temp->id] = NULL;
+            mh_timer_id_push(this, temp->id);
+            mh_timer_free(this, temp);
+        }
+
+        this->running = NULL;
+        this->running_rearm = 0;
+    }
+
+    ///睡眠到新堆顶的到期时间，没有定时器时不再唤醒
+    if(this->start_flag) {
+        heap_arm(this);
+    }
+
+    pthread_mutex_unlock(&this->mh_lock);
+    ///这一轮所有THREAD回调一次交给执行器
+    timer_executor_flush(&batch);
+    timer_stat_add(this->stats.expirations, num);
+    return num;
+}
+
+/**
+ * @brief	entry
+ *
+ * 定时器开启的入口函数, 完成定时器的全部工作
+ *
+ * @param	p
+ *
+ * @return
+ */
+static void *entry(void *p)
+{
+    if(p  ==  NULL) {
+        return NULL;
+    }
+
+    struct mh_timer_s_internal *this = (struct mh_timer_s_internal *)p;
+    sigset_t sigmask;
+    /* sigemptyset(&sigmask);
+    sigaddset(&sigmask, TIMER_STOP_SIGNAL);
+    pthread_sigmask(SIG_UNBLOCK, &sigmask, NULL);  */
+    sigfillset(&sigmask);
+    sigdelset(&sigmask, MH_TIMER_STOP_SIGNAL);
+    pthread_sigmask(SIG_SETMASK, &sigmask, NULL);
+    signal(MH_TIMER_STOP_SIGNAL, catch_signal);
+    struct timespec now;
+    /* int timerfd; */
+    uint64_t exp;
+
+    while(this->start_flag) {
+        //gettimeofday(&now, NULL);
+        if(clock_gettime(this->clock_id, &now) == -1) {
+            printf("get clock time failed\n");
+            goto MH_END;
+        }
+
+        heap_expire(this, &now);
 
         if(read(this->timerfd, &exp, sizeof(uint64_t)) != sizeof(uint64_t)) {
             perror("[mh timer exit abnormally] - read failed");
             goto MH_END;
-        } else {
-            if(exp > 1) {
-                fprintf(stderr, "maintain timer_list expire one time_slot\n");
-
-                if(++replay == 5) {
-                    goto MH_END;
-                }
-            }
         }
     }
 
@@ -659,17 +1269,20 @@ static void ti_close(MH_TIMER_MANAGER *this)
     }
 
     struct mh_timer_s_internal *p = (struct mh_timer_s_internal *)this;
-    struct mh_timer_internal *temp;
     pthread_rwlock_wrlock(&p->lock);
 
     ///还没有初始化，直接返回
     if(atomic_read(&p->init_flag)  ==  0) {
+        pthread_rwlock_unlock(&p->lock);
         return;
     }
 
     //p->stop( this );
-    if(p->start_flag  != 0) {
+    if(p->start_flag  != 0 && p->start_type == TIMER_START_EMBED) {
+        p->start_flag = 0;
+    } else if(p->start_flag  != 0) {
         p->start_flag = 0 ;
+        heap_wakeup(p);
         sleep(1);
 
         if(p->pid != 0) {
@@ -678,26 +1291,20 @@ static void ti_close(MH_TIMER_MANAGER *this)
         }
     }
 
-    int cnt = 0;
-
-    for(; cnt < p->max_timer_num; ++cnt) {
-        temp = p->queue[cnt];
-
-        if(temp != NULL) {
-            if(temp->param != NULL && temp->param_len != 0) {
-                free(temp->param);
-            }
-
-            free(temp);
-        }
-    }
-
+    free_all_timers(p);
     p->max_timer_num = 0;
 
     if(p->queue) {
         free(p->queue);
+        p->queue = NULL;
     }
 
+    free(p->timers);
+    free(p->free_ids);
+    p->timers = NULL;
+    p->free_ids = NULL;
+    mem_pool_destroy(&p->pool);
+
     if(p->timerfd > 2) {
         close(p->timerfd);
     }
@@ -730,15 +1337,428 @@ static void ti_disable(MH_TIMER_MANAGER *this)
     p->enable_flag = 0;
     pthread_rwlock_unlock(&p->lock);
 }
-static void catch_signal(int i)
+static void ti_set_executor(MH_TIMER_MANAGER *this, TIMER_EXECUTOR *executor)
 {
-    switch(i) {
-        case 62:
-            pthread_exit(0);
+    if(this  ==  NULL) {
+        return;
+    }
+
+    struct mh_timer_s_internal *p = (struct mh_timer_s_internal *)this;
+    pthread_mutex_lock(&p->mh_lock);
+    p->executor = executor;
+    pthread_mutex_unlock(&p->mh_lock);
+}
+
+static int ti_get_fd(MH_TIMER_MANAGER *this)
+{
+    struct mh_timer_s_internal *p = (struct mh_timer_s_internal *)this;
+
+    if(this == NULL || atomic_read(&p->init_flag) == 0) {
+        return -1;
+    }
+
+    return p->timerfd;
+}
+
+/**
+ * @brief	process_expired
+ *
+ * EMBED方式下由调用者的事件循环驱动，处理截止到now为止到期的定时器
+ *
+ * @param	this		定时器管理对象指针
+ * @param	now			当前时间(clock_type对应的时钟)，为NULL时读取系统时间
+ *
+ * @return	到期的定时器个数
+ */
+static unsigned int ti_process_expired(MH_TIMER_MANAGER *this, const struct timespec *now)
+{
+    struct mh_timer_s_internal *p = (struct mh_timer_s_internal *)this;
+    struct timespec cur;
+    uint64_t exp;
+
+    if(this == NULL || p->start_flag == 0 || p->start_type != TIMER_START_EMBED) {
+        return 0;
+    }
+
+    ///清除timerfd的可读状态，heap_expire会按新的堆顶重新设置
+    if(read(p->timerfd, &exp, sizeof(uint64_t)) != sizeof(uint64_t) && errno != EAGAIN) {
+        perror("read timerfd failed");
+    }
+
+    if(now != NULL) {
+        cur = *now;
+    } else if(clock_gettime(p->clock_id, &cur) == -1) {
+        return 0;
+    }
+
+    return heap_expire(p, &cur);
+}
+
+static void ti_get_overrun(MH_TIMER_MANAGER *this, struct timer_overrun *overrun)
+{
+    struct mh_timer_s_internal *p = (struct mh_timer_s_internal *)this;
+
+    if(this == NULL || overrun == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&p->mh_lock);
+    *overrun = p->overrun;
+    pthread_mutex_unlock(&p->mh_lock);
+}
+
+/**
+ * @brief	get_stats
+ *
+ * 最小堆没有时间片，busy_slots和max_slot_depth为0
+ *
+ * @param	this
+ * @param	stats
+ */
+static void ti_get_stats(MH_TIMER_MANAGER *this, struct timer_stats *stats)
+{
+    struct mh_timer_s_internal *p = (struct mh_timer_s_internal *)this;
+
+    if(this == NULL || stats == NULL) {
+        return;
+    }
+
+    memset(stats, 0, sizeof(struct timer_stats));
+    timer_stats_copy(stats, &p->stats);
+    pthread_mutex_lock(&p->mh_lock);
+    stats->overrun = p->overrun;
+    stats->timers = p->cur_timer_num;
+    pthread_mutex_unlock(&p->mh_lock);
+}
+
+static TIMER_BOOL ti_set_trace(MH_TIMER_MANAGER *this, unsigned int events)
+{
+    if(this == NULL) {
+        return TIMER_FALSE;
+    }
+
+    return timer_trace_set(&((struct mh_timer_s_internal *)this)->trace, events);
+}
+
+static TIMER_BOOL ti_dump_trace(MH_TIMER_MANAGER *this, const char *path)
+{
+    if(this == NULL) {
+        return TIMER_FALSE;
+    }
+
+    return timer_trace_dump(&((struct mh_timer_s_internal *)this)->trace, path);
+}
+
+/**
+ * @brief	snapshot
+ *
+ * 按堆中的顺序保存所有定时器，到期时间是没有加上slack的nominal，恢复时重新对齐
+ *
+ * @param	this
+ * @param	path
+ *
+ * @return	库布尔值
+ */
+static TIMER_BOOL ti_snapshot(MH_TIMER_MANAGER *this, const char *path)
+{
+    if(this == NULL || path == NULL) {
+        return TIMER_FALSE;
+    }
+
+    struct mh_timer_s_internal *p = (struct mh_timer_s_internal *)this;
+    struct mh_timer_internal *t;
+    struct timer_snapshot s;
+    int i;
+    pthread_rwlock_rdlock(&p->lock);
+
+    if(atomic_read(&p->init_flag)  ==  0) {
+        pthread_rwlock_unlock(&p->lock);
+        return TIMER_FALSE;
+    }
+
+    timer_snapshot_init(&s, p->clock_id);
+    pthread_mutex_lock(&p->mh_lock);
+
+    for(i = 0; i < p->cur_timer_num; ++i) {
+        t = p->queue[i];
+
+        if(timer_snapshot_add(&s, (struct timer *)t, timer_timespec_ns(&t->nominal)) == TIMER_FALSE) {
             break;
-        default:
+        }
+    }
+
+    ///正在执行回调的循环定时器按下一个周期保存
+    if(i == p->cur_timer_num && (t = p->running) != NULL && (t->type == REPEAT || p->running_rearm)
+            && timer_snapshot_add(&s, (struct timer *)t, timer_timespec_ns(&t->nominal) + interval_ns(t)) == TIMER_FALSE) {
+        i = -1;
+    }
+
+    pthread_mutex_unlock(&p->mh_lock);
+    pthread_rwlock_unlock(&p->lock);
+
+    if(i != p->cur_timer_num) {
+        timer_snapshot_free(&s);
+        return TIMER_FALSE;
+    }
+
+    return timer_snapshot_write(&s, path);
+}
+
+/**
+ * @brief	restore
+ *
+ * 与push_batch相同，恢复的定时器不少于堆中原有的定时器时放到堆尾再整体建堆
+ *
+ * @param	this
+ * @param	path
+ *
+ * @return	全部添加成功时返回TIMER_TRUE
+ */
+static TIMER_BOOL ti_restore(MH_TIMER_MANAGER *this, const char *path)
+{
+    if(this == NULL || path == NULL) {
+        return TIMER_FALSE;
+    }
+
+    struct mh_timer_s_internal *p = (struct mh_timer_s_internal *)this;
+    struct mh_timer_internal *t, *top;
+    struct timer_snapshot_file f;
+    struct timer timer;
+    struct timespec from;
+    unsigned long long i, num = 0;
+    long long deadline;
+    int heapify;
+
+    if(timer_snapshot_open(&f, path, p->clock_id) == TIMER_FALSE) {
+        return TIMER_FALSE;
+    }
+
+    pthread_rwlock_rdlock(&p->lock);
+
+    if(atomic_read(&p->init_flag)  ==  0 || p->enable_flag == 0) {
+        pthread_rwlock_unlock(&p->lock);
+        timer_snapshot_close(&f);
+        return TIMER_FALSE;
+    }
+
+    pthread_mutex_lock(&p->mh_lock);
+    top = p->cur_timer_num > 0 ? p->queue[0] : NULL;
+    heapify = f.header->count >= (unsigned long long)p->cur_timer_num;
+
+    for(i = 0; i < f.header->count; ++i) {
+        deadline = timer_snapshot_get(&f, i, &timer);
+
+        if((timer.interval == 0 && timer.interval_ns == 0) || timer.cb == NULL) {
+            fprintf(stderr, "timer is illegal \n");
+            continue;
+        }
+
+        if(p->free_num == 0 || (t = mem_pool_alloc(&p->pool)) == NULL) {
+            fprintf(stderr, "ACHIEVE TIMER MAX NUMBER\n");
             break;
+        }
+
+        *(struct timer *)t = timer;
+
+        if(mh_timer_param_init(t, &timer) == TIMER_FALSE) {
+            perror("malloc failed\n");
+            mem_pool_free(&p->pool, t);
+            continue;
+        }
+
+        ///nominal为文件中的到期时间，已经过期的在下一次处理时到期
+        deadline = deadline > (long long)interval_ns(t) ? deadline - (long long)interval_ns(t) : 0;
+        from.tv_sec = deadline / (long long)NSEC_PER_SEC;
+        from.tv_nsec = deadline % (long long)NSEC_PER_SEC;
+        mh_timer_set_expire(t, &from);
+        t->id = mh_timer_id_pop(p);
+        p->timers[t->id] = t;
+
+        if(heapify) {
+            t->index = p->cur_timer_num;
+            p->queue[p->cur_timer_num++] = t;
+        } else {
+            heap_sift_up(p, p->cur_timer_num++, t);
+        }
+
+        timer_trace_record(&p->trace, TIMER_TRACE_ADD, t->id, t->interval);
+        ++num;
+    }
+
+    if(heapify && num > 0) {
+        heap_build(p);
+    }
+
+    if(p->cur_timer_num > 0 && p->queue[0] != top && p->start_flag) {
+        heap_arm(p);
     }
+
+    pthread_mutex_unlock(&p->mh_lock);
+    pthread_rwlock_unlock(&p->lock);
+    timer_stat_add(p->stats.adds, num);
+    i = f.header->count;
+    timer_snapshot_close(&f);
+    return num == i ? TIMER_TRUE : TIMER_FALSE;
 }
 
+static void catch_signal(int i)
+{
+    if(i == MH_TIMER_STOP_SIGNAL) {
+        pthread_exit(0);
+    }
+}
 
+/**
+ * @brief	timespec_add_ns
+ *
+ * 给时间加上ns纳秒
+ *
+ * @param	ts
+ * @param	ns
+ */
+static inline void timespec_add_ns(struct timespec *ts, uint64_t ns)
+{
+    ns += ts->tv_nsec;
+    ts->tv_sec += ns / NSEC_PER_SEC;
+    ts->tv_nsec = ns % NSEC_PER_SEC;
+}
+
+/**
+ * @brief	mh_timer_param_init
+ *
+ * 按param_mode保存定时器的参数，短参数拷贝到节点内部，长参数另外申请内存
+ *
+ * @param	t
+ * @param	timer
+ *
+ * @return	申请内存失败返回TIMER_FALSE
+ */
+static inline TIMER_BOOL mh_timer_param_init(struct mh_timer_internal *t, struct timer *timer)
+{
+    if(timer->param_mode == TIMER_PARAM_REF) {
+        t->param = timer->param;
+    } else if(timer->param_len <= 0) {
+        t->param = NULL;
+    } else if(timer->param_len <= TIMER_INLINE_PARAM_SIZE) {
+        t->param = t->param_buf;
+        memcpy(t->param, timer->param, timer->param_len);
+    } else if((t->param = malloc(timer->param_len)) != NULL) {
+        memcpy(t->param, timer->param, timer->param_len);
+    } else {
+        return TIMER_FALSE;
+    }
+
+    return TIMER_TRUE;
+}
+
+/**
+ * @brief	mh_timer_set_expire 从from开始计算到期时间，并按slack对齐
+ *
+ * @param	timer
+ * @param	from
+ */
+static inline void mh_timer_set_expire(struct mh_timer_internal *timer, struct timespec *from)
+{
+    uint64_t ns;
+
+    timer->nominal = *from;
+    timespec_add_ns(&timer->nominal, interval_ns(timer));
+    timer->expiretime = timer->nominal;
+
+    if(timer->slack > 0) {
+        ns = timer_apply_slack((uint64_t)timer->nominal.tv_sec * NSEC_PER_SEC + timer->nominal.tv_nsec,
+                               (uint64_t)timer->slack * NSEC_PER_MSEC);
+        timer->expiretime.tv_sec = ns / NSEC_PER_SEC;
+        timer->expiretime.tv_nsec = ns % NSEC_PER_SEC;
+    }
+}
+
+/**
+ * @brief	mh_timer_id_pop
+ *
+ * 从空闲id队列头部取出一个id，调用者必须持有mh_lock且队列不为空
+ *
+ * @param	this
+ *
+ * @return
+ */
+static inline timer_id mh_timer_id_pop(struct mh_timer_s_internal *this)
+{
+    timer_id id = this->free_ids[this->free_head];
+
+    if(++this->free_head == this->max_timer_num) {
+        this->free_head = 0;
+    }
+
+    --this->free_num;
+    return id;
+}
+
+/**
+ * @brief	mh_timer_id_push
+ *
+ * 将已用的id放回空闲id队列尾部
+ *
+ * @param	this
+ * @param	id
+ */
+static inline void mh_timer_id_push(struct mh_timer_s_internal *this, timer_id id)
+{
+    this->free_ids[(this->free_head + this->free_num) % this->max_timer_num] = id;
+    ++this->free_num;
+}
+
+static inline struct mh_timer_internal *mh_timer_lookup(struct mh_timer_s_internal *this, timer_id id)
+{
+    if(id == 0 || id > (timer_id)this->max_timer_num) {
+        return NULL;
+    }
+
+    return this->timers[id];
+}
+
+static inline void mh_timer_free(struct mh_timer_s_internal *this, struct mh_timer_internal *timer)
+{
+    if(timer->param_mode == TIMER_PARAM_COPY && timer->param != (void *)timer->param_buf) {
+        free(timer->param);
+    }
+
+    mem_pool_free(&this->pool, timer);
+}
+
+/**
+ * @brief	free_all_timers
+ *
+ * 释放所有定时器，调用者必须持有mh_lock
+ *
+ * @param	this
+ *
+ * @return	原来有定时器返回TIMER_TRUE，否则TIMER_FALSE
+ */
+static TIMER_BOOL free_all_timers(struct mh_timer_s_internal *this)
+{
+    timer_id id = 1;
+    TIMER_BOOL ret = TIMER_FALSE;
+    struct mh_timer_internal *temp;
+
+    for(; id <= (timer_id)this->max_timer_num; ++id) {
+        if((temp = this->timers[id]) == NULL) {
+            continue;
+        }
+
+        this->timers[id] = NULL;
+        mh_timer_id_push(this, id);
+        ret = TIMER_TRUE;
+
+        ///正在执行回调的定时器由定时器线程释放
+        if(temp == this->running) {
+            this->running = NULL;
+        } else {
+            mh_timer_free(this, temp);
+        }
+    }
+
+    memset(this->queue, 0, sizeof(void *) * this->max_timer_num);
+    this->cur_timer_num = 0;
+    return ret;
+}
@@ -12,6 +12,7 @@
 #ifndef __MINHEAP_TIMER_H__
 #define	__MINHEAP_TIMER_H__
 
+#include <time.h>
 
 
 /***********mini heap timer************/
@@ -23,10 +24,16 @@
 
 typedef unsigned int timer_id;
 typedef struct mh_timer_manager_s	MH_TIMER_MANAGER;
+typedef struct timer_executor_s	TIMER_EXECUTOR;
 
 typedef enum timer_type_s {SINGLE_SHOT, REPEAT} timer_type;
-typedef enum timer_start_type_s {TIMER_START_UNBLOCK = 0, TIMER_START_BLOCK} timer_start_type;
+typedef enum timer_start_type_s {TIMER_START_UNBLOCK = 0, TIMER_START_BLOCK, TIMER_START_EMBED} timer_start_type;
 typedef enum timer_run_type_s {DIRECT = 0, SIGNAL, THREAD} timer_run_type;
+///COPY: 库内部保存一份param的拷贝；REF: 只保存调用者的指针，调用者保证定时器存在期间param有效
+typedef enum timer_param_mode_s {TIMER_PARAM_COPY = 0, TIMER_PARAM_REF} timer_param_mode;
+
+///不超过该长度的param直接拷贝到定时器节点内部，不再单独申请内存
+#define TIMER_INLINE_PARAM_SIZE	32
 
 struct timer {
     timer_type type;
@@ -34,8 +41,49 @@ struct timer {
     ///单位时毫秒
     unsigned int interval;
     void*(*cb)(void *);
-    void *param;			//该参数在内部都是拷贝到定时器管理单元中的
+    void *param;			//默认拷贝到定时器管理单元中，见param_mode
     int param_len;		//if param is string, param_len 不包含字符串最后的结束符
+    ///间隔的纳秒部分，只有堆定时器使用，实际间隔为interval毫秒加interval_ns纳秒
+    unsigned int interval_ns;
+    timer_param_mode param_mode;
+    ///允许推迟的毫秒数，到期时间在[interval, interval + slack]内对齐，使相近的定时器在同一次唤醒中处理
+    unsigned int slack;
+};
+
+struct timer_overrun {
+    unsigned long events;
+    unsigned long long missed;
+    unsigned long long max_missed;
+};
+
+#define TIMER_HIST_SUB_BITS	3
+#define TIMER_HIST_BUCKETS	((64 - TIMER_HIST_SUB_BITS + 1) << TIMER_HIST_SUB_BITS)
+
+struct timer_histogram {
+    unsigned long long count[TIMER_HIST_BUCKETS];
+    unsigned long long total;
+    unsigned long long sum;
+    unsigned long long max;
+};
+
+struct timer_stats {
+    unsigned long long adds;
+    unsigned long long dels;
+    unsigned long long mods;
+    unsigned long long expirations;
+    struct timer_overrun overrun;
+    unsigned int timers;
+    unsigned int busy_slots;
+    unsigned int max_slot_depth;
+    struct timer_histogram lateness;
+    struct timer_histogram callback;
+};
+
+typedef enum timer_clock_type_s {TIMER_CLOCK_MONOTONIC = 0, TIMER_CLOCK_REALTIME, TIMER_CLOCK_BOOTTIME, TIMER_CLOCK_MONOTONIC_COARSE} timer_clock_type;
+
+struct mh_timer_manager_conf {
+    int max_size;
+    timer_clock_type clock_type;
 };
 
 #ifndef TIMER_BOOL
@@ -47,14 +95,26 @@ typedef int TIMER_BOOL;
 
 struct mh_timer_manager_s {
     TIMER_BOOL(*init)(MH_TIMER_MANAGER *this, int max_size);
-    TIMER_BOOL(*push)(MH_TIMER_MANAGER *this, struct timer *timer);
+    timer_id(*push)(MH_TIMER_MANAGER *this, struct timer *timer);
+    TIMER_BOOL(*del)(MH_TIMER_MANAGER *this, timer_id id);
+    TIMER_BOOL(*mod)(MH_TIMER_MANAGER *this, timer_id id, unsigned int interval);
     void (*enable)(MH_TIMER_MANAGER *this);
     void (*disable)(MH_TIMER_MANAGER *this);
-    //TIMER_BOOL( *pop )( MH_TIMER_MANAGER *this );	//不允许随便删除
-    //	TIMER_BOOL (*reset) (TIMER_MANAGER *this, timer_id id);
     void (*start)(MH_TIMER_MANAGER *this, timer_start_type type);
     void (*stop)(MH_TIMER_MANAGER *this);
     void (*close)(MH_TIMER_MANAGER *this);
+    void (*set_executor)(MH_TIMER_MANAGER *this, TIMER_EXECUTOR *executor);
+    int (*get_fd)(MH_TIMER_MANAGER *this);
+    unsigned int (*process_expired)(MH_TIMER_MANAGER *this, const struct timespec *now);
+    void (*get_overrun)(MH_TIMER_MANAGER *this, struct timer_overrun *overrun);
+    TIMER_BOOL(*init_conf)(MH_TIMER_MANAGER *this, struct mh_timer_manager_conf *conf);
+    unsigned int (*push_batch)(MH_TIMER_MANAGER *this, struct timer *timers, unsigned int n, timer_id *ids);
+    unsigned int (*del_batch)(MH_TIMER_MANAGER *this, const timer_id *ids, unsigned int n);
+    void (*get_stats)(MH_TIMER_MANAGER *this, struct timer_stats *stats);
+    TIMER_BOOL(*set_trace)(MH_TIMER_MANAGER *this, unsigned int events);
+    TIMER_BOOL(*dump_trace)(MH_TIMER_MANAGER *this, const char *path);
+    TIMER_BOOL(*snapshot)(MH_TIMER_MANAGER *this, const char *path);
+    TIMER_BOOL(*restore)(MH_TIMER_MANAGER *this, const char *path);
 };
 
 MH_TIMER_MANAGER *create_mh_timer_manager();
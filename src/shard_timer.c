@@ -0,0 +1,718 @@
+/*
+ * 分片时间轮：由多个独立的时间轮组成，每个分片有自己的tick线程和锁，
+ * 对外仍然是TIMER_MANAGER接口。add按调用者当前所在的cpu选择分片，
+ * 分片号编码在timer_id下标部分的最高几位，del/mod据此直接找到分片
+ */
+#define _GNU_SOURCE
+#include "timer.h"
+#include "trace.h"
+#include "clock.h"
+#include "snapshot.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+struct timer_shard_internal {
+    TIMER_BOOL(*init)(TIMER_MANAGER *this, struct timer_manager_conf *conf);
+    timer_id(*add)(TIMER_MANAGER *this, struct timer *timer);
+    TIMER_BOOL(*del)(TIMER_MANAGER *this, timer_id id);
+    TIMER_BOOL(*mod)(TIMER_MANAGER *this, timer_id id, unsigned int interval);
+    void (*enable)(TIMER_MANAGER *this);
+    void (*disable)(TIMER_MANAGER *this);
+    void (*start)(TIMER_MANAGER *this, timer_start_type type);
+    void (*stop)(TIMER_MANAGER *this);
+    void (*close)(TIMER_MANAGER *this);
+    void (*set_executor)(TIMER_MANAGER *this, TIMER_EXECUTOR *executor);
+    int (*get_fd)(TIMER_MANAGER *this);
+    unsigned int (*process_expired)(TIMER_MANAGER *this, const struct timespec *now);
+    void (*get_overrun)(TIMER_MANAGER *this, struct timer_overrun *overrun);
+    unsigned int (*add_batch)(TIMER_MANAGER *this, struct timer *timers, unsigned int n, timer_id *ids);
+    unsigned int (*del_batch)(TIMER_MANAGER *this, const timer_id *ids, unsigned int n);
+    void (*get_stats)(TIMER_MANAGER *this, struct timer_stats *stats);
+    TIMER_BOOL(*set_trace)(TIMER_MANAGER *this, unsigned int events);
+    TIMER_BOOL(*dump_trace)(TIMER_MANAGER *this, const char *path);
+    TIMER_BOOL(*snapshot)(TIMER_MANAGER *this, const char *path);
+    TIMER_BOOL(*restore)(TIMER_MANAGER *this, const char *path);
+
+    unsigned int shard_num;
+    ///分片号所占的位数
+    unsigned int shard_bits;
+    TIMER_MANAGER **shards;
+    ///各分片使用的时钟，snapshot/restore换算到期时间
+    clockid_t clock_id;
+};
+
+///分片号在timer_id中的起始位置
+#define shard_shift(p)		(TIMER_ID_INDEX_BITS - (p)->shard_bits)
+#define shard_mask(p)		(((1U << (p)->shard_bits) - 1) << shard_shift(p))
+#define shard_of(p, id)		(((id) & shard_mask(p)) >> shard_shift(p))
+#define shard_inner_id(p, id)	((id) & ~shard_mask(p))
+///批量操作时每次交给一个分片的定时器个数
+#define SHARD_BATCH_SIZE	64
+
+static TIMER_BOOL shard_init(TIMER_MANAGER *this, struct timer_manager_conf *conf);
+static timer_id shard_add(TIMER_MANAGER *this, struct timer *timer);
+static TIMER_BOOL shard_del(TIMER_MANAGER *this, timer_id id);
+static TIMER_BOOL shard_mod(TIMER_MANAGER *this, timer_id id, unsigned int interval);
+static void shard_enable(TIMER_MANAGER *this);
+static void shard_disable(TIMER_MANAGER *this);
+static void shard_start(TIMER_MANAGER *this, timer_start_type type);
+static void shard_stop(TIMER_MANAGER *this);
+static void shard_close(TIMER_MANAGER *this);
+static void shard_set_executor(TIMER_MANAGER *this, TIMER_EXECUTOR *executor);
+static int shard_get_fd(TIMER_MANAGER *this);
+static unsigned int shard_process_expired(TIMER_MANAGER *this, const struct timespec *now);
+static void shard_get_overrun(TIMER_MANAGER *this, struct timer_overrun *overrun);
+static unsigned int shard_add_batch(TIMER_MANAGER *this, struct timer *timers, unsigned int n, timer_id *ids);
+static unsigned int shard_del_batch(TIMER_MANAGER *this, const timer_id *ids, unsigned int n);
+static void shard_get_stats(TIMER_MANAGER *this, struct timer_stats *stats);
+static TIMER_BOOL shard_set_trace(TIMER_MANAGER *this, unsigned int events);
+static TIMER_BOOL shard_dump_trace(TIMER_MANAGER *this, const char *path);
+static TIMER_BOOL shard_snapshot(TIMER_MANAGER *this, const char *path);
+static TIMER_BOOL shard_restore(TIMER_MANAGER *this, const char *path);
+
+/**
+ * @brief	create_sharded_timer_manager
+ *
+ * 创建分片时间轮管理对象
+ *
+ * @param	shard_num	分片个数，0表示每个在线cpu一个分片
+ *
+ * @return	定时器管理对象指针，必须用destroy_sharded_timer_manager销毁
+ */
+TIMER_MANAGER *create_sharded_timer_manager(unsigned int shard_num)
+{
+    unsigned int i;
+    long cpus;
+    struct timer_shard_internal *p;
+
+    if(shard_num == 0) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        shard_num = cpus > 0 ? (unsigned int)cpus : 1;
+    }
+
+    if((p = malloc(sizeof(struct timer_shard_internal))) == NULL) {
+        perror("malloc failed");
+        return NULL;
+    }
+
+    memset(p, 0, sizeof(struct timer_shard_internal));
+    p->init = shard_init;
+    p->add = shard_add;
+    p->del = shard_del;
+    p->mod = shard_mod;
+    p->enable = shard_enable;
+    p->disable = shard_disable;
+    p->start = shard_start;
+    p->stop = shard_stop;
+    p->close = shard_close;
+    p->set_executor = shard_set_executor;
+    p->get_fd = shard_get_fd;
+    p->process_expired = shard_process_expired;
+    p->get_overrun = shard_get_overrun;
+    p->add_batch = shard_add_batch;
+    p->del_batch = shard_del_batch;
+    p->get_stats = shard_get_stats;
+    p->set_trace = shard_set_trace;
+    p->dump_trace = shard_dump_trace;
+    p->snapshot = shard_snapshot;
+    p->restore = shard_restore;
+    p->shard_num = shard_num;
+
+    while((1U << p->shard_bits) < shard_num) {
+        ++p->shard_bits;
+    }
+
+    if(p->shard_bits >= TIMER_ID_INDEX_BITS || (p->shards = calloc(shard_num, sizeof(TIMER_MANAGER *))) == NULL) {
+        perror("malloc failed");
+        free(p);
+        return NULL;
+    }
+
+    for(i = 0; i < shard_num; ++i) {
+        if((p->shards[i] = create_timer_manager()) == NULL) {
+            destroy_sharded_timer_manager((TIMER_MANAGER *)p);
+            return NULL;
+        }
+    }
+
+    return (TIMER_MANAGER *)p;
+}
+
+void destroy_sharded_timer_manager(TIMER_MANAGER *this)
+{
+    unsigned int i;
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(p == NULL) {
+        return;
+    }
+
+    for(i = 0; i < p->shard_num; ++i) {
+        if(p->shards[i] != NULL) {
+            destroy_timer_manager(p->shards[i]);
+        }
+    }
+
+    free(p->shards);
+    free(p);
+}
+
+/**
+ * @brief	shard_init
+ *
+ * 用同一份配置初始化所有分片，timer_max_num平均分给各个分片
+ *
+ * @param	this
+ * @param	conf
+ *
+ * @return
+ */
+static TIMER_BOOL shard_init(TIMER_MANAGER *this, struct timer_manager_conf *conf)
+{
+    unsigned int i;
+    struct timer_manager_conf c;
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(this == NULL || conf == NULL || conf->timer_max_num == 0) {
+        return TIMER_FALSE;
+    }
+
+    c = *conf;
+    c.timer_max_num = (conf->timer_max_num - 1) / p->shard_num + 1;
+
+    ///分片号占用了下标的最高几位
+    if(c.timer_max_num >= (1U << shard_shift(p))) {
+        fprintf(stderr, "timer_conf is illegal \n");
+        return TIMER_FALSE;
+    }
+
+    for(i = 0; i < p->shard_num; ++i) {
+        if(p->shards[i]->init(p->shards[i], &c) == TIMER_FALSE) {
+            while(i-- > 0) {
+                p->shards[i]->close(p->shards[i]);
+            }
+
+            return TIMER_FALSE;
+        }
+    }
+
+    p->clock_id = timer_clock_id(conf->clock_type);
+    return TIMER_TRUE;
+}
+
+/**
+ * @brief	shard_add
+ *
+ * 优先添加到调用者当前cpu对应的分片，该分片满了再依次尝试其他分片
+ *
+ * @param	this
+ * @param	timer
+ *
+ * @return
+ */
+static inline unsigned int shard_current(struct timer_shard_internal *p)
+{
+    int cpu;
+
+    if((cpu = sched_getcpu()) < 0) {
+        cpu = (int)((unsigned long)pthread_self() >> 12);
+    }
+
+    return (unsigned int)cpu % p->shard_num;
+}
+
+static timer_id shard_add(TIMER_MANAGER *this, struct timer *timer)
+{
+    unsigned int i, s, cur;
+    timer_id id;
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(this == NULL) {
+        return 0;
+    }
+
+    cur = shard_current(p);
+
+    for(i = 0; i < p->shard_num; ++i) {
+        s = (cur + i) % p->shard_num;
+
+        if((id = p->shards[s]->add(p->shards[s], timer)) != 0) {
+            return id | (s << shard_shift(p));
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief	shard_del
+ *
+ * @param	this
+ * @param	id		为0时删除所有分片上的定时器
+ *
+ * @return
+ */
+static TIMER_BOOL shard_del(TIMER_MANAGER *this, timer_id id)
+{
+    unsigned int i, s;
+    TIMER_BOOL ret = TIMER_FALSE;
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(this == NULL) {
+        return TIMER_FALSE;
+    }
+
+    if(id == 0) {
+        for(i = 0; i < p->shard_num; ++i) {
+            if(p->shards[i]->del(p->shards[i], 0) == TIMER_TRUE) {
+                ret = TIMER_TRUE;
+            }
+        }
+
+        return ret;
+    }
+
+    if((s = shard_of(p, id)) >= p->shard_num) {
+        return TIMER_FALSE;
+    }
+
+    return p->shards[s]->del(p->shards[s], shard_inner_id(p, id));
+}
+
+static TIMER_BOOL shard_mod(TIMER_MANAGER *this, timer_id id, unsigned int interval)
+{
+    unsigned int s;
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(this == NULL || id == 0 || (s = shard_of(p, id)) >= p->shard_num) {
+        return TIMER_FALSE;
+    }
+
+    return p->shards[s]->mod(p->shards[s], shard_inner_id(p, id), interval);
+}
+
+static void shard_enable(TIMER_MANAGER *this)
+{
+    unsigned int i;
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(this == NULL) {
+        return;
+    }
+
+    for(i = 0; i < p->shard_num; ++i) {
+        p->shards[i]->enable(p->shards[i]);
+    }
+}
+
+static void shard_disable(TIMER_MANAGER *this)
+{
+    unsigned int i;
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(this == NULL) {
+        return;
+    }
+
+    for(i = 0; i < p->shard_num; ++i) {
+        p->shards[i]->disable(p->shards[i]);
+    }
+}
+
+/**
+ * @brief	shard_start
+ *
+ * 每个分片启动自己的tick线程；阻塞方式时最后一个分片阻塞调用者
+ *
+ * @param	this
+ * @param	type
+ */
+static void shard_start(TIMER_MANAGER *this, timer_start_type type)
+{
+    unsigned int i;
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(this == NULL) {
+        return;
+    }
+
+    for(i = 0; i + 1 < p->shard_num; ++i) {
+        p->shards[i]->start(p->shards[i], TIMER_START_UNBLOCK);
+    }
+
+    p->shards[i]->start(p->shards[i], type);
+}
+
+static void shard_stop(TIMER_MANAGER *this)
+{
+    unsigned int i;
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(this == NULL) {
+        return;
+    }
+
+    for(i = 0; i < p->shard_num; ++i) {
+        p->shards[i]->stop(p->shards[i]);
+    }
+}
+
+static void shard_close(TIMER_MANAGER *this)
+{
+    unsigned int i;
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(this == NULL) {
+        return;
+    }
+
+    for(i = 0; i < p->shard_num; ++i) {
+        p->shards[i]->close(p->shards[i]);
+    }
+}
+
+static void shard_set_executor(TIMER_MANAGER *this, TIMER_EXECUTOR *executor)
+{
+    unsigned int i;
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(this == NULL) {
+        return;
+    }
+
+    for(i = 0; i < p->shard_num; ++i) {
+        p->shards[i]->set_executor(p->shards[i], executor);
+    }
+}
+
+///每个分片有自己的timerfd，没有可以代表整个管理对象的fd
+static int shard_get_fd(TIMER_MANAGER *this)
+{
+    (void)this;
+    return -1;
+}
+
+static unsigned int shard_process_expired(TIMER_MANAGER *this, const struct timespec *now)
+{
+    unsigned int i, num = 0;
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(this == NULL) {
+        return 0;
+    }
+
+    for(i = 0; i < p->shard_num; ++i) {
+        num += p->shards[i]->process_expired(p->shards[i], now);
+    }
+
+    return num;
+}
+
+///各分片的统计之和，max_missed取最大值
+static void shard_get_overrun(TIMER_MANAGER *this, struct timer_overrun *overrun)
+{
+    unsigned int i;
+    struct timer_overrun o;
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(this == NULL || overrun == NULL) {
+        return;
+    }
+
+    memset(overrun, 0, sizeof(struct timer_overrun));
+
+    for(i = 0; i < p->shard_num; ++i) {
+        p->shards[i]->get_overrun(p->shards[i], &o);
+        overrun->events += o.events;
+        overrun->missed += o.missed;
+
+        if(o.max_missed > overrun->max_missed) {
+            overrun->max_missed = o.max_missed;
+        }
+    }
+}
+
+/**
+ * @brief	shard_get_stats
+ *
+ * 计数求和，直方图逐个桶相加，max_slot_depth取各分片的最大值
+ *
+ * @param	this
+ * @param	stats
+ */
+static void shard_get_stats(TIMER_MANAGER *this, struct timer_stats *stats)
+{
+    unsigned int i;
+    struct timer_stats o;
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(this == NULL || stats == NULL) {
+        return;
+    }
+
+    memset(stats, 0, sizeof(struct timer_stats));
+
+    for(i = 0; i < p->shard_num; ++i) {
+        p->shards[i]->get_stats(p->shards[i], &o);
+        stats->adds += o.adds;
+        stats->dels += o.dels;
+        stats->mods += o.mods;
+        stats->expirations += o.expirations;
+        stats->overrun.events += o.overrun.events;
+        stats->overrun.missed += o.overrun.missed;
+
+        if(o.overrun.max_missed > stats->overrun.max_missed) {
+            stats->overrun.max_missed = o.overrun.max_missed;
+        }
+
+        stats->timers += o.timers;
+        stats->busy_slots += o.busy_slots;
+
+        if(o.max_slot_depth > stats->max_slot_depth) {
+            stats->max_slot_depth = o.max_slot_depth;
+        }
+
+        timer_histogram_merge(&stats->lateness, &o.lateness);
+        timer_histogram_merge(&stats->callback, &o.callback);
+    }
+}
+
+/**
+ * @brief	shard_set_trace
+ *
+ * 每个分片有自己的环，各分片都开启events大小的环
+ *
+ * @param	this
+ * @param	events
+ *
+ * @return	库布尔值
+ */
+static TIMER_BOOL shard_set_trace(TIMER_MANAGER *this, unsigned int events)
+{
+    unsigned int i;
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(this == NULL) {
+        return TIMER_FALSE;
+    }
+
+    for(i = 0; i < p->shard_num; ++i) {
+        if(p->shards[i]->set_trace(p->shards[i], events) == TIMER_FALSE) {
+            return TIMER_FALSE;
+        }
+    }
+
+    return TIMER_TRUE;
+}
+
+/**
+ * @brief	shard_dump_trace
+ *
+ * 合并各分片的事件写到一个文件，id换算成add返回的id，source为分片号
+ *
+ * @param	this
+ * @param	path
+ *
+ * @return	库布尔值
+ */
+static TIMER_BOOL shard_dump_trace(TIMER_MANAGER *this, const char *path)
+{
+    unsigned int i;
+    unsigned long long size = 0, count = 0, lost = 0, k, n;
+    struct timer_trace_ring *ring;
+    struct timer_trace_event *events = NULL;
+    TIMER_BOOL ret;
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(this == NULL || path == NULL) {
+        return TIMER_FALSE;
+    }
+
+    for(i = 0; i < p->shard_num; ++i) {
+        ring = __atomic_load_n(&timer_manager_trace(p->shards[i])->ring, __ATOMIC_ACQUIRE);
+
+        if(ring != NULL) {
+            size += ring->mask + 1;
+        }
+    }
+
+    if(size > 0 && (events = malloc(size * sizeof(struct timer_trace_event))) == NULL) {
+        perror("malloc failed");
+        return TIMER_FALSE;
+    }
+
+    for(i = 0; i < p->shard_num && size > 0; ++i) {
+        n = timer_trace_collect(timer_manager_trace(p->shards[i]), events + count, size - count, &lost);
+
+        for(k = count; k < count + n; ++k) {
+            events[k].source = i;
+
+            if(events[k].id != 0) {
+                events[k].id |= i << shard_shift(p);
+            }
+        }
+
+        count += n;
+    }
+
+    ret = timer_trace_write(path, events, count, lost);
+    free(events);
+    return ret;
+}
+
+/**
+ * @brief	shard_snapshot
+ *
+ * 各分片的定时器写到同一个文件中，文件中不记录分片
+ *
+ * @param	this
+ * @param	path
+ *
+ * @return
+ */
+static TIMER_BOOL shard_snapshot(TIMER_MANAGER *this, const char *path)
+{
+    unsigned int i;
+    struct timer_snapshot s;
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(this == NULL || path == NULL) {
+        return TIMER_FALSE;
+    }
+
+    timer_snapshot_init(&s, p->clock_id);
+
+    for(i = 0; i < p->shard_num; ++i) {
+        if(timer_manager_snapshot(p->shards[i], &s) == TIMER_FALSE) {
+            timer_snapshot_free(&s);
+            return TIMER_FALSE;
+        }
+    }
+
+    return timer_snapshot_write(&s, path);
+}
+
+/**
+ * @brief	shard_restore
+ *
+ * 文件中的定时器平均分给各分片，每个分片只加一次锁
+ *
+ * @param	this
+ * @param	path
+ *
+ * @return
+ */
+static TIMER_BOOL shard_restore(TIMER_MANAGER *this, const char *path)
+{
+    unsigned int i;
+    unsigned long long count;
+    struct timer_snapshot_file f;
+    TIMER_BOOL ret = TIMER_TRUE;
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(this == NULL || path == NULL || timer_snapshot_open(&f, path, p->clock_id) == TIMER_FALSE) {
+        return TIMER_FALSE;
+    }
+
+    count = f.header->count;
+
+    for(i = 0; i < p->shard_num; ++i) {
+        if(timer_manager_restore(p->shards[i], &f, count * i / p->shard_num, count * (i + 1) / p->shard_num) == TIMER_FALSE) {
+            ret = TIMER_FALSE;
+        }
+    }
+
+    timer_snapshot_close(&f);
+    return ret;
+}
+
+/**
+ * @brief	shard_add_batch
+ *
+ * 整批添加到调用者当前cpu对应的分片，该分片放不下的定时器再按shard_add逐个添加到其他分片
+ *
+ * @param	this
+ * @param	timers
+ * @param	n
+ * @param	ids
+ *
+ * @return
+ */
+static unsigned int shard_add_batch(TIMER_MANAGER *this, struct timer *timers, unsigned int n, timer_id *ids)
+{
+    unsigned int i, j, k, s, num = 0;
+    timer_id buf[SHARD_BATCH_SIZE];
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(this == NULL || timers == NULL) {
+        return 0;
+    }
+
+    s = shard_current(p);
+
+    for(i = 0; i < n; i += k) {
+        k = n - i < SHARD_BATCH_SIZE ? n - i : SHARD_BATCH_SIZE;
+        num += p->shards[s]->add_batch(p->shards[s], timers + i, k, buf);
+
+        for(j = 0; j < k; ++j) {
+            if(buf[j] != 0) {
+                buf[j] |= s << shard_shift(p);
+            } else if((buf[j] = shard_add(this, &timers[i + j])) != 0) {
+                ++num;
+            }
+
+            if(ids != NULL) {
+                ids[i + j] = buf[j];
+            }
+        }
+    }
+
+    return num;
+}
+
+/**
+ * @brief	shard_del_batch
+ *
+ * 按分片分组后交给各分片的del_batch，每个分片每SHARD_BATCH_SIZE个id加一次锁
+ *
+ * @param	this
+ * @param	ids
+ * @param	n
+ *
+ * @return
+ */
+static unsigned int shard_del_batch(TIMER_MANAGER *this, const timer_id *ids, unsigned int n)
+{
+    unsigned int i, s, k, num = 0;
+    timer_id buf[SHARD_BATCH_SIZE];
+    struct timer_shard_internal *p = (struct timer_shard_internal *)this;
+
+    if(this == NULL || ids == NULL) {
+        return 0;
+    }
+
+    for(s = 0; s < p->shard_num; ++s) {
+        for(i = 0, k = 0; i < n; ++i) {
+            if(ids[i] == 0 || shard_of(p, ids[i]) != s) {
+                continue;
+            }
+
+            buf[k++] = shard_inner_id(p, ids[i]);
+
+            if(k == SHARD_BATCH_SIZE) {
+                num += p->shards[s]->del_batch(p->shards[s], buf, k);
+                k = 0;
+            }
+        }
+
+        if(k > 0) {
+            num += p->shards[s]->del_batch(p->shards[s], buf, k);
+        }
+    }
+
+    return num;
+}
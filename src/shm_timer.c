@@ -0,0 +1,1333 @@
+/*
+ * 共享内存时间轮：时间片、定时器节点和空闲链表都在shm_open/mmap的区域中，节点之间用下标链接，
+ * 各进程映射地址不同也可以使用。多个进程映射同一个区域后直接add/del/mod，不需要进程间通信；
+ * 每个进程的TIMER_MANAGER只是区域的句柄，tick线程、timerfd、执行器和跟踪环属于各自的进程。
+ * 任何一个开启了的进程都可以推进时间轮，到期的定时器只在其中一个进程中执行一次
+ */
+#define _GNU_SOURCE
+#include "timer.h"
+#include "clock.h"
+#include "stats.h"
+#include "trace.h"
+#include "executor.h"
+#include "snapshot.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define SHM_MAGIC		"STSHM001"
+#define SHM_VERSION		1
+///节点下标从1开始，0表示链表结束
+#define SHM_NIL			0
+///节点不在任何时间片上(空闲)
+#define SHM_SLOT_NONE	((uint32_t)-1)
+///等待创建者初始化区域的最长时间(毫秒)
+#define SHM_ATTACH_WAIT	1000
+///一次从到期链表中取出的定时器个数，取出后释放锁执行回调
+#define SHM_FIRE_BATCH	64
+#define NSEC_PER_MSEC	1000000LL
+
+#define shm_index(id)		((id) & ((1U << TIMER_ID_INDEX_BITS) - 1))
+#define shm_gen(id)			((id) >> TIMER_ID_INDEX_BITS)
+#define shm_make_id(index, gen)	((index) | ((gen) << TIMER_ID_INDEX_BITS))
+///定时器的间隔对应的时间片数，interval不小于time_slot，因此至少为1
+#define shm_slots(hdr, interval)	((interval) / (hdr)->time_slot)
+#define SHM_GEN_MASK		((1U << (32 - TIMER_ID_INDEX_BITS)) - 1)
+
+///时间片，slots[slot_num]是到期等待执行的链表
+struct shm_slot {
+    uint32_t head;
+    uint32_t cnt;
+};
+
+///共享内存中的定时器节点
+struct shm_node {
+    uint32_t next;
+    uint32_t prev;
+    ///所在时间片在slots[]中的下标，SHM_SLOT_NONE表示空闲
+    uint32_t slot;
+    ///id的高位，节点释放后加1，旧的id失效
+    uint32_t gen;
+    ///时间轮圈数
+    uint32_t round;
+    uint32_t used;
+    ///到期的时间片(绝对值)
+    uint64_t expires;
+    timer_type type;
+    timer_run_type run_type;
+    unsigned int interval;
+    unsigned int slack;
+    int param_len;
+    timer_param_mode param_mode;
+    ///只在fork自同一进程的进程之间有效
+    void *(*cb)(void *);
+    ///TIMER_PARAM_REF方式的param
+    void *param;
+    uint64_t param_buf[TIMER_SHM_PARAM_SIZE / sizeof(uint64_t)];
+};
+
+///共享内存区域的头部，后面是slots[slot_num + 1]和nodes[timer_max_num + 1]
+struct shm_header {
+    char magic[8];
+    unsigned int version;
+    ///创建者初始化完成后置1
+    int ready;
+    uint64_t size;
+    uint64_t slots_off;
+    uint64_t nodes_off;
+    unsigned int time_slot;
+    unsigned int slot_num;
+    unsigned int timer_max_num;
+    timer_clock_type clock_type;
+    ///进程间共享的robust锁，持有锁的进程退出后其他进程仍然可以加锁
+    pthread_mutex_t lock;
+    ///区域创建的时间和之后已经处理的时间片数
+    struct timespec tick_base;
+    uint64_t ticks;
+    unsigned int cur_slot;
+    unsigned int timer_num;
+    uint32_t free_head;
+    ///futex，空的时间轮加入定时器时加1并唤醒各进程的tick线程
+    uint32_t wake;
+    struct timer_overrun overrun;
+    struct timer_stats_internal stats;
+};
+
+struct timer_shm_internal {
+    TIMER_BOOL(*init)(TIMER_MANAGER *this, struct timer_manager_conf *conf);
+    timer_id(*add)(TIMER_MANAGER *this, struct timer *timer);
+    TIMER_BOOL(*del)(TIMER_MANAGER *this, timer_id id);
+    TIMER_BOOL(*mod)(TIMER_MANAGER *this, timer_id id, unsigned int interval);
+    void (*enable)(TIMER_MANAGER *this);
+    void (*disable)(TIMER_MANAGER *this);
+    void (*start)(TIMER_MANAGER *this, timer_start_type type);
+    void (*stop)(TIMER_MANAGER *this);
+    void (*close)(TIMER_MANAGER *this);
+    void (*set_executor)(TIMER_MANAGER *this, TIMER_EXECUTOR *executor);
+    int (*get_fd)(TIMER_MANAGER *this);
+    unsigned int (*process_expired)(TIMER_MANAGER *this, const struct timespec *now);
+    void (*get_overrun)(TIMER_MANAGER *this, struct timer_overrun *overrun);
+    unsigned int (*add_batch)(TIMER_MANAGER *this, struct timer *timers, unsigned int n, timer_id *ids);
+    unsigned int (*del_batch)(TIMER_MANAGER *this, const timer_id *ids, unsigned int n);
+    void (*get_stats)(TIMER_MANAGER *this, struct timer_stats *stats);
+    TIMER_BOOL(*set_trace)(TIMER_MANAGER *this, unsigned int events);
+    TIMER_BOOL(*dump_trace)(TIMER_MANAGER *this, const char *path);
+    TIMER_BOOL(*snapshot)(TIMER_MANAGER *this, const char *path);
+    TIMER_BOOL(*restore)(TIMER_MANAGER *this, const char *path);
+
+    char *name;
+    struct shm_header *hdr;
+    ///本进程中的映射地址
+    struct shm_slot *slots;
+    struct shm_node *nodes;
+    clockid_t clock_id;
+    ///EMBED方式下每个时间片可读一次
+    int timerfd;
+    int init_flag;
+    volatile int start_flag;
+    timer_start_type start_type;
+    pthread_t tid;
+    ///阻止本进程add
+    int enable_flag;
+    TIMER_EXECUTOR *executor;
+    struct timer_trace trace;
+};
+
+///到期后在锁外执行的回调
+struct shm_fired {
+    void *(*cb)(void *);
+    void *param;
+    timer_run_type run_type;
+    timer_id id;
+    ///拷贝到buf中的param长度，THREAD回调投递时再复制一份交给执行器
+    int param_len;
+    uint64_t buf[TIMER_SHM_PARAM_SIZE / sizeof(uint64_t)];
+};
+
+static TIMER_BOOL shm_init(TIMER_MANAGER *this, struct timer_manager_conf *conf);
+static timer_id shm_add(TIMER_MANAGER *this, struct timer *timer);
+static TIMER_BOOL shm_del(TIMER_MANAGER *this, timer_id id);
+static TIMER_BOOL shm_mod(TIMER_MANAGER *this, timer_id id, unsigned int interval);
+static void shm_enable(TIMER_MANAGER *this);
+static void shm_disable(TIMER_MANAGER *this);
+static void shm_start(TIMER_MANAGER *this, timer_start_type type);
+static void shm_stop(TIMER_MANAGER *this);
+static void shm_close(TIMER_MANAGER *this);
+static void shm_set_executor(TIMER_MANAGER *this, TIMER_EXECUTOR *executor);
+static int shm_get_fd(TIMER_MANAGER *this);
+static unsigned int shm_process_expired(TIMER_MANAGER *this, const struct timespec *now);
+static void shm_get_overrun(TIMER_MANAGER *this, struct timer_overrun *overrun);
+static unsigned int shm_add_batch(TIMER_MANAGER *this, struct timer *timers, unsigned int n, timer_id *ids);
+static unsigned int shm_del_batch(TIMER_MANAGER *this, const timer_id *ids, unsigned int n);
+static void shm_get_stats(TIMER_MANAGER *this, struct timer_stats *stats);
+static TIMER_BOOL shm_set_trace(TIMER_MANAGER *this, unsigned int events);
+static TIMER_BOOL shm_dump_trace(TIMER_MANAGER *this, const char *path);
+static TIMER_BOOL shm_snapshot(TIMER_MANAGER *this, const char *path);
+static TIMER_BOOL shm_restore(TIMER_MANAGER *this, const char *path);
+static void *shm_entry(void *p);
+
+/* ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  == */
+
+static void shm_lock(struct timer_shm_internal *this);
+static void shm_unlock(struct timer_shm_internal *this);
+static TIMER_BOOL shm_map(struct timer_shm_internal *this, struct timer_manager_conf *conf);
+static inline uint64_t shm_due(struct timer_shm_internal *this, const struct timespec *now);
+static inline void slot_link(struct timer_shm_internal *this, uint32_t index, uint32_t slot);
+static inline void slot_unlink(struct timer_shm_internal *this, uint32_t index);
+static inline void shm_wheel_link(struct timer_shm_internal *this, uint32_t index, uint64_t steps);
+static inline uint64_t shm_steps(struct timer_shm_internal *this, struct shm_node *node, uint64_t target);
+static inline struct shm_node *shm_lookup(struct timer_shm_internal *this, timer_id id);
+static inline void shm_free(struct timer_shm_internal *this, uint32_t index);
+static timer_id shm_alloc(struct timer_shm_internal *this, struct timer *timer, uint64_t target);
+static TIMER_BOOL shm_check(struct timer_shm_internal *this, struct timer *timer);
+static void shm_free_all(struct timer_shm_internal *this);
+static unsigned int shm_advance(struct timer_shm_internal *this, const struct timespec *now);
+static void shm_futex_wait(uint32_t *addr, uint32_t val, const struct timespec *timeout);
+static void shm_futex_wake(uint32_t *addr);
+
+/**
+ * @brief	create_shm_timer_manager
+ *
+ * 创建共享内存时间轮的句柄，init时才打开或创建区域
+ *
+ * @param	name	shm_open的名字，以/开头
+ *
+ * @return	定时器管理对象指针，必须用destroy_shm_timer_manager销毁
+ */
+TIMER_MANAGER *create_shm_timer_manager(const char *name)
+{
+    struct timer_shm_internal *p;
+
+    if(name == NULL) {
+        return NULL;
+    }
+
+    if((p = malloc(sizeof(struct timer_shm_internal))) == NULL) {
+        perror("malloc failed");
+        return NULL;
+    }
+
+    memset(p, 0, sizeof(struct timer_shm_internal));
+
+    if((p->name = strdup(name)) == NULL) {
+        perror("malloc failed");
+        free(p);
+        return NULL;
+    }
+
+    p->init = shm_init;
+    p->add = shm_add;
+    p->del = shm_del;
+    p->mod = shm_mod;
+    p->enable = shm_enable;
+    p->disable = shm_disable;
+    p->start = shm_start;
+    p->stop = shm_stop;
+    p->close = shm_close;
+    p->set_executor = shm_set_executor;
+    p->get_fd = shm_get_fd;
+    p->process_expired = shm_process_expired;
+    p->get_overrun = shm_get_overrun;
+    p->add_batch = shm_add_batch;
+    p->del_batch = shm_del_batch;
+    p->get_stats = shm_get_stats;
+    p->set_trace = shm_set_trace;
+    p->dump_trace = shm_dump_trace;
+    p->snapshot = shm_snapshot;
+    p->restore = shm_restore;
+    p->timerfd = -1;
+    return (TIMER_MANAGER *)p;
+}
+
+/**
+ * @brief	destroy_shm_timer_manager
+ *
+ * 解除本进程的映射并释放句柄，区域和其中的定时器保留，见unlink_shm_timer_manager
+ *
+ * @param	this
+ */
+void destroy_shm_timer_manager(TIMER_MANAGER *this)
+{
+    struct timer_shm_internal *p = (struct timer_shm_internal *)this;
+
+    if(this == NULL) {
+        return;
+    }
+
+    p->close(this);
+    timer_trace_free(&p->trace);
+    free(p->name);
+    free(p);
+}
+
+TIMER_BOOL unlink_shm_timer_manager(const char *name)
+{
+    if(name == NULL || shm_unlink(name) == -1) {
+        return TIMER_FALSE;
+    }
+
+    return TIMER_TRUE;
+}
+
+/**
+ * @brief	shm_init
+ *
+ * 区域不存在时按conf创建，已经存在时直接映射，此时conf中的时间片参数被忽略
+ *
+ * @param	this
+ * @param	conf	只支持单级时间轮，submit_queue_len被忽略
+ *
+ * @return	库布尔值
+ */
+static TIMER_BOOL shm_init(TIMER_MANAGER *this, struct timer_manager_conf *conf)
+{
+    struct timer_shm_internal *p = (struct timer_shm_internal *)this;
+
+    if(this == NULL || conf == NULL) {
+        return TIMER_FALSE;
+    }
+
+    if(p->init_flag) {
+        fprintf(stderr, "TIMER Manager has been init\n");
+        return TIMER_FALSE;
+    }
+
+    if(shm_map(p, conf) == TIMER_FALSE) {
+        return TIMER_FALSE;
+    }
+
+    p->clock_id = timer_clock_id(p->hdr->clock_type);
+
+    if((p->timerfd = timerfd_create(p->clock_id, TFD_NONBLOCK)) == -1) {
+        perror("create timerfd failed");
+        munmap(p->hdr, p->hdr->size);
+        p->hdr = NULL;
+        return TIMER_FALSE;
+    }
+
+    p->enable_flag = 1;
+    p->init_flag = 1;
+    return TIMER_TRUE;
+}
+
+/**
+ * @brief	shm_map
+ *
+ * 区域不存在时用O_EXCL决定谁是创建者；其他进程等到创建者初始化完成(ready)后再映射整个区域
+ *
+ * @param	this
+ * @param	conf
+ *
+ * @return	库布尔值
+ */
+static TIMER_BOOL shm_map(struct timer_shm_internal *this, struct timer_manager_conf *conf)
+{
+    struct shm_header *hdr;
+    struct stat st;
+    pthread_mutexattr_t attr;
+    uint64_t slots_off, nodes_off, size;
+    struct timespec wait = {0, NSEC_PER_MSEC};
+    unsigned int i;
+    int fd, created = 0, waited = 0;
+
+    ///区域已经存在时不检查conf
+    if((fd = shm_open(this->name, O_RDWR, 0600)) == -1 && errno == ENOENT) {
+        if(conf->wheel_type != TIMER_WHEEL_SINGLE || conf->time_slot == 0 || conf->slot_num == 0 || conf->timer_max_num == 0
+                || conf->timer_max_num >= (1U << TIMER_ID_INDEX_BITS) || !check_clock_type(conf->clock_type)) {
+            fprintf(stderr, "timer manager conf is illegal\n");
+            return TIMER_FALSE;
+        }
+
+        fd = shm_open(this->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        created = fd != -1;
+
+        ///其他进程同时创建
+        if(fd == -1 && errno == EEXIST) {
+            fd = shm_open(this->name, O_RDWR, 0600);
+        }
+    }
+
+    if(fd == -1) {
+        perror("open shared memory failed");
+        return TIMER_FALSE;
+    }
+
+    if(created) {
+        slots_off = (sizeof(struct shm_header) + 63) & ~63ULL;
+        nodes_off = (slots_off + sizeof(struct shm_slot) * (conf->slot_num + 1) + 63) & ~63ULL;
+        size = nodes_off + sizeof(struct shm_node) * ((uint64_t)conf->timer_max_num + 1);
+
+        if(ftruncate(fd, size) == -1 || (hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+            perror("create shared memory failed");
+            close(fd);
+            shm_unlink(this->name);
+            return TIMER_FALSE;
+        }
+
+        close(fd);
+        ///ftruncate出来的内存已经是0
+        memcpy(hdr->magic, SHM_MAGIC, sizeof(hdr->magic));
+        hdr->version = SHM_VERSION;
+        hdr->size = size;
+        hdr->slots_off = slots_off;
+        hdr->nodes_off = nodes_off;
+        hdr->time_slot = conf->time_slot;
+        hdr->slot_num = conf->slot_num;
+        hdr->timer_max_num = conf->timer_max_num;
+        hdr->clock_type = conf->clock_type;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&hdr->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+        clock_gettime(timer_clock_id(conf->clock_type), &hdr->tick_base);
+        this->hdr = hdr;
+        this->slots = (struct shm_slot *)((char *)hdr + slots_off);
+        this->nodes = (struct shm_node *)((char *)hdr + nodes_off);
+
+        for(i = 1; i <= conf->timer_max_num; ++i) {
+            this->nodes[i].slot = SHM_SLOT_NONE;
+            this->nodes[i].next = i < conf->timer_max_num ? i + 1 : SHM_NIL;
+        }
+
+        hdr->free_head = 1;
+        __atomic_store_n(&hdr->ready, 1, __ATOMIC_RELEASE);
+        return TIMER_TRUE;
+    }
+
+    ///创建者可能还没有ftruncate
+    while(fstat(fd, &st) == 0 && (uint64_t)st.st_size < sizeof(struct shm_header) && waited++ < SHM_ATTACH_WAIT) {
+        nanosleep(&wait, NULL);
+    }
+
+    if((uint64_t)st.st_size < sizeof(struct shm_header)
+            || (hdr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        fprintf(stderr, "shared memory %s is not a timer manager\n", this->name);
+        close(fd);
+        return TIMER_FALSE;
+    }
+
+    close(fd);
+
+    while(!__atomic_load_n(&hdr->ready, __ATOMIC_ACQUIRE) && waited++ < SHM_ATTACH_WAIT) {
+        nanosleep(&wait, NULL);
+    }
+
+    if(!hdr->ready || memcmp(hdr->magic, SHM_MAGIC, sizeof(hdr->magic)) != 0 || hdr->version != SHM_VERSION
+            || hdr->size != (uint64_t)st.st_size) {
+        fprintf(stderr, "shared memory %s is not a timer manager\n", this->name);
+        munmap(hdr, st.st_size);
+        return TIMER_FALSE;
+    }
+
+    this->hdr = hdr;
+    this->slots = (struct shm_slot *)((char *)hdr + hdr->slots_off);
+    this->nodes = (struct shm_node *)((char *)hdr + hdr->nodes_off);
+    return TIMER_TRUE;
+}
+
+/**
+ * @brief	shm_lock
+ *
+ * 持有锁的进程异常退出时，它正在修改的节点可能不一致，这里只恢复锁本身
+ *
+ * @param	this
+ */
+static void shm_lock(struct timer_shm_internal *this)
+{
+    if(pthread_mutex_lock(&this->hdr->lock) == EOWNERDEAD) {
+        fprintf(stderr, "timer manager lock owner died\n");
+        pthread_mutex_consistent(&this->hdr->lock);
+    }
+}
+
+static void shm_unlock(struct timer_shm_internal *this)
+{
+    pthread_mutex_unlock(&this->hdr->lock);
+}
+
+static timer_id shm_add(TIMER_MANAGER *this, struct timer *timer)
+{
+    struct timer_shm_internal *p = (struct timer_shm_internal *)this;
+    struct timespec now;
+    timer_id id;
+
+    if(this == NULL || timer == NULL || p->init_flag == 0 || shm_check(p, timer) == TIMER_FALSE) {
+        return 0;
+    }
+
+    if(p->enable_flag == 0) {
+        fprintf(stderr, "TIMER Manager has been disable\n");
+        return 0;
+    }
+
+    if(clock_gettime(p->clock_id, &now) == -1) {
+        return 0;
+    }
+
+    shm_lock(p);
+    id = shm_alloc(p, timer, shm_due(p, &now) + shm_slots(p->hdr, timer->interval));
+    shm_unlock(p);
+
+    if(id != 0) {
+        timer_stat_add(p->hdr->stats.adds, 1);
+        timer_trace_record(&p->trace, TIMER_TRACE_ADD, id, timer->interval);
+    }
+
+    return id;
+}
+
+/**
+ * @brief	shm_alloc
+ *
+ * 从空闲链表取出节点并挂到时间轮上，调用者持有锁
+ *
+ * @param	this
+ * @param	timer
+ * @param	target	到期的时间片(绝对值)
+ *
+ * @return	timer_id，没有空闲节点时为0
+ */
+static timer_id shm_alloc(struct timer_shm_internal *this, struct timer *timer, uint64_t target)
+{
+    struct shm_header *hdr = this->hdr;
+    struct shm_node *node;
+    uint32_t index = hdr->free_head;
+
+    if(index == SHM_NIL) {
+        fprintf(stderr, "ACHIEVE TIMER MAX NUMBER\n");
+        return 0;
+    }
+
+    node = &this->nodes[index];
+    hdr->free_head = node->next;
+    node->used = 1;
+    node->type = timer->type;
+    node->run_type = timer->run_type;
+    node->interval = timer->interval;
+    node->slack = timer->slack;
+    node->cb = timer->cb;
+    node->param_mode = timer->param_mode;
+    node->param_len = timer->param_len;
+    node->param = timer->param_mode == TIMER_PARAM_REF ? timer->param : NULL;
+
+    if(timer->param_mode == TIMER_PARAM_COPY && timer->param_len > 0) {
+        memcpy(node->param_buf, timer->param, timer->param_len);
+    }
+
+    shm_wheel_link(this, index, shm_steps(this, node, target));
+
+    ///空的时间轮上各进程的tick线程都在无限期等待
+    if(hdr->timer_num++ == 0) {
+        __atomic_fetch_add(&hdr->wake, 1, __ATOMIC_RELEASE);
+        shm_futex_wake(&hdr->wake);
+    }
+
+    return shm_make_id(index, node->gen);
+}
+
+static TIMER_BOOL shm_check(struct timer_shm_internal *this, struct timer *timer)
+{
+    if(timer->interval < this->hdr->time_slot || timer->cb == NULL) {
+        fprintf(stderr, "timer is illegal \n");
+        return TIMER_FALSE;
+    }
+
+    if(timer->param_mode == TIMER_PARAM_COPY
+            && (timer->param_len < 0 || timer->param_len > TIMER_SHM_PARAM_SIZE || (timer->param == NULL) != (timer->param_len == 0))) {
+        fprintf(stderr, "timer's param and param_len is not conform\n");
+        return TIMER_FALSE;
+    }
+
+    return TIMER_TRUE;
+}
+
+static TIMER_BOOL shm_del(TIMER_MANAGER *this, timer_id id)
+{
+    struct timer_shm_internal *p = (struct timer_shm_internal *)this;
+    struct shm_node *node;
+
+    if(this == NULL || p->init_flag == 0) {
+        return TIMER_FALSE;
+    }
+
+    shm_lock(p);
+
+    if(id == 0) {
+        shm_free_all(p);
+    } else if((node = shm_lookup(p, id)) != NULL) {
+        shm_free(p, shm_index(id));
+    } else {
+        shm_unlock(p);
+        return TIMER_FALSE;
+    }
+
+    shm_unlock(p);
+    timer_stat_add(p->hdr->stats.dels, 1);
+    timer_trace_record(&p->trace, TIMER_TRACE_DEL, id, 0);
+    return TIMER_TRUE;
+}
+
+static TIMER_BOOL shm_mod(TIMER_MANAGER *this, timer_id id, unsigned int interval)
+{
+    struct timer_shm_internal *p = (struct timer_shm_internal *)this;
+    struct shm_node *node;
+    struct timespec now;
+
+    if(this == NULL || p->init_flag == 0 || (interval != 0 && interval < p->hdr->time_slot)) {
+        return TIMER_FALSE;
+    }
+
+    if(clock_gettime(p->clock_id, &now) == -1) {
+        return TIMER_FALSE;
+    }
+
+    shm_lock(p);
+
+    if((node = shm_lookup(p, id)) == NULL) {
+        shm_unlock(p);
+        return TIMER_FALSE;
+    }
+
+    if(interval != 0) {
+        node->interval = interval;
+    }
+
+    slot_unlink(p, shm_index(id));
+    shm_wheel_link(p, shm_index(id), shm_steps(p, node, shm_due(p, &now) + shm_slots(p->hdr, node->interval)));
+    shm_unlock(p);
+    timer_stat_add(p->hdr->stats.mods, 1);
+    timer_trace_record(&p->trace, TIMER_TRACE_MOD, id, interval);
+    return TIMER_TRUE;
+}
+
+static unsigned int shm_add_batch(TIMER_MANAGER *this, struct timer *timers, unsigned int n, timer_id *ids)
+{
+    struct timer_shm_internal *p = (struct timer_shm_internal *)this;
+    struct timespec now;
+    unsigned int i, num = 0;
+    timer_id id;
+
+    if(ids != NULL) {
+        memset(ids, 0, sizeof(timer_id) * n);
+    }
+
+    if(this == NULL || timers == NULL || p->init_flag == 0 || p->enable_flag == 0 || clock_gettime(p->clock_id, &now) == -1) {
+        return 0;
+    }
+
+    shm_lock(p);
+
+    for(i = 0; i < n; ++i) {
+        if(shm_check(p, &timers[i]) == TIMER_FALSE) {
+            continue;
+        }
+
+        if((id = shm_alloc(p, &timers[i], shm_due(p, &now) + shm_slots(p->hdr, timers[i].interval))) == 0) {
+            break;
+        }
+
+        if(ids != NULL) {
+            ids[i] = id;
+        }
+
+        timer_trace_record(&p->trace, TIMER_TRACE_ADD, id, timers[i].interval);
+        ++num;
+    }
+
+    shm_unlock(p);
+    timer_stat_add(p->hdr->stats.adds, num);
+    return num;
+}
+
+static unsigned int shm_del_batch(TIMER_MANAGER *this, const timer_id *ids, unsigned int n)
+{
+    struct timer_shm_internal *p = (struct timer_shm_internal *)this;
+    unsigned int i, num = 0;
+
+    if(this == NULL || ids == NULL || p->init_flag == 0) {
+        return 0;
+    }
+
+    shm_lock(p);
+
+    for(i = 0; i < n; ++i) {
+        if(ids[i] != 0 && shm_lookup(p, ids[i]) != NULL) {
+            shm_free(p, shm_index(ids[i]));
+            timer_trace_record(&p->trace, TIMER_TRACE_DEL, ids[i], 0);
+            ++num;
+        }
+    }
+
+    shm_unlock(p);
+    timer_stat_add(p->hdr->stats.dels, num);
+    return num;
+}
+
+static inline struct shm_node *shm_lookup(struct timer_shm_internal *this, timer_id id)
+{
+    uint32_t index = shm_index(id);
+    struct shm_node *node;
+
+    if(index == SHM_NIL || index > this->hdr->timer_max_num) {
+        return NULL;
+    }
+
+    node = &this->nodes[index];
+    return node->used && node->gen == shm_gen(id) ? node : NULL;
+}
+
+///从时间轮上摘下并放回空闲链表，旧的id失效，调用者持有锁
+static inline void shm_free(struct timer_shm_internal *this, uint32_t index)
+{
+    struct shm_node *node = &this->nodes[index];
+
+    slot_unlink(this, index);
+    node->used = 0;
+    node->gen = (node->gen + 1) & SHM_GEN_MASK;
+    node->next = this->hdr->free_head;
+    this->hdr->free_head = index;
+    --this->hdr->timer_num;
+}
+
+static void shm_free_all(struct timer_shm_internal *this)
+{
+    uint32_t i;
+
+    for(i = 1; i <= this->hdr->timer_max_num; ++i) {
+        if(this->nodes[i].used) {
+            shm_free(this, i);
+        }
+    }
+}
+
+///挂到slots[slot]链表头部
+static inline void slot_link(struct timer_shm_internal *this, uint32_t index, uint32_t slot)
+{
+    struct shm_slot *s = &this->slots[slot];
+    struct shm_node *node = &this->nodes[index];
+
+    node->slot = slot;
+    node->prev = SHM_NIL;
+    node->next = s->head;
+
+    if(s->head != SHM_NIL) {
+        this->nodes[s->head].prev = index;
+    }
+
+    s->head = index;
+    ++s->cnt;
+}
+
+static inline void slot_unlink(struct timer_shm_internal *this, uint32_t index)
+{
+    struct shm_node *node = &this->nodes[index];
+    struct shm_slot *s;
+
+    if(node->slot == SHM_SLOT_NONE) {
+        return;
+    }
+
+    s = &this->slots[node->slot];
+
+    if(node->prev != SHM_NIL) {
+        this->nodes[node->prev].next = node->next;
+    } else {
+        s->head = node->next;
+    }
+
+    if(node->next != SHM_NIL) {
+        this->nodes[node->next].prev = node->prev;
+    }
+
+    --s->cnt;
+    node->slot = SHM_SLOT_NONE;
+    node->next = node->prev = SHM_NIL;
+}
+
+/**
+ * @brief	shm_wheel_link
+ *
+ * 挂到steps个时间片之后，steps不小于1
+ *
+ * @param	this
+ * @param	index
+ * @param	steps	相对已经处理到的时间片(hdr->ticks)
+ */
+static inline void shm_wheel_link(struct timer_shm_internal *this, uint32_t index, uint64_t steps)
+{
+    unsigned int n = this->hdr->slot_num;
+
+    this->nodes[index].round = (uint32_t)((steps - 1) / n);
+    slot_link(this, index, (uint32_t)((this->hdr->cur_slot + steps) % n));
+}
+
+/**
+ * @brief	shm_steps
+ *
+ * 时间轮可能落后于当前时间(没有进程在推进)，add/mod从当前时间对应的时间片开始计算
+ *
+ * @param	this
+ * @param	node
+ * @param	target	到期的时间片(绝对值)
+ *
+ * @return	相对hdr->ticks的时间片数，已经过期的为1
+ */
+static inline uint64_t shm_steps(struct timer_shm_internal *this, struct shm_node *node, uint64_t target)
+{
+    ///到期的时间片按slack对齐，相近的定时器挂到同一个时间片上
+    if(node->slack >= this->hdr->time_slot) {
+        target = timer_apply_slack(target, node->slack / this->hdr->time_slot);
+    }
+
+    return target > this->hdr->ticks ? target - this->hdr->ticks : 1;
+}
+
+///从创建区域到now为止的时间片数
+static inline uint64_t shm_due(struct timer_shm_internal *this, const struct timespec *now)
+{
+    int64_t ns = timer_timespec_ns(now) - timer_timespec_ns(&this->hdr->tick_base);
+
+    return ns > 0 ? (uint64_t)ns / (this->hdr->time_slot * NSEC_PER_MSEC) : 0;
+}
+
+/**
+ * @brief	shm_advance
+ *
+ * 推进到now对应的时间片，到期的定时器先移到slots[slot_num]上，再分批取出在锁外执行
+ *
+ * @param	this
+ * @param	now		为NULL时读取当前时间
+ *
+ * @return	本进程执行的到期定时器个数
+ */
+static unsigned int shm_advance(struct timer_shm_internal *this, const struct timespec *now)
+{
+    struct shm_header *hdr = this->hdr;
+    struct shm_fired fired[SHM_FIRE_BATCH];
+    struct timer_dispatch_batch batch;
+    struct shm_node *node;
+    struct timespec cur, start, end;
+    unsigned int n = hdr->slot_num, num = 0, k, i;
+    uint32_t index, next;
+    uint64_t due, lag, rot, slot_ns = hdr->time_slot * NSEC_PER_MSEC;
+    int64_t late;
+
+    if(now == NULL) {
+        if(clock_gettime(this->clock_id, &cur) == -1) {
+            return 0;
+        }
+
+        now = &cur;
+    }
+
+    due = shm_due(this, now);
+    shm_lock(this);
+
+    if(hdr->timer_num == 0) {
+        ///没有定时器时直接跳到due
+        if(due > hdr->ticks) {
+            hdr->cur_slot = (hdr->cur_slot + (due - hdr->ticks)) % n;
+            hdr->ticks = due;
+        }
+    } else if(due > hdr->ticks) {
+        if((lag = due - hdr->ticks - 1) > 0) {
+            ++hdr->overrun.events;
+            hdr->overrun.missed += lag;
+
+            if(lag > hdr->overrun.max_missed) {
+                hdr->overrun.max_missed = lag;
+            }
+
+            timer_trace_record(&this->trace, TIMER_TRACE_OVERRUN, 0, timer_trace_arg(lag));
+        }
+
+        ///落后超过一圈时先整圈地减少圈数，只逐个处理最后不到两圈的时间片
+        if((rot = (due - hdr->ticks - 1) / n) > 0) {
+            for(i = 1; i <= hdr->timer_max_num; ++i) {
+                node = &this->nodes[i];
+
+                if(node->used && node->slot < n) {
+                    node->round = node->round > rot ? node->round - (uint32_t)rot : 0;
+                }
+            }
+
+            hdr->ticks += rot * n;
+        }
+
+        while(hdr->ticks < due) {
+            ++hdr->ticks;
+            hdr->cur_slot = hdr->cur_slot == n - 1 ? 0 : hdr->cur_slot + 1;
+
+            for(index = this->slots[hdr->cur_slot].head; index != SHM_NIL; index = next) {
+                node = &this->nodes[index];
+                next = node->next;
+
+                if(node->round == 0) {
+                    slot_unlink(this, index);
+                    node->expires = hdr->ticks;
+                    slot_link(this, index, n);
+                } else {
+                    --node->round;
+                }
+            }
+        }
+    }
+
+    ///其他进程可能也在取到期链表，每个定时器只被取出一次
+    while(this->slots[n].head != SHM_NIL) {
+        timer_batch_init(&batch, this->executor);
+
+        for(k = 0; k < SHM_FIRE_BATCH && (index = this->slots[n].head) != SHM_NIL; ++k) {
+            node = &this->nodes[index];
+            late = timer_timespec_ns(now) - timer_timespec_ns(&hdr->tick_base) - (int64_t)(node->expires * slot_ns);
+            timer_histogram_record(&hdr->stats.lateness, late > 0 ? late : 0);
+            fired[k].cb = node->cb;
+            fired[k].run_type = node->run_type;
+            fired[k].id = shm_make_id(index, node->gen);
+            timer_trace_record(&this->trace, TIMER_TRACE_EXPIRE, fired[k].id, late > 0 ? timer_trace_arg(late / 1000) : 0);
+
+            ///节点解锁后可能被其他进程释放或复用，拷贝方式的param先复制出来
+            fired[k].param_len = 0;
+
+            if(node->param_mode == TIMER_PARAM_REF) {
+                fired[k].param = node->param;
+            } else if(node->param_len == 0) {
+                fired[k].param = NULL;
+            } else {
+                fired[k].param_len = node->param_len;
+                memcpy(fired[k].buf, node->param_buf, node->param_len);
+                fired[k].param = fired[k].buf;
+            }
+
+            if(node->type == REPEAT) {
+                slot_unlink(this, index);
+                shm_wheel_link(this, index, shm_steps(this, node, hdr->ticks + shm_slots(hdr, node->interval)));
+            } else {
+                shm_free(this, index);
+            }
+        }
+
+        shm_unlock(this);
+        num += k;
+
+        for(i = 0; i < k; ++i) {
+            if(fired[i].run_type == THREAD) {
+                ///fired[]在下一轮会被覆盖，执行器持有自己的副本
+                timer_batch_add(&batch, fired[i].cb, fired[i].param, fired[i].param_len);
+            } else if(fired[i].run_type == SIGNAL) {
+                kill(getpid(), SIGALRM);
+            } else {
+                clock_gettime(this->clock_id, &start);
+                timer_trace_record(&this->trace, TIMER_TRACE_CB_START, fired[i].id, 0);
+                fired[i].cb(fired[i].param);
+                timer_trace_record(&this->trace, TIMER_TRACE_CB_END, fired[i].id, 0);
+                clock_gettime(this->clock_id, &end);
+                timer_histogram_record(&hdr->stats.callback, timer_timespec_ns(&end) - timer_timespec_ns(&start));
+            }
+        }
+
+        timer_executor_flush(&batch);
+        shm_lock(this);
+    }
+
+    shm_unlock(this);
+    timer_stat_add(hdr->stats.expirations, num);
+    return num;
+}
+
+static void shm_futex_wait(uint32_t *addr, uint32_t val, const struct timespec *timeout)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static void shm_futex_wake(uint32_t *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/**
+ * @brief	shm_entry
+ *
+ * tick线程：有定时器时睡到下一个时间片，没有时在futex上等待其他进程add
+ *
+ * @param	p
+ *
+ * @return
+ */
+static void *shm_entry(void *p)
+{
+    struct timer_shm_internal *this = (struct timer_shm_internal *)p;
+    struct shm_header *hdr = this->hdr;
+    struct timespec now, timeout;
+    uint64_t slot_ns = hdr->time_slot * NSEC_PER_MSEC;
+    int64_t wait;
+    uint32_t seen;
+
+    while(this->start_flag) {
+        shm_advance(this, NULL);
+        seen = __atomic_load_n(&hdr->wake, __ATOMIC_ACQUIRE);
+
+        if(__atomic_load_n(&hdr->timer_num, __ATOMIC_RELAXED) == 0) {
+            ///stop也会唤醒，超时只是为了防止漏掉唤醒
+            timeout.tv_sec = 1;
+            timeout.tv_nsec = 0;
+        } else {
+            clock_gettime(this->clock_id, &now);
+            wait = timer_timespec_ns(&hdr->tick_base) + (int64_t)((shm_due(this, &now) + 1) * slot_ns) - timer_timespec_ns(&now);
+            timeout.tv_sec = wait / 1000000000LL;
+            timeout.tv_nsec = wait % 1000000000LL;
+        }
+
+        if(this->start_flag) {
+            shm_futex_wait(&hdr->wake, seen, &timeout);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief	shm_start
+ *
+ * 每个进程独立开启；EMBED方式下timerfd每个时间片可读一次，其他进程add的定时器也能按时处理
+ *
+ * @param	this
+ * @param	type
+ */
+static void shm_start(TIMER_MANAGER *this, timer_start_type type)
+{
+    struct timer_shm_internal *p = (struct timer_shm_internal *)this;
+    struct itimerspec its;
+    struct timespec now;
+    uint64_t slot_ns;
+    int64_t first;
+
+    if(this == NULL || p->init_flag == 0 || p->start_flag) {
+        return;
+    }
+
+    p->start_flag = 1;
+    p->start_type = type;
+
+    switch(type) {
+        case TIMER_START_EMBED:
+            slot_ns = p->hdr->time_slot * NSEC_PER_MSEC;
+            clock_gettime(p->clock_id, &now);
+            first = timer_timespec_ns(&p->hdr->tick_base) + (int64_t)((shm_due(p, &now) + 1) * slot_ns) - timer_timespec_ns(&now);
+            its.it_value.tv_sec = first / 1000000000LL;
+            its.it_value.tv_nsec = first % 1000000000LL;
+            its.it_interval.tv_sec = slot_ns / 1000000000ULL;
+            its.it_interval.tv_nsec = slot_ns % 1000000000ULL;
+            timerfd_settime(p->timerfd, 0, &its, NULL);
+            break;
+        case TIMER_START_UNBLOCK:
+        case TIMER_START_BLOCK:
+
+            if(pthread_create(&p->tid, NULL, shm_entry, p) != 0) {
+                perror("create timer thread failed");
+                p->start_flag = 0;
+                return;
+            }
+
+            if(type == TIMER_START_BLOCK && pthread_join(p->tid, NULL) != 0) {
+                perror("block failed");
+            }
+
+            break;
+        default:
+            p->start_flag = 0;
+            break;
+    }
+}
+
+static void shm_stop(TIMER_MANAGER *this)
+{
+    struct timer_shm_internal *p = (struct timer_shm_internal *)this;
+    struct itimerspec its;
+
+    if(this == NULL || p->start_flag == 0) {
+        return;
+    }
+
+    p->start_flag = 0;
+
+    if(p->start_type == TIMER_START_EMBED) {
+        memset(&its, 0, sizeof(its));
+        timerfd_settime(p->timerfd, 0, &its, NULL);
+        return;
+    }
+
+    ///会把其他进程的tick线程也唤醒一次，它们重新计算睡眠时间
+    __atomic_fetch_add(&p->hdr->wake, 1, __ATOMIC_RELEASE);
+    shm_futex_wake(&p->hdr->wake);
+
+    ///BLOCK方式由start的调用者回收线程，在回调中stop时不能等待自己
+    if(p->start_type == TIMER_START_UNBLOCK) {
+        if(pthread_equal(pthread_self(), p->tid)) {
+            pthread_detach(p->tid);
+        } else {
+            pthread_join(p->tid, NULL);
+        }
+    }
+}
+
+/**
+ * @brief	shm_close
+ *
+ * 只解除本进程的映射，区域中的定时器保留给其他进程
+ *
+ * @param	this
+ */
+static void shm_close(TIMER_MANAGER *this)
+{
+    struct timer_shm_internal *p = (struct timer_shm_internal *)this;
+
+    if(this == NULL || p->init_flag == 0) {
+        return;
+    }
+
+    shm_stop(this);
+    close(p->timerfd);
+    p->timerfd = -1;
+    munmap(p->hdr, p->hdr->size);
+    p->hdr = NULL;
+    p->slots = NULL;
+    p->nodes = NULL;
+    p->init_flag = 0;
+}
+
+static void shm_enable(TIMER_MANAGER *this)
+{
+    if(this != NULL) {
+        ((struct timer_shm_internal *)this)->enable_flag = 1;
+    }
+}
+
+static void shm_disable(TIMER_MANAGER *this)
+{
+    if(this != NULL) {
+        ((struct timer_shm_internal *)this)->enable_flag = 0;
+    }
+}
+
+static void shm_set_executor(TIMER_MANAGER *this, TIMER_EXECUTOR *executor)
+{
+    if(this != NULL) {
+        ((struct timer_shm_internal *)this)->executor = executor;
+    }
+}
+
+static int shm_get_fd(TIMER_MANAGER *this)
+{
+    struct timer_shm_internal *p = (struct timer_shm_internal *)this;
+
+    if(this == NULL || p->init_flag == 0) {
+        return -1;
+    }
+
+    return p->timerfd;
+}
+
+static unsigned int shm_process_expired(TIMER_MANAGER *this, const struct timespec *now)
+{
+    struct timer_shm_internal *p = (struct timer_shm_internal *)this;
+    uint64_t exp;
+
+    if(this == NULL || p->start_flag == 0 || p->start_type != TIMER_START_EMBED) {
+        return 0;
+    }
+
+    ///只是清除timerfd的可读状态
+    if(read(p->timerfd, &exp, sizeof(uint64_t)) != sizeof(uint64_t) && errno != EAGAIN) {
+        perror("read timerfd failed");
+    }
+
+    return shm_advance(p, now);
+}
+
+static void shm_get_overrun(TIMER_MANAGER *this, struct timer_overrun *overrun)
+{
+    struct timer_shm_internal *p = (struct timer_shm_internal *)this;
+
+    if(this == NULL || overrun == NULL || p->init_flag == 0) {
+        return;
+    }
+
+    shm_lock(p);
+    *overrun = p->hdr->overrun;
+    shm_unlock(p);
+}
+
+/**
+ * @brief	shm_get_stats
+ *
+ * 计数和直方图是所有进程共同累计的
+ *
+ * @param	this
+ * @param	stats
+ */
+static void shm_get_stats(TIMER_MANAGER *this, struct timer_stats *stats)
+{
+    struct timer_shm_internal *p = (struct timer_shm_internal *)this;
+    unsigned int i;
+
+    if(this == NULL || stats == NULL || p->init_flag == 0) {
+        return;
+    }
+
+    memset(stats, 0, sizeof(struct timer_stats));
+    timer_stats_copy(stats, &p->hdr->stats);
+    shm_lock(p);
+    stats->overrun = p->hdr->overrun;
+    stats->timers = p->hdr->timer_num;
+
+    for(i = 0; i < p->hdr->slot_num; ++i) {
+        if(p->slots[i].cnt > 0) {
+            ++stats->busy_slots;
+
+            if(p->slots[i].cnt > stats->max_slot_depth) {
+                stats->max_slot_depth = p->slots[i].cnt;
+            }
+        }
+    }
+
+    shm_unlock(p);
+}
+
+///跟踪环在本进程中，只记录本进程的操作和执行的回调
+static TIMER_BOOL shm_set_trace(TIMER_MANAGER *this, unsigned int events)
+{
+    if(this == NULL) {
+        return TIMER_FALSE;
+    }
+
+    return timer_trace_set(&((struct timer_shm_internal *)this)->trace, events);
+}
+
+static TIMER_BOOL shm_dump_trace(TIMER_MANAGER *this, const char *path)
+{
+    if(this == NULL) {
+        return TIMER_FALSE;
+    }
+
+    return timer_trace_dump(&((struct timer_shm_internal *)this)->trace, path);
+}
+
+/**
+ * @brief	shm_snapshot
+ *
+ * 区域本身在重启后仍然存在，快照用于重启机器或者换到新的区域
+ *
+ * @param	this
+ * @param	path
+ *
+ * @return	库布尔值
+ */
+static TIMER_BOOL shm_snapshot(TIMER_MANAGER *this, const char *path)
+{
+    struct timer_shm_internal *p = (struct timer_shm_internal *)this;
+    struct shm_header *hdr;
+    struct shm_node *node;
+    struct timer_snapshot s;
+    struct timer timer;
+    uint64_t remaining;
+    int64_t slot_ns;
+    uint32_t i;
+
+    if(this == NULL || path == NULL || p->init_flag == 0) {
+        return TIMER_FALSE;
+    }
+
+    hdr = p->hdr;
+    slot_ns = hdr->time_slot * NSEC_PER_MSEC;
+    timer_snapshot_init(&s, p->clock_id);
+    memset(&timer, 0, sizeof(timer));
+    shm_lock(p);
+
+    for(i = 1; i <= hdr->timer_max_num; ++i) {
+        node = &p->nodes[i];
+
+        if(!node->used) {
+            continue;
+        }
+
+        ///在到期链表上的定时器下一个时间片执行
+        if(node->slot == hdr->slot_num) {
+            remaining = 0;
+        } else {
+            remaining = (node->slot + hdr->slot_num - hdr->cur_slot - 1) % hdr->slot_num + 1 + (uint64_t)node->round * hdr->slot_num;
+        }
+
+        timer.type = node->type;
+        timer.run_type = node->run_type;
+        timer.interval = node->interval;
+        timer.slack = node->slack;
+        timer.cb = node->cb;
+        timer.param_mode = node->param_mode;
+        timer.param_len = node->param_len;
+        timer.param = node->param_mode == TIMER_PARAM_REF ? node->param : (node->param_len > 0 ? node->param_buf : NULL);
+
+        if(timer_snapshot_add(&s, &timer, timer_timespec_ns(&hdr->tick_base) + (int64_t)(hdr->ticks + remaining) * slot_ns) == TIMER_FALSE) {
+            shm_unlock(p);
+            timer_snapshot_free(&s);
+            return TIMER_FALSE;
+        }
+    }
+
+    shm_unlock(p);
+    return timer_snapshot_write(&s, path);
+}
+
+static TIMER_BOOL shm_restore(TIMER_MANAGER *this, const char *path)
+{
+    struct timer_shm_internal *p = (struct timer_shm_internal *)this;
+    struct timer_snapshot_file f;
+    struct timer timer;
+    unsigned long long i, num = 0;
+    int64_t deadline, base, slot_ns;
+    timer_id id;
+
+    if(this == NULL || path == NULL || p->init_flag == 0 || p->enable_flag == 0
+            || timer_snapshot_open(&f, path, p->clock_id) == TIMER_FALSE) {
+        return TIMER_FALSE;
+    }
+
+    base = timer_timespec_ns(&p->hdr->tick_base);
+    slot_ns = p->hdr->time_slot * NSEC_PER_MSEC;
+    shm_lock(p);
+
+    for(i = 0; i < f.header->count; ++i) {
+        deadline = timer_snapshot_get(&f, i, &timer);
+
+        if(shm_check(p, &timer) == TIMER_FALSE) {
+            continue;
+        }
+
+        if((id = shm_alloc(p, &timer, deadline > base ? (uint64_t)(deadline - base + slot_ns - 1) / slot_ns : 0)) == 0) {
+            break;
+        }
+
+        timer_trace_record(&p->trace, TIMER_TRACE_ADD, id, timer.interval);
+        ++num;
+    }
+
+    shm_unlock(p);
+    timer_stat_add(p->hdr->stats.adds, num);
+    i = f.header->count;
+    timer_snapshot_close(&f);
+    return num == i ? TIMER_TRUE : TIMER_FALSE;
+}
@@ -0,0 +1,649 @@
+#define _GNU_SOURCE
+#include "timer.h"
+#include "snapshot.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <link.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_INIT_CAP	64
+#define SNAPSHOT_BUILD_ID_MAX	64
+#define snapshot_align(n)	(((n) + 7) & ~7ULL)
+
+///登记了名字的回调
+struct snapshot_name {
+    char name[TIMER_SNAPSHOT_NAME_MAX + 1];
+    void *(*cb)(void *);
+};
+
+static pthread_mutex_t snapshot_names_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct snapshot_name *snapshot_names;
+static unsigned int snapshot_name_num, snapshot_name_cap;
+
+///dl_iterate_phdr查找模块的参数和结果
+struct snapshot_module {
+    uintptr_t addr;
+    uintptr_t base;
+    uintptr_t start;
+    uintptr_t end;
+    unsigned int id_len;
+    unsigned char id[SNAPSHOT_BUILD_ID_MAX];
+};
+
+static inline long long timespec_ns(const struct timespec *ts)
+{
+    return (long long)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+///clock_id的时间换算成CLOCK_REALTIME需要加上的纳秒数
+static long long snapshot_offset(clockid_t clock_id)
+{
+    struct timespec real, cur;
+
+    clock_gettime(clock_id, &cur);
+    clock_gettime(CLOCK_REALTIME, &real);
+    return timespec_ns(&real) - timespec_ns(&cur);
+}
+
+TIMER_BOOL timer_snapshot_register(const char *name, void *(*cb)(void *))
+{
+    unsigned int i;
+    size_t len;
+    void *mem;
+    TIMER_BOOL ret = TIMER_TRUE;
+
+    if(name == NULL || cb == NULL || (len = strlen(name)) == 0 || len > TIMER_SNAPSHOT_NAME_MAX) {
+        fprintf(stderr, "snapshot callback name is illegal\n");
+        return TIMER_FALSE;
+    }
+
+    pthread_mutex_lock(&snapshot_names_lock);
+
+    ///一个名字只对应一个回调，一个回调也只有一个名字，重复登记同样的一对没有影响
+    for(i = 0; i < snapshot_name_num; ++i) {
+        if(strcmp(snapshot_names[i].name, name) == 0 || snapshot_names[i].cb == cb) {
+            break;
+        }
+    }
+
+    if(i < snapshot_name_num) {
+        if(strcmp(snapshot_names[i].name, name) != 0 || snapshot_names[i].cb != cb) {
+            fprintf(stderr, "snapshot callback %s conflicts with a registered one\n", name);
+            ret = TIMER_FALSE;
+        }
+    } else if(snapshot_name_num == snapshot_name_cap
+              && (mem = realloc(snapshot_names, sizeof(struct snapshot_name) * (snapshot_name_cap > 0 ? snapshot_name_cap * 2 : 16))) == NULL) {
+        perror("malloc failed");
+        ret = TIMER_FALSE;
+    } else {
+        if(snapshot_name_num == snapshot_name_cap) {
+            snapshot_names = mem;
+            snapshot_name_cap = snapshot_name_cap > 0 ? snapshot_name_cap * 2 : 16;
+        }
+
+        memcpy(snapshot_names[snapshot_name_num].name, name, len + 1);
+        snapshot_names[snapshot_name_num++].cb = cb;
+    }
+
+    pthread_mutex_unlock(&snapshot_names_lock);
+    return ret;
+}
+
+///cb登记的名字拷贝到name(不含结束符)，返回长度，没有登记时返回0
+static unsigned int snapshot_name_of(void *(*cb)(void *), char *name)
+{
+    unsigned int i, len = 0;
+    pthread_mutex_lock(&snapshot_names_lock);
+
+    for(i = 0; i < snapshot_name_num; ++i) {
+        if(snapshot_names[i].cb == cb) {
+            len = strlen(snapshot_names[i].name);
+            memcpy(name, snapshot_names[i].name, len);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&snapshot_names_lock);
+    return len;
+}
+
+static void *(*snapshot_cb_of(const char *name, unsigned int len))(void *)
+{
+    unsigned int i;
+    void *(*cb)(void *) = NULL;
+    pthread_mutex_lock(&snapshot_names_lock);
+
+    for(i = 0; i < snapshot_name_num; ++i) {
+        if(strlen(snapshot_names[i].name) == len && memcmp(snapshot_names[i].name, name, len) == 0) {
+            cb = snapshot_names[i].cb;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&snapshot_names_lock);
+    return cb;
+}
+
+///读取模块PT_NOTE段中的GNU build-id，没有时返回0
+static unsigned int snapshot_build_id(struct dl_phdr_info *info, unsigned char *id)
+{
+    const ElfW(Phdr) *ph;
+    const ElfW(Nhdr) *note;
+    const char *p, *end, *desc;
+    unsigned long align;
+    int i;
+
+    for(i = 0; i < info->dlpi_phnum; ++i) {
+        ph = &info->dlpi_phdr[i];
+
+        if(ph->p_type != PT_NOTE) {
+            continue;
+        }
+
+        align = ph->p_align == 8 ? 8 : 4;
+        p = (const char *)(info->dlpi_addr + ph->p_vaddr);
+        end = p + ph->p_memsz;
+
+        while(p + sizeof(ElfW(Nhdr)) <= end) {
+            note = (const ElfW(Nhdr) *)p;
+            desc = p + sizeof(ElfW(Nhdr)) + ((note->n_namesz + align - 1) & ~(align - 1));
+
+            if(note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 && memcmp(note + 1, "GNU", 4) == 0
+                    && note->n_descsz <= SNAPSHOT_BUILD_ID_MAX && desc + note->n_descsz <= end) {
+                memcpy(id, desc, note->n_descsz);
+                return note->n_descsz;
+            }
+
+            p = desc + ((note->n_descsz + align - 1) & ~(align - 1));
+        }
+    }
+
+    return 0;
+}
+
+///找到包含m->addr的模块
+static int snapshot_module_by_addr(struct dl_phdr_info *info, size_t size, void *data)
+{
+    struct snapshot_module *m = data;
+    uintptr_t start;
+    int i;
+    (void)size;
+
+    for(i = 0; i < info->dlpi_phnum; ++i) {
+        if(info->dlpi_phdr[i].p_type != PT_LOAD) {
+            continue;
+        }
+
+        start = info->dlpi_addr + info->dlpi_phdr[i].p_vaddr;
+
+        if(m->addr >= start && m->addr < start + info->dlpi_phdr[i].p_memsz) {
+            m->base = info->dlpi_addr;
+            m->start = start;
+            m->end = start + info->dlpi_phdr[i].p_memsz;
+            m->id_len = snapshot_build_id(info, m->id);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+///找到build-id与m->id相同的模块
+static int snapshot_module_by_id(struct dl_phdr_info *info, size_t size, void *data)
+{
+    struct snapshot_module *m = data;
+    unsigned char id[SNAPSHOT_BUILD_ID_MAX];
+    (void)size;
+
+    if(snapshot_build_id(info, id) == m->id_len && memcmp(id, m->id, m->id_len) == 0) {
+        m->base = info->dlpi_addr;
+        return 1;
+    }
+
+    return 0;
+}
+
+static struct timer_snapshot_key *snapshot_key_new(struct timer_snapshot_key **keys, unsigned int *num, unsigned int *cap)
+{
+    void *mem;
+
+    if(*num == *cap) {
+        if((mem = realloc(*keys, sizeof(struct timer_snapshot_key) * (*cap > 0 ? *cap * 2 : 8))) == NULL) {
+            perror("malloc failed");
+            return NULL;
+        }
+
+        *keys = mem;
+        *cap = *cap > 0 ? *cap * 2 : 8;
+    }
+
+    memset(&(*keys)[*num], 0, sizeof(struct timer_snapshot_key));
+    return &(*keys)[(*num)++];
+}
+
+///把len字节追加到数据区，返回偏移，申请内存失败返回-1
+static long long snapshot_append(struct timer_snapshot *s, const void *data, unsigned long long len)
+{
+    unsigned long long cap, off = s->param_size;
+    void *mem;
+
+    if(s->param_size + snapshot_align(len) > s->param_cap) {
+        for(cap = s->param_cap > 0 ? s->param_cap : SNAPSHOT_INIT_CAP * 8; cap < s->param_size + snapshot_align(len); cap *= 2);
+
+        if((mem = realloc(s->params, cap)) == NULL) {
+            perror("malloc failed");
+            return -1;
+        }
+
+        s->params = mem;
+        s->param_cap = cap;
+    }
+
+    if(len > 0) {
+        memcpy(s->params + s->param_size, data, len);
+        memset(s->params + s->param_size + len, 0, snapshot_align(len) - len);
+        s->param_size += snapshot_align(len);
+    }
+
+    return off;
+}
+
+/**
+ * @brief	snapshot_cb_key
+ *
+ * 查找回调的标识，第一次出现的名字或build-id写到数据区；
+ * 没有登记名字的回调保存相对所在模块加载地址的偏移
+ *
+ * @return	申请内存失败返回NULL
+ */
+static struct timer_snapshot_key *snapshot_cb_key(struct timer_snapshot *s, void *(*cb)(void *), long long *offset)
+{
+    char name[TIMER_SNAPSHOT_NAME_MAX];
+    struct snapshot_module m;
+    struct timer_snapshot_key *k;
+    unsigned int i, len;
+    long long off = -1;
+
+    if((len = snapshot_name_of(cb, name)) > 0) {
+        *offset = 0;
+
+        for(i = 0; i < s->key_num; ++i) {
+            if(s->keys[i].kind == TIMER_SNAPSHOT_KEY_NAME && s->keys[i].cb == cb) {
+                return &s->keys[i];
+            }
+        }
+
+        if((off = snapshot_append(s, name, len)) == -1 || (k = snapshot_key_new(&s->keys, &s->key_num, &s->key_cap)) == NULL) {
+            return NULL;
+        }
+
+        k->kind = TIMER_SNAPSHOT_KEY_NAME;
+        k->cb = cb;
+        k->off = off;
+        k->len = len;
+        return k;
+    }
+
+    ///回调大多在少数几个模块中，按段的地址范围找到已经写过的build-id
+    for(i = 0; i < s->key_num; ++i) {
+        k = &s->keys[i];
+
+        if(k->kind == TIMER_SNAPSHOT_KEY_BUILD_ID && (uintptr_t)cb >= k->start && (uintptr_t)cb < k->end) {
+            *offset = (uintptr_t)cb - k->base;
+            return k;
+        }
+    }
+
+    memset(&m, 0, sizeof(m));
+    m.addr = (uintptr_t)cb;
+    dl_iterate_phdr(snapshot_module_by_addr, &m);
+
+    ///同一个模块的其他段已经写过build-id
+    for(i = 0; i < s->key_num; ++i) {
+        k = &s->keys[i];
+
+        if(k->kind == TIMER_SNAPSHOT_KEY_BUILD_ID && k->len == m.id_len && memcmp(s->params + k->off, m.id, m.id_len) == 0) {
+            off = k->off;
+            break;
+        }
+    }
+
+    if((off == -1 && (off = snapshot_append(s, m.id, m.id_len)) == -1)
+            || (k = snapshot_key_new(&s->keys, &s->key_num, &s->key_cap)) == NULL) {
+        return NULL;
+    }
+
+    k->kind = TIMER_SNAPSHOT_KEY_BUILD_ID;
+    k->off = off;
+    k->len = m.id_len;
+    k->base = m.base;
+    k->start = m.start;
+    k->end = m.end;
+    *offset = (uintptr_t)cb - m.base;
+    return k;
+}
+
+void timer_snapshot_init(struct timer_snapshot *s, clockid_t clock_id)
+{
+    memset(s, 0, sizeof(struct timer_snapshot));
+    s->offset = snapshot_offset(clock_id);
+}
+
+/**
+ * @brief	timer_snapshot_add
+ *
+ * 追加一个定时器，COPY方式的param拷贝到数据区
+ *
+ * @param	s
+ * @param	timer
+ * @param	deadline	管理对象时钟的到期时间(纳秒)
+ *
+ * @return	库布尔值，只有申请内存失败时返回TIMER_FALSE
+ */
+TIMER_BOOL timer_snapshot_add(struct timer_snapshot *s, const struct timer *timer, long long deadline)
+{
+    struct timer_snapshot_record *r;
+    struct timer_snapshot_key *k = NULL;
+    unsigned long long len = timer->param_len > 0 ? timer->param_len : 0, cap;
+    long long off, cb = 0;
+    void *mem;
+
+    if(timer->param_mode == TIMER_PARAM_REF && timer->param != NULL) {
+        ++s->skipped;
+        return TIMER_TRUE;
+    }
+
+    if(s->count == s->cap) {
+        cap = s->cap > 0 ? s->cap * 2 : SNAPSHOT_INIT_CAP;
+
+        if((mem = realloc(s->records, cap * sizeof(struct timer_snapshot_record))) == NULL) {
+            perror("malloc failed");
+            return TIMER_FALSE;
+        }
+
+        s->records = mem;
+        s->cap = cap;
+    }
+
+    if((timer->cb != NULL && (k = snapshot_cb_key(s, timer->cb, &cb)) == NULL) || (off = snapshot_append(s, timer->param, len)) == -1) {
+        return TIMER_FALSE;
+    }
+
+    r = &s->records[s->count++];
+    memset(r, 0, sizeof(struct timer_snapshot_record));
+    r->deadline = deadline + s->offset;
+    r->cb = cb;
+    r->param_off = off;
+    r->param_len = (int)len;
+    r->interval = timer->interval;
+    r->interval_ns = timer->interval_ns;
+    r->slack = timer->slack;
+    r->type = timer->type;
+    r->run_type = timer->run_type;
+
+    if(k != NULL) {
+        r->key_kind = k->kind;
+        r->key_off = k->off;
+        r->key_len = k->len;
+    }
+
+    return TIMER_TRUE;
+}
+
+void timer_snapshot_free(struct timer_snapshot *s)
+{
+    free(s->records);
+    free(s->params);
+    free(s->keys);
+    s->records = NULL;
+    s->params = NULL;
+    s->keys = NULL;
+    s->count = s->cap = 0;
+    s->param_size = s->param_cap = 0;
+    s->key_num = s->key_cap = 0;
+}
+
+/**
+ * @brief	timer_snapshot_write
+ *
+ * 先写到path.tmp再rename，写到一半时进程退出不会破坏原来的快照
+ *
+ * @param	s
+ * @param	path
+ *
+ * @return	库布尔值
+ */
+TIMER_BOOL timer_snapshot_write(struct timer_snapshot *s, const char *path)
+{
+    struct timer_snapshot_header header;
+    struct timespec real;
+    TIMER_BOOL ret = TIMER_TRUE;
+    char *tmp;
+    FILE *fp;
+
+    if((tmp = malloc(strlen(path) + sizeof(".tmp"))) == NULL) {
+        perror("malloc failed");
+        timer_snapshot_free(s);
+        return TIMER_FALSE;
+    }
+
+    sprintf(tmp, "%s.tmp", path);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TIMER_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = TIMER_SNAPSHOT_VERSION;
+    header.record_size = sizeof(struct timer_snapshot_record);
+    header.count = s->count;
+    header.param_off = sizeof(header) + s->count * sizeof(struct timer_snapshot_record);
+    header.param_size = s->param_size;
+    clock_gettime(CLOCK_REALTIME, &real);
+    header.realtime = timespec_ns(&real);
+
+    if(s->skipped > 0) {
+        fprintf(stderr, "snapshot: %llu timers with TIMER_PARAM_REF param skipped\n", s->skipped);
+    }
+
+    if((fp = fopen(tmp, "wb")) == NULL) {
+        perror("open snapshot file failed");
+        free(tmp);
+        timer_snapshot_free(s);
+        return TIMER_FALSE;
+    }
+
+    if(fwrite(&header, sizeof(header), 1, fp) != 1
+            || (s->count > 0 && fwrite(s->records, sizeof(struct timer_snapshot_record), s->count, fp) != s->count)
+            || (s->param_size > 0 && fwrite(s->params, s->param_size, 1, fp) != 1)) {
+        perror("write snapshot file failed");
+        ret = TIMER_FALSE;
+    }
+
+    if(fclose(fp) != 0 || (ret == TIMER_TRUE && rename(tmp, path) == -1)) {
+        ret = TIMER_FALSE;
+    }
+
+    if(ret == TIMER_FALSE) {
+        unlink(tmp);
+    }
+
+    free(tmp);
+    timer_snapshot_free(s);
+    return ret;
+}
+
+///记录的回调标识在f->keys中的位置
+static struct timer_snapshot_key *snapshot_key_find(struct timer_snapshot_file *f, const struct timer_snapshot_record *r)
+{
+    unsigned int i;
+
+    for(i = 0; i < f->key_num; ++i) {
+        if(f->keys[i].off == r->key_off && f->keys[i].kind == r->key_kind && f->keys[i].len == r->key_len) {
+            return &f->keys[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief	snapshot_resolve
+ *
+ * 第一次遇到的回调标识在当前程序中查找：名字在登记的回调中找，build-id在已经加载的模块中找
+ *
+ * @return	找不到或者申请内存失败返回TIMER_FALSE
+ */
+static TIMER_BOOL snapshot_resolve(struct timer_snapshot_file *f, const struct timer_snapshot_record *r, const char *path)
+{
+    const char *data = f->params + r->key_off;
+    struct timer_snapshot_key *k;
+    struct snapshot_module m;
+    int found = 0;
+
+    if(r->key_kind == TIMER_SNAPSHOT_KEY_NONE || snapshot_key_find(f, r) != NULL) {
+        return TIMER_TRUE;
+    }
+
+    if((k = snapshot_key_new(&f->keys, &f->key_num, &f->key_cap)) == NULL) {
+        return TIMER_FALSE;
+    }
+
+    k->off = r->key_off;
+    k->kind = r->key_kind;
+    k->len = r->key_len;
+
+    if(r->key_kind == TIMER_SNAPSHOT_KEY_NAME) {
+        if((k->cb = snapshot_cb_of(data, r->key_len)) == NULL) {
+            fprintf(stderr, "%s: callback %.*s is not registered\n", path, (int)r->key_len, data);
+            return TIMER_FALSE;
+        }
+
+        return TIMER_TRUE;
+    }
+
+    ///没有build-id的模块无法确认是不是同一个程序
+    memset(&m, 0, sizeof(m));
+    m.id_len = r->key_len;
+
+    if(r->key_len > 0 && r->key_len <= SNAPSHOT_BUILD_ID_MAX) {
+        memcpy(m.id, data, r->key_len);
+        found = dl_iterate_phdr(snapshot_module_by_id, &m);
+    }
+
+    if(found == 0) {
+        fprintf(stderr, "%s was written by another program, register its callbacks by name\n", path);
+        return TIMER_FALSE;
+    }
+
+    k->base = m.base;
+    return TIMER_TRUE;
+}
+
+/**
+ * @brief	timer_snapshot_open
+ *
+ * 映射快照文件，检查格式和每条记录的param范围，并在当前程序中找到所有回调
+ *
+ * @param	f
+ * @param	path
+ * @param	clock_id	恢复到的管理对象的时钟
+ *
+ * @return	库布尔值
+ */
+TIMER_BOOL timer_snapshot_open(struct timer_snapshot_file *f, const char *path, clockid_t clock_id)
+{
+    const struct timer_snapshot_header *h;
+    const struct timer_snapshot_record *r;
+    struct stat st;
+    unsigned long long i;
+    void *mem;
+    int fd;
+
+    memset(f, 0, sizeof(struct timer_snapshot_file));
+
+    if((fd = open(path, O_RDONLY)) == -1) {
+        perror("open snapshot file failed");
+        return TIMER_FALSE;
+    }
+
+    if(fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct timer_snapshot_header)
+            || (mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        fprintf(stderr, "%s is not a timer snapshot\n", path);
+        close(fd);
+        return TIMER_FALSE;
+    }
+
+    close(fd);
+    h = mem;
+    f->size = st.st_size;
+
+    if(memcmp(h->magic, TIMER_SNAPSHOT_MAGIC, sizeof(h->magic)) != 0 || h->version != TIMER_SNAPSHOT_VERSION
+            || h->record_size != sizeof(struct timer_snapshot_record)
+            || h->count > (f->size - sizeof(*h)) / sizeof(struct timer_snapshot_record)
+            || h->param_off != sizeof(*h) + h->count * sizeof(struct timer_snapshot_record)
+            || h->param_size > f->size - h->param_off) {
+        fprintf(stderr, "%s is not a timer snapshot\n", path);
+        munmap(mem, f->size);
+        return TIMER_FALSE;
+    }
+
+    f->header = h;
+    f->records = (const struct timer_snapshot_record *)(h + 1);
+    f->params = (const char *)mem + h->param_off;
+
+    for(i = 0; i < h->count; ++i) {
+        r = &f->records[i];
+
+        if(r->param_len < 0 || r->param_off > h->param_size || (unsigned long long)r->param_len > h->param_size - r->param_off
+                || r->key_kind > TIMER_SNAPSHOT_KEY_BUILD_ID || r->key_off > h->param_size || r->key_len > h->param_size - r->key_off) {
+            fprintf(stderr, "%s is corrupted\n", path);
+            timer_snapshot_close(f);
+            return TIMER_FALSE;
+        }
+
+        if(snapshot_resolve(f, r, path) == TIMER_FALSE) {
+            timer_snapshot_close(f);
+            return TIMER_FALSE;
+        }
+    }
+
+    f->offset = snapshot_offset(clock_id);
+    return TIMER_TRUE;
+}
+
+long long timer_snapshot_get(struct timer_snapshot_file *f, unsigned long long i, struct timer *timer)
+{
+    const struct timer_snapshot_record *r = &f->records[i];
+    struct timer_snapshot_key *k = snapshot_key_find(f, r);
+
+    memset(timer, 0, sizeof(struct timer));
+    timer->type = r->type;
+    timer->run_type = r->run_type;
+    timer->interval = r->interval;
+    timer->interval_ns = r->interval_ns;
+    timer->slack = r->slack;
+
+    if(k != NULL) {
+        timer->cb = k->kind == TIMER_SNAPSHOT_KEY_NAME ? k->cb : (void *(*)(void *))(k->base + (uintptr_t)r->cb);
+    }
+
+    timer->param = r->param_len > 0 ? (void *)(f->params + r->param_off) : NULL;
+    timer->param_len = r->param_len;
+    timer->param_mode = TIMER_PARAM_COPY;
+    return r->deadline - f->offset;
+}
+
+void timer_snapshot_close(struct timer_snapshot_file *f)
+{
+    if(f->header != NULL) {
+        munmap((void *)f->header, f->size);
+    }
+
+    free(f->keys);
+
+    memset(f, 0, sizeof(struct timer_snapshot_file));
+}
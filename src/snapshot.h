@@ -0,0 +1,84 @@
+/**
+ * @file snapshot.h
+ * @brief	定时器快照文件的读写，供时间轮、最小堆和分片管理对象内部使用
+ *
+ *	1.snapshot时在锁内把定时器追加到内存中的缓冲区，释放锁之后再写文件\n
+ *	2.restore时mmap整个文件，按下标读取记录，param直接指向映射的数据区，添加时拷贝\n
+ *	3.回调保存登记的名字，没有登记的保存相对所在模块加载地址的偏移和模块的build-id，
+ *	打开文件时一次查出每个标识对应的回调或者模块
+ *
+ * @author tangfu - abctangfuqiang2008@163.com
+ * @version 0.1
+ * @date 2012-07-08
+ */
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <time.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "timer.h"
+
+///回调标识，相同的名字或build-id在数据区中只保存一次
+struct timer_snapshot_key {
+    unsigned long long off;
+    unsigned short kind;
+    unsigned short len;
+    ///模块的加载地址
+    uintptr_t base;
+    ///写文件时是回调所在段的地址范围，用来查找下一个回调属于哪个模块
+    uintptr_t start;
+    uintptr_t end;
+    ///恢复时名字对应的回调
+    void *(*cb)(void *);
+};
+
+///写文件之前的缓冲区
+struct timer_snapshot {
+    struct timer_snapshot_record *records;
+    unsigned long long count;
+    unsigned long long cap;
+    char *params;
+    unsigned long long param_size;
+    unsigned long long param_cap;
+    ///管理对象的时钟换算成CLOCK_REALTIME需要加上的纳秒数
+    long long offset;
+    ///跳过的TIMER_PARAM_REF定时器
+    unsigned long long skipped;
+    struct timer_snapshot_key *keys;
+    unsigned int key_num;
+    unsigned int key_cap;
+};
+
+///映射的快照文件
+struct timer_snapshot_file {
+    const struct timer_snapshot_header *header;
+    const struct timer_snapshot_record *records;
+    const char *params;
+    size_t size;
+    ///CLOCK_REALTIME换算成管理对象的时钟需要减去的纳秒数
+    long long offset;
+    struct timer_snapshot_key *keys;
+    unsigned int key_num;
+    unsigned int key_cap;
+};
+
+void timer_snapshot_init(struct timer_snapshot *s, clockid_t clock_id);
+///deadline是管理对象时钟的纳秒数
+TIMER_BOOL timer_snapshot_add(struct timer_snapshot *s, const struct timer *timer, long long deadline);
+///写完后释放缓冲区
+TIMER_BOOL timer_snapshot_write(struct timer_snapshot *s, const char *path);
+void timer_snapshot_free(struct timer_snapshot *s);
+
+TIMER_BOOL timer_snapshot_open(struct timer_snapshot_file *f, const char *path, clockid_t clock_id);
+///取出第i个定时器，param指向映射的文件，返回管理对象时钟的到期时间(纳秒)
+long long timer_snapshot_get(struct timer_snapshot_file *f, unsigned long long i, struct timer *timer);
+void timer_snapshot_close(struct timer_snapshot_file *f);
+
+///时间轮的快照，分片管理对象用来合并各分片的定时器
+TIMER_BOOL timer_manager_snapshot(TIMER_MANAGER *this, struct timer_snapshot *s);
+///添加文件中[begin, end)的定时器，分片管理对象把文件分给各分片
+TIMER_BOOL timer_manager_restore(TIMER_MANAGER *this, struct timer_snapshot_file *f, unsigned long long begin, unsigned long long end);
+
+#endif	/* __SNAPSHOT_H__ */
@@ -0,0 +1,76 @@
+#include "timer.h"
+#include "stats.h"
+
+/**
+ * @brief	timer_histogram_value
+ *
+ * @param	index
+ *
+ * @return	第index个桶中的最大值
+ */
+unsigned long long timer_histogram_value(unsigned int index)
+{
+    unsigned int shift;
+
+    if(index < (1U << TIMER_HIST_SUB_BITS)) {
+        return index;
+    }
+
+    if(index >= TIMER_HIST_BUCKETS - 1) {
+        return ~0ULL;
+    }
+
+    shift = (index >> TIMER_HIST_SUB_BITS) - 1;
+    return ((unsigned long long)((index & ((1U << TIMER_HIST_SUB_BITS) - 1)) + (1U << TIMER_HIST_SUB_BITS) + 1) << shift) - 1;
+}
+
+/**
+ * @brief	timer_histogram_percentile
+ *
+ * @param	h
+ * @param	p		0~1之间
+ *
+ * @return	第p比例样本所在桶的上界，不超过记录过的最大值
+ */
+unsigned long long timer_histogram_percentile(const struct timer_histogram *h, double p)
+{
+    unsigned long long want, seen = 0, v;
+    unsigned int i;
+
+    if(h == NULL || h->total == 0) {
+        return 0;
+    }
+
+    want = p <= 0 ? 0 : (p >= 1 ? h->total - 1 : (unsigned long long)(h->total * p));
+
+    for(i = 0; i < TIMER_HIST_BUCKETS; ++i) {
+        seen += h->count[i];
+
+        if(seen > want) {
+            v = timer_histogram_value(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+void timer_histogram_merge(struct timer_histogram *to, const struct timer_histogram *from)
+{
+    unsigned int i;
+
+    if(to == NULL || from == NULL) {
+        return;
+    }
+
+    for(i = 0; i < TIMER_HIST_BUCKETS; ++i) {
+        to->count[i] += from->count[i];
+    }
+
+    to->total += from->total;
+    to->sum += from->sum;
+
+    if(from->max > to->max) {
+        to->max = from->max;
+    }
+}
@@ -0,0 +1,90 @@
+/**
+ * @file stats.h
+ * @brief	定时器管理对象的统计，供时间轮和最小堆内部使用
+ *
+ *	1.计数和直方图都用relaxed原子操作更新，不加锁，get_stats时逐项复制\n
+ *	2.直方图按对数分桶，记录一次只是几次原子加，适合在定时器线程中一直开启
+ *
+ * @author tangfu - abctangfuqiang2008@163.com
+ * @version 0.1
+ * @date 2012-07-04
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include "timer.h"
+
+struct timer_stats_internal {
+    unsigned long long adds;
+    unsigned long long dels;
+    unsigned long long mods;
+    unsigned long long expirations;
+    struct timer_histogram lateness;
+    struct timer_histogram callback;
+};
+
+#define timer_stat_add(counter, v)	((void)__atomic_fetch_add(&(counter), (v), __ATOMIC_RELAXED))
+
+/**
+ * @brief	timer_histogram_index
+ *
+ * @param	v
+ *
+ * @return	v所在的桶，小于2^TIMER_HIST_SUB_BITS的值每个值一个桶
+ */
+static inline unsigned int timer_histogram_index(unsigned long long v)
+{
+    unsigned int shift;
+
+    if(v < (1ULL << TIMER_HIST_SUB_BITS)) {
+        return (unsigned int)v;
+    }
+
+    shift = 63 - __builtin_clzll(v) - TIMER_HIST_SUB_BITS;
+    return (shift << TIMER_HIST_SUB_BITS) + (unsigned int)(v >> shift);
+}
+
+static inline void timer_histogram_record(struct timer_histogram *h, unsigned long long v)
+{
+    unsigned long long max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&h->count[timer_histogram_index(v)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->total, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, v, __ATOMIC_RELAXED);
+
+    while(v > max && !__atomic_compare_exchange_n(&h->max, &max, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static inline void timer_histogram_copy(struct timer_histogram *to, struct timer_histogram *from)
+{
+    unsigned int i;
+
+    for(i = 0; i < TIMER_HIST_BUCKETS; ++i) {
+        to->count[i] = __atomic_load_n(&from->count[i], __ATOMIC_RELAXED);
+    }
+
+    to->total = __atomic_load_n(&from->total, __ATOMIC_RELAXED);
+    to->sum = __atomic_load_n(&from->sum, __ATOMIC_RELAXED);
+    to->max = __atomic_load_n(&from->max, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief	timer_stats_copy
+ *
+ * 复制计数和直方图，overrun和时间片占用由调用者填写
+ *
+ * @param	to
+ * @param	from
+ */
+static inline void timer_stats_copy(struct timer_stats *to, struct timer_stats_internal *from)
+{
+    to->adds = __atomic_load_n(&from->adds, __ATOMIC_RELAXED);
+    to->dels = __atomic_load_n(&from->dels, __ATOMIC_RELAXED);
+    to->mods = __atomic_load_n(&from->mods, __ATOMIC_RELAXED);
+    to->expirations = __atomic_load_n(&from->expirations, __ATOMIC_RELAXED);
+    timer_histogram_copy(&to->lateness, &from->lateness);
+    timer_histogram_copy(&to->callback, &from->callback);
+}
+
+#endif	/* __STATS_H__ */
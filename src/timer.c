@@ -1,7 +1,13 @@
 #include "timer.h"
 #include "atomic.h"
 #include "list.h"
-#include "rbtree.h"
+#include "mempool.h"
+#include "cmdring.h"
+#include "executor.h"
+#include "clock.h"
+#include "stats.h"
+#include "trace.h"
+#include "snapshot.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
@@ -10,8 +16,10 @@
 #include <sys/timerfd.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdint.h>
 /* #include <math.h> */
@@ -19,22 +27,46 @@
 #define TIMER_FD_QUEUE_LEN	50
 
 ///检查配置文件是否合法
-#define check_timer_manager_conf(cf) (cf->time_slot > 0  && cf->slot_num >= 2  && cf->timer_max_num > 0)
+#define check_timer_manager_conf(cf) (cf->time_slot > 0  && cf->timer_max_num > 0 && cf->timer_max_num <= TIMER_ID_INDEX_MASK \
+        && ((cf->wheel_type == TIMER_WHEEL_SINGLE && cf->slot_num >= 2) || cf->wheel_type == TIMER_WHEEL_HIERARCHY) \
+        && check_clock_type(cf->clock_type))
+///时间片占用位图每个字64位
+#define ID_MAP_BITS			6
+#define ID_MAP_MASK			((1U << ID_MAP_BITS) - 1)
+///cnt位需要的64位字个数
+#define id_map_words(cnt)	((((cnt) - 1) >> ID_MAP_BITS) + 1)
+
+/*
+ * timer_id的低24位是句柄表下标，高8位是该下标的代数，
+ * 下标每回收一次代数加1，因此已删除定时器的旧id不会误中复用了该下标的新定时器
+ */
+#define TIMER_ID_INDEX_MASK	((1U << TIMER_ID_INDEX_BITS) - 1)
+#define TIMER_ID_GEN_MASK	((1U << (32 - TIMER_ID_INDEX_BITS)) - 1)
+#define timer_id_index(id)	((id) & TIMER_ID_INDEX_MASK)
+#define timer_id_gen(id)	((id) >> TIMER_ID_INDEX_BITS)
+#define timer_id_make(gen, index)	(((gen) << TIMER_ID_INDEX_BITS) | (index))
+
 /*
-///计算位图所占字节数
-#define bitmap_bytes(cnt)		(cnt - 1) / 8 + 1
-///设置位图的id位(设为1)
-#define set_bit(pointer, id)	*(pointer + (id - 1) / 8) |= (1 << (7 - (id - 1) % 8))
-///取消位图的id位的设置(设为0)
-#define unset_bit(pointer, id)	*(pointer + (id - 1) / 8) &= ~(1 << (7 - (id - 1) % 8))
-*/
-
-///计算位图所占字节数
-#define bitmap_bytes(cnt)   ((cnt - 1) >> 3) + 1
-///设置位图的id位(设为1)
-#define set_bit(pointer, id)	*(pointer + ((id - 1) >> 3) ) |= (128U >> ((id - 1) & 7))
-/////取消位图的id位的设置(设为0)
-#define unset_bit(pointer, id)    *(pointer + ((id - 1) >> 3)) &= ~(128U >> ((id - 1) & 7))
+ * 多级时间轮(与内核timer_list一致): 第一级256个时间片，其余四级各64个时间片，
+ * 所有级别的时间片连续存放在data[]中，第一级在前
+ */
+#define TVR_BITS	8
+#define TVN_BITS	6
+#define TVR_SIZE	(1 << TVR_BITS)
+#define TVN_SIZE	(1 << TVN_BITS)
+#define TVR_MASK	(TVR_SIZE - 1)
+#define TVN_MASK	(TVN_SIZE - 1)
+#define TVN_LEVEL	4
+#define HIERARCHY_SLOT_NUM	(TVR_SIZE + TVN_LEVEL * TVN_SIZE)
+///多级时间轮能表示的最大时间片数
+#define HIERARCHY_MAX_TICKS	((1ULL << (TVR_BITS + TVN_LEVEL * TVN_BITS)) - 1)
+///第level(1~TVN_LEVEL)级时间轮index号时间片在data[]中的下标
+#define tvn_slot(level, index)	(TVR_SIZE + ((level) - 1) * TVN_SIZE + (index))
+
+///定时器不在任何时间片上(已到期等待执行)
+#define TIMER_SLOT_NONE	((unsigned int)-1)
+///timerfd没有设置到期时间
+#define TIMER_TICK_NONE	((uint64_t)-1)
 
 
 ///定时器管理单元的节点
@@ -47,6 +79,13 @@ struct timer_node {
     struct list_head head;
 };
 
+///句柄表项，下标即timer_id的低位
+struct timer_handle {
+    struct timer_internal *volatile timer;
+    volatile unsigned int gen;
+    ///空闲时是空闲栈中的下一个下标
+    volatile unsigned int next;
+};
 
 ///定时器结构
 struct timer_internal {
@@ -56,9 +95,16 @@ struct timer_internal {
     void*(*cb)(void *);
     void *param;
     int param_len;
+    unsigned int interval_ns;
+    timer_param_mode param_mode;
+    unsigned int slack;
     timer_id id;
     unsigned int round;	///时间轮圈数
+    uint64_t expires;	///多级时间轮中的到期时间片(绝对值)
+    unsigned int slot;	///所在时间片在data[]中的下标
     struct list_head list;
+    ///短param直接保存在节点内部
+    uint64_t param_buf[TIMER_INLINE_PARAM_SIZE / sizeof(uint64_t)];
 };
 
 
@@ -69,12 +115,23 @@ struct timer_s_internal {
     TIMER_BOOL(*init)(TIMER_MANAGER *this, struct timer_manager_conf *conf);
     timer_id(*add)(TIMER_MANAGER *this, struct timer *timer);
     TIMER_BOOL(*del)(TIMER_MANAGER *this, timer_id id);
+    TIMER_BOOL(*mod)(TIMER_MANAGER *this, timer_id id, unsigned int interval);
     void (*enable)(TIMER_MANAGER *this);
     void (*disable)(TIMER_MANAGER *this);
-    //TIMER_BOOL (*reset) (TIMER_MANAGER *this, timer_id id);
     void (*start)(TIMER_MANAGER *this, timer_start_type type);
     void (*stop)(TIMER_MANAGER *this);
     void (*close)(TIMER_MANAGER *this);
+    void (*set_executor)(TIMER_MANAGER *this, TIMER_EXECUTOR *executor);
+    int (*get_fd)(TIMER_MANAGER *this);
+    unsigned int (*process_expired)(TIMER_MANAGER *this, const struct timespec *now);
+    void (*get_overrun)(TIMER_MANAGER *this, struct timer_overrun *overrun);
+    unsigned int (*add_batch)(TIMER_MANAGER *this, struct timer *timers, unsigned int n, timer_id *ids);
+    unsigned int (*del_batch)(TIMER_MANAGER *this, const timer_id *ids, unsigned int n);
+    void (*get_stats)(TIMER_MANAGER *this, struct timer_stats *stats);
+    TIMER_BOOL(*set_trace)(TIMER_MANAGER *this, unsigned int events);
+    TIMER_BOOL(*dump_trace)(TIMER_MANAGER *this, const char *path);
+    TIMER_BOOL(*snapshot)(TIMER_MANAGER *this, const char *path);
+    TIMER_BOOL(*restore)(TIMER_MANAGER *this, const char *path);
 
     unsigned int time_slot; ///毫秒ms
     unsigned int slot_num;	///时间片个数
@@ -85,27 +142,78 @@ struct timer_s_internal {
 
     ///timer_id从1开始
     volatile pthread_t pid;
-    volatile timer_id timer_fd_min_free;
     atomic_t init_flag;
     volatile int start_flag;
+    timer_start_type start_type;
     int enable_flag;		//阻止add操作
     pthread_rwlock_t lock;
 
     int timerfd;
-    unsigned char *timer_fd_bitmap;
+    ///timerfd和tick线程使用的时钟
+    clockid_t clock_id;
+    ///add/mod读取当前时间使用的时钟，时间片足够长时是粗粒度时钟
+    clockid_t fast_clock_id;
+    ///开启的时间和之后已经处理的时间片数，据此计算当前应该处理到的时间片
+    struct timespec tick_base;
+    volatile uint64_t ticks;
+    ///timerfd设置的到期时间片，没有定时器时为TIMER_TICK_NONE
+    volatile uint64_t armed;
+    ///时间片占用位图，置位表示该时间片上有定时器，用来跳过空的时间片
+    uint64_t *slot_map;
+    ///tick线程落后的统计
+    struct timer_overrun overrun;
+    struct timer_stats_internal stats;
+    ///生命周期事件的跟踪环，销毁时释放
+    struct timer_trace trace;
+    /*
+     * 空闲句柄组成的栈，用CAS维护，应用线程和tick线程分配、回收id都不加锁；
+     * 高32位是每次修改加1的版本号(避免ABA)，低32位是栈顶下标，0表示空
+     */
+    volatile uint64_t id_free;
+    ///从未使用过的句柄的起始下标
+    volatile unsigned int id_unused;
+    ///按下标索引的句柄表，大小为timer_max_num + 1
+    struct timer_handle *handles;
     struct timer_node *data;
-    rb_node_t *rb_root;
+    ///timer_internal节点的对象池，使用不加锁的mem_pool_alloc_mt/mem_pool_free_mt
+    struct mem_pool pool;
+    ///应用线程提交add/del/mod命令的无锁队列，cells为NULL表示不使用队列
+    struct cmd_ring cmds;
+    ///THREAD类型回调的执行器
+    TIMER_EXECUTOR *executor;
+
+    timer_wheel_type wheel_type;
+    ///多级时间轮已经处理到的时间片
+    uint64_t jiffies;
+    ///已到期等待执行的定时器
+    struct list_head expired;
+    ///正在执行回调的定时器，回调期间被删除时置为NULL
+    struct timer_internal *running;
+    ///回调期间被mod过，回调结束后重新挂到时间轮上
+    int running_rearm;
 };
 
 
 static TIMER_BOOL ti_init(TIMER_MANAGER *this, struct timer_manager_conf *conf);
 static timer_id ti_add(TIMER_MANAGER *this, struct timer *timer);
 static TIMER_BOOL ti_del(TIMER_MANAGER *this, timer_id id);
+static TIMER_BOOL ti_mod(TIMER_MANAGER *this, timer_id id, unsigned int interval);
 static void ti_stop(TIMER_MANAGER *this);
 static void ti_start(TIMER_MANAGER *this, timer_start_type type);
 static void ti_close(TIMER_MANAGER *this);
 static void ti_enable(TIMER_MANAGER *this);
 static void ti_disable(TIMER_MANAGER *this);
+static void ti_set_executor(TIMER_MANAGER *this, TIMER_EXECUTOR *executor);
+static int ti_get_fd(TIMER_MANAGER *this);
+static unsigned int ti_process_expired(TIMER_MANAGER *this, const struct timespec *now);
+static void ti_get_overrun(TIMER_MANAGER *this, struct timer_overrun *overrun);
+static unsigned int ti_add_batch(TIMER_MANAGER *this, struct timer *timers, unsigned int n, timer_id *ids);
+static unsigned int ti_del_batch(TIMER_MANAGER *this, const timer_id *ids, unsigned int n);
+static void ti_get_stats(TIMER_MANAGER *this, struct timer_stats *stats);
+static TIMER_BOOL ti_set_trace(TIMER_MANAGER *this, unsigned int events);
+static TIMER_BOOL ti_dump_trace(TIMER_MANAGER *this, const char *path);
+static TIMER_BOOL ti_snapshot(TIMER_MANAGER *this, const char *path);
+static TIMER_BOOL ti_restore(TIMER_MANAGER *this, const char *path);
 TIMER_MANAGER *create_timer_manager_();
 void destroy_timer_manager(TIMER_MANAGER *);
 static void catch_signal(int i);
@@ -113,10 +221,34 @@ static void *entry(void *p);
 
 /* ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  == */
 
-timer_id find_min_id(unsigned char *tmp, int len);
+static TIMER_BOOL timer_id_init(struct timer_s_internal *this);
+static void timer_id_destroy(struct timer_s_internal *this);
+static inline struct timer_internal *timer_lookup(struct timer_s_internal *this, timer_id id);
+static struct timer_internal *timer_alloc(struct timer_s_internal *this, struct timer *timer);
+static inline TIMER_BOOL add_check(struct timer_s_internal *this, struct timer *timer);
+static void timer_remove(struct timer_s_internal *this, struct timer_internal *timer);
+static void timer_reset(struct timer_s_internal *this, struct timer_internal *timer, unsigned int interval);
+static void cmd_drain(struct timer_s_internal *this);
 static inline timer_id timer_id_pop(struct timer_s_internal *this);
 static inline void timer_id_push(struct timer_s_internal *this, timer_id id);
-static TIMER_BOOL del_and_add(struct timer_s_internal *this, struct timer_internal *timer, struct timer_node *node);
+static void wheel_link(struct timer_s_internal *this, struct timer_internal *timer);
+static void wheel_link_ticks(struct timer_s_internal *this, struct timer_internal *timer, uint64_t ticks);
+static uint64_t timer_remaining(struct timer_s_internal *this, struct timer_internal *timer);
+static unsigned int run_expired(struct timer_s_internal *this, struct timer_dispatch_batch *batch, const struct timespec *now);
+static inline uint64_t timer_due(struct timer_s_internal *this, const struct timespec *now);
+static inline uint64_t timer_due_fast(struct timer_s_internal *this);
+static uint64_t timer_next_event(struct timer_s_internal *this);
+static void timer_forward(struct timer_s_internal *this, uint64_t due);
+static unsigned int timer_advance(struct timer_s_internal *this, const struct timespec *now);
+static void timer_settime_tick(struct timer_s_internal *this, uint64_t tick);
+static void timer_rearm(struct timer_s_internal *this);
+static void timer_kick(struct timer_s_internal *this);
+static void timerfd_set_nonblock(int fd, int nonblock);
+static inline void timer_unlink(struct timer_s_internal *this, struct timer_internal *timer);
+static inline void timer_release(struct timer_s_internal *this, struct timer_internal *timer);
+static inline TIMER_BOOL timer_param_init(struct timer_internal *t, struct timer *timer);
+static inline void timer_free(struct timer_s_internal *this, struct timer_internal *timer);
+static TIMER_BOOL free_all_timers(struct timer_s_internal *this);
 static inline TIMER_BOOL check_timer(struct timer_s_internal *this, struct timer *conf);
 
 /**
@@ -139,11 +271,23 @@ TIMER_MANAGER *create_timer_manager()
     p->init = ti_init;
     p->add = ti_add;
     p->del = ti_del;
+    p->mod = ti_mod;
     p->enable = ti_enable;
     p->disable = ti_disable;
     p->stop = ti_stop;
     p->start = ti_start;
     p->close = ti_close;
+    p->set_executor = ti_set_executor;
+    p->get_fd = ti_get_fd;
+    p->process_expired = ti_process_expired;
+    p->get_overrun = ti_get_overrun;
+    p->add_batch = ti_add_batch;
+    p->del_batch = ti_del_batch;
+    p->get_stats = ti_get_stats;
+    p->set_trace = ti_set_trace;
+    p->dump_trace = ti_dump_trace;
+    p->snapshot = ti_snapshot;
+    p->restore = ti_restore;
     pthread_rwlockattr_t attr;
     pthread_rwlockattr_init(&attr);
     pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
@@ -167,6 +311,7 @@ void destroy_timer_manager(TIMER_MANAGER *this)
     struct timer_s_internal *p = (struct timer_s_internal *)this;
     p->close(this);
     pthread_rwlock_destroy(&p->lock);
+    timer_trace_free(&p->trace);
     free((void *)this);
 }
 
@@ -200,17 +345,13 @@ static TIMER_BOOL ti_init(TIMER_MANAGER *this, struct timer_manager_conf *conf)
         atomic_set(&p->init_flag,  1);
     }
 
-    if((p->timerfd = timerfd_create(CLOCK_REALTIME, 0)) == -1) {
-        perror("create timerfd failed");
-        atomic_set(&p->init_flag, 0);
-        pthread_rwlock_unlock(&p->lock);
-        return TIMER_FALSE;
-    }
-
     if(conf  ==  NULL) {
         p->time_slot = DEFAULT_TIME_SLOT;
         p->slot_num = DEFAULT_SLOT_NUM;
         p->timer_max_num = DEFAULT_TIMER_MAX_NUM;
+        p->wheel_type = TIMER_WHEEL_SINGLE;
+        p->clock_id = CLOCK_MONOTONIC;
+        p->fast_clock_id = CLOCK_MONOTONIC;
     } else {
         if(check_timer_manager_conf(conf) == 0) {
             fprintf(stderr, "timer_conf is illegal \n");
@@ -221,10 +362,32 @@ static TIMER_BOOL ti_init(TIMER_MANAGER *this, struct timer_manager_conf *conf)
             p->time_slot = conf->time_slot;
             p->slot_num = conf->slot_num;
             p->timer_max_num = conf->timer_max_num;
+            p->wheel_type = conf->wheel_type;
+            p->clock_id = timer_clock_id(conf->clock_type);
+            p->fast_clock_id = timer_fast_clock_id(conf->clock_type, conf->time_slot * 1000000ULL);
         }
     }
 
+    if((p->timerfd = timerfd_create(p->clock_id, 0)) == -1) {
+        perror("create timerfd failed");
+        atomic_set(&p->init_flag, 0);
+        pthread_rwlock_unlock(&p->lock);
+        return TIMER_FALSE;
+    }
+
+    ///多级时间轮的时间片个数是固定的
+    if(p->wheel_type == TIMER_WHEEL_HIERARCHY) {
+        p->slot_num = HIERARCHY_SLOT_NUM;
+    }
+
     atomic_set(&p->cur_timer_num,  0);
+    p->cur_slot = 0;
+    p->jiffies = 0;
+    p->running = NULL;
+    p->running_rearm = 0;
+    INIT_LIST_HEAD(&p->expired);
+    memset(&p->overrun, 0, sizeof(struct timer_overrun));
+    memset(&p->stats, 0, sizeof(struct timer_stats_internal));
     p->data = malloc(sizeof(struct timer_node) * p->slot_num);
 
     if(p->data  ==  NULL) {
@@ -236,18 +399,40 @@ static TIMER_BOOL ti_init(TIMER_MANAGER *this, struct timer_manager_conf *conf)
         memset(p->data, 0,  sizeof(struct timer_node) * p->slot_num);
     }
 
-    p->timer_fd_bitmap = malloc(bitmap_bytes(p->timer_max_num));
+    if((p->slot_map = calloc(id_map_words(p->slot_num), sizeof(uint64_t))) == NULL || timer_id_init(p) == TIMER_FALSE) {
+        perror("malloc failed");
+        free(p->data);
+        free(p->slot_map);
+        p->data = NULL;
+        p->slot_map = NULL;
+        atomic_set(&p->init_flag, 0);
+        pthread_rwlock_unlock(&p->lock);
+        return TIMER_FALSE;
+    }
 
-    if(p->timer_fd_bitmap  == NULL) {
+    if(mem_pool_init(&p->pool, sizeof(struct timer_internal), p->timer_max_num) == -1) {
         perror("malloc failed");
         free(p->data);
+        free(p->slot_map);
         p->data = NULL;
+        p->slot_map = NULL;
+        timer_id_destroy(p);
+        atomic_set(&p->init_flag, 0);
+        pthread_rwlock_unlock(&p->lock);
+        return TIMER_FALSE;
+    }
+
+    if(conf != NULL && conf->submit_queue_len > 0 && cmd_ring_init(&p->cmds, conf->submit_queue_len) == -1) {
+        perror("malloc failed");
+        free(p->data);
+        free(p->slot_map);
+        p->data = NULL;
+        p->slot_map = NULL;
+        timer_id_destroy(p);
+        mem_pool_destroy(&p->pool);
         atomic_set(&p->init_flag, 0);
         pthread_rwlock_unlock(&p->lock);
         return TIMER_FALSE;
-    } else {
-        memset(p->timer_fd_bitmap,  0,  sizeof(bitmap_bytes(p->timer_max_num)));
-        p->timer_fd_min_free = 1;
     }
 
     ///初始化所有时间轮节点的链表头
@@ -287,650 +472,1776 @@ static timer_id ti_add(TIMER_MANAGER *this, struct timer *timer)
     }
 
     struct timer_s_internal *p = (struct timer_s_internal *)this;
-    pthread_rwlock_wrlock(&p->lock);
+    struct timer_internal *t;
+    struct timer_cmd cmd;
 
-    if(atomic_read(&p->init_flag)  ==  0) {
-        fprintf(stderr, "TIMER Manager has not been init yet\n");
+    ///使用命令队列时不持有lock，节点和id在调用者线程中分配好，由tick线程挂到时间轮上
+    if(p->cmds.cells != NULL && add_check(p, timer) == TIMER_TRUE) {
+        if((t = timer_alloc(p, timer)) == NULL) {
+            return 0;
+        }
+
+        cmd.op = TIMER_CMD_ADD;
+        cmd.id = t->id;
+        cmd.interval = 0;
+        cmd.timer = t;
+
+        if(cmd_ring_push(&p->cmds, &cmd) == 0) {
+            timer_kick(p);
+            timer_stat_add(p->stats.adds, 1);
+            timer_trace_record(&p->trace, TIMER_TRACE_ADD, cmd.id, timer->interval);
+            return cmd.id;
+        }
+
+        ///队列满时先处理掉队列中的命令，保证同一个定时器上的命令按顺序执行
+        pthread_rwlock_wrlock(&p->lock);
+        timer_forward(p, timer_due_fast(p));
+        cmd_drain(p);
+        wheel_link(p, t);
+        timer_rearm(p);
         pthread_rwlock_unlock(&p->lock);
-        return 0;
+        timer_stat_add(p->stats.adds, 1);
+        timer_trace_record(&p->trace, TIMER_TRACE_ADD, cmd.id, timer->interval);
+        return cmd.id;
     }
 
-    if(p->enable_flag == 0) {
-        fprintf(stderr, "TIMER Manager has been disable\n");
+    pthread_rwlock_wrlock(&p->lock);
+
+    if(add_check(p, timer) == TIMER_FALSE || (t = timer_alloc(p, timer)) == NULL) {
         pthread_rwlock_unlock(&p->lock);
         return 0;
     }
 
-    if((unsigned int)atomic_read(&p->cur_timer_num) >= p->timer_max_num) {
-        fprintf(stderr, "ACHIEVE TIMER MAX NUMBER\n");
-        pthread_rwlock_unlock(&p->lock);
+    ///tick线程可能还在睡眠，先跳过已经过去的空时间片，新定时器从当前时间开始计时
+    timer_forward(p, timer_due_fast(p));
+    wheel_link(p, t);
+    timer_rearm(p);
+    timer_trace_record(&p->trace, TIMER_TRACE_ADD, t->id, timer->interval);
+    pthread_rwlock_unlock(&p->lock);
+    timer_stat_add(p->stats.adds, 1);
+    return t->id;
+}
+
+/**
+ * @brief	add_batch
+ *
+ * 批量添加定时器，整个批次只获取一次写锁、只跳过一次空时间片、只重设一次timerfd
+ *
+ * @param	this		定时器管理对象指针
+ * @param	timers		定时器数组
+ * @param	n			定时器个数
+ * @param	ids			输出每个定时器的id，添加失败的为0，可以为NULL
+ *
+ * @note
+ *	使用命令队列时先处理掉队列中的命令，批量添加的定时器不经过队列
+ *
+ * @return	添加成功的个数
+ */
+static unsigned int ti_add_batch(TIMER_MANAGER *this, struct timer *timers, unsigned int n, timer_id *ids)
+{
+    if(this  ==  NULL || timers == NULL) {
         return 0;
     }
 
-    if(check_timer(p, timer) == TIMER_FALSE) {
-        fprintf(stderr, "timer is illegal \n");
-        pthread_rwlock_unlock(&p->lock);
-        return 0;
+    struct timer_s_internal *p = (struct timer_s_internal *)this;
+    struct timer_internal *t;
+    unsigned int i, num = 0;
+
+    if(ids != NULL) {
+        memset(ids, 0, sizeof(timer_id) * n);
     }
 
-    int index = (p->cur_slot + timer->interval / p->time_slot) % p->slot_num;
-    struct timer_internal *temp,  *t = malloc(sizeof(struct timer_internal));
-    struct list_head *header = &p->data[index].head;
-    struct timer_node *tmp = container_of(header, struct timer_node , head);
+    pthread_rwlock_wrlock(&p->lock);
 
-    if(t  ==  NULL) {
-        perror("malloc failed");
+    if(atomic_read(&p->init_flag)  ==  0) {
+        fprintf(stderr, "TIMER Manager has not been init yet\n");
         pthread_rwlock_unlock(&p->lock);
         return 0;
-    } else {
-        *(struct timer *)t = *timer;
-        t->param = malloc(t->param_len);
+    }
 
-        if(t->param == NULL) {
-            perror("malloc failed\n");
-            pthread_rwlock_unlock(&p->lock);
-            free(t);
-            return 0;
+    timer_forward(p, timer_due_fast(p));
+    cmd_drain(p);
+
+    for(i = 0; i < n; ++i) {
+        if(add_check(p, &timers[i]) == TIMER_FALSE) {
+            ///管理对象不允许再添加时，剩下的定时器也不会成功
+            if(p->enable_flag == 0 || (unsigned int)atomic_read(&p->cur_timer_num) >= p->timer_max_num) {
+                break;
+            }
+
+            continue;
         }
 
-        memcpy(t->param, timer->param, t->param_len);
-        t->id = timer_id_pop(p);
-        t->round = timer->interval / (p->time_slot * p->slot_num);
-        INIT_LIST_HEAD(&t->list);
-    }
+        if((t = timer_alloc(p, &timers[i])) == NULL) {
+            break;
+        }
 
-    ///链表中是否有定时器 分开处理
-    if(header->next != header) {
-        temp = container_of(header->next, struct timer_internal, list);
+        wheel_link(p, t);
+        timer_trace_record(&p->trace, TIMER_TRACE_ADD, t->id, t->interval);
+        ++num;
 
-        if(temp->interval > t->interval) {
-            list_add(&t->list, header);
-        } else {
-            list_add_tail(&t->list, header);
+        if(ids != NULL) {
+            ids[i] = t->id;
         }
-    } else {
-        list_add(&t->list, header);
     }
 
-    p->rb_root = rb_insert(t->id, (void *)t, p->rb_root);
-    atomic_inc(&tmp->timer_cnt);
-    atomic_inc(&p->cur_timer_num);
+    if(num > 0) {
+        timer_rearm(p);
+    }
+
     pthread_rwlock_unlock(&p->lock);
-    return t->id;
+    timer_stat_add(p->stats.adds, num);
+    return num;
 }
 
-
 /**
- * @brief	del_and_add
+ * @brief	add_check
  *
- * 专门针对repeat timer的一个add重定义版本
+ * 检查定时器管理对象的状态和定时器本身是否允许添加
  *
- * @param	this		定时器内部管理对象指针
- * @param	timer		定时器内部结构指针
- * @param	node	时间轮节点
+ * @param	this
+ * @param	timer
  *
  * @return
  */
-static TIMER_BOOL del_and_add(struct timer_s_internal *this, struct timer_internal *timer, struct timer_node *node)
+static inline TIMER_BOOL add_check(struct timer_s_internal *this, struct timer *timer)
 {
-    if(this  ==  NULL) {
+    if(atomic_read(&this->init_flag)  ==  0) {
+        fprintf(stderr, "TIMER Manager has not been init yet\n");
         return TIMER_FALSE;
     }
 
-    pthread_rwlock_wrlock(&this->lock);
-
-    if(atomic_read(&this->init_flag)  ==  0) {
-        fprintf(stderr, "TIMER Manager has not been init yet\n");
-        pthread_rwlock_unlock(&this->lock);
+    if(this->enable_flag == 0) {
+        fprintf(stderr, "TIMER Manager has been disable\n");
         return TIMER_FALSE;
     }
 
-    if((unsigned int)atomic_read(&this->cur_timer_num)  >=  this->timer_max_num) {
+    if((unsigned int)atomic_read(&this->cur_timer_num) >= this->timer_max_num) {
         fprintf(stderr, "ACHIEVE TIMER MAX NUMBER\n");
-        pthread_rwlock_unlock(&this->lock);
         return TIMER_FALSE;
     }
 
-    list_del(&timer->list);
-    atomic_dec(&node->timer_cnt);
-    int index = (this->cur_slot + timer->interval / this->time_slot) % this->slot_num;
-    struct timer_internal *temp;
-    struct timer_node *tmp;
-    struct list_head *header = &(this->data[index]).head;
-    timer->round = timer->interval / (this->time_slot * this->slot_num);
-
-    ///链表中是否有定时器 分开处理
-    if(header->next != header) {
-        temp = container_of(header->next, struct timer_internal, list);
-
-        if(temp->interval > timer->interval) {
-            list_add(&timer->list, header);
-        } else {
-            list_add_tail(&timer->list, header);
-        }
-    } else {
-        list_add(&timer->list, header);
+    if(check_timer(this, timer) == TIMER_FALSE) {
+        fprintf(stderr, "timer is illegal \n");
+        return TIMER_FALSE;
     }
 
-    tmp = container_of(header, struct timer_node ,  head);
-    atomic_inc(&tmp->timer_cnt);
-    pthread_rwlock_unlock(&this->lock);
     return TIMER_TRUE;
 }
+
 /**
- * @brief	del
- *
- * 删除定时器
+ * @brief	timer_alloc
  *
- * @param	this		定时器管理对象
- * @param	id			定时器标志
+ * 分配定时器节点和id，并登记到句柄表中，此时定时器还没有挂到时间轮上
  *
- * @note
- *		id <= 0表示删除所有定时器, 定时器标志也是从1开始的
+ * @param	this
+ * @param	timer
  *
- * @return		库布尔值
+ * @return	失败返回NULL
  */
-static TIMER_BOOL ti_del(TIMER_MANAGER *this, timer_id id)
+static struct timer_internal *timer_alloc(struct timer_s_internal *this, struct timer *timer)
 {
-    if(this  ==  NULL) {
-        return TIMER_FALSE;
-    }
-
-    struct timer_s_internal *p = (struct timer_s_internal *)this;
-    rb_node_t *node;
-    unsigned int cnt = 0, stat = 0;
-    struct timer_internal *temp;
-    struct list_head *header;
-    pthread_rwlock_wrlock(&p->lock);
-
-    if(id <= 0) {
-        for(; cnt < p->slot_num; ++cnt) {
-            if(atomic_read(&p->data[cnt].timer_cnt) != 0) {
-                stat = 1;
-                header = &p->data[cnt].head;
+    struct timer_internal *t;
+    timer_id index = 0;
 
-                while(!list_empty(header)) {
-                    list_del(header->next);
-                    temp = container_of(header->next, struct timer_internal, list);
-
-                    if(temp->param_len  !=  0) {
-                        free(temp->param);
-                    }
+    ///回调期间被删除的定时器先回收id、回调结束后才释放节点，节点和id要分别检查
+    if((t = mem_pool_alloc_mt(&this->pool)) == NULL || (index = timer_id_pop(this)) == 0) {
+        fprintf(stderr, "ACHIEVE TIMER MAX NUMBER\n");
 
-                    free(temp);
-                }
-            }
+        if(t != NULL) {
+            mem_pool_free_mt(&this->pool, t);
         }
 
-        atomic_set(&p->cur_timer_num , 0);
-        pthread_rwlock_unlock(&p->lock);
+        return NULL;
+    }
 
-        if(stat == 1) {
-            return TIMER_TRUE;
-        } else {
-            return TIMER_FALSE;
-        }
-    } else {
-        /*
-                        for( ; cnt < p->slot_num; ++cnt ) {
-                                if( atomic_read( &p->data[cnt].timer_cnt ) != 0 ) {
-                                        header = &p->data[cnt].head;
-                                        list_for_each_entry( temp, header, list ) {
-                                                if( temp->id  ==  id ) {
-                                                        list_del( &temp->list );
-
-                                                        if( temp->param_len != 0 )
-                                                                free( temp->param );
-
-                                                        free( temp );
-                                                        timer_id_push( p, id );
-                                                        atomic_dec( &p->cur_timer_num );
-                                                        pthread_rwlock_unlock( &p->lock );
-                                                        return TIMER_TRUE;
-                                                }
-                                        }
-                                }
-                        }
-        */
-        node = rb_search(id, p->rb_root);
-
-        if(node != NULL) {
-            temp = (struct timer_internal *)(node->data);
-            list_del(&temp->list);
-
-            if(temp->param_len != 0) {
-                free(temp->param);
-            }
+    *(struct timer *)t = *timer;
 
-            free(temp);
-            timer_id_push(p, id);
-            atomic_dec(&p->cur_timer_num);
-            p->rb_root = rb_erase(id, p->rb_root);
-            pthread_rwlock_unlock(&p->lock);
-            return TIMER_TRUE;
-        } else {
-            pthread_rwlock_unlock(&p->lock);
-            return TIMER_FALSE;
-        }
+    if(timer_param_init(t, timer) == TIMER_FALSE) {
+        perror("malloc failed\n");
+        timer_id_push(this, index);
+        mem_pool_free_mt(&this->pool, t);
+        return NULL;
     }
+
+    t->id = timer_id_make(this->handles[index].gen, index);
+    t->slot = TIMER_SLOT_NONE;
+    INIT_LIST_HEAD(&t->list);
+    ///节点初始化完成之后才能被timer_lookup找到
+    __sync_synchronize();
+    this->handles[index].timer = t;
+    atomic_inc(&this->cur_timer_num);
+    return t;
 }
 
 
 /**
- * @brief	stop
+ * @brief	slot_link
  *
- * 停止定时器
+ * 将定时器挂到data[]的index号时间片上
  *
- * @param	this	定时器管理对象指针
+ * @param	this		定时器内部管理对象指针
+ * @param	timer		定时器内部结构指针
+ * @param	index		时间片下标
  */
-static void ti_stop(TIMER_MANAGER *this)
+static inline void slot_link(struct timer_s_internal *this, struct timer_internal *timer, unsigned int index)
 {
-    if(this  ==  NULL) {
-        return;
-    }
-
-    struct timer_s_internal *p = (struct timer_s_internal *)this;
-    ///如果定时器并没有开始，直接结束
-    pthread_rwlock_wrlock(&p->lock);
-
-    if(p->start_flag  == 0) {
-        pthread_rwlock_unlock(&p->lock);
-        return ;
-    }
+    struct timer_node *node = &this->data[index];
+    struct list_head *header = &node->head;
+    struct timer_internal *temp;
 
-    //atomic_set( &p->start_flag, 0 );
-    p->start_flag = 0;
-    sleep(1);
+    ///单级时间轮保持最小的interval位于链表最前面，多级时间轮按到期先后排列
+    if(this->wheel_type == TIMER_WHEEL_SINGLE && header->next != header) {
+        temp = container_of(header->next, struct timer_internal, list);
 
-    if(p->pid != 0) {
-        pthread_kill(p->pid, TIMER_STOP_SIGNAL);
-        p->pid = 0;
+        if(temp->interval > timer->interval) {
+            list_add(&timer->list, header);
+        } else {
+            list_add_tail(&timer->list, header);
+        }
+    } else {
+        list_add_tail(&timer->list, header);
     }
 
-    pthread_rwlock_unlock(&p->lock);
+    timer->slot = index;
+    atomic_inc(&node->timer_cnt);
+    this->slot_map[index >> ID_MAP_BITS] |= 1ULL << (index & ID_MAP_MASK);
 }
 
-
 /**
- * @brief	start
+ * @brief	hierarchy_link
  *
- * 以两种方式来开启定时器
+ * 根据到期时间片把定时器挂到多级时间轮的对应级别上
  *
- * @param	this		定时器管理对象指针
- * @param	type		开启方式
+ * @param	this		定时器内部管理对象指针
+ * @param	timer		定时器内部结构指针
  */
-static void ti_start(TIMER_MANAGER *this, timer_start_type type)
+static void hierarchy_link(struct timer_s_internal *this, struct timer_internal *timer)
 {
-    if(this  ==  NULL) {
+    uint64_t idx = timer->expires - this->jiffies;
+    unsigned int level;
+
+    ///已经过期的定时器放到下一个要处理的时间片上
+    if((int64_t)idx < 0) {
+        slot_link(this, timer, (this->jiffies + 1) & TVR_MASK);
         return;
     }
 
-    struct timer_s_internal *p = (struct timer_s_internal *)this;
-    pthread_rwlock_wrlock(&p->lock);
-
-    if(p->start_flag  == 1) {
-        pthread_rwlock_unlock(&p->lock);
+    if(idx < TVR_SIZE) {
+        slot_link(this, timer, timer->expires & TVR_MASK);
         return;
-    } else {
-        p->start_flag = 1 ;
     }
 
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-
-    switch(type) {
-        case TIMER_START_UNBLOCK:
-            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-
-            if(pthread_create((pthread_t *)(&p->pid), &attr, entry, (void *)p) != 0) {
-                p->start_flag = 0 ;
-                p->pid = 0;
-                pthread_rwlock_unlock(&p->lock);
-                return;
-            }
-
-            pthread_rwlock_unlock(&p->lock);
-            break;
-        case TIMER_START_BLOCK:
-
-            if(pthread_create((pthread_t *)(&p->pid), NULL, entry, (void *)p) != 0) {
-                p->start_flag = 0 ;
-                p->pid = 0;
-                pthread_rwlock_unlock(&p->lock);
-                return;
-            }
-
-            pthread_rwlock_unlock(&p->lock);
-
-            if(pthread_join(p->pid, NULL) != 0) {
-                perror("block failed");
-            }
-
-            break;
-        default:
-            break;
+    if(idx > HIERARCHY_MAX_TICKS) {
+        timer->expires = this->jiffies + HIERARCHY_MAX_TICKS;
     }
 
-    pthread_rwlock_unlock(&p->lock);
+    for(level = 1; level < TVN_LEVEL && idx >= (1ULL << (TVR_BITS + level * TVN_BITS)); ++level);
+
+    slot_link(this, timer, tvn_slot(level, (timer->expires >> (TVR_BITS + (level - 1) * TVN_BITS)) & TVN_MASK));
 }
 
 /**
- * @brief	entry
+ * @brief	wheel_link
  *
- * 定时器开启的入口函数, 完成定时器的全部工作
+ * 根据定时器的interval把定时器挂到时间轮上，add和repeat timer重新添加时使用
  *
- * @param	p
+ * @param	this		定时器内部管理对象指针
+ * @param	timer		定时器内部结构指针
  *
- * @return
+ * @note
+ *	调用者必须持有写锁; 当前时间片(cur_slot/jiffies)总是已经处理过的
  */
-static void *entry(void *p)
+static void wheel_link(struct timer_s_internal *this, struct timer_internal *timer)
 {
-    if(p  ==  NULL) {
-        return NULL;
-    }
+    wheel_link_ticks(this, timer, timer->interval / this->time_slot);
+}
 
-    struct timer_s_internal *this = (struct timer_s_internal *)p;
-    pthread_t id;
-    pthread_attr_t attr;
-    sigset_t sigmask;
-    /* sigemptyset(&sigmask);
-    sigaddset(&sigmask, TIMER_STOP_SIGNAL);
-    pthread_sigmask(SIG_UNBLOCK, &sigmask, NULL);  */
-    sigfillset(&sigmask);
-    sigdelset(&sigmask, TIMER_STOP_SIGNAL);
-    pthread_sigmask(SIG_SETMASK, &sigmask, NULL);
-    signal(TIMER_STOP_SIGNAL, catch_signal);
-    struct itimerspec new_value;
-    struct timespec increment;
-    /* int timerfd; */
+/**
+ * @brief	wheel_link_ticks
+ *
+ * 把定时器挂到ticks个时间片之后，restore按文件中的到期时间添加时使用
+ *
+ * @param	this		定时器内部管理对象指针
+ * @param	timer		定时器内部结构指针
+ * @param	ticks		不小于1
+ */
+static void wheel_link_ticks(struct timer_s_internal *this, struct timer_internal *timer, uint64_t ticks)
+{
+    uint64_t now = this->wheel_type == TIMER_WHEEL_HIERARCHY ? this->jiffies : this->ticks;
+
+    ///到期的时间片按slack对齐，相近的定时器挂到同一个时间片上
+    if(timer->slack >= this->time_slot) {
+        ticks = timer_apply_slack(now + ticks, timer->slack / this->time_slot) - now;
+    }
+
+    if(this->wheel_type == TIMER_WHEEL_HIERARCHY) {
+        timer->expires = this->jiffies + ticks;
+        hierarchy_link(this, timer);
+    } else {
+        timer->round = (ticks - 1) / this->slot_num;
+        slot_link(this, timer, (this->cur_slot + ticks) % this->slot_num);
+    }
+}
+
+/**
+ * @brief	cascade
+ *
+ * 把第level级时间轮当前时间片上的定时器重新分散到低级时间轮上
+ *
+ * @param	this		定时器内部管理对象指针
+ * @param	level		时间轮级别(1~TVN_LEVEL)
+ *
+ * @return	该级时间轮当前的时间片号，为0时需要继续迁移上一级
+ */
+static unsigned int cascade(struct timer_s_internal *this, unsigned int level)
+{
+    unsigned int index = (this->jiffies >> (TVR_BITS + (level - 1) * TVN_BITS)) & TVN_MASK;
+    struct timer_node *node = &this->data[tvn_slot(level, index)];
+    struct timer_internal *temp;
+    LIST_HEAD(work);
+
+    list_splice_init(&node->head, &work);
+    atomic_set(&node->timer_cnt, 0);
+    this->slot_map[node->slot_id >> ID_MAP_BITS] &= ~(1ULL << (node->slot_id & ID_MAP_MASK));
+
+    while(!list_empty(&work)) {
+        temp = container_of(work.next, struct timer_internal, list);
+        list_del(&temp->list);
+        hierarchy_link(this, temp);
+        timer_trace_record(&this->trace, TIMER_TRACE_CASCADE, temp->id, level);
+    }
+
+    return index;
+}
+
+/**
+ * @brief	collect_expired
+ *
+ * 时间轮前进一个时间片，并把该时间片上到期的定时器移到expired链表
+ *
+ * @param	this		定时器内部管理对象指针
+ *
+ * @note
+ *	单级时间轮需要递减该时间片上所有定时器的圈数；多级时间轮在第一级转完一圈时
+ *	惰性地迁移上级时间轮，当前时间片上的定时器全部到期
+ */
+static void collect_expired(struct timer_s_internal *this)
+{
+    struct list_head *pos, *n;
     struct timer_internal *temp;
     struct timer_node *node;
-    struct list_head *header, *tmp;
-    //int64_t diff;
-    uint64_t exp;
-    int replay = 0;
-    increment.tv_sec = this->time_slot / 1000;
-    increment.tv_nsec = this->time_slot % 1000 * 1000000;
-    new_value.it_value.tv_sec = increment.tv_sec;
-    new_value.it_value.tv_nsec = increment.tv_nsec;
-    new_value.it_interval.tv_sec = increment.tv_sec;
-    new_value.it_interval.tv_nsec = increment.tv_nsec;
 
-    if(timerfd_settime(this->timerfd, 0, &new_value, NULL) == -1) {
-        perror("[timer exit normally] - timer_set failed");
-        goto END;
+    if(this->wheel_type == TIMER_WHEEL_HIERARCHY) {
+        unsigned int index = ++this->jiffies & TVR_MASK;
+
+        if(index == 0 && cascade(this, 1) == 0 && cascade(this, 2) == 0 && cascade(this, 3) == 0) {
+            cascade(this, 4);
+        }
+
+        node = &this->data[index];
+        list_for_each_safe(pos, n, &node->head) {
+            temp = container_of(pos, struct timer_internal, list);
+            timer_unlink(this, temp);
+            temp->expires = this->ticks + 1;
+            list_add_tail(&temp->list, &this->expired);
+        }
+    } else {
+        if(this->cur_slot == this->slot_num - 1) {
+            this->cur_slot = 0;
+        } else {
+            ++this->cur_slot;
+        }
+
+        node = &this->data[this->cur_slot];
+        list_for_each_safe(pos, n, &node->head) {
+            temp = container_of(pos, struct timer_internal, list);
+
+            if(temp->round == 0) {
+                timer_unlink(this, temp);
+                temp->expires = this->ticks + 1;
+                list_add_tail(&temp->list, &this->expired);
+            } else {
+                --temp->round;
+            }
+        }
+    }
+}
+
+/**
+ * @brief	run_expired
+ *
+ * 逐个处理expired链表上的定时器：在锁外执行回调，之后重新添加或释放
+ *
+ * @param	this		定时器内部管理对象指针
+ * @param	batch		THREAD类型的回调放入批次，由调用者在释放锁之后交给执行器
+ * @param	now			醒来的时间，用来统计lateness，为NULL时按当前时间片计算
+ *
+ * @note	调用者持有写锁，返回时仍然持有；collect_expired把定时器到期的时间片记在expires中
+ *
+ * @return	处理的定时器个数
+ */
+static unsigned int run_expired(struct timer_s_internal *this, struct timer_dispatch_batch *batch, const struct timespec *now)
+{
+    struct timer_internal *temp;
+    struct timespec start, end;
+    unsigned int num = 0;
+    int64_t slot_ns = this->time_slot * 1000000LL, late, cost;
+    ///当前定时器开始执行的时间(相对tick_base)，醒来的时间加上之前的DIRECT回调占用的时间
+    int64_t elapsed = now != NULL ? timer_timespec_ns(now) - timer_timespec_ns(&this->tick_base) : (int64_t)this->ticks * slot_ns;
+
+    while(!list_empty(&this->expired)) {
+        if(timer_batch_full(batch)) {
+            pthread_rwlock_unlock(&this->lock);
+            timer_executor_flush(batch);
+            pthread_rwlock_wrlock(&this->lock);
+            continue;
+        }
+
+        temp = container_of(this->expired.next, struct timer_internal, list);
+        list_del_init(&temp->list);
+        ++num;
+        late = elapsed - (int64_t)temp->expires * slot_ns;
+        timer_histogram_record(&this->stats.lateness, late > 0 ? late : 0);
+        timer_trace_record(&this->trace, TIMER_TRACE_EXPIRE, temp->id, late > 0 ? timer_trace_arg(late / 1000) : 0);
+
+        ///异步执行的回调只放入批次，不需要释放锁；节点随后可能被释放，拷贝方式的参数由批次复制一份
+        if(temp->run_type == THREAD) {
+            timer_batch_add(batch, temp->cb, temp->param, temp->param_mode == TIMER_PARAM_COPY && temp->param_len > 0 ? temp->param_len : 0);
+        } else {
+            this->running = temp;
+            pthread_rwlock_unlock(&this->lock);
+            clock_gettime(this->clock_id, &start);
+
+            if(temp->run_type == SIGNAL) {
+                kill(getpid(), SIGALRM);
+            } else {
+                timer_trace_record(&this->trace, TIMER_TRACE_CB_START, temp->id, 0);
+                temp->cb(temp->param);
+                timer_trace_record(&this->trace, TIMER_TRACE_CB_END, temp->id, 0);
+            }
+
+            clock_gettime(this->clock_id, &end);
+            cost = timer_timespec_ns(&end) - timer_timespec_ns(&start);
+            elapsed += cost;
+
+            if(temp->run_type == DIRECT) {
+                timer_histogram_record(&this->stats.callback, cost);
+            }
+
+            pthread_rwlock_wrlock(&this->lock);
+
+            if(this->running == NULL) {
+                ///回调执行期间定时器已经被删除
+                timer_free(this, temp);
+                this->running_rearm = 0;
+                continue;
+            }
+        }
+
+        if(temp->type == REPEAT || this->running_rearm) {
+            wheel_link(this, temp);
+        } else {
+            timer_release(this, temp);
+            timer_free(this, temp);
+        }
+
+        this->running = NULL;
+        this->running_rearm = 0;
+    }
+
+    return num;
+}
+
+/**
+ * @brief	del
+ *
+ * 删除定时器
+ *
+ * @param	this		定时器管理对象
+ * @param	id			定时器标志
+ *
+ * @note
+ *		id <= 0表示删除所有定时器, 定时器标志也是从1开始的
+ *
+ * @return		库布尔值
+ */
+static TIMER_BOOL ti_del(TIMER_MANAGER *this, timer_id id)
+{
+    if(this  ==  NULL) {
+        return TIMER_FALSE;
+    }
+
+    struct timer_s_internal *p = (struct timer_s_internal *)this;
+    TIMER_BOOL ret;
+    struct timer_internal *temp;
+    struct timer_cmd cmd;
+
+    if(id > 0 && p->cmds.cells != NULL) {
+        if(timer_lookup(p, id) == NULL) {
+            return TIMER_FALSE;
+        }
+
+        cmd.op = TIMER_CMD_DEL;
+        cmd.id = id;
+        cmd.interval = 0;
+        cmd.timer = NULL;
+
+        if(cmd_ring_push(&p->cmds, &cmd) == 0) {
+            timer_kick(p);
+            timer_stat_add(p->stats.dels, 1);
+            timer_trace_record(&p->trace, TIMER_TRACE_DEL, id, 0);
+            return TIMER_TRUE;
+        }
+    }
+
+    pthread_rwlock_wrlock(&p->lock);
+    cmd_drain(p);
+
+    if(id <= 0) {
+        ret = free_all_timers(p);
+        timer_trace_record(&p->trace, TIMER_TRACE_DEL, 0, 0);
+        pthread_rwlock_unlock(&p->lock);
+        return ret;
+    } else {
+        temp = timer_lookup(p, id);
+
+        if(temp != NULL) {
+            timer_remove(p, temp);
+            timer_trace_record(&p->trace, TIMER_TRACE_DEL, id, 0);
+            pthread_rwlock_unlock(&p->lock);
+            timer_stat_add(p->stats.dels, 1);
+            return TIMER_TRUE;
+        } else {
+            pthread_rwlock_unlock(&p->lock);
+            return TIMER_FALSE;
+        }
+    }
+}
+
+/**
+ * @brief	timer_remove
+ *
+ * 删除定时器，调用者持有lock
+ *
+ * @param	this
+ * @param	timer
+ */
+static void timer_remove(struct timer_s_internal *this, struct timer_internal *timer)
+{
+    timer_release(this, timer);
+
+    ///回调正在执行的定时器由tick线程在回调结束后释放
+    if(timer == this->running) {
+        this->running = NULL;
+    } else {
+        timer_unlink(this, timer);
+        timer_free(this, timer);
+    }
+}
+
+/**
+ * @brief	del_batch
+ *
+ * 批量删除定时器，整个批次只获取一次写锁
+ *
+ * @param	this		定时器管理对象
+ * @param	ids			定时器标志数组，为0的项被忽略
+ * @param	n			个数
+ *
+ * @return	删除成功的个数
+ */
+static unsigned int ti_del_batch(TIMER_MANAGER *this, const timer_id *ids, unsigned int n)
+{
+    if(this  ==  NULL || ids == NULL) {
+        return 0;
+    }
+
+    struct timer_s_internal *p = (struct timer_s_internal *)this;
+    struct timer_internal *temp;
+    unsigned int i, num = 0;
+    pthread_rwlock_wrlock(&p->lock);
+    cmd_drain(p);
+
+    for(i = 0; i < n; ++i) {
+        if(ids[i] != 0 && (temp = timer_lookup(p, ids[i])) != NULL) {
+            timer_remove(p, temp);
+            timer_trace_record(&p->trace, TIMER_TRACE_DEL, ids[i], 0);
+            ++num;
+        }
+    }
+
+    pthread_rwlock_unlock(&p->lock);
+    timer_stat_add(p->stats.dels, num);
+    return num;
+}
+
+
+/**
+ * @brief	mod
+ *
+ * 重新设置定时器，从当前时间片开始按新的interval计时
+ *
+ * @param	this		定时器管理对象
+ * @param	id			定时器标志
+ * @param	interval	新的间隔(毫秒)，为0表示沿用原来的间隔
+ *
+ * @note
+ *		定时器节点只是从原来的时间片移到新的时间片上，不重新分配内存，id也保持不变
+ *
+ * @return		库布尔值
+ */
+static TIMER_BOOL ti_mod(TIMER_MANAGER *this, timer_id id, unsigned int interval)
+{
+    if(this  ==  NULL) {
+        return TIMER_FALSE;
+    }
+
+    struct timer_s_internal *p = (struct timer_s_internal *)this;
+    struct timer_internal *temp;
+    struct timer_cmd cmd;
+
+    if(interval != 0 && interval < p->time_slot) {
+        fprintf(stderr, "timer precision can not been achieve\n");
+        return TIMER_FALSE;
+    }
+
+    if(p->cmds.cells != NULL) {
+        if(timer_lookup(p, id) == NULL) {
+            return TIMER_FALSE;
+        }
+
+        cmd.op = TIMER_CMD_MOD;
+        cmd.id = id;
+        cmd.interval = interval;
+        cmd.timer = NULL;
+
+        if(cmd_ring_push(&p->cmds, &cmd) == 0) {
+            timer_kick(p);
+            timer_stat_add(p->stats.mods, 1);
+            timer_trace_record(&p->trace, TIMER_TRACE_MOD, id, interval);
+            return TIMER_TRUE;
+        }
+    }
+
+    pthread_rwlock_wrlock(&p->lock);
+    timer_forward(p, timer_due_fast(p));
+    cmd_drain(p);
+
+    if((temp = timer_lookup(p, id)) == NULL) {
+        pthread_rwlock_unlock(&p->lock);
+        return TIMER_FALSE;
+    }
+
+    timer_reset(p, temp, interval);
+    timer_rearm(p);
+    timer_trace_record(&p->trace, TIMER_TRACE_MOD, id, interval);
+    pthread_rwlock_unlock(&p->lock);
+    timer_stat_add(p->stats.mods, 1);
+    return TIMER_TRUE;
+}
+
+/**
+ * @brief	timer_reset
+ *
+ * 从当前时间片开始重新计时，调用者持有lock
+ *
+ * @param	this
+ * @param	timer
+ * @param	interval	为0表示沿用原来的间隔
+ */
+static void timer_reset(struct timer_s_internal *this, struct timer_internal *timer, unsigned int interval)
+{
+    if(interval != 0) {
+        timer->interval = interval;
+    }
+
+    ///回调正在执行的定时器由tick线程在回调结束后重新挂到时间轮上
+    if(timer == this->running) {
+        this->running_rearm = 1;
+    } else {
+        timer_unlink(this, timer);
+        wheel_link(this, timer);
+    }
+}
+
+/**
+ * @brief	cmd_drain
+ *
+ * 按提交顺序执行命令队列中的所有命令，调用者持有lock，因此同一时刻只有一个消费者
+ *
+ * @param	this
+ */
+static void cmd_drain(struct timer_s_internal *this)
+{
+    struct timer_cmd cmd;
+    struct timer_internal *temp;
+    unsigned long end;
+
+    if(this->cmds.cells == NULL) {
+        return;
+    }
+
+    /*
+     * 必须处理完当前tail之前的所有命令: 生产者可能已经抢到单元但还没有发布，
+     * 如果跳过它，后面直接加锁执行的del/mod会先于该定时器的ADD命令执行
+     */
+    end = this->cmds.tail;
+
+    while(this->cmds.head != end) {
+        if(cmd_ring_pop(&this->cmds, &cmd) == -1) {
+            sched_yield();
+            continue;
+        }
+
+        switch(cmd.op) {
+            case TIMER_CMD_ADD:
+                wheel_link(this, (struct timer_internal *)cmd.timer);
+                break;
+            case TIMER_CMD_DEL:
+
+                ///同一个定时器可能被重复删除，后面的命令直接忽略
+                if((temp = timer_lookup(this, cmd.id)) != NULL) {
+                    timer_remove(this, temp);
+                }
+
+                break;
+            case TIMER_CMD_MOD:
+
+                if((temp = timer_lookup(this, cmd.id)) != NULL) {
+                    timer_reset(this, temp, cmd.interval);
+                }
+
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+
+/**
+ * @brief	stop
+ *
+ * 停止定时器
+ *
+ * @param	this	定时器管理对象指针
+ */
+static void ti_stop(TIMER_MANAGER *this)
+{
+    if(this  ==  NULL) {
+        return;
+    }
+
+    struct timer_s_internal *p = (struct timer_s_internal *)this;
+    ///如果定时器并没有开始，直接结束
+    pthread_rwlock_wrlock(&p->lock);
+
+    if(p->start_flag  == 0) {
+        pthread_rwlock_unlock(&p->lock);
+        return ;
+    }
+
+    //atomic_set( &p->start_flag, 0 );
+    p->start_flag = 0;
+
+    if(p->start_type == TIMER_START_EMBED) {
+        timer_settime_tick(p, TIMER_TICK_NONE);
+        pthread_rwlock_unlock(&p->lock);
+        return;
+    }
+
+    sleep(1);
+
+    if(p->pid != 0) {
+        pthread_kill(p->pid, TIMER_STOP_SIGNAL);
+        p->pid = 0;
+    }
+
+    pthread_rwlock_unlock(&p->lock);
+}
+
+
+/**
+ * @brief	start
+ *
+ * 以两种方式来开启定时器
+ *
+ * @param	this		定时器管理对象指针
+ * @param	type		开启方式
+ */
+static void ti_start(TIMER_MANAGER *this, timer_start_type type)
+{
+    if(this  ==  NULL) {
+        return;
+    }
+
+    struct timer_s_internal *p = (struct timer_s_internal *)this;
+    pthread_rwlock_wrlock(&p->lock);
+
+    if(p->start_flag  == 1) {
+        pthread_rwlock_unlock(&p->lock);
+        return;
+    } else {
+        p->start_flag = 1 ;
+    }
+
+    p->start_type = type;
+    ///只有EMBED方式下timerfd是非阻塞的，tick线程需要阻塞在read上
+    timerfd_set_nonblock(p->timerfd, type == TIMER_START_EMBED);
+
+    ///从现在开始计算时间片，timerfd只设置到下一个有定时器的时间片
+    if(clock_gettime(p->clock_id, &p->tick_base) == -1) {
+        p->start_flag = 0;
+        pthread_rwlock_unlock(&p->lock);
+        return;
+    }
+
+    p->ticks = 0;
+    p->armed = TIMER_TICK_NONE;
+    timer_settime_tick(p, TIMER_TICK_NONE);
+    timer_rearm(p);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+
+    switch(type) {
+        case TIMER_START_UNBLOCK:
+            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+            if(pthread_create((pthread_t *)(&p->pid), &attr, entry, (void *)p) != 0) {
+                p->start_flag = 0 ;
+                p->pid = 0;
+                pthread_rwlock_unlock(&p->lock);
+                return;
+            }
+
+            pthread_rwlock_unlock(&p->lock);
+            break;
+        case TIMER_START_BLOCK:
+
+            if(pthread_create((pthread_t *)(&p->pid), NULL, entry, (void *)p) != 0) {
+                p->start_flag = 0 ;
+                p->pid = 0;
+                pthread_rwlock_unlock(&p->lock);
+                return;
+            }
+
+            pthread_rwlock_unlock(&p->lock);
+
+            if(pthread_join(p->pid, NULL) != 0) {
+                perror("block failed");
+            }
+
+            break;
+        case TIMER_START_EMBED:
+            pthread_rwlock_unlock(&p->lock);
+            break;
+        default:
+            p->start_flag = 0;
+            pthread_rwlock_unlock(&p->lock);
+            break;
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
+/**
+ * @brief	entry
+ *
+ * 定时器开启的入口函数, 完成定时器的全部工作
+ *
+ * @param	p
+ *
+ * @return
+ */
+static void *entry(void *p)
+{
+    if(p  ==  NULL) {
+        return NULL;
+    }
+
+    struct timer_s_internal *this = (struct timer_s_internal *)p;
+    sigset_t sigmask;
+    /* sigemptyset(&sigmask);
+    sigaddset(&sigmask, TIMER_STOP_SIGNAL);
+    pthread_sigmask(SIG_UNBLOCK, &sigmask, NULL);  */
+    sigfillset(&sigmask);
+    sigdelset(&sigmask, TIMER_STOP_SIGNAL);
+    pthread_sigmask(SIG_SETMASK, &sigmask, NULL);
+    signal(TIMER_STOP_SIGNAL, catch_signal);
+    /* int timerfd; */
+    //int64_t diff;
+    uint64_t exp;
+
+    /*
+     * timerfd是一次性的，只在下一个有定时器的时间片到期，因此exp总是1；
+     * 醒来后按当前时间计算应该处理到的时间片，中间空的时间片直接跳过
+     */
+    while(this->start_flag) {
+        if(read(this->timerfd, &exp, sizeof(uint64_t)) != sizeof(uint64_t)) {
+            perror("[timer exit abnormally] - read failed");
+            goto END;
+        }
+
+        timer_advance(this, NULL);
+    }
+
+    fprintf(stderr, "timer exit normally\n");
+    //atomic_set( &this->start_flag, 0 );
+END:
+    this->start_flag = 0;
+    this->pid = 0;
+    return NULL;
+}
+
+static void ti_close(TIMER_MANAGER *this)
+{
+    if(this  ==  NULL) {
+        return;
+    }
+
+    struct timer_s_internal *p = (struct timer_s_internal *)this;
+    pthread_rwlock_wrlock(&p->lock);
+
+    ///还没有初始化，直接返回
+    if(atomic_read(&p->init_flag)  ==  0) {
+        pthread_rwlock_unlock(&p->lock);
+        return;
+    }
+
+    //p->stop( this );
+    if(p->start_flag  != 0 && p->start_type == TIMER_START_EMBED) {
+        p->start_flag = 0;
+    } else if(p->start_flag  != 0) {
+        p->start_flag = 0;
+        sleep(1);
+
+        if(p->pid != 0) {
+            pthread_kill(p->pid, TIMER_STOP_SIGNAL);
+            p->pid = 0;
+        }
+    }
+
+    cmd_drain(p);
+    free_all_timers(p);
+    cmd_ring_destroy(&p->cmds);
+    p->time_slot = 0;
+    p->slot_num = 0;
+    p->timer_max_num = 0;
+
+    if(p->data) {
+        free(p->data);
+        p->data = NULL;
+    }
+
+    free(p->slot_map);
+    p->slot_map = NULL;
+
+    timer_id_destroy(p);
+    mem_pool_destroy(&p->pool);
+
+    if(p->timerfd > 2) {
+        close(p->timerfd);
+    }
+
+    atomic_set(&p->init_flag,  0);
+    pthread_rwlock_unlock(&p->lock);
+}
+
+
+/* ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  HELPER FUNC ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  == = */
+/**
+ * @brief	timer_id_init
+ *
+ * 建立句柄表，初始时所有id都是空闲的；空闲栈为空时按顺序取从未使用过的下标，不需要在这里逐个入栈
+ *
+ * @param	this
+ *
+ * @return
+ */
+static TIMER_BOOL timer_id_init(struct timer_s_internal *this)
+{
+    this->handles = calloc(this->timer_max_num + 1, sizeof(struct timer_handle));
+
+    if(this->handles == NULL) {
+        return TIMER_FALSE;
+    }
+
+    this->id_free = 0;
+    this->id_unused = 1;
+    return TIMER_TRUE;
+}
+
+/**
+ * @brief	timer_id_pop
+ *
+ * 取出一个空闲id，可以与timer_id_push和其他timer_id_pop并发执行
+ *
+ * @param	this
+ *
+ * @note
+ *	栈顶的版本号每次修改都加1，即使栈顶下标被取走又放回，CAS也会失败；
+ *	返回的是句柄表下标，对外的timer_id还要加上代数
+ *
+ * @return	id已经用完时返回0
+ */
+static inline timer_id timer_id_pop(struct timer_s_internal *this)
+{
+    uint64_t top;
+    unsigned int index;
+
+    while((index = (uint32_t)(top = this->id_free)) != 0) {
+        if(__sync_bool_compare_and_swap(&this->id_free, top, (((top >> 32) + 1) << 32) | this->handles[index].next)) {
+            return index;
+        }
+    }
+
+    while((index = this->id_unused) <= this->timer_max_num) {
+        if(__sync_bool_compare_and_swap(&this->id_unused, index, index + 1)) {
+            return index;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief	timer_id_push
+ *
+ * 将已用的id重新放回空闲栈
+ *
+ * @param	this
+ * @param	id
+ */
+static inline void timer_id_push(struct timer_s_internal *this, timer_id id)
+{
+    uint64_t top;
+
+    do {
+        top = this->id_free;
+        this->handles[id].next = (uint32_t)top;
+    } while(!__sync_bool_compare_and_swap(&this->id_free, top, (((top >> 32) + 1) << 32) | id));
+}
+
+static void timer_id_destroy(struct timer_s_internal *this)
+{
+    free(this->handles);
+    this->handles = NULL;
+}
+
+/**
+ * @brief	timer_lookup
+ *
+ * 通过句柄表查找定时器，代数不一致说明id已经失效
+ *
+ * @param	this
+ * @param	id
+ *
+ * @return	找不到返回NULL
+ */
+static inline struct timer_internal *timer_lookup(struct timer_s_internal *this, timer_id id)
+{
+    unsigned int index = timer_id_index(id);
+    struct timer_handle *h;
+    struct timer_internal *t;
+
+    if(index == 0 || index > this->timer_max_num) {
+        return NULL;
+    }
+
+    ///不加锁读取：读节点前后代数都没有变，说明节点确实属于这个id
+    h = &this->handles[index];
+
+    if(h->gen != timer_id_gen(id)) {
+        return NULL;
+    }
+
+    __sync_synchronize();
+    t = h->timer;
+    __sync_synchronize();
+    return h->gen == timer_id_gen(id) ? t : NULL;
+}
+
+static void ti_enable(TIMER_MANAGER *this)
+{
+    if(this  ==  NULL) {
+        return;
+    }
+
+    struct timer_s_internal *p = (struct timer_s_internal *)this;
+    pthread_rwlock_rdlock(&p->lock);
+    p->enable_flag = 1;
+    pthread_rwlock_unlock(&p->lock);
+}
+
+static void ti_disable(TIMER_MANAGER *this)
+{
+    if(this  ==  NULL) {
+        return;
+    }
+
+    struct timer_s_internal *p = (struct timer_s_internal *)this;
+    pthread_rwlock_rdlock(&p->lock);
+    p->enable_flag = 0;
+    pthread_rwlock_unlock(&p->lock);
+}
+
+static void ti_set_executor(TIMER_MANAGER *this, TIMER_EXECUTOR *executor)
+{
+    if(this  ==  NULL) {
+        return;
+    }
+
+    struct timer_s_internal *p = (struct timer_s_internal *)this;
+    pthread_rwlock_wrlock(&p->lock);
+    p->executor = executor;
+    pthread_rwlock_unlock(&p->lock);
+}
+
+static int ti_get_fd(TIMER_MANAGER *this)
+{
+    struct timer_s_internal *p = (struct timer_s_internal *)this;
+
+    if(this == NULL || atomic_read(&p->init_flag) == 0) {
+        return -1;
+    }
+
+    return p->timerfd;
+}
+
+/**
+ * @brief	process_expired
+ *
+ * EMBED方式下由调用者的事件循环驱动时间轮，前进从开启到now为止还没有处理的时间片
+ *
+ * @param	this		定时器管理对象指针
+ * @param	now			当前时间(clock_type对应的时钟)，为NULL时读取系统时间
+ *
+ * @return	到期的定时器个数
+ */
+static unsigned int ti_process_expired(TIMER_MANAGER *this, const struct timespec *now)
+{
+    struct timer_s_internal *p = (struct timer_s_internal *)this;
+    uint64_t exp;
+
+    if(this == NULL || p->start_flag == 0 || p->start_type != TIMER_START_EMBED) {
+        return 0;
+    }
+
+    ///只是清除timerfd的可读状态，前进的时间片数由now决定
+    if(read(p->timerfd, &exp, sizeof(uint64_t)) != sizeof(uint64_t) && errno != EAGAIN) {
+        perror("read timerfd failed");
+    }
+
+    return timer_advance(p, now);
+}
+
+static void ti_get_overrun(TIMER_MANAGER *this, struct timer_overrun *overrun)
+{
+    struct timer_s_internal *p = (struct timer_s_internal *)this;
+
+    if(this == NULL || overrun == NULL) {
+        return;
+    }
+
+    pthread_rwlock_rdlock(&p->lock);
+    *overrun = p->overrun;
+    pthread_rwlock_unlock(&p->lock);
+}
+
+/**
+ * @brief	get_stats
+ *
+ * 计数和直方图不加锁复制；时间片占用只遍历位图中置位的时间片，持有读锁
+ *
+ * @param	this
+ * @param	stats
+ */
+static void ti_get_stats(TIMER_MANAGER *this, struct timer_stats *stats)
+{
+    struct timer_s_internal *p = (struct timer_s_internal *)this;
+    unsigned int i, w, depth;
+    uint64_t bits;
+
+    if(this == NULL || stats == NULL) {
+        return;
+    }
+
+    memset(stats, 0, sizeof(struct timer_stats));
+    timer_stats_copy(stats, &p->stats);
+    pthread_rwlock_rdlock(&p->lock);
+
+    if(atomic_read(&p->init_flag) != 0) {
+        stats->overrun = p->overrun;
+        stats->timers = atomic_read(&p->cur_timer_num);
+
+        for(w = 0; w < id_map_words(p->slot_num); ++w) {
+            for(bits = p->slot_map[w]; bits != 0; bits &= bits - 1) {
+                i = (w << ID_MAP_BITS) + __builtin_ctzll(bits);
+                depth = atomic_read(&p->data[i].timer_cnt);
+                ++stats->busy_slots;
+
+                if(depth > stats->max_slot_depth) {
+                    stats->max_slot_depth = depth;
+                }
+            }
+        }
+    }
+
+    pthread_rwlock_unlock(&p->lock);
+}
+
+static TIMER_BOOL ti_set_trace(TIMER_MANAGER *this, unsigned int events)
+{
+    if(this == NULL) {
+        return TIMER_FALSE;
+    }
+
+    return timer_trace_set(&((struct timer_s_internal *)this)->trace, events);
+}
+
+static TIMER_BOOL ti_dump_trace(TIMER_MANAGER *this, const char *path)
+{
+    if(this == NULL) {
+        return TIMER_FALSE;
+    }
+
+    return timer_trace_dump(&((struct timer_s_internal *)this)->trace, path);
+}
+
+/**
+ * @brief	timer_remaining
+ *
+ * 定时器距离当前时间片还有多少个时间片到期，调用者持有写锁
+ *
+ * @param	this
+ * @param	timer
+ *
+ * @return	在expired链表上等待执行的为0
+ */
+static uint64_t timer_remaining(struct timer_s_internal *this, struct timer_internal *timer)
+{
+    if(timer->slot == TIMER_SLOT_NONE) {
+        return 0;
+    }
+
+    if(this->wheel_type == TIMER_WHEEL_HIERARCHY) {
+        return timer->expires > this->jiffies ? timer->expires - this->jiffies : 0;
+    }
+
+    return (timer->slot + this->slot_num - this->cur_slot - 1) % this->slot_num + 1 + (uint64_t)timer->round * this->slot_num;
+}
+
+/**
+ * @brief	timer_manager_snapshot
+ *
+ * 把所有定时器追加到s中，正在执行回调的一次性定时器不保存，循环定时器按下一个周期保存
+ *
+ * @param	this
+ * @param	s
+ *
+ * @return	库布尔值
+ */
+TIMER_BOOL timer_manager_snapshot(TIMER_MANAGER *this, struct timer_snapshot *s)
+{
+    struct timer_s_internal *p = (struct timer_s_internal *)this;
+    struct timer_internal *t;
+    struct timespec now;
+    int64_t base, slot_ns;
+    uint64_t ticks;
+    unsigned int i;
+
+    pthread_rwlock_wrlock(&p->lock);
+
+    if(atomic_read(&p->init_flag) == 0 || clock_gettime(p->clock_id, &now) == -1) {
+        pthread_rwlock_unlock(&p->lock);
+        return TIMER_FALSE;
+    }
+
+    timer_forward(p, timer_due(p, &now));
+    cmd_drain(p);
+    slot_ns = p->time_slot * 1000000LL;
+    ///没有开启时时间片不前进，从现在开始计算
+    base = p->start_flag ? timer_timespec_ns(&p->tick_base) + (int64_t)p->ticks * slot_ns : timer_timespec_ns(&now);
+
+    for(i = 1; i <= p->timer_max_num; ++i) {
+        if((t = p->handles[i].timer) == NULL) {
+            continue;
+        }
+
+        if(t == p->running) {
+            if(t->type != REPEAT && !p->running_rearm) {
+                continue;
+            }
+
+            ticks = t->interval / p->time_slot;
+        } else {
+            ticks = timer_remaining(p, t);
+        }
+
+        if(timer_snapshot_add(s, (struct timer *)t, base + (int64_t)ticks * slot_ns) == TIMER_FALSE) {
+            pthread_rwlock_unlock(&p->lock);
+            return TIMER_FALSE;
+        }
+    }
+
+    pthread_rwlock_unlock(&p->lock);
+    return TIMER_TRUE;
+}
+
+static TIMER_BOOL ti_snapshot(TIMER_MANAGER *this, const char *path)
+{
+    struct timer_s_internal *p = (struct timer_s_internal *)this;
+    struct timer_snapshot s;
+
+    if(this == NULL || path == NULL) {
+        return TIMER_FALSE;
+    }
+
+    timer_snapshot_init(&s, p->clock_id);
+
+    if(timer_manager_snapshot(this, &s) == TIMER_FALSE) {
+        timer_snapshot_free(&s);
+        return TIMER_FALSE;
+    }
+
+    return timer_snapshot_write(&s, path);
+}
+
+/**
+ * @brief	timer_manager_restore
+ *
+ * 在一次加锁中添加文件中[begin, end)的定时器，按到期时间直接挂到对应的时间片上
+ *
+ * @param	this
+ * @param	f
+ * @param	begin
+ * @param	end
+ *
+ * @return	全部添加成功时返回TIMER_TRUE
+ */
+TIMER_BOOL timer_manager_restore(TIMER_MANAGER *this, struct timer_snapshot_file *f, unsigned long long begin, unsigned long long end)
+{
+    struct timer_s_internal *p = (struct timer_s_internal *)this;
+    struct timer_internal *t;
+    struct timer timer;
+    struct timespec now;
+    int64_t base, slot_ns, deadline;
+    unsigned long long i, num = 0;
+
+    pthread_rwlock_wrlock(&p->lock);
+
+    if(atomic_read(&p->init_flag) == 0 || clock_gettime(p->clock_id, &now) == -1) {
+        pthread_rwlock_unlock(&p->lock);
+        return TIMER_FALSE;
+    }
+
+    timer_forward(p, timer_due(p, &now));
+    cmd_drain(p);
+    slot_ns = p->time_slot * 1000000LL;
+    base = p->start_flag ? timer_timespec_ns(&p->tick_base) + (int64_t)p->ticks * slot_ns : timer_timespec_ns(&now);
+
+    for(i = begin; i < end; ++i) {
+        deadline = timer_snapshot_get(f, i, &timer);
+
+        if(add_check(p, &timer) == TIMER_FALSE) {
+            if(p->enable_flag == 0 || (unsigned int)atomic_read(&p->cur_timer_num) >= p->timer_max_num) {
+                break;
+            }
+
+            continue;
+        }
+
+        if((t = timer_alloc(p, &timer)) == NULL) {
+            break;
+        }
+
+        ///已经过期的放到下一个时间片
+        wheel_link_ticks(p, t, deadline > base ? (uint64_t)(deadline - base + slot_ns - 1) / slot_ns : 1);
+        timer_trace_record(&p->trace, TIMER_TRACE_ADD, t->id, t->interval);
+        ++num;
+    }
+
+    if(num > 0) {
+        timer_rearm(p);
+    }
+
+    pthread_rwlock_unlock(&p->lock);
+    timer_stat_add(p->stats.adds, num);
+    return num == end - begin ? TIMER_TRUE : TIMER_FALSE;
+}
+
+static TIMER_BOOL ti_restore(TIMER_MANAGER *this, const char *path)
+{
+    struct timer_s_internal *p = (struct timer_s_internal *)this;
+    struct timer_snapshot_file f;
+    TIMER_BOOL ret;
+
+    if(this == NULL || path == NULL || timer_snapshot_open(&f, path, p->clock_id) == TIMER_FALSE) {
+        return TIMER_FALSE;
+    }
+
+    ret = timer_manager_restore(this, &f, 0, f.header->count);
+    timer_snapshot_close(&f);
+    return ret;
+}
+
+struct timer_trace *timer_manager_trace(TIMER_MANAGER *this)
+{
+    return &((struct timer_s_internal *)this)->trace;
+}
+
+static void catch_signal(int i)
+{
+    switch(i) {
+        case 62:
+            pthread_exit(0);
+            break;
+        default:
+            break;
     }
+}
 
-    while(this->start_flag) {
-        //gettimeofday(&now, NULL);
-        header = &((this->data[this->cur_slot]).head);
-        node = &this->data[this->cur_slot];
-        tmp = header;
+/**
+ * @brief	timer_due
+ *
+ * 计算截止到now应该处理到的时间片
+ *
+ * @param	this
+ * @param	now		为NULL时读取系统时间
+ *
+ * @return	从开启时算起的时间片数
+ */
+static inline uint64_t timer_due(struct timer_s_internal *this, const struct timespec *now)
+{
+    struct timespec cur;
+    int64_t elapsed;
 
-        /* list_for_each_entry(temp, &(this->data[this->cur_slot]).head, list) { */
-        while(!list_is_last(tmp, header)) {
-            temp = container_of(tmp->next, struct timer_internal, list);
+    if(now != NULL) {
+        cur = *now;
+    } else if(clock_gettime(this->clock_id, &cur) == -1) {
+        return this->ticks;
+    }
 
-            if(temp->round == 0) {
-                switch(temp->run_type) {
-                    case SIGNAL:
-                        kill(getpid(), SIGALRM);
-                        break;
-                    case THREAD:
-                        pthread_attr_init(&attr);
-                        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-
-                        if(pthread_create(&id, &attr, temp->cb, (void *)temp->param)  ==  -1) {
-                            perror("execute expiry func failed");
-                        }
-
-                        pthread_attr_destroy(&attr);
-                        break;
-                    case DIRECT:
-                        temp->cb(temp->param);
-                    default:
-                        break;
-                }
+    elapsed = ((int64_t)cur.tv_sec - this->tick_base.tv_sec) * 1000 + (cur.tv_nsec - this->tick_base.tv_nsec) / 1000000;
+    return elapsed > 0 ? (uint64_t)elapsed / this->time_slot : 0;
+}
 
-                switch(temp->type) {
-                    case REPEAT:
-                        del_and_add(this, temp, node);
-                        /*
-                        list_del( tmp->next );
-                        this->rb_root = rb_erase( temp->id, this->rb_root );
-                        atomic_dec( &node->timer_cnt );
-                        atomic_dec( &this->cur_timer_num );
-                        readd( this, temp );
-                        */
-                        break;
-                    case SINGLE_SHOT:
-                    default:
-                        pthread_rwlock_rdlock(&this->lock);			////////////////
-                        list_del(tmp->next);
-                        this->rb_root = rb_erase(temp->id, this->rb_root);
-
-                        if(temp->param_len != 0) {
-                            free(temp->param);
-                        }
-
-                        free(temp);
-                        timer_id_push(this, temp->id);
-                        atomic_dec(&node->timer_cnt);
-                        pthread_rwlock_unlock(&this->lock);
-                        break;
-                }
-            } else {
-                --temp->round;
-            }
+/**
+ * @brief	timer_due_fast
+ *
+ * add/mod使用: 时钟读慢一点只会少跳过几个空时间片，因此可以用粗粒度时钟
+ *
+ * @param	this
+ *
+ * @return
+ */
+static inline uint64_t timer_due_fast(struct timer_s_internal *this)
+{
+    struct timespec cur;
 
-            tmp = tmp->next;
-        }
+    if(this->start_flag == 0 || clock_gettime(this->fast_clock_id, &cur) == -1) {
+        return this->ticks;
+    }
 
-        if(read(this->timerfd, &exp, sizeof(uint64_t)) != sizeof(uint64_t)) {
-            perror("[timer exit abnormally] - read failed");
-            goto END;
-        } else {
-            if(exp > 1) {
-                fprintf(stderr, "maintain timer_list expire one time_slot\n");
+    return timer_due(this, &cur);
+}
 
-                if(++replay == 5) {
-                    goto END;
-                }
-            }
-        }
+/**
+ * @brief	slot_map_next
+ *
+ * 在占用位图中查找[start, end)范围内第一个有定时器的时间片
+ *
+ * @return	没有时返回end
+ */
+static inline unsigned int slot_map_next(struct timer_s_internal *this, unsigned int start, unsigned int end)
+{
+    unsigned int i = start;
+    uint64_t word;
 
-        if(this->cur_slot == this->slot_num - 1) {
-            this->cur_slot = 0;
-        } else {
-            ++this->cur_slot;
+    while(i < end) {
+        word = this->slot_map[i >> ID_MAP_BITS] >> (i & ID_MAP_MASK);
+
+        if(word != 0) {
+            i += __builtin_ctzll(word);
+            return i < end ? i : end;
         }
+
+        i = (i | ID_MAP_MASK) + 1;
     }
 
-    fprintf(stderr, "timer exit normally\n");
-    //atomic_set( &this->start_flag, 0 );
-END:
-    this->start_flag = 0;
-    this->pid = 0;
-    return NULL;
+    return end;
 }
 
-static void ti_close(TIMER_MANAGER *this)
+/**
+ * @brief	timer_next_event
+ *
+ * 距离下一个需要处理的时间片还有几个时间片
+ *
+ * @param	this
+ *
+ * @note
+ *	单级时间轮是下一个有定时器的时间片(圈数没到也要处理一次递减圈数)；
+ *	多级时间轮上级有定时器时，第一级转完一圈的时间片也要处理(迁移上级时间轮)
+ *
+ * @return	大于0，没有定时器时返回TIMER_TICK_NONE
+ */
+static uint64_t timer_next_event(struct timer_s_internal *this)
 {
-    if(this  ==  NULL) {
-        return;
-    }
-
-    struct timer_s_internal *p = (struct timer_s_internal *)this;
-    pthread_rwlock_wrlock(&p->lock);
+    unsigned int index, next;
 
-    ///还没有初始化，直接返回
-    if(atomic_read(&p->init_flag)  ==  0) {
-        return;
-    }
+    if(this->wheel_type == TIMER_WHEEL_HIERARCHY) {
+        index = this->jiffies & TVR_MASK;
 
-    //p->stop( this );
-    if(p->start_flag  != 0) {
-        p->start_flag = 0;
-        sleep(1);
+        if((next = slot_map_next(this, index + 1, TVR_SIZE)) < TVR_SIZE) {
+            return next - index;
+        }
 
-        if(p->pid != 0) {
-            pthread_kill(p->pid, TIMER_STOP_SIGNAL);
-            p->pid = 0;
+        if(slot_map_next(this, 0, index + 1) <= index || slot_map_next(this, TVR_SIZE, HIERARCHY_SLOT_NUM) < HIERARCHY_SLOT_NUM) {
+            return TVR_SIZE - index;
         }
+
+        return TIMER_TICK_NONE;
     }
 
-    unsigned int cnt = 0;
-    struct list_head *header,  *tmp;
-    struct timer_internal *temp;
+    index = this->cur_slot;
 
-    for(; cnt < p->slot_num; ++cnt) {
-        if(atomic_read(&p->data[cnt].timer_cnt) != 0) {
-            header = &p->data[cnt].head;
+    if((next = slot_map_next(this, index + 1, this->slot_num)) < this->slot_num) {
+        return next - index;
+    }
 
-            while(!list_empty(header)) {
-                tmp = header->next;
-                list_del(header->next);
-                temp = container_of(tmp, struct timer_internal, list);
+    if((next = slot_map_next(this, 0, index + 1)) <= index) {
+        return this->slot_num - index + next;
+    }
 
-                if(temp->param_len != 0) {
-                    free(temp->param);
-                }
+    return TIMER_TICK_NONE;
+}
 
-                free(temp);
-            }
-        }
+/**
+ * @brief	timer_forward
+ *
+ * 跳过从当前时间片到due之间空的时间片，遇到有定时器的时间片就停在它前面，调用者持有lock
+ *
+ * @param	this
+ * @param	due		应该处理到的时间片
+ */
+static void timer_forward(struct timer_s_internal *this, uint64_t due)
+{
+    uint64_t skip, next;
+
+    if(this->start_flag == 0 || due <= this->ticks) {
+        return;
     }
 
-    p->time_slot = 0;
-    p->slot_num = 0;
-    p->timer_max_num = 0;
+    skip = due - this->ticks;
+    next = timer_next_event(this);
 
-    if(p->data) {
-        free(p->data);
+    if(next != TIMER_TICK_NONE && next - 1 < skip) {
+        skip = next - 1;
     }
 
-    if(p->timer_fd_bitmap) {
-        free(p->timer_fd_bitmap);
+    if(skip == 0) {
+        return;
     }
 
-    if(p->timerfd > 2) {
-        close(p->timerfd);
+    if(this->wheel_type == TIMER_WHEEL_HIERARCHY) {
+        this->jiffies += skip;
+    } else {
+        this->cur_slot = (this->cur_slot + skip) % this->slot_num;
     }
 
-    atomic_set(&p->init_flag,  0);
-    pthread_rwlock_unlock(&p->lock);
+    this->ticks += skip;
 }
 
-
-/* ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  HELPER FUNC ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  ==  == = */
 /**
- * @brief	find_min_id
+ * @brief	timer_advance
  *
- * 从位图中找寻最小的未用id
+ * 处理截止到now为止的所有时间片，处理完后重新设置timerfd
  *
- * @param	tmp
- * @param	len
+ * @param	this
+ * @param	now		为NULL时读取当前时间
  *
  * @note
- *	因为timer_id是从1开始的，因此从位图获取的值还要加1
+ *	空的时间片直接跳过；tick线程落后时(CPU繁忙)一次收集所有落后时间片上到期的定时器，
+ *	在同一批中处理，循环定时器从当前时间片重新计时(错过的周期不补)
  *
- * @return
+ * @return	到期的定时器个数
  */
-timer_id find_min_id(unsigned char *tmp, int len)
+static unsigned int timer_advance(struct timer_s_internal *this, const struct timespec *now)
 {
-    int bytes = bitmap_bytes(len);
-    int i = 0, cnt = 0;
-    unsigned char base = 0x80;
+    struct timer_dispatch_batch batch;
+    struct timespec cur;
+    unsigned int num = 0;
+    uint64_t due, next, lag;
 
-    while(i < bytes) {
-        if(tmp[i]  ==  255) {
-            ++i;
-            continue;
-        } else {
-            while(1) {
-                if((tmp[i] & base) == 0) {
-                    return i * 8 + cnt + 1;
-                } else {
-                    base = base >> 1;
-                    ++cnt;
-                }
-            }
+    if(now == NULL && clock_gettime(this->clock_id, &cur) == 0) {
+        now = &cur;
+    }
+
+    due = timer_due(this, now);
+    pthread_rwlock_wrlock(&this->lock);
+    timer_batch_init(&batch, this->executor);
+    /*
+     * 先把队列中的命令挂到时间轮上再计算下一个事件，否则时间轮为空时timer_forward
+     * 直接跳到due，循环里的cmd_drain永远执行不到
+     */
+    cmd_drain(this);
+
+    ///第一个要处理的时间片之后还有已经到期的时间片，说明醒来晚了
+    next = timer_next_event(this);
+
+    if(this->start_flag && next != TIMER_TICK_NONE && this->ticks + next < due) {
+        lag = due - this->ticks - next;
+        ++this->overrun.events;
+        this->overrun.missed += lag;
+
+        if(lag > this->overrun.max_missed) {
+            this->overrun.max_missed = lag;
         }
+
+        timer_trace_record(&this->trace, TIMER_TRACE_OVERRUN, 0, timer_trace_arg(lag));
     }
 
-    ///表示位图已经被占完
-    return 0;
-}
+    while(this->start_flag) {
+        timer_forward(this, due);
+
+        if(this->ticks >= due) {
+            break;
+        }
+
+        ///先批量处理应用线程提交的命令，再前进时间片
+        cmd_drain(this);
+        collect_expired(this);
+        ++this->ticks;
+    }
 
+    num = run_expired(this, &batch, now);
+    timer_rearm(this);
+    pthread_rwlock_unlock(&this->lock);
+    timer_stat_add(this->stats.expirations, num);
+    ///所有THREAD回调一次交给执行器
+    timer_executor_flush(&batch);
+    return num;
+}
 
 /**
- * @brief	timer_id_pop
+ * @brief	timer_settime_tick
  *
- * 从定时器管理单元内部取出一个最小未用的id
+ * 把timerfd设置为在第tick个时间片到期(绝对时间)
  *
  * @param	this
- *
- * @return
+ * @param	tick	为TIMER_TICK_NONE时停止timerfd
  */
-static inline timer_id timer_id_pop(struct timer_s_internal *this)
+static void timer_settime_tick(struct timer_s_internal *this, uint64_t tick)
 {
-    ///因为调用这些函数时都是在加了锁的环境中，因此这些函数本身就不进行加锁了
-    timer_id temp = this->timer_fd_min_free;
-    set_bit(this->timer_fd_bitmap, temp);
-    this->timer_fd_min_free = find_min_id(this->timer_fd_bitmap, this->timer_max_num);
-    return temp;
+    struct itimerspec new_value;
+    uint64_t ns;
+    memset(&new_value, 0, sizeof(new_value));
+
+    if(tick != TIMER_TICK_NONE) {
+        ns = tick * this->time_slot * 1000000ULL + this->tick_base.tv_nsec;
+        new_value.it_value.tv_sec = this->tick_base.tv_sec + ns / 1000000000ULL;
+        new_value.it_value.tv_nsec = ns % 1000000000ULL;
+    }
+
+    if(timerfd_settime(this->timerfd, TFD_TIMER_ABSTIME, &new_value, NULL) == -1) {
+        perror("timer_set failed");
+    }
 }
 
 /**
- * @brief	timer_id_push
+ * @brief	timer_settime_armed
  *
- * 将已用的id重新放回定时器管理单元结构中
+ * 把timerfd设置为tick，之后armed被其它线程改过时按最新的值重新设置
  *
  * @param	this
- * @param	id
+ * @param	tick	调用者刚写入armed的值
+ *
+ * @note
+ *	生产者在不加锁的情况下调用timer_kick，多个timerfd_settime的执行顺序和修改armed的
+ *	顺序可能不一致；每个线程设置完都检查一次armed，最后一次设置的值一定等于armed
  */
-static inline void timer_id_push(struct timer_s_internal *this, timer_id id)
+static void timer_settime_armed(struct timer_s_internal *this, uint64_t tick)
 {
-    unset_bit(this->timer_fd_bitmap, id);
+    uint64_t cur;
+    timer_settime_tick(this, tick);
 
-    if(this->timer_fd_min_free > id) {
-        this->timer_fd_min_free = id;
+    while((cur = this->armed) != tick) {
+        tick = cur;
+        timer_settime_tick(this, tick);
     }
 }
 
-static void ti_enable(TIMER_MANAGER *this)
+/**
+ * @brief	timer_rearm
+ *
+ * 把timerfd设置到下一个需要处理的时间片，调用者持有lock
+ *
+ * @param	this
+ */
+static void timer_rearm(struct timer_s_internal *this)
 {
-    if(this  ==  NULL) {
+    uint64_t next, tick;
+
+    if(this->start_flag == 0) {
         return;
     }
 
-    struct timer_s_internal *p = (struct timer_s_internal *)this;
-    pthread_rwlock_rdlock(&p->lock);
-    p->enable_flag = 1;
-    pthread_rwlock_unlock(&p->lock);
+    next = timer_next_event(this);
+    tick = next == TIMER_TICK_NONE ? TIMER_TICK_NONE : this->ticks + next;
+
+    if(tick != this->armed) {
+        this->armed = tick;
+        timer_settime_armed(this, tick);
+    }
+
+    ///与timer_kick配合: 设置之后队列中还有命令，说明生产者的唤醒可能被覆盖了
+    __sync_synchronize();
+
+    if(this->cmds.cells != NULL && this->cmds.head != this->cmds.tail) {
+        timer_kick(this);
+    }
 }
 
-static void ti_disable(TIMER_MANAGER *this)
+/**
+ * @brief	timer_kick
+ *
+ * 命令放入队列后调用，保证tick线程最迟在下一个时间片醒来处理命令
+ *
+ * @param	this
+ */
+static void timer_kick(struct timer_s_internal *this)
 {
-    if(this  ==  NULL) {
+    uint64_t tick, armed;
+
+    if(this->start_flag == 0) {
         return;
     }
 
-    struct timer_s_internal *p = (struct timer_s_internal *)this;
-    pthread_rwlock_rdlock(&p->lock);
-    p->enable_flag = 0;
-    pthread_rwlock_unlock(&p->lock);
+    __sync_synchronize();
+    tick = this->ticks + 1;
+    armed = this->armed;
+
+    ///只有把armed调小的线程才设置timerfd，避免较晚的时间片覆盖较早的
+    while(armed > tick) {
+        if(__sync_bool_compare_and_swap(&this->armed, armed, tick)) {
+            timer_settime_armed(this, tick);
+            return;
+        }
+
+        armed = this->armed;
+    }
 }
 
-static void catch_signal(int i)
+static void timerfd_set_nonblock(int fd, int nonblock)
 {
-    switch(i) {
-        case 62:
-            pthread_exit(0);
-            break;
-        default:
-            break;
+    int flags = fcntl(fd, F_GETFL);
+
+    if(flags == -1) {
+        return;
     }
+
+    fcntl(fd, F_SETFL, nonblock ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
 }
 
 static inline TIMER_BOOL check_timer(struct timer_s_internal *this, struct timer *conf)
@@ -945,10 +2256,132 @@ static inline TIMER_BOOL check_timer(struct timer_s_internal *this, struct timer
         return TIMER_FALSE;
     }
 
-    if((conf->param  ==  NULL  && conf->param_len  != 0) || (conf->param != NULL  && conf->param_len  == 0)) {
+    if(conf->param_mode == TIMER_PARAM_COPY
+            && ((conf->param  ==  NULL  && conf->param_len  != 0) || (conf->param != NULL  && conf->param_len  == 0))) {
         fprintf(stderr, "timer's param and param_len is not conform\n");
         return TIMER_FALSE;
     }
 
     return TIMER_TRUE;
 }
+
+/**
+ * @brief	timer_unlink
+ *
+ * 把定时器从所在的时间片(或expired链表)上摘下
+ *
+ * @param	this
+ * @param	timer
+ */
+static inline void timer_unlink(struct timer_s_internal *this, struct timer_internal *timer)
+{
+    list_del_init(&timer->list);
+
+    if(timer->slot != TIMER_SLOT_NONE) {
+        atomic_dec(&this->data[timer->slot].timer_cnt);
+
+        if(atomic_read(&this->data[timer->slot].timer_cnt) == 0) {
+            this->slot_map[timer->slot >> ID_MAP_BITS] &= ~(1ULL << (timer->slot & ID_MAP_MASK));
+        }
+
+        timer->slot = TIMER_SLOT_NONE;
+    }
+}
+
+/**
+ * @brief	timer_release
+ *
+ * 回收定时器的id，此后该id不再能找到这个定时器
+ *
+ * @param	this
+ * @param	timer
+ */
+static inline void timer_release(struct timer_s_internal *this, struct timer_internal *timer)
+{
+    struct timer_handle *h = &this->handles[timer_id_index(timer->id)];
+
+    ///先让旧id失效再放回空闲栈，push中的CAS保证这两次写在下标被重新分配之前可见
+    h->timer = NULL;
+    h->gen = (h->gen + 1) & TIMER_ID_GEN_MASK;
+    timer_id_push(this, timer_id_index(timer->id));
+    atomic_dec(&this->cur_timer_num);
+}
+
+/**
+ * @brief	timer_param_init
+ *
+ * 按param_mode保存定时器的参数：引用模式只保存指针，短参数拷贝到节点内部，长参数另外申请内存
+ *
+ * @param	t
+ * @param	timer
+ *
+ * @return	申请内存失败返回TIMER_FALSE
+ */
+static inline TIMER_BOOL timer_param_init(struct timer_internal *t, struct timer *timer)
+{
+    if(timer->param_mode == TIMER_PARAM_REF) {
+        t->param = timer->param;
+        return TIMER_TRUE;
+    }
+
+    if(timer->param_len <= 0) {
+        t->param = NULL;
+        return TIMER_TRUE;
+    }
+
+    if(timer->param_len <= TIMER_INLINE_PARAM_SIZE) {
+        t->param = t->param_buf;
+    } else if((t->param = malloc(timer->param_len)) == NULL) {
+        return TIMER_FALSE;
+    }
+
+    memcpy(t->param, timer->param, timer->param_len);
+    return TIMER_TRUE;
+}
+
+static inline void timer_free(struct timer_s_internal *this, struct timer_internal *timer)
+{
+    if(timer->param_mode == TIMER_PARAM_COPY && timer->param != (void *)timer->param_buf) {
+        free(timer->param);
+    }
+
+    mem_pool_free_mt(&this->pool, timer);
+}
+
+/**
+ * @brief	free_all_timers
+ *
+ * 释放时间轮上所有的定时器，调用者必须持有写锁
+ *
+ * @param	this
+ *
+ * @return	原来有定时器返回TIMER_TRUE，否则TIMER_FALSE
+ */
+static TIMER_BOOL free_all_timers(struct timer_s_internal *this)
+{
+    unsigned int cnt = 0;
+    TIMER_BOOL ret = TIMER_FALSE;
+    struct list_head *header;
+    struct timer_internal *temp;
+
+    for(; cnt <= this->slot_num; ++cnt) {
+        ///最后一次处理等待执行的expired链表
+        header = cnt < this->slot_num ? &this->data[cnt].head : &this->expired;
+
+        while(!list_empty(header)) {
+            temp = container_of(header->next, struct timer_internal, list);
+            timer_unlink(this, temp);
+            timer_release(this, temp);
+            timer_free(this, temp);
+            ret = TIMER_TRUE;
+        }
+    }
+
+    if(this->running != NULL) {
+        timer_release(this, this->running);
+        this->running = NULL;
+        ret = TIMER_TRUE;
+    }
+
+    return ret;
+}
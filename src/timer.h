@@ -12,6 +12,7 @@
 #ifndef __TIMER_H__
 #define	__TIMER_H__
 
+#include <time.h>
 
 #define TIMER_STOP_SIGNAL SIGRTMAX-2
 
@@ -32,21 +33,44 @@ typedef int TIMER_BOOL;
 #define gte(a,b)	((a.tv_sec > b.tv_sec) ||  ( (a.tv_sec == b.tv_sec) && (a.tv_nsec >= b.tv_nsec)) )
 
 
+///定时器句柄，0表示无效；时间轮的id中带有代数，定时器删除后旧id不会再命中复用的新定时器
 typedef unsigned int timer_id;
+///时间轮timer_id的低TIMER_ID_INDEX_BITS位是下标，高位是代数，因此timer_max_num不能超过2^24-1
+#define TIMER_ID_INDEX_BITS	24
 typedef struct timer_manager_s	TIMER_MANAGER;
+typedef struct timer_executor_s	TIMER_EXECUTOR;
 
 typedef enum timer_type_s {SINGLE_SHOT, REPEAT} timer_type;
-typedef enum timer_start_type_s {TIMER_START_UNBLOCK = 0, TIMER_START_BLOCK} timer_start_type;
+///EMBED: 不创建tick线程，由调用者在自己的事件循环中监听get_fd返回的fd，可读时调用process_expired
+typedef enum timer_start_type_s {TIMER_START_UNBLOCK = 0, TIMER_START_BLOCK, TIMER_START_EMBED} timer_start_type;
 typedef enum timer_run_type_s {DIRECT = 0, SIGNAL, THREAD} timer_run_type;
+///COPY: 库内部保存一份param的拷贝；REF: 只保存调用者的指针，调用者保证定时器存在期间param有效
+typedef enum timer_param_mode_s {TIMER_PARAM_COPY = 0, TIMER_PARAM_REF} timer_param_mode;
+
+///不超过该长度的param直接拷贝到定时器节点内部，不再单独申请内存
+#define TIMER_INLINE_PARAM_SIZE	32
+///共享内存时间轮中param的最大长度
+#define TIMER_SHM_PARAM_SIZE	64
+typedef enum timer_wheel_type_s {TIMER_WHEEL_SINGLE = 0, TIMER_WHEEL_HIERARCHY} timer_wheel_type;
+/**
+ * 定时器管理对象使用的时钟，默认CLOCK_MONOTONIC，不受系统时间调整(NTP)的影响；
+ * BOOTTIME包含系统挂起的时间；MONOTONIC_COARSE读取时间最快，但只有一个jiffy的精度
+ */
+typedef enum timer_clock_type_s {TIMER_CLOCK_MONOTONIC = 0, TIMER_CLOCK_REALTIME, TIMER_CLOCK_BOOTTIME, TIMER_CLOCK_MONOTONIC_COARSE} timer_clock_type;
 
 struct timer {
     timer_type type;
     timer_run_type run_type;
-    ///单位是毫秒，对于堆定时器，这个代表秒
+    ///单位是毫秒
     unsigned int interval;
     void*(*cb)(void *);
-    void *param;
+    void *param;			//默认拷贝到定时器管理单元中，见param_mode
     int param_len;		//if param is string, param_len 不包含字符串最后的结束符
+    ///间隔的纳秒部分，只有堆定时器使用，实际间隔为interval毫秒加interval_ns纳秒
+    unsigned int interval_ns;
+    timer_param_mode param_mode;
+    ///允许推迟的毫秒数，到期时间在[interval, interval + slack]内对齐，使相近的定时器在同一次唤醒中处理
+    unsigned int slack;
 };
 
 /***********************main_timer***************************/
@@ -57,18 +81,267 @@ struct timer_manager_conf {
     unsigned int slot_num;
     ///能够维护的最大定时器个数
     unsigned int timer_max_num;
+    ///时间轮类型，默认为单级时间轮；多级时间轮忽略slot_num
+    timer_wheel_type wheel_type;
+    /**
+     * 命令队列长度，0表示不使用队列。使用队列时add/del/mod只把命令放入无锁队列就返回(id和节点用CAS分配，不加锁)，
+     * 不会阻塞在到期处理上，由tick线程在每个时间片开始时批量执行；
+     * 此时del/mod的返回值只表示提交时id有效，队列满时退回到加锁的方式
+     */
+    unsigned int submit_queue_len;
+    timer_clock_type clock_type;
+};
+
+///tick线程落后(CPU繁忙时没有按时醒来)的统计
+struct timer_overrun {
+    ///醒来时已经落后的次数(时间轮)，或错过了周期的循环定时器到期次数(最小堆)
+    unsigned long events;
+    ///累计落后的时间片数(时间轮)，或累计错过的周期数(最小堆)
+    unsigned long long missed;
+    ///单次最多落后的时间片数/周期数
+    unsigned long long max_missed;
+};
+
+/***********statistics************/
+///直方图把每个2的幂区间再分成2^TIMER_HIST_SUB_BITS个桶，相对误差不超过1/8
+#define TIMER_HIST_SUB_BITS	3
+#define TIMER_HIST_BUCKETS	((64 - TIMER_HIST_SUB_BITS + 1) << TIMER_HIST_SUB_BITS)
+
+///对数分桶的直方图，单位纳秒
+struct timer_histogram {
+    unsigned long long count[TIMER_HIST_BUCKETS];
+    ///样本个数
+    unsigned long long total;
+    ///样本之和
+    unsigned long long sum;
+    unsigned long long max;
+};
+
+///get_stats的结果，计数从init开始累计
+struct timer_stats {
+    unsigned long long adds;
+    unsigned long long dels;
+    unsigned long long mods;
+    unsigned long long expirations;
+    struct timer_overrun overrun;
+    ///当前的定时器个数
+    unsigned int timers;
+    ///有定时器的时间片个数和定时器最多的时间片上的定时器个数，最小堆没有时间片，总是为0；日历队列为非空的桶数和最长的桶
+    unsigned int busy_slots;
+    unsigned int max_slot_depth;
+    ///实际开始执行(THREAD类型为交给执行器)的时间减去到期时间
+    struct timer_histogram lateness;
+    ///DIRECT回调阻塞定时器线程的时间
+    struct timer_histogram callback;
 };
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    ///第index个桶中的最大值
+    unsigned long long timer_histogram_value(unsigned int index);
+    ///p在0~1之间，返回不小于p比例样本的值(桶的上界)
+    unsigned long long timer_histogram_percentile(const struct timer_histogram *h, double p);
+    ///合并多个管理对象的直方图
+    void timer_histogram_merge(struct timer_histogram *to, const struct timer_histogram *from);
+
+#ifdef __cplusplus
+}
+#endif
+
+/***********trace************/
+///dump_trace写出的文件以此开头
+#define TIMER_TRACE_MAGIC	"STTRACE1"
+#define TIMER_TRACE_VERSION	1
+
+///跟踪事件的类型
+typedef enum {
+    ///arg为间隔(毫秒)
+    TIMER_TRACE_ADD = 1,
+    ///id为0表示删除所有定时器
+    TIMER_TRACE_DEL,
+    ///arg为新的间隔，为0表示沿用原来的间隔
+    TIMER_TRACE_MOD,
+    ///arg为到期延迟(微秒)
+    TIMER_TRACE_EXPIRE,
+    ///DIRECT回调开始和结束
+    TIMER_TRACE_CB_START,
+    TIMER_TRACE_CB_END,
+    ///arg为错过的时间片数(时间轮，id为0)或周期数(最小堆)
+    TIMER_TRACE_OVERRUN,
+    ///多级时间轮把定时器从上级迁移到低级，arg为原来的级别
+    TIMER_TRACE_CASCADE
+} timer_trace_type;
+
+///一个跟踪事件，32字节
+struct timer_trace_event {
+    ///x86上为TSC，其他平台为CLOCK_MONOTONIC的纳秒数
+    unsigned long long tsc;
+    ///写入序号加1，写完后才设置，读取时用来跳过正在写或已被覆盖的事件
+    unsigned long long seq;
+    unsigned int id;
+    unsigned int arg;
+    unsigned short type;
+    ///分片号，dump时填写
+    unsigned short source;
+    ///记录事件的cpu
+    unsigned int cpu;
+};
+
+///跟踪文件头，后面紧跟count个按tsc排序的事件
+struct timer_trace_header {
+    char magic[8];
+    unsigned int version;
+    unsigned int event_size;
+    unsigned long long count;
+    ///环满后被覆盖或正在写而没有写出的事件数
+    unsigned long long lost;
+    ///每秒的tsc计数
+    unsigned long long tsc_hz;
+    ///dump时的tsc和对应的CLOCK_REALTIME(纳秒)，用于换算成绝对时间
+    unsigned long long tsc_base;
+    unsigned long long realtime_base;
+};
+
+/***********snapshot************/
+///snapshot写出的文件以此开头
+#define TIMER_SNAPSHOT_MAGIC	"STSNAP01"
+#define TIMER_SNAPSHOT_VERSION	2
+///timer_snapshot_register登记的回调名字的最大长度
+#define TIMER_SNAPSHOT_NAME_MAX	64
+///记录中回调的标识：没有回调、登记的名字、所在模块(可执行文件或动态库)的GNU build-id
+#define TIMER_SNAPSHOT_KEY_NONE	0
+#define TIMER_SNAPSHOT_KEY_NAME	1
+#define TIMER_SNAPSHOT_KEY_BUILD_ID	2
+
+/**
+ * 快照文件头，后面是count个定长的timer_snapshot_record，最后是param和回调标识拼接成的数据区；
+ * 各部分按8字节对齐，可以直接mmap后按下标访问
+ */
+struct timer_snapshot_header {
+    char magic[8];
+    unsigned int version;
+    unsigned int record_size;
+    unsigned long long count;
+    ///数据区在文件中的偏移和长度
+    unsigned long long param_off;
+    unsigned long long param_size;
+    ///写文件时的CLOCK_REALTIME(纳秒)
+    long long realtime;
+};
+
+///一个定时器，56字节
+struct timer_snapshot_record {
+    ///到期时间，CLOCK_REALTIME的纳秒数，重启后按当前时间换算
+    long long deadline;
+    ///回调相对所在模块加载地址的偏移，回调登记了名字时为0
+    long long cb;
+    ///param在数据区中的偏移
+    unsigned long long param_off;
+    ///回调名字或所在模块build-id在数据区中的偏移，相同的标识只保存一次
+    unsigned long long key_off;
+    int param_len;
+    unsigned int interval;
+    unsigned int interval_ns;
+    unsigned int slack;
+    unsigned short type;
+    unsigned short run_type;
+    unsigned short key_kind;
+    unsigned short key_len;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /**
+     * 给回调登记一个名字，snapshot时保存名字，restore时在当前程序登记的回调中按名字查找，
+     * 换了程序或者重新编译过也能恢复；没有登记的回调只能由build-id相同的模块恢复
+     */
+    TIMER_BOOL timer_snapshot_register(const char *name, void *(*cb)(void *));
+
+#ifdef __cplusplus
+}
+#endif
+
+/***********callback executor************/
+///回调队列满时的处理策略：阻塞tick线程直到有空位、丢弃本次回调、在tick线程中直接执行
+typedef enum timer_executor_policy_s {TIMER_EXECUTOR_BLOCK = 0, TIMER_EXECUTOR_DISCARD, TIMER_EXECUTOR_CALLER_RUNS} timer_executor_policy;
+///SHARED: 所有工作线程共用一个加锁的队列；STEALING: 每个工作线程一个Chase-Lev双端队列，空闲的线程从忙的线程窃取回调
+typedef enum timer_executor_type_s {TIMER_EXECUTOR_SHARED = 0, TIMER_EXECUTOR_STEALING} timer_executor_type;
+
+struct timer_executor_conf {
+    ///工作线程个数
+    unsigned int worker_num;
+    ///等待执行的回调队列长度，STEALING时是每个工作线程的队列长度
+    unsigned int queue_len;
+    timer_executor_policy policy;
+    timer_executor_type type;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    TIMER_EXECUTOR *create_timer_executor(struct timer_executor_conf *conf);
+    void destroy_timer_executor(TIMER_EXECUTOR *);
+    ///因为队列满而被丢弃的回调次数
+    unsigned long timer_executor_discarded(TIMER_EXECUTOR *);
+
+#ifdef __cplusplus
+}
+#endif
+/**************************************/
+
 struct timer_manager_s {
     TIMER_BOOL(*init)(TIMER_MANAGER *this, struct timer_manager_conf *conf);
     timer_id(*add)(TIMER_MANAGER *this, struct timer *timer);
     TIMER_BOOL(*del)(TIMER_MANAGER *this, timer_id id);
+    TIMER_BOOL(*mod)(TIMER_MANAGER *this, timer_id id, unsigned int interval);
     void (*enable)(TIMER_MANAGER *this);
     void (*disable)(TIMER_MANAGER *this);
-    //	TIMER_BOOL (*reset) (TIMER_MANAGER *this, timer_id id);
     void (*start)(TIMER_MANAGER *this, timer_start_type type);
     void (*stop)(TIMER_MANAGER *this);
     void (*close)(TIMER_MANAGER *this);
+    ///THREAD类型定时器的回调交给executor执行，NULL表示每次创建一个线程；executor可以被多个管理对象共用
+    void (*set_executor)(TIMER_MANAGER *this, TIMER_EXECUTOR *executor);
+    ///内部timerfd，以TIMER_START_EMBED方式开启后可以加入epoll，未初始化时返回-1
+    int (*get_fd)(TIMER_MANAGER *this);
+    /**
+     * 以TIMER_START_EMBED方式开启后，处理截止到now为止到期的定时器，回调在调用者线程中执行；
+     * now是管理对象所用时钟(clock_type)的时间，为NULL时读取当前时间，返回处理的到期定时器个数
+     */
+    unsigned int (*process_expired)(TIMER_MANAGER *this, const struct timespec *now);
+    ///读取落后统计，落后时到期的定时器在同一批中处理，不会停止tick线程
+    void (*get_overrun)(TIMER_MANAGER *this, struct timer_overrun *overrun);
+    /**
+     * 在一次加锁中添加n个定时器，ids[i]为timers[i]的id，添加失败的为0(ids可以为NULL)；
+     * 返回添加成功的个数，达到timer_max_num后剩下的定时器不再添加
+     */
+    unsigned int (*add_batch)(TIMER_MANAGER *this, struct timer *timers, unsigned int n, timer_id *ids);
+    ///在一次加锁中删除n个定时器，id为0的项被忽略(不会删除所有定时器)，返回删除成功的个数
+    unsigned int (*del_batch)(TIMER_MANAGER *this, const timer_id *ids, unsigned int n);
+    ///复制一份统计，不阻塞定时器线程，只在统计时间片占用时短暂持有读锁
+    void (*get_stats)(TIMER_MANAGER *this, struct timer_stats *stats);
+    /**
+     * 开启跟踪，在无锁的环中记录最近的events个事件(向上取2的幂)，events为0时停止记录；
+     * 环在第一次开启时分配，之后一直保留到销毁管理对象，再次开启时沿用原来的大小
+     */
+    TIMER_BOOL(*set_trace)(TIMER_MANAGER *this, unsigned int events);
+    ///把环中的事件写到文件，格式见struct timer_trace_header，可以用tools/timer_trace解析
+    TIMER_BOOL(*dump_trace)(TIMER_MANAGER *this, const char *path);
+    /**
+     * 把所有等待到期的定时器写到文件，格式见struct timer_snapshot_header；
+     * TIMER_PARAM_REF方式的param是调用者的指针，这样的定时器(param不为NULL)不保存
+     */
+    TIMER_BOOL(*snapshot)(TIMER_MANAGER *this, const char *path);
+    /**
+     * 把snapshot文件中的定时器在一次加锁中添加进来，复杂度O(n)，已经过期的在下一个时间片执行；
+     * 回调按timer_snapshot_register登记的名字或所在模块的build-id查找，找不到时整个文件都不恢复；
+     * 全部添加成功时返回TIMER_TRUE
+     */
+    TIMER_BOOL(*restore)(TIMER_MANAGER *this, const char *path);
 };
 
 #ifdef __cplusplus
@@ -78,6 +351,36 @@ extern "C" {
     TIMER_MANAGER *create_timer_manager();
     void destroy_timer_manager(TIMER_MANAGER *);
 
+    /**
+     * @brief	create_sharded_timer_manager
+     *
+     * 创建由多个独立时间轮组成的分片管理对象，每个分片有自己的tick线程和锁，add添加到调用者当前cpu对应的分片\n
+     * 分片号编码在timer_id下标的最高几位，因此各分片的timer_max_num(平均分配)要比2^24-1小
+     *
+     * @param	shard_num	分片个数，0表示每个在线cpu一个分片
+     *
+     * @return
+     */
+    TIMER_MANAGER *create_sharded_timer_manager(unsigned int shard_num);
+    void destroy_sharded_timer_manager(TIMER_MANAGER *);
+
+    /**
+     * @brief	create_shm_timer_manager
+     *
+     * 创建共享内存时间轮，时间轮和定时器都在名为name的POSIX共享内存中，映射了同一区域的多个进程可以直接add/del/mod\n
+     * 第一个init的进程按conf创建区域(只支持单级时间轮)，之后的进程直接映射；回调函数和TIMER_PARAM_REF的param是指针，
+     * 只在由同一进程fork出来的进程之间有效，COPY方式的param不能超过TIMER_SHM_PARAM_SIZE
+     *
+     * @param	name	shm_open的名字，以/开头
+     *
+     * @return
+     */
+    TIMER_MANAGER *create_shm_timer_manager(const char *name);
+    ///只解除本进程的映射，区域中的定时器保留
+    void destroy_shm_timer_manager(TIMER_MANAGER *);
+    ///删除共享内存的名字，已经映射的进程不受影响
+    TIMER_BOOL unlink_shm_timer_manager(const char *name);
+
 #ifdef __cplusplus
 }
 #endif
@@ -86,16 +389,37 @@ extern "C" {
 #define MH_TIMER_STOP_SIGNAL SIGRTMAX-3
 typedef struct mh_timer_manager_s	MH_TIMER_MANAGER;
 
+struct mh_timer_manager_conf {
+    ///能够维护的最大定时器个数，小于等于0时使用DEFAULT_TIMER_MAX_NUM
+    int max_size;
+    timer_clock_type clock_type;
+};
+
 struct mh_timer_manager_s {
     TIMER_BOOL(*init)(MH_TIMER_MANAGER *this, int max_size);
-    TIMER_BOOL(*push)(MH_TIMER_MANAGER *this, struct timer *timer);
+    timer_id(*push)(MH_TIMER_MANAGER *this, struct timer *timer);
+    TIMER_BOOL(*del)(MH_TIMER_MANAGER *this, timer_id id);
+    TIMER_BOOL(*mod)(MH_TIMER_MANAGER *this, timer_id id, unsigned int interval);
     void (*enable)(MH_TIMER_MANAGER *this);
     void (*disable)(MH_TIMER_MANAGER *this);
-    //TIMER_BOOL( *pop )( MH_TIMER_MANAGER *this );	//不允许随便删除
-    //	TIMER_BOOL (*reset) (TIMER_MANAGER *this, timer_id id);
     void (*start)(MH_TIMER_MANAGER *this, timer_start_type type);
     void (*stop)(MH_TIMER_MANAGER *this);
     void (*close)(MH_TIMER_MANAGER *this);
+    void (*set_executor)(MH_TIMER_MANAGER *this, TIMER_EXECUTOR *executor);
+    int (*get_fd)(MH_TIMER_MANAGER *this);
+    unsigned int (*process_expired)(MH_TIMER_MANAGER *this, const struct timespec *now);
+    void (*get_overrun)(MH_TIMER_MANAGER *this, struct timer_overrun *overrun);
+    ///init的完整版本，可以选择时钟；init使用默认的CLOCK_MONOTONIC
+    TIMER_BOOL(*init_conf)(MH_TIMER_MANAGER *this, struct mh_timer_manager_conf *conf);
+    ///与时间轮的add_batch相同，批量较大时整体建堆，复杂度O(n + m)
+    unsigned int (*push_batch)(MH_TIMER_MANAGER *this, struct timer *timers, unsigned int n, timer_id *ids);
+    unsigned int (*del_batch)(MH_TIMER_MANAGER *this, const timer_id *ids, unsigned int n);
+    void (*get_stats)(MH_TIMER_MANAGER *this, struct timer_stats *stats);
+    TIMER_BOOL(*set_trace)(MH_TIMER_MANAGER *this, unsigned int events);
+    TIMER_BOOL(*dump_trace)(MH_TIMER_MANAGER *this, const char *path);
+    ///与时间轮相同，恢复时整体建堆，复杂度O(n + m)
+    TIMER_BOOL(*snapshot)(MH_TIMER_MANAGER *this, const char *path);
+    TIMER_BOOL(*restore)(MH_TIMER_MANAGER *this, const char *path);
 };
 
 #ifdef __cplusplus
@@ -105,6 +429,60 @@ extern "C" {
     MH_TIMER_MANAGER *create_mh_timer_manager();
     void destroy_mh_timer_manager(MH_TIMER_MANAGER *);
 
+#ifdef __cplusplus
+}
+#endif
+
+/***********calendar queue timer************/
+typedef struct cq_timer_manager_s	CQ_TIMER_MANAGER;
+
+struct cq_timer_manager_conf {
+    ///能够维护的最大定时器个数，小于等于0时使用DEFAULT_TIMER_MAX_NUM
+    int max_size;
+    timer_clock_type clock_type;
+};
+
+///操作与最小堆相同，间隔同样可以精确到纳秒；插入、删除和取最早的定时器都是均摊O(1)
+struct cq_timer_manager_s {
+    TIMER_BOOL(*init)(CQ_TIMER_MANAGER *this, int max_size);
+    timer_id(*push)(CQ_TIMER_MANAGER *this, struct timer *timer);
+    TIMER_BOOL(*del)(CQ_TIMER_MANAGER *this, timer_id id);
+    TIMER_BOOL(*mod)(CQ_TIMER_MANAGER *this, timer_id id, unsigned int interval);
+    void (*enable)(CQ_TIMER_MANAGER *this);
+    void (*disable)(CQ_TIMER_MANAGER *this);
+    void (*start)(CQ_TIMER_MANAGER *this, timer_start_type type);
+    void (*stop)(CQ_TIMER_MANAGER *this);
+    void (*close)(CQ_TIMER_MANAGER *this);
+    void (*set_executor)(CQ_TIMER_MANAGER *this, TIMER_EXECUTOR *executor);
+    int (*get_fd)(CQ_TIMER_MANAGER *this);
+    unsigned int (*process_expired)(CQ_TIMER_MANAGER *this, const struct timespec *now);
+    void (*get_overrun)(CQ_TIMER_MANAGER *this, struct timer_overrun *overrun);
+    TIMER_BOOL(*init_conf)(CQ_TIMER_MANAGER *this, struct cq_timer_manager_conf *conf);
+    unsigned int (*push_batch)(CQ_TIMER_MANAGER *this, struct timer *timers, unsigned int n, timer_id *ids);
+    unsigned int (*del_batch)(CQ_TIMER_MANAGER *this, const timer_id *ids, unsigned int n);
+    ///busy_slots和max_slot_depth为非空的桶数和最长的桶
+    void (*get_stats)(CQ_TIMER_MANAGER *this, struct timer_stats *stats);
+    TIMER_BOOL(*set_trace)(CQ_TIMER_MANAGER *this, unsigned int events);
+    TIMER_BOOL(*dump_trace)(CQ_TIMER_MANAGER *this, const char *path);
+    TIMER_BOOL(*snapshot)(CQ_TIMER_MANAGER *this, const char *path);
+    TIMER_BOOL(*restore)(CQ_TIMER_MANAGER *this, const char *path);
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /**
+     * @brief	create_cq_timer_manager
+     *
+     * 创建日历队列(calendar queue)定时器，桶数随定时器个数加倍或减半，桶宽度按最早的定时器之间的平均间隔调整，
+     * 不需要像时间轮那样预先选择时间片和时间片个数；stop通过timerfd唤醒并等待定时器线程，不使用信号
+     *
+     * @return
+     */
+    CQ_TIMER_MANAGER *create_cq_timer_manager();
+    void destroy_cq_timer_manager(CQ_TIMER_MANAGER *);
+
 #ifdef __cplusplus
 }
 #endif
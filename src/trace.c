@@ -0,0 +1,234 @@
+#include "timer.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+///dump时校准tsc频率的间隔(纳秒)
+#define TRACE_CALIBRATE_NS	10000000LL
+
+/**
+ * @brief	timer_trace_set
+ *
+ * 第一次开启时分配环，events为0时只停止记录，环保留到timer_trace_free
+ *
+ * @param	trace
+ * @param	events	环的大小，向上取2的幂
+ *
+ * @return	库布尔值
+ */
+TIMER_BOOL timer_trace_set(struct timer_trace *trace, unsigned int events)
+{
+    struct timer_trace_ring *ring, *expected = NULL;
+    unsigned long long size = 1;
+
+    if(events == 0) {
+        __atomic_store_n(&trace->enabled, 0, __ATOMIC_RELEASE);
+        return TIMER_TRUE;
+    }
+
+    if(__atomic_load_n(&trace->ring, __ATOMIC_ACQUIRE) == NULL) {
+        while(size < events) {
+            size <<= 1;
+        }
+
+        if((ring = calloc(1, sizeof(struct timer_trace_ring) + size * sizeof(struct timer_trace_event))) == NULL) {
+            perror("malloc failed");
+            return TIMER_FALSE;
+        }
+
+        ring->mask = size - 1;
+
+        ///同时开启时只保留一个环
+        if(!__atomic_compare_exchange_n(&trace->ring, &expected, ring, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+            free(ring);
+        }
+    }
+
+    __atomic_store_n(&trace->enabled, 1, __ATOMIC_RELEASE);
+    return TIMER_TRUE;
+}
+
+/**
+ * @brief	timer_trace_free
+ *
+ * 销毁管理对象时调用，此时不能再有线程记录事件
+ *
+ * @param	trace
+ */
+void timer_trace_free(struct timer_trace *trace)
+{
+    trace->enabled = 0;
+    free(trace->ring);
+    trace->ring = NULL;
+    trace->head = 0;
+}
+
+/**
+ * @brief	timer_trace_collect
+ *
+ * 复制环中完整的事件，跳过正在写的和已经被覆盖的
+ *
+ * @param	trace
+ * @param	out
+ * @param	max		out能放下的事件数，超过时只保留最新的
+ * @param	lost	累加丢掉的事件数
+ *
+ * @return	复制的事件数
+ */
+unsigned long long timer_trace_collect(struct timer_trace *trace, struct timer_trace_event *out, unsigned long long max, unsigned long long *lost)
+{
+    struct timer_trace_ring *ring = __atomic_load_n(&trace->ring, __ATOMIC_ACQUIRE);
+    struct timer_trace_event *e;
+    unsigned long long head, pos, seq, num = 0;
+
+    if(ring == NULL) {
+        return 0;
+    }
+
+    head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+    pos = head > ring->mask + 1 ? head - ring->mask - 1 : 0;
+
+    if(head - pos > max) {
+        pos = head - max;
+    }
+
+    *lost += pos;
+
+    for(; pos < head; ++pos) {
+        e = &ring->events[pos & ring->mask];
+        seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+        out[num] = *e;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if(seq != pos + 1 || __atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq) {
+            ++*lost;
+            continue;
+        }
+
+        ++num;
+    }
+
+    return num;
+}
+
+static int event_cmp(const void *a, const void *b)
+{
+    const struct timer_trace_event *x = a, *y = b;
+
+    if(x->tsc != y->tsc) {
+        return x->tsc < y->tsc ? -1 : 1;
+    }
+
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static inline long long timespec_ns(const struct timespec *ts)
+{
+    return (long long)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/**
+ * @brief	trace_calibrate
+ *
+ * 在TRACE_CALIBRATE_NS内同时读取tsc和CLOCK_MONOTONIC，估算tsc频率，并记录一组tsc和CLOCK_REALTIME的对应值
+ *
+ * @param	header
+ */
+static void trace_calibrate(struct timer_trace_header *header)
+{
+    struct timespec start, end, real, wait = {0, TRACE_CALIBRATE_NS};
+    unsigned long long tsc0, tsc1;
+    unsigned int cpu;
+    long long ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    tsc0 = timer_trace_clock(&cpu);
+    nanosleep(&wait, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    tsc1 = timer_trace_clock(&cpu);
+    clock_gettime(CLOCK_REALTIME, &real);
+    ns = timespec_ns(&end) - timespec_ns(&start);
+    header->tsc_hz = ns > 0 ? (unsigned long long)((double)(tsc1 - tsc0) * 1e9 / ns) : 1000000000ULL;
+    header->tsc_base = tsc1;
+    header->realtime_base = timespec_ns(&real);
+}
+
+/**
+ * @brief	timer_trace_write
+ *
+ * 把事件按tsc排序后写到文件
+ *
+ * @param	path
+ * @param	events
+ * @param	count
+ * @param	lost
+ *
+ * @return	库布尔值
+ */
+TIMER_BOOL timer_trace_write(const char *path, struct timer_trace_event *events, unsigned long long count, unsigned long long lost)
+{
+    struct timer_trace_header header;
+    FILE *fp;
+    TIMER_BOOL ret = TIMER_TRUE;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TIMER_TRACE_MAGIC, sizeof(header.magic));
+    header.version = TIMER_TRACE_VERSION;
+    header.event_size = sizeof(struct timer_trace_event);
+    header.count = count;
+    header.lost = lost;
+    trace_calibrate(&header);
+    qsort(events, count, sizeof(struct timer_trace_event), event_cmp);
+
+    if((fp = fopen(path, "wb")) == NULL) {
+        perror("open trace file failed");
+        return TIMER_FALSE;
+    }
+
+    if(fwrite(&header, sizeof(header), 1, fp) != 1
+            || (count > 0 && fwrite(events, sizeof(struct timer_trace_event), count, fp) != count)) {
+        perror("write trace file failed");
+        ret = TIMER_FALSE;
+    }
+
+    if(fclose(fp) != 0) {
+        ret = TIMER_FALSE;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief	timer_trace_dump
+ *
+ * @param	trace
+ * @param	path
+ *
+ * @return	库布尔值，没有开启过跟踪时写出空文件
+ */
+TIMER_BOOL timer_trace_dump(struct timer_trace *trace, const char *path)
+{
+    struct timer_trace_ring *ring = __atomic_load_n(&trace->ring, __ATOMIC_ACQUIRE);
+    struct timer_trace_event *events = NULL;
+    unsigned long long count = 0, lost = 0;
+    TIMER_BOOL ret;
+
+    if(path == NULL) {
+        return TIMER_FALSE;
+    }
+
+    if(ring != NULL) {
+        if((events = malloc((ring->mask + 1) * sizeof(struct timer_trace_event))) == NULL) {
+            perror("malloc failed");
+            return TIMER_FALSE;
+        }
+
+        count = timer_trace_collect(trace, events, ring->mask + 1, &lost);
+    }
+
+    ret = timer_trace_write(path, events, count, lost);
+    free(events);
+    return ret;
+}
@@ -0,0 +1,107 @@
+/**
+ * @file trace.h
+ * @brief	定时器生命周期事件的跟踪环，供时间轮和最小堆内部使用
+ *
+ *	1.多个线程用一次原子加取得写入位置，不加锁；环满后覆盖最旧的事件\n
+ *	2.没有开启时记录只是一次读取和一次分支，开启后是一次rdtscp加几次写内存\n
+ *	3.dump时用seq跳过正在写或已经被覆盖的事件，不阻塞记录的线程
+ *
+ * @author tangfu - abctangfuqiang2008@163.com
+ * @version 0.1
+ * @date 2012-07-05
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <time.h>
+#include "timer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+///环的大小和事件一起分配，同时开启跟踪时不会出现大小和环不一致
+struct timer_trace_ring {
+    unsigned long long mask;
+    struct timer_trace_event events[];
+};
+
+struct timer_trace {
+    struct timer_trace_ring *ring;
+    ///下一个写入位置，只增不减
+    unsigned long long head;
+    int enabled;
+};
+
+/**
+ * @brief	timer_trace_clock
+ *
+ * @param	cpu		输出当前cpu(x86上来自IA32_TSC_AUX，其他平台为0)
+ *
+ * @return	事件的时间戳
+ */
+static inline unsigned long long timer_trace_clock(unsigned int *cpu)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned long long tsc = __rdtscp(cpu);
+    *cpu &= 0xfff;
+    return tsc;
+#else
+    struct timespec ts;
+    *cpu = 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/**
+ * @brief	timer_trace_record
+ *
+ * 记录一个事件，没有开启跟踪时直接返回
+ *
+ * @param	trace
+ * @param	type	timer_trace_type
+ * @param	id
+ * @param	arg		含义见timer_trace_type
+ */
+static inline void timer_trace_record(struct timer_trace *trace, unsigned short type, unsigned int id, unsigned int arg)
+{
+    struct timer_trace_ring *ring;
+    struct timer_trace_event *e;
+    unsigned long long pos;
+
+    if(__builtin_expect(!__atomic_load_n(&trace->enabled, __ATOMIC_ACQUIRE), 1)) {
+        return;
+    }
+
+    ///开启后ring不会再变
+    ring = trace->ring;
+    pos = __atomic_fetch_add(&trace->head, 1, __ATOMIC_RELAXED);
+    e = &ring->events[pos & ring->mask];
+    ///先清掉seq，dump时不会把写了一半的事件当成有效的
+    __atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    e->tsc = timer_trace_clock(&e->cpu);
+    e->id = id;
+    e->arg = arg;
+    e->type = type;
+    e->source = 0;
+    __atomic_store_n(&e->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+///arg是32位的，超出范围的值截断为最大值
+static inline unsigned int timer_trace_arg(unsigned long long v)
+{
+    return v > 0xffffffffULL ? 0xffffffffU : (unsigned int)v;
+}
+
+TIMER_BOOL timer_trace_set(struct timer_trace *trace, unsigned int events);
+void timer_trace_free(struct timer_trace *trace);
+unsigned long long timer_trace_collect(struct timer_trace *trace, struct timer_trace_event *out, unsigned long long max, unsigned long long *lost);
+TIMER_BOOL timer_trace_write(const char *path, struct timer_trace_event *events, unsigned long long count, unsigned long long lost);
+TIMER_BOOL timer_trace_dump(struct timer_trace *trace, const char *path);
+///时间轮的跟踪环，分片管理对象用来合并各分片的事件
+struct timer_trace *timer_manager_trace(TIMER_MANAGER *this);
+
+#endif	/* __TRACE_H__ */
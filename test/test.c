@@ -16,6 +16,14 @@
  * =====================================================================================
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include "timer.h"
 #include <stdarg.h>
 #include <setjmp.h>
@@ -54,8 +62,11 @@ void test_add_and_del( void **state )
                t1 = {SINGLE_SHOT, DIRECT, 1000, NULL, NULL, 0},
                t2 = {SINGLE_SHOT, DIRECT, 100, timer_task, "timer2", sizeof( "timer2" )},
                t3 = {SINGLE_SHOT, DIRECT, 100, timer_task, NULL, 3},
-               t4 = {SINGLE_SHOT, DIRECT, 100, timer_task, "timer2",  0};
+               t4 = {SINGLE_SHOT, DIRECT, 100, timer_task, "timer2",  0},
+               t5 = {SINGLE_SHOT, DIRECT, 1000, timer_task, "timer5", 0, 0, TIMER_PARAM_REF},
+               t6 = {SINGLE_SHOT, DIRECT, 1000, timer_task, "a param longer than the inline buffer", sizeof( "a param longer than the inline buffer" )};
         struct timer_manager_conf conf_f = {1000, 30, 100};
+        timer_id id;
         p->close( p );
         assert_int_equal( p->add( p, &t ), 0 );
         p->init( p, &conf_f );
@@ -66,13 +77,1238 @@ void test_add_and_del( void **state )
         assert_int_equal( p->del( p, 1 ), TIMER_FALSE );
         assert_int_equal( p->add( p, &t ), 1 );
         assert_int_equal( p->del( p, 1 ), TIMER_TRUE );
-        assert_int_equal( p->add( p, &t ), 1 );
+        id = p->add( p, &t );
+        assert_int_not_equal( id, 0 );
+        assert_int_not_equal( id, 1 );
+        assert_int_equal( p->del( p, 1 ), TIMER_FALSE );
         //printf( "id=%d\n", p->add( p, &t ) );
         assert_int_equal( p->add( p, &t ), 2 );
+        assert_int_equal( p->add( p, &t5 ), 3 );
+        assert_int_equal( p->add( p, &t6 ), 4 );
+        assert_int_equal( p->del( p, 4 ), TIMER_TRUE );
+}
+
+void test_mh_push_and_del( void **state )
+{
+        struct timer t = {REPEAT, DIRECT, 1000, timer_task, "timer", sizeof( "timer" )},
+               t1 = {SINGLE_SHOT, DIRECT, 0, timer_task, "timer1", sizeof( "timer1" )};
+        timer_id id, id1;
+        assert_int_equal( p1->push( p1, &t1 ), 0 );
+        id = p1->push( p1, &t );
+        id1 = p1->push( p1, &t );
+        assert_int_not_equal( id, 0 );
+        assert_int_not_equal( id1, 0 );
+        assert_int_not_equal( id, id1 );
+        assert_int_equal( p1->mod( p1, id, 500 ), TIMER_TRUE );
+        assert_int_equal( p1->mod( p1, id1, 0 ), TIMER_TRUE );
+        assert_int_equal( p1->del( p1, id ), TIMER_TRUE );
+        assert_int_equal( p1->del( p1, id ), TIMER_FALSE );
+        assert_int_equal( p1->mod( p1, id, 500 ), TIMER_FALSE );
+        assert_int_equal( p1->del( p1, 0 ), TIMER_TRUE );
+        assert_int_equal( p1->del( p1, id1 ), TIMER_FALSE );
+}
+
+#define QUEUED_NUM      10
+static volatile int queued_fired_num;
+
+void *queued_task( void *p )
+{
+        __sync_fetch_and_add( &queued_fired_num, 1 );
+        return NULL;
+}
+
+//EMBED方式下处理到第tick个时间片(时间片为10ms)
+static unsigned int hierarchy_process( TIMER_MANAGER *m, const struct timespec *base, unsigned long tick )
+{
+        struct timespec now = *base;
+        unsigned long long ns = now.tv_nsec + tick * 10 * 1000000ULL;
+        now.tv_sec += ns / 1000000000ULL;
+        now.tv_nsec = ns % 1000000000ULL;
+        return m->process_expired( m, &now );
+}
+
+void test_hierarchy_wheel( void **state )
+{
+        struct timer t = {REPEAT, DIRECT, 1000, timer_task, "timer", sizeof( "timer" )},
+               t1 = {SINGLE_SHOT, DIRECT, 3600000, timer_task, "timer1", sizeof( "timer1" )},
+               q = {SINGLE_SHOT, DIRECT, 2570, queued_task, NULL, 0};
+        struct timer_manager_conf conf = {10, 0, 100, TIMER_WHEEL_HIERARCHY},
+               conf_1 = {0, 0, 100, TIMER_WHEEL_HIERARCHY};
+        TIMER_MANAGER *m = create_timer_manager();
+        struct timespec base;
+        timer_id id, id1;
+        assert_int_equal( m->init( m, &conf_1 ), TIMER_FALSE );
+        assert_int_equal( m->init( m, &conf ), TIMER_TRUE );
+        assert_int_equal( m->add( m, &t ), 1 );
+        assert_int_equal( m->add( m, &t1 ), 2 );
+        assert_int_equal( m->mod( m, 2, 5 ), TIMER_FALSE );
+        assert_int_equal( m->mod( m, 2, 300000 ), TIMER_TRUE );
+        assert_int_equal( m->mod( m, 1, 0 ), TIMER_TRUE );
+        assert_int_equal( m->del( m, 2 ), TIMER_TRUE );
+        assert_int_equal( m->mod( m, 2, 1000 ), TIMER_FALSE );
+        assert_int_equal( m->del( m, 2 ), TIMER_FALSE );
+        assert_int_equal( m->del( m, 0 ), TIMER_TRUE );
+        assert_int_equal( m->del( m, 1 ), TIMER_FALSE );
+        destroy_timer_manager( m );
+        //跨过第一级(256个时间片)的定时器迁移后只执行一次，mod可以在不同级之间移动定时器
+        m = create_timer_manager();
+        assert_int_equal( m->init( m, &conf ), TIMER_TRUE );
+        m->enable( m );
+        m->start( m, TIMER_START_EMBED );
+        clock_gettime( CLOCK_MONOTONIC, &base );
+        queued_fired_num = 0;
+        assert_int_not_equal( m->add( m, &q ), 0 );
+        q.interval = 3000;
+        assert_int_not_equal( m->add( m, &q ), 0 );
+        q.interval = 170000;
+        assert_int_not_equal( m->add( m, &q ), 0 );
+        q.interval = 1000000;
+        assert_int_not_equal( id = m->add( m, &q ), 0 );
+        q.interval = 500;
+        assert_int_not_equal( id1 = m->add( m, &q ), 0 );
+        //第0级移到第1级
+        assert_int_equal( m->mod( m, id1, 6000 ), TIMER_TRUE );
+        assert_int_equal( hierarchy_process( m, &base, 50 ), 0 );
+        assert_int_equal( hierarchy_process( m, &base, 256 ), 0 );
+        assert_int_equal( hierarchy_process( m, &base, 257 ), 1 );
+        assert_int_equal( hierarchy_process( m, &base, 299 ), 0 );
+        assert_int_equal( hierarchy_process( m, &base, 300 ), 1 );
+        //第2级移到第0级
+        assert_int_equal( m->mod( m, id, 2000 ), TIMER_TRUE );
+        assert_int_equal( hierarchy_process( m, &base, 499 ), 0 );
+        assert_int_equal( hierarchy_process( m, &base, 500 ), 1 );
+        assert_int_equal( hierarchy_process( m, &base, 599 ), 0 );
+        assert_int_equal( hierarchy_process( m, &base, 600 ), 1 );
+        assert_int_equal( hierarchy_process( m, &base, 16999 ), 0 );
+        assert_int_equal( hierarchy_process( m, &base, 17000 ), 1 );
+        assert_int_equal( hierarchy_process( m, &base, 100001 ), 0 );
+        assert_int_equal( queued_fired_num, 5 );
+        m->stop( m );
+        destroy_timer_manager( m );
+}
+
+#define SUBMIT_THREADS  4
+#define SUBMIT_LIVE     50
+
+TIMER_MANAGER *submit_m;
+timer_id submit_ids[SUBMIT_THREADS][SUBMIT_LIVE];
+
+//多个线程同时add/del，id和节点的分配都不加锁
+void *submit_entry( void *p )
+{
+        struct timer t = {REPEAT, DIRECT, 1000, timer_task, "timer", sizeof( "timer" )};
+        timer_id *ids = submit_ids[( long )p];
+        int round, i, ret = 0;
+
+        for( round = 0; round < 200; ++round ) {
+                for( i = 0; i < SUBMIT_LIVE; ++i ) {
+                        ret |= ( ids[i] = submit_m->add( submit_m, &t ) ) == 0;
+                }
+
+                //最后一轮留给主线程检查
+                for( i = 0; i < SUBMIT_LIVE && round < 199; ++i ) {
+                        ret |= submit_m->del( submit_m, ids[i] ) != TIMER_TRUE;
+                }
+        }
+
+        return ( void * )( long )ret;
+}
+
+int submit_id_cmp( const void *a, const void *b )
+{
+        return *( const timer_id * )a < *( const timer_id * )b ? -1 : *( const timer_id * )a > *( const timer_id * )b;
+}
+
+void test_submit_queue( void **state )
+{
+        struct timer t = {REPEAT, DIRECT, 1000, timer_task, "timer", sizeof( "timer" )},
+                     q = {SINGLE_SHOT, DIRECT, 20, queued_task, NULL, 0};
+        struct timer_manager_conf conf = {10, 30, 100, TIMER_WHEEL_SINGLE, 2};
+        TIMER_MANAGER *m = create_timer_manager();
+        struct timespec now;
+        timer_id id, id1, id2;
+        pthread_t tids[SUBMIT_THREADS];
+        void *ret;
+        int i;
+        assert_int_equal( m->init( m, &conf ), TIMER_TRUE );
+        id = m->add( m, &t );
+        id1 = m->add( m, &t );
+        //队列已满，退回到加锁的方式
+        id2 = m->add( m, &t );
+        assert_int_not_equal( id, 0 );
+        assert_int_not_equal( id1, 0 );
+        assert_int_not_equal( id2, 0 );
+        assert_int_equal( m->mod( m, id, 5 ), TIMER_FALSE );
+        assert_int_equal( m->mod( m, id, 500 ), TIMER_TRUE );
+        assert_int_equal( m->del( m, id1 ), TIMER_TRUE );
+        assert_int_equal( m->del( m, id2 ), TIMER_TRUE );
+        assert_int_equal( m->del( m, 0 ), TIMER_TRUE );
+        assert_int_equal( m->del( m, id ), TIMER_FALSE );
+        assert_int_equal( m->del( m, id1 ), TIMER_FALSE );
+        destroy_timer_manager( m );
+        //同时存在的id互不相同，全部删除后没有泄漏
+        submit_m = create_timer_manager();
+        conf.timer_max_num = 1000;
+        conf.submit_queue_len = 64;
+        assert_int_equal( submit_m->init( submit_m, &conf ), TIMER_TRUE );
+        submit_m->enable( submit_m );
+        submit_m->start( submit_m, TIMER_START_UNBLOCK );
+
+        for( i = 0; i < SUBMIT_THREADS; ++i ) {
+                pthread_create( &tids[i], NULL, submit_entry, ( void * )( long )i );
+        }
+
+        for( i = 0; i < SUBMIT_THREADS; ++i ) {
+                pthread_join( tids[i], &ret );
+                assert_true( ret == NULL );
+        }
+
+        qsort( submit_ids, SUBMIT_THREADS * SUBMIT_LIVE, sizeof( timer_id ), submit_id_cmp );
+
+        for( i = 1; i < SUBMIT_THREADS * SUBMIT_LIVE; ++i ) {
+                assert_true( submit_ids[0][i - 1] != submit_ids[0][i] );
+        }
+
+        for( i = 0; i < SUBMIT_THREADS * SUBMIT_LIVE; ++i ) {
+                assert_int_equal( submit_m->del( submit_m, submit_ids[0][i] ), TIMER_TRUE );
+        }
+
+        //通过队列提交的单次定时器都会执行
+        queued_fired_num = 0;
+
+        for( i = 0; i < QUEUED_NUM; ++i ) {
+                assert_int_not_equal( submit_m->add( submit_m, &q ), 0 );
+        }
+
+        for( i = 0; i < 100 && queued_fired_num < QUEUED_NUM; ++i ) {
+                usleep( 10 * 1000 );
+        }
+
+        assert_int_equal( queued_fired_num, QUEUED_NUM );
+        submit_m->stop( submit_m );
+        submit_m->close( submit_m );
+        destroy_timer_manager( submit_m );
+        //队列中的mod在add之后执行，到期时间按mod后的间隔计算
+        m = create_timer_manager();
+        assert_int_equal( m->init( m, &conf ), TIMER_TRUE );
+        m->enable( m );
+        m->start( m, TIMER_START_EMBED );
+        queued_fired_num = 0;
+        q.interval = 5000;
+        assert_int_not_equal( id = m->add( m, &q ), 0 );
+        assert_int_equal( m->mod( m, id, 100 ), TIMER_TRUE );
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        now.tv_sec += 1;
+        assert_int_equal( m->process_expired( m, &now ), 1 );
+        assert_int_equal( queued_fired_num, 1 );
+        q.interval = 100;
+        assert_int_not_equal( id = m->add( m, &q ), 0 );
+        assert_int_equal( m->mod( m, id, 3000 ), TIMER_TRUE );
+        now.tv_sec += 1;
+        assert_int_equal( m->process_expired( m, &now ), 0 );
+        now.tv_sec += 3;
+        assert_int_equal( m->process_expired( m, &now ), 1 );
+        assert_int_equal( queued_fired_num, 2 );
+        m->stop( m );
+        destroy_timer_manager( m );
+}
+
+//执行器测试：exec_block_task占住唯一的工作线程，直到exec_release被post
+sem_t exec_started, exec_release;
+pthread_t exec_main;
+pthread_mutex_t exec_lock = PTHREAD_MUTEX_INITIALIZER;
+int exec_on_worker, exec_on_caller, exec_seen_num;
+char exec_seen[8][16];
+
+void *exec_block_task( void *p )
+{
+        sem_post( &exec_started );
+        sem_wait( &exec_release );
+        return NULL;
+}
+
+void *exec_task( void *p )
+{
+        pthread_mutex_lock( &exec_lock );
+
+        if( pthread_equal( pthread_self(), exec_main ) ) {
+                ++exec_on_caller;
+        } else {
+                ++exec_on_worker;
+        }
+
+        if( exec_seen_num < 8 ) {
+                snprintf( exec_seen[exec_seen_num++], sizeof( exec_seen[0] ), "%s", ( char * )p );
+        }
+
+        pthread_mutex_unlock( &exec_lock );
+        return NULL;
+}
+
+void *exec_releaser( void *p )
+{
+        usleep( 50 * 1000 );
+        sem_post( &exec_release );
+        return NULL;
+}
+
+/**
+ * 工作线程被占住、队列长度为1时一次到期3个THREAD定时器，返回丢弃的个数；
+ * 到期的节点马上被新的定时器复用，工作线程看到的仍然应该是原来的param
+ */
+unsigned long exec_fire( timer_executor_type type, timer_executor_policy policy )
+{
+        struct timer_executor_conf conf = {1, 1, policy, type};
+        struct timer block = {SINGLE_SHOT, THREAD, 10, exec_block_task, NULL, 0},
+               t[3] = {{SINGLE_SHOT, THREAD, 10, exec_task, "p0", sizeof( "p0" )},
+                       {SINGLE_SHOT, THREAD, 10, exec_task, "p1", sizeof( "p1" )},
+                       {SINGLE_SHOT, THREAD, 10, exec_task, "p2", sizeof( "p2" )}},
+               clobber = {SINGLE_SHOT, DIRECT, 10000, timer_task, "CLOBBERED", sizeof( "CLOBBERED" )};
+        struct timer_manager_conf mconf = {10, 30, 10, TIMER_WHEEL_SINGLE, 0};
+        TIMER_MANAGER *m = create_timer_manager();
+        TIMER_EXECUTOR *e = create_timer_executor( &conf );
+        timer_id id[3];
+        struct timespec now;
+        pthread_t releaser;
+        unsigned long discarded;
+        int i;
+        assert_true( e != NULL );
+        exec_main = pthread_self();
+        exec_on_worker = exec_on_caller = exec_seen_num = 0;
+        sem_init( &exec_started, 0, 0 );
+        sem_init( &exec_release, 0, 0 );
+        assert_int_equal( m->init( m, &mconf ), TIMER_TRUE );
+        m->set_executor( m, e );
+        m->start( m, TIMER_START_EMBED );
+        assert_int_not_equal( m->add( m, &block ), 0 );
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        now.tv_sec += 1;
+        assert_int_equal( m->process_expired( m, &now ), 1 );
+        sem_wait( &exec_started );
+        assert_int_equal( m->add_batch( m, t, 3, NULL ), 3 );
+
+        //BLOCK时tick线程(这里是调用者)要等工作线程腾出位置
+        if( policy == TIMER_EXECUTOR_BLOCK ) {
+                pthread_create( &releaser, NULL, exec_releaser, NULL );
+        }
+
+        now.tv_sec += 1;
+        assert_int_equal( m->process_expired( m, &now ), 3 );
+
+        for( i = 0; i < 3; ++i ) {
+                id[i] = m->add( m, &clobber );
+                assert_int_not_equal( id[i], 0 );
+        }
+
+        if( policy == TIMER_EXECUTOR_BLOCK ) {
+                pthread_join( releaser, NULL );
+        } else {
+                sem_post( &exec_release );
+        }
+
+        for( i = 0; i < 3; ++i ) {
+                assert_int_equal( m->del( m, id[i] ), TIMER_TRUE );
+        }
+
+        m->set_executor( m, NULL );
+        m->stop( m );
+        destroy_timer_manager( m );
+        //销毁时执行完已经投递的回调
+        discarded = timer_executor_discarded( e );
+        destroy_timer_executor( e );
+        assert_int_equal( exec_on_worker + exec_on_caller + discarded, 3 );
+
+        for( i = 0; i < exec_seen_num; ++i ) {
+                assert_int_equal( exec_seen[i][0], 'p' );
+                assert_int_equal( strlen( exec_seen[i] ), 2 );
+        }
+
+        sem_destroy( &exec_started );
+        sem_destroy( &exec_release );
+        return discarded;
+}
+
+//最小堆和日历队列：到期的节点马上被复用，工作线程看到的仍然应该是原来的param
+struct exec_engine {
+        void *( *create )( TIMER_EXECUTOR *e );
+        timer_id( *push )( void *m, struct timer *t );
+        unsigned int ( *expire )( void *m, const struct timespec *now );
+        void ( *destroy )( void *m );
+};
+
+static void *exec_mh_create( TIMER_EXECUTOR *e )
+{
+        MH_TIMER_MANAGER *h = create_mh_timer_manager();
+        assert_int_equal( h->init( h, 10 ), TIMER_TRUE );
+        h->set_executor( h, e );
+        h->start( h, TIMER_START_EMBED );
+        return h;
+}
+
+static timer_id exec_mh_push( void *m, struct timer *t )
+{
+        return ( ( MH_TIMER_MANAGER * )m )->push( m, t );
+}
+
+static unsigned int exec_mh_expire( void *m, const struct timespec *now )
+{
+        return ( ( MH_TIMER_MANAGER * )m )->process_expired( m, now );
+}
+
+static void exec_mh_destroy( void *m )
+{
+        MH_TIMER_MANAGER *h = m;
+        h->set_executor( h, NULL );
+        h->stop( h );
+        destroy_mh_timer_manager( h );
+}
+
+static void *exec_cq_create( TIMER_EXECUTOR *e )
+{
+        CQ_TIMER_MANAGER *c = create_cq_timer_manager();
+        assert_int_equal( c->init( c, 10 ), TIMER_TRUE );
+        c->set_executor( c, e );
+        c->start( c, TIMER_START_EMBED );
+        return c;
+}
+
+static timer_id exec_cq_push( void *m, struct timer *t )
+{
+        return ( ( CQ_TIMER_MANAGER * )m )->push( m, t );
+}
+
+static unsigned int exec_cq_expire( void *m, const struct timespec *now )
+{
+        return ( ( CQ_TIMER_MANAGER * )m )->process_expired( m, now );
+}
+
+static void exec_cq_destroy( void *m )
+{
+        CQ_TIMER_MANAGER *c = m;
+        c->set_executor( c, NULL );
+        c->stop( c );
+        destroy_cq_timer_manager( c );
+}
+
+static const struct exec_engine exec_engines[] = {
+        {exec_mh_create, exec_mh_push, exec_mh_expire, exec_mh_destroy},
+        {exec_cq_create, exec_cq_push, exec_cq_expire, exec_cq_destroy}
+};
+
+void exec_reuse( const struct exec_engine *engine )
+{
+        struct timer_executor_conf conf = {1, 1, TIMER_EXECUTOR_BLOCK, TIMER_EXECUTOR_SHARED};
+        struct timer block = {SINGLE_SHOT, THREAD, 10, exec_block_task, NULL, 0},
+               t = {SINGLE_SHOT, THREAD, 10, exec_task, "p0", sizeof( "p0" )},
+               clobber = {SINGLE_SHOT, DIRECT, 10000, timer_task, "CLOBBERED", sizeof( "CLOBBERED" )};
+        TIMER_EXECUTOR *e = create_timer_executor( &conf );
+        struct timespec now;
+        void *m;
+        exec_on_worker = exec_on_caller = exec_seen_num = 0;
+        sem_init( &exec_started, 0, 0 );
+        sem_init( &exec_release, 0, 0 );
+        m = engine->create( e );
+        assert_int_not_equal( engine->push( m, &block ), 0 );
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        now.tv_sec += 1;
+        assert_int_equal( engine->expire( m, &now ), 1 );
+        sem_wait( &exec_started );
+        assert_int_not_equal( engine->push( m, &t ), 0 );
+        assert_int_equal( engine->expire( m, &now ), 1 );
+        assert_int_not_equal( engine->push( m, &clobber ), 0 );
+        sem_post( &exec_release );
+        engine->destroy( m );
+        destroy_timer_executor( e );
+        assert_int_equal( exec_seen_num, 1 );
+        assert_int_equal( strcmp( exec_seen[0], "p0" ), 0 );
+        sem_destroy( &exec_started );
+        sem_destroy( &exec_release );
+}
+
+void test_executor( void **state )
+{
+        timer_executor_type type[2] = {TIMER_EXECUTOR_SHARED, TIMER_EXECUTOR_STEALING};
+        int i;
+        struct timer_executor_conf conf = {2, 16, TIMER_EXECUTOR_DISCARD},
+               conf_1 = {0, 16, TIMER_EXECUTOR_BLOCK};
+        TIMER_EXECUTOR *e;
+        assert_true( create_timer_executor( &conf_1 ) == NULL );
+        e = create_timer_executor( &conf );
+        assert_true( e != NULL );
+        p->set_executor( p, e );
+        p1->set_executor( p1, e );
+        assert_int_equal( timer_executor_discarded( e ), 0 );
+        p->set_executor( p, NULL );
+        p1->set_executor( p1, NULL );
+        destroy_timer_executor( e );
+        conf.type = TIMER_EXECUTOR_STEALING;
+        e = create_timer_executor( &conf );
+        assert_true( e != NULL );
+        p1->set_executor( p1, e );
+        p1->set_executor( p1, NULL );
+        destroy_timer_executor( e );
+
+        //两种执行器都只能放下1个，其余2个按策略处理
+        for( i = 0; i < 2; ++i ) {
+                assert_int_equal( exec_fire( type[i], TIMER_EXECUTOR_DISCARD ), 2 );
+                assert_int_equal( exec_on_worker, 1 );
+                assert_int_equal( exec_fire( type[i], TIMER_EXECUTOR_CALLER_RUNS ), 0 );
+                assert_int_equal( exec_on_worker, 1 );
+                assert_int_equal( exec_on_caller, 2 );
+                assert_int_equal( exec_fire( type[i], TIMER_EXECUTOR_BLOCK ), 0 );
+                assert_int_equal( exec_on_worker, 3 );
+                assert_int_equal( exec_on_caller, 0 );
+        }
+
+        for( i = 0; i < 2; ++i ) {
+                exec_reuse( &exec_engines[i] );
+        }
+}
+
+void test_sharded( void **state )
+{
+        struct timer t = {REPEAT, DIRECT, 1000, timer_task, "timer", sizeof( "timer" )};
+        struct timer_manager_conf conf = {10, 30, 8, TIMER_WHEEL_SINGLE, 0},
+                                  conf_1 = {10, 30, ( 1 << 24 ) - 1, TIMER_WHEEL_SINGLE, 0};
+        TIMER_MANAGER *m = create_sharded_timer_manager( 4 );
+        timer_id id[9];
+        int i;
+        assert_true( m != NULL );
+        //分片号占用了下标的高2位
+        assert_int_equal( m->init( m, &conf_1 ), TIMER_FALSE );
+        assert_int_equal( m->init( m, &conf ), TIMER_TRUE );
+
+        //当前分片满了之后添加到其他分片
+        for( i = 0; i < 8; i++ ) {
+                id[i] = m->add( m, &t );
+                assert_int_not_equal( id[i], 0 );
+        }
+
+        assert_int_equal( m->add( m, &t ), 0 );
+        assert_int_equal( m->mod( m, id[0], 500 ), TIMER_TRUE );
+        assert_int_equal( m->del( m, id[1] ), TIMER_TRUE );
+        assert_int_equal( m->del( m, id[1] ), TIMER_FALSE );
+        id[8] = m->add( m, &t );
+        assert_int_not_equal( id[8], 0 );
+        assert_int_equal( m->del( m, 0 ), TIMER_TRUE );
+        assert_int_equal( m->del( m, id[8] ), TIMER_FALSE );
+        m->close( m );
+        destroy_sharded_timer_manager( m );
+}
+
+void test_embed( void **state )
+{
+        struct timer t = {SINGLE_SHOT, DIRECT, 20, timer_task, "embed", sizeof( "embed" )};
+        struct timer_manager_conf conf = {10, 30, 10, TIMER_WHEEL_SINGLE, 0};
+        TIMER_MANAGER *m = create_timer_manager();
+        MH_TIMER_MANAGER *h = create_mh_timer_manager();
+        struct timespec now;
+        assert_int_equal( m->get_fd( m ), -1 );
+        assert_int_equal( m->init( m, &conf ), TIMER_TRUE );
+        assert_true( m->get_fd( m ) >= 0 );
+        //没有以EMBED方式开启时不处理
+        assert_int_equal( m->process_expired( m, NULL ), 0 );
+        m->enable( m );
+        m->start( m, TIMER_START_EMBED );
+        assert_int_not_equal( m->add( m, &t ), 0 );
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        now.tv_sec += 1;
+        assert_int_equal( m->process_expired( m, &now ), 1 );
+        assert_int_equal( m->process_expired( m, &now ), 0 );
+        m->stop( m );
+        destroy_timer_manager( m );
+        //minheap_timer
+        assert_int_equal( h->init( h, 10 ), TIMER_TRUE );
+        assert_true( h->get_fd( h ) >= 0 );
+        h->enable( h );
+        h->start( h, TIMER_START_EMBED );
+        assert_int_not_equal( h->push( h, &t ), 0 );
+        assert_int_not_equal( h->push( h, &t ), 0 );
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        assert_int_equal( h->process_expired( h, &now ), 0 );
+        now.tv_sec += 1;
+        assert_int_equal( h->process_expired( h, &now ), 2 );
+        h->stop( h );
+        destroy_mh_timer_manager( h );
+}
+
+void test_tickless( void **state )
+{
+        struct timer t = {SINGLE_SHOT, DIRECT, 20, timer_task, "tickless", sizeof( "tickless" )};
+        struct timer_manager_conf conf = {10, 30, 10, TIMER_WHEEL_HIERARCHY, 0};
+        TIMER_MANAGER *m = create_timer_manager();
+        struct pollfd pfd;
+        assert_int_equal( m->init( m, &conf ), TIMER_TRUE );
+        m->start( m, TIMER_START_EMBED );
+        pfd.fd = m->get_fd( m );
+        pfd.events = POLLIN;
+        //没有定时器时timerfd不会到期
+        assert_int_equal( poll( &pfd, 1, 50 ), 0 );
+        assert_int_not_equal( m->add( m, &t ), 0 );
+        assert_int_equal( poll( &pfd, 1, 1000 ), 1 );
+        assert_int_equal( m->process_expired( m, NULL ), 1 );
+        assert_int_equal( poll( &pfd, 1, 50 ), 0 );
+        m->stop( m );
+        destroy_timer_manager( m );
+}
+
+void test_tickless_queue( void **state )
+{
+        struct timer t = {SINGLE_SHOT, DIRECT, 20, queued_task, NULL, 0};
+        struct timer_manager_conf conf = {10, 30, 100, TIMER_WHEEL_SINGLE, 1024};
+        unsigned int wheel[2] = {TIMER_WHEEL_SINGLE, TIMER_WHEEL_HIERARCHY};
+        TIMER_MANAGER *m;
+        struct timespec now;
+        int i, j, k;
+
+        //时间轮为空时，通过命令队列提交的定时器也要按时执行
+        for( i = 0; i < 2; ++i ) {
+                conf.wheel_type = wheel[i];
+                //EMBED
+                m = create_timer_manager();
+                assert_int_equal( m->init( m, &conf ), TIMER_TRUE );
+                m->enable( m );
+                m->start( m, TIMER_START_EMBED );
+                queued_fired_num = 0;
+
+                for( j = 0; j < QUEUED_NUM; ++j ) {
+                        assert_int_not_equal( m->add( m, &t ), 0 );
+                }
+
+                clock_gettime( CLOCK_MONOTONIC, &now );
+                now.tv_sec += 1;
+                assert_int_equal( m->process_expired( m, &now ), QUEUED_NUM );
+                assert_int_equal( queued_fired_num, QUEUED_NUM );
+                m->stop( m );
+                destroy_timer_manager( m );
+                //UNBLOCK
+                m = create_timer_manager();
+                assert_int_equal( m->init( m, &conf ), TIMER_TRUE );
+                m->enable( m );
+                m->start( m, TIMER_START_UNBLOCK );
+                queued_fired_num = 0;
+
+                for( j = 0; j < QUEUED_NUM; ++j ) {
+                        assert_int_not_equal( m->add( m, &t ), 0 );
+                }
+
+                for( k = 0; k < 100 && queued_fired_num < QUEUED_NUM; ++k ) {
+                        usleep( 10 * 1000 );
+                }
+
+                assert_int_equal( queued_fired_num, QUEUED_NUM );
+                m->stop( m );
+                destroy_timer_manager( m );
+        }
+}
+
+void test_overrun( void **state )
+{
+        struct timer t = {REPEAT, DIRECT, 20, timer_task, "overrun", sizeof( "overrun" )};
+        struct timer_manager_conf conf = {10, 30, 10, TIMER_WHEEL_SINGLE, 0};
+        TIMER_MANAGER *m = create_timer_manager();
+        MH_TIMER_MANAGER *h = create_mh_timer_manager();
+        struct timer_overrun o;
+        struct timespec now;
+        assert_int_equal( m->init( m, &conf ), TIMER_TRUE );
+        m->start( m, TIMER_START_EMBED );
+        assert_int_not_equal( m->add( m, &t ), 0 );
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        now.tv_sec += 1;
+        //落后的时间片一次处理完，循环定时器只执行一次
+        assert_int_equal( m->process_expired( m, &now ), 1 );
+        m->get_overrun( m, &o );
+        assert_int_equal( o.events, 1 );
+        assert_true( o.missed >= 98 );
+        assert_true( o.max_missed == o.missed );
+        m->stop( m );
+        destroy_timer_manager( m );
+        //minheap_timer
+        assert_int_equal( h->init( h, 10 ), TIMER_TRUE );
+        h->enable( h );
+        h->start( h, TIMER_START_EMBED );
+        assert_int_not_equal( h->push( h, &t ), 0 );
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        now.tv_sec += 1;
+        assert_int_equal( h->process_expired( h, &now ), 1 );
+        h->get_overrun( h, &o );
+        assert_int_equal( o.events, 1 );
+        assert_true( o.missed >= 48 );
+        h->stop( h );
+        destroy_mh_timer_manager( h );
+}
+
+void test_clock( void **state )
+{
+        struct timer t = {SINGLE_SHOT, DIRECT, 20, timer_task, "clock", sizeof( "clock" )};
+        struct timer_manager_conf conf = {10, 30, 10, TIMER_WHEEL_SINGLE, 0, TIMER_CLOCK_REALTIME},
+                                  conf_1 = {10, 30, 10, TIMER_WHEEL_SINGLE, 0, 100};
+        struct mh_timer_manager_conf mh_conf = {10, TIMER_CLOCK_MONOTONIC_COARSE},
+                                     mh_conf_1 = {10, 100};
+        TIMER_MANAGER *m = create_timer_manager();
+        MH_TIMER_MANAGER *h = create_mh_timer_manager();
+        struct timespec now;
+        assert_int_equal( m->init( m, &conf_1 ), TIMER_FALSE );
+        assert_int_equal( m->init( m, &conf ), TIMER_TRUE );
+        m->start( m, TIMER_START_EMBED );
+        assert_int_not_equal( m->add( m, &t ), 0 );
+        clock_gettime( CLOCK_REALTIME, &now );
+        now.tv_sec += 1;
+        assert_int_equal( m->process_expired( m, &now ), 1 );
+        destroy_timer_manager( m );
+        //minheap_timer
+        assert_int_equal( h->init_conf( h, &mh_conf_1 ), TIMER_FALSE );
+        assert_int_equal( h->init_conf( h, &mh_conf ), TIMER_TRUE );
+        h->start( h, TIMER_START_EMBED );
+        assert_int_not_equal( h->push( h, &t ), 0 );
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        now.tv_sec += 1;
+        assert_int_equal( h->process_expired( h, &now ), 1 );
+        destroy_mh_timer_manager( h );
+}
+
+void test_slack( void **state )
+{
+        struct timer t = {SINGLE_SHOT, DIRECT, 30, timer_task, "slack", sizeof( "slack" ), 0, 0, 60},
+                     t1 = {SINGLE_SHOT, DIRECT, 50, timer_task, "slack", sizeof( "slack" ), 0, 0, 60};
+        struct timer_manager_conf conf = {10, 30, 10, TIMER_WHEEL_SINGLE, 0};
+        TIMER_MANAGER *m = create_timer_manager();
+        struct timespec now, later;
+        assert_int_equal( m->init( m, &conf ), TIMER_TRUE );
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        m->start( m, TIMER_START_EMBED );
+        assert_int_not_equal( m->add( m, &t ), 0 );
+        assert_int_not_equal( m->add( m, &t1 ), 0 );
+        //两个定时器都推迟到同一个时间片，一次处理
+        later = now;
+        later.tv_nsec += 55 * 1000000;
+        later.tv_sec += later.tv_nsec / 1000000000;
+        later.tv_nsec %= 1000000000;
+        assert_int_equal( m->process_expired( m, &later ), 0 );
+        later = now;
+        later.tv_nsec += 85 * 1000000;
+        later.tv_sec += later.tv_nsec / 1000000000;
+        later.tv_nsec %= 1000000000;
+        assert_int_equal( m->process_expired( m, &later ), 2 );
+        m->stop( m );
+        destroy_timer_manager( m );
+}
+
+void test_batch( void **state )
+{
+        struct timer t[10];
+        struct timer_manager_conf conf = {10, 30, 8, TIMER_WHEEL_SINGLE, 0};
+        TIMER_MANAGER *m = create_timer_manager(), *sm = create_sharded_timer_manager( 4 );
+        MH_TIMER_MANAGER *h = create_mh_timer_manager();
+        timer_id ids[10];
+        struct timespec now;
+        int i;
+
+        for( i = 0; i < 10; i++ ) {
+                t[i] = ( struct timer ) {SINGLE_SHOT, DIRECT, 100 * ( 10 - i ), timer_task, "batch", sizeof( "batch" )};
+        }
+
+        t[2].interval = 0;
+        //非法的定时器跳过，达到timer_max_num后停止
+        assert_int_equal( m->init( m, &conf ), TIMER_TRUE );
+        assert_int_equal( m->add_batch( m, t, 10, ids ), 8 );
+        assert_int_equal( ids[2], 0 );
+        assert_int_equal( ids[9], 0 );
+        assert_int_equal( m->del_batch( m, ids, 10 ), 8 );
+        assert_int_equal( m->del_batch( m, ids, 10 ), 0 );
+        destroy_timer_manager( m );
+        //分片
+        assert_int_equal( sm->init( sm, &conf ), TIMER_TRUE );
+        assert_int_equal( sm->add_batch( sm, t, 10, ids ), 8 );
+        assert_int_equal( sm->del_batch( sm, ids, 10 ), 8 );
+        sm->close( sm );
+        destroy_sharded_timer_manager( sm );
+        //minheap_timer，批量大于堆中原有的定时器时整体建堆
+        assert_int_equal( h->init( h, 16 ), TIMER_TRUE );
+        h->start( h, TIMER_START_EMBED );
+        assert_int_not_equal( h->push( h, &t[0] ), 0 );
+        assert_int_equal( h->push_batch( h, t, 10, ids ), 9 );
+        assert_int_equal( h->del_batch( h, ids, 5 ), 4 );
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        now.tv_nsec += 450 * 1000000;
+        now.tv_sec += now.tv_nsec / 1000000000;
+        now.tv_nsec %= 1000000000;
+        //剩下的定时器间隔为100~500ms和1000ms
+        assert_int_equal( h->process_expired( h, &now ), 4 );
+        now.tv_sec += 1;
+        assert_int_equal( h->process_expired( h, &now ), 2 );
+        destroy_mh_timer_manager( h );
+}
+
+void test_stats( void **state )
+{
+        struct timer t = {SINGLE_SHOT, DIRECT, 20, timer_task, "stats", sizeof( "stats" )};
+        struct timer_manager_conf conf = {10, 30, 10, TIMER_WHEEL_SINGLE, 0};
+        TIMER_MANAGER *m = create_timer_manager();
+        MH_TIMER_MANAGER *h = create_mh_timer_manager();
+        struct timer_stats stats;
+        struct timespec now;
+        timer_id id;
+        assert_int_equal( m->init( m, &conf ), TIMER_TRUE );
+        m->enable( m );
+        m->start( m, TIMER_START_EMBED );
+        id = m->add( m, &t );
+        assert_int_equal( m->mod( m, id, 50 ), TIMER_TRUE );
+        assert_int_equal( m->del( m, id ), TIMER_TRUE );
+        assert_int_not_equal( m->add( m, &t ), 0 );
+        m->get_stats( m, &stats );
+        assert_int_equal( stats.adds, 2 );
+        assert_int_equal( stats.dels, 1 );
+        assert_int_equal( stats.mods, 1 );
+        assert_int_equal( stats.timers, 1 );
+        assert_int_equal( stats.busy_slots, 1 );
+        assert_int_equal( stats.max_slot_depth, 1 );
+        //晚了将近1秒才处理
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        now.tv_sec += 1;
+        assert_int_equal( m->process_expired( m, &now ), 1 );
+        m->get_stats( m, &stats );
+        assert_int_equal( stats.expirations, 1 );
+        assert_int_equal( stats.timers, 0 );
+        assert_int_equal( stats.busy_slots, 0 );
+        assert_int_equal( stats.lateness.total, 1 );
+        assert_true( stats.lateness.max >= 900 * 1000000ULL );
+        assert_true( timer_histogram_percentile( &stats.lateness, 0.99 ) <= stats.lateness.max );
+        assert_int_equal( stats.callback.total, 1 );
+        m->stop( m );
+        destroy_timer_manager( m );
+        //minheap_timer
+        assert_int_equal( h->init( h, 10 ), TIMER_TRUE );
+        h->enable( h );
+        h->start( h, TIMER_START_EMBED );
+        assert_int_not_equal( h->push( h, &t ), 0 );
+        assert_int_not_equal( h->push( h, &t ), 0 );
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        now.tv_sec += 1;
+        assert_int_equal( h->process_expired( h, &now ), 2 );
+        h->get_stats( h, &stats );
+        assert_int_equal( stats.adds, 2 );
+        assert_int_equal( stats.expirations, 2 );
+        assert_int_equal( stats.lateness.total, 2 );
+        assert_int_equal( stats.callback.total, 2 );
+        assert_true( stats.lateness.sum >= 2 * 900 * 1000000ULL );
+        h->stop( h );
+        destroy_mh_timer_manager( h );
+}
+
+///读取dump_trace写出的文件，返回事件个数
+static int read_trace( const char *path, struct timer_trace_event *events, int max )
+{
+        struct timer_trace_header h;
+        FILE *fp = fopen( path, "rb" );
+        int n = -1;
+
+        if( fp == NULL ) {
+                return -1;
+        }
+
+        if( fread( &h, sizeof( h ), 1, fp ) == 1 && memcmp( h.magic, TIMER_TRACE_MAGIC, sizeof( h.magic ) ) == 0 && h.count <= ( unsigned long long )max ) {
+                n = ( int )fread( events, sizeof( struct timer_trace_event ), h.count, fp );
+        }
+
+        fclose( fp );
+        return n;
+}
+
+void test_trace( void **state )
+{
+        struct timer t = {SINGLE_SHOT, DIRECT, 20, timer_task, "trace", sizeof( "trace" )};
+        struct timer_manager_conf conf = {10, 30, 10, TIMER_WHEEL_SINGLE, 0};
+        TIMER_MANAGER *m = create_timer_manager(), *sm = create_sharded_timer_manager( 2 );
+        struct timer_trace_event e[16];
+        const char *path = "/tmp/simpletimer_test.trace";
+        struct timespec now;
+        timer_id id;
+        int i;
+        assert_int_equal( m->init( m, &conf ), TIMER_TRUE );
+        m->enable( m );
+        m->start( m, TIMER_START_EMBED );
+        //没有开启时不记录
+        assert_int_not_equal( m->add( m, &t ), 0 );
+        assert_int_equal( m->set_trace( m, 6 ), TIMER_TRUE );
+        id = m->add( m, &t );
+        assert_int_equal( m->mod( m, id, 50 ), TIMER_TRUE );
+        assert_int_equal( m->del( m, id ), TIMER_TRUE );
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        now.tv_sec += 1;
+        assert_int_equal( m->process_expired( m, &now ), 1 );
+        assert_int_equal( m->dump_trace( m, path ), TIMER_TRUE );
+        assert_int_equal( read_trace( path, e, 16 ), 7 );
+        assert_int_equal( e[0].type, TIMER_TRACE_ADD );
+        assert_int_equal( e[0].id, id );
+        assert_int_equal( e[0].arg, 20 );
+        assert_int_equal( e[1].type, TIMER_TRACE_MOD );
+        assert_int_equal( e[1].arg, 50 );
+        assert_int_equal( e[2].type, TIMER_TRACE_DEL );
+        //晚了将近1秒，先记录落后的时间片数
+        assert_int_equal( e[3].type, TIMER_TRACE_OVERRUN );
+        assert_int_equal( e[4].type, TIMER_TRACE_EXPIRE );
+        assert_true( e[4].arg >= 900 * 1000 );
+        assert_int_equal( e[5].type, TIMER_TRACE_CB_START );
+        assert_int_equal( e[6].type, TIMER_TRACE_CB_END );
+        assert_true( e[6].tsc >= e[5].tsc );
+        //环(8个)满后覆盖最旧的事件，停止后不再记录
+        for( i = 0; i < 3; i++ ) {
+                assert_int_not_equal( m->add( m, &t ), 0 );
+        }
+
+        assert_int_equal( m->set_trace( m, 0 ), TIMER_TRUE );
+        assert_int_not_equal( m->add( m, &t ), 0 );
+        assert_int_equal( m->dump_trace( m, path ), TIMER_TRUE );
+        assert_int_equal( read_trace( path, e, 16 ), 8 );
+        assert_int_equal( e[0].type, TIMER_TRACE_DEL );
+        assert_int_equal( e[7].type, TIMER_TRACE_ADD );
+        m->stop( m );
+        destroy_timer_manager( m );
+        //分片的id换算成add返回的id
+        assert_int_equal( sm->init( sm, &conf ), TIMER_TRUE );
+        assert_int_equal( sm->set_trace( sm, 4 ), TIMER_TRUE );
+        id = sm->add( sm, &t );
+        assert_int_not_equal( id, 0 );
+        assert_int_equal( sm->dump_trace( sm, path ), TIMER_TRUE );
+        assert_int_equal( read_trace( path, e, 16 ), 1 );
+        assert_int_equal( e[0].id, id );
+        sm->close( sm );
+        destroy_sharded_timer_manager( sm );
+        unlink( path );
+}
+
+void test_shm( void **state )
+{
+        struct timer t = {SINGLE_SHOT, DIRECT, 20, timer_task, "shm", sizeof( "shm" )},
+               block = {SINGLE_SHOT, THREAD, 10, exec_block_task, NULL, 0},
+               t_1 = {SINGLE_SHOT, THREAD, 10, exec_task, "p0", sizeof( "p0" )},
+               clobber = {SINGLE_SHOT, DIRECT, 10000, timer_task, "CLOBBERED", sizeof( "CLOBBERED" )};
+        struct timer_manager_conf conf = {10, 30, 10, TIMER_WHEEL_SINGLE, 0},
+               conf_1 = {10, 30, 10, TIMER_WHEEL_HIERARCHY, 0};
+        struct timer_executor_conf econf = {1, 1, TIMER_EXECUTOR_BLOCK, TIMER_EXECUTOR_SHARED};
+        TIMER_EXECUTOR *e;
+        const char *name = "/simpletimer_test";
+        TIMER_MANAGER *m = create_shm_timer_manager( name ), *m2 = create_shm_timer_manager( name );
+        struct timer_stats stats;
+        struct timespec now;
+        timer_id id;
+        pid_t pid;
+        int status;
+        unlink_shm_timer_manager( name );
+        assert_int_equal( m->init( m, &conf_1 ), TIMER_FALSE );
+        assert_int_equal( m->init( m, &conf ), TIMER_TRUE );
+        //已经存在时直接映射，conf被忽略
+        assert_int_equal( m2->init( m2, &conf_1 ), TIMER_TRUE );
+        id = m2->add( m2, &t );
+        assert_int_not_equal( id, 0 );
+        assert_int_equal( m->del( m, id ), TIMER_TRUE );
+        assert_int_equal( m2->del( m2, id ), TIMER_FALSE );
+        destroy_shm_timer_manager( m2 );
+        //子进程添加的定时器由父进程执行
+        pid = fork();
+
+        if( pid == 0 ) {
+                _exit( m->add( m, &t ) != 0 && m->add( m, &t ) != 0 ? 0 : 1 );
+        }
+
+        assert_true( pid > 0 );
+        assert_int_equal( waitpid( pid, &status, 0 ), pid );
+        assert_true( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+        m->start( m, TIMER_START_EMBED );
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        now.tv_sec += 1;
+        assert_int_equal( m->process_expired( m, &now ), 2 );
+        m->get_stats( m, &stats );
+        assert_int_equal( stats.adds, 3 );
+        assert_int_equal( stats.expirations, 2 );
+        assert_int_equal( stats.timers, 0 );
+        //THREAD回调拿到的是param的副本，节点被复用后不受影响
+        e = create_timer_executor( &econf );
+        assert_true( e != NULL );
+        exec_seen_num = 0;
+        sem_init( &exec_started, 0, 0 );
+        sem_init( &exec_release, 0, 0 );
+        m->set_executor( m, e );
+        assert_int_not_equal( m->add( m, &block ), 0 );
+        now.tv_sec += 1;
+        assert_int_equal( m->process_expired( m, &now ), 1 );
+        sem_wait( &exec_started );
+        assert_int_not_equal( m->add( m, &t_1 ), 0 );
+        now.tv_sec += 1;
+        assert_int_equal( m->process_expired( m, &now ), 1 );
+        id = m->add( m, &clobber );
+        assert_int_not_equal( id, 0 );
+        sem_post( &exec_release );
+        m->set_executor( m, NULL );
+        destroy_timer_executor( e );
+        assert_int_equal( exec_seen_num, 1 );
+        assert_int_equal( strcmp( exec_seen[0], "p0" ), 0 );
+        assert_int_equal( m->del( m, id ), TIMER_TRUE );
+        sem_destroy( &exec_started );
+        sem_destroy( &exec_release );
+        m->stop( m );
+        destroy_shm_timer_manager( m );
+        assert_int_equal( unlink_shm_timer_manager( name ), TIMER_TRUE );
+        assert_int_equal( unlink_shm_timer_manager( name ), TIMER_FALSE );
+}
+
+static char snapshot_param[64];
+
+void *snapshot_task( void *p )
+{
+        strncpy( snapshot_param, ( char * )p, sizeof( snapshot_param ) - 1 );
+        return NULL;
+}
+
+//在另一个程序中按名字找回调，恢复后执行到期的snapshot_task；返回0表示param正确，1表示恢复失败
+int snapshot_restore_main( const char *path, const char *param )
+{
+        struct timer_manager_conf conf = {10, 30, 10, TIMER_WHEEL_SINGLE, 0};
+        TIMER_MANAGER *m = create_timer_manager();
+        struct timespec now;
+        int ret = 1;
+        timer_snapshot_register( "snapshot_task", snapshot_task );
+        m->init( m, &conf );
+        m->start( m, TIMER_START_EMBED );
+
+        if( m->restore( m, path ) == TIMER_TRUE ) {
+                clock_gettime( CLOCK_MONOTONIC, &now );
+                now.tv_sec += 1;
+                m->process_expired( m, &now );
+                ret = strcmp( snapshot_param, param ) == 0 ? 0 : 2;
+        }
+
+        m->stop( m );
+        destroy_timer_manager( m );
+        return ret;
+}
+
+//把测试程序拷贝一份并改掉其中的build-id，得到一个不同的程序，在里面恢复path，返回它的退出码
+int snapshot_restore_other( const char *path, const char *param )
+{
+        //ELF note头: namesz=4, descsz, type=NT_GNU_BUILD_ID, "GNU"
+        const unsigned char head[4] = {4, 0, 0, 0}, type[8] = {3, 0, 0, 0, 'G', 'N', 'U', 0};
+        const char *exe = "/tmp/simpletimer_test_other";
+        char *buf;
+        long size, i;
+        FILE *fp;
+        pid_t pid;
+        int status;
+        fp = fopen( "/proc/self/exe", "rb" );
+        assert_true( fp != NULL );
+        fseek( fp, 0, SEEK_END );
+        size = ftell( fp );
+        rewind( fp );
+        buf = malloc( size );
+        assert_true( buf != NULL );
+        assert_int_equal( fread( buf, size, 1, fp ), 1 );
+        fclose( fp );
+
+        for( i = 0; i + 16 < size; ++i ) {
+                if( memcmp( buf + i, head, 4 ) == 0 && memcmp( buf + i + 8, type, 8 ) == 0 ) {
+                        buf[i + 16] ^= 0xff;
+                        break;
+                }
+        }
+
+        assert_true( i + 16 < size );
+        fp = fopen( exe, "wb" );
+        assert_true( fp != NULL );
+        assert_int_equal( fwrite( buf, size, 1, fp ), 1 );
+        fclose( fp );
+        free( buf );
+        chmod( exe, 0755 );
+        pid = fork();
+
+        if( pid == 0 ) {
+                execl( exe, exe, "--restore", path, param, ( char * )NULL );
+                _exit( 3 );
+        }
+
+        assert_true( pid > 0 );
+        assert_int_equal( waitpid( pid, &status, 0 ), pid );
+        unlink( exe );
+        return WIFEXITED( status ) ? WEXITSTATUS( status ) : -1;
+}
+
+void test_snapshot( void **state )
+{
+        const char *param = "a param longer than the inline buffer of a node";
+        struct timer t[2] = {{SINGLE_SHOT, DIRECT, 500, snapshot_task, ( void * )param, strlen( param ) + 1},
+                {REPEAT, DIRECT, 20, timer_task, "snapshot", sizeof( "snapshot" )}
+        };
+        struct timer_manager_conf conf = {10, 30, 10, TIMER_WHEEL_SINGLE, 0},
+               conf_1 = {10, 30, 10, TIMER_WHEEL_HIERARCHY, 0};
+        TIMER_MANAGER *m = create_timer_manager(), *sm = create_sharded_timer_manager( 2 );
+        MH_TIMER_MANAGER *h = create_mh_timer_manager();
+        CQ_TIMER_MANAGER *c = create_cq_timer_manager();
+        const char *path = "/tmp/simpletimer_test.snapshot";
+        struct timer_stats stats;
+        struct timespec now, later;
+        timer_id id;
+        FILE *fp;
+        assert_int_equal( m->init( m, &conf ), TIMER_TRUE );
+        m->start( m, TIMER_START_EMBED );
+        assert_int_equal( m->add_batch( m, t, 2, NULL ), 2 );
+        assert_int_equal( m->snapshot( m, path ), TIMER_TRUE );
+        m->stop( m );
+        m->close( m );
+        //恢复到多级时间轮，到期时间不变
+        assert_int_equal( m->init( m, &conf_1 ), TIMER_TRUE );
+        m->start( m, TIMER_START_EMBED );
+        assert_int_equal( m->restore( m, path ), TIMER_TRUE );
+        m->get_stats( m, &stats );
+        assert_int_equal( stats.timers, 2 );
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        later = now;
+        later.tv_nsec += 300 * 1000000;
+        memset( snapshot_param, 0, sizeof( snapshot_param ) );
+        assert_int_equal( m->process_expired( m, &later ), 1 );
+        assert_int_equal( snapshot_param[0], 0 );
+        now.tv_sec += 1;
+        assert_int_equal( m->process_expired( m, &now ), 2 );
+        assert_int_equal( strcmp( snapshot_param, param ), 0 );
+        m->stop( m );
+        destroy_timer_manager( m );
+        //最小堆、日历队列和分片时间轮读取同一个文件
+        assert_int_equal( h->init( h, 10 ), TIMER_TRUE );
+        h->start( h, TIMER_START_EMBED );
+        assert_int_equal( h->restore( h, path ), TIMER_TRUE );
+        h->get_stats( h, &stats );
+        assert_int_equal( stats.timers, 2 );
+        assert_int_equal( h->process_expired( h, &now ), 2 );
+        h->stop( h );
+        destroy_mh_timer_manager( h );
+        assert_int_equal( c->init( c, 10 ), TIMER_TRUE );
+        c->start( c, TIMER_START_EMBED );
+        assert_int_equal( c->restore( c, path ), TIMER_TRUE );
+        c->get_stats( c, &stats );
+        assert_int_equal( stats.timers, 2 );
+        assert_int_equal( c->process_expired( c, &now ), 2 );
+        destroy_cq_timer_manager( c );
+        assert_int_equal( sm->init( sm, &conf ), TIMER_TRUE );
+        assert_int_equal( sm->restore( sm, path ), TIMER_TRUE );
+        assert_int_equal( sm->snapshot( sm, path ), TIMER_TRUE );
+        assert_int_equal( sm->restore( sm, path ), TIMER_TRUE );
+        sm->get_stats( sm, &stats );
+        assert_int_equal( stats.timers, 4 );
+        sm->close( sm );
+        destroy_sharded_timer_manager( sm );
+        //一个名字只对应一个回调
+        assert_int_equal( timer_snapshot_register( "snapshot_task", snapshot_task ), TIMER_TRUE );
+        assert_int_equal( timer_snapshot_register( "snapshot_task", snapshot_task ), TIMER_TRUE );
+        assert_int_equal( timer_snapshot_register( "snapshot_task", timer_task ), TIMER_FALSE );
+        assert_int_equal( timer_snapshot_register( "other_task", snapshot_task ), TIMER_FALSE );
+        assert_int_equal( timer_snapshot_register( "", timer_task ), TIMER_FALSE );
+        //build-id不同的程序可以恢复登记了名字的回调，没有登记的回调不能恢复
+        m = create_timer_manager();
+        assert_int_equal( m->init( m, &conf ), TIMER_TRUE );
+        m->start( m, TIMER_START_EMBED );
+        id = m->add( m, &t[0] );
+        assert_int_not_equal( id, 0 );
+        assert_int_equal( m->snapshot( m, path ), TIMER_TRUE );
+        assert_int_equal( snapshot_restore_other( path, param ), 0 );
+        assert_int_not_equal( m->add( m, &t[1] ), 0 );
+        assert_int_equal( m->snapshot( m, path ), TIMER_TRUE );
+        assert_int_equal( snapshot_restore_other( path, param ), 1 );
+        //同一个程序仍然可以按build-id恢复
+        assert_int_equal( m->del( m, id ), TIMER_TRUE );
+        assert_int_equal( m->snapshot( m, path ), TIMER_TRUE );
+        assert_int_equal( m->restore( m, path ), TIMER_TRUE );
+        m->stop( m );
+        destroy_timer_manager( m );
+        //不是快照文件
+        fp = fopen( path, "w" );
+        assert_true( fp != NULL );
+        fprintf( fp, "not a snapshot" );
+        fclose( fp );
+        m = create_timer_manager();
+        assert_int_equal( m->init( m, &conf ), TIMER_TRUE );
+        assert_int_equal( m->restore( m, path ), TIMER_FALSE );
+        destroy_timer_manager( m );
+        unlink( path );
+}
+
+#define CQ_TEST_NUM     2000
+static unsigned int cq_fired[CQ_TEST_NUM];
+static volatile int cq_fired_num;
+
+void *cq_task( void *p )
+{
+        cq_fired[cq_fired_num++] = *( unsigned int * )p;
+        return NULL;
+}
+
+void test_calendar( void **state )
+{
+        static struct timer t[CQ_TEST_NUM];
+        static timer_id ids[CQ_TEST_NUM];
+        static unsigned int intervals[CQ_TEST_NUM];
+        struct timer r = {REPEAT, DIRECT, 10, cq_task, &intervals[0], sizeof( unsigned int )};
+        CQ_TIMER_MANAGER *c = create_cq_timer_manager();
+        struct timer_stats stats;
+        struct timespec now;
+        unsigned int i, seed = 1;
+        timer_id id;
+        assert_int_equal( c->init( c, CQ_TEST_NUM ), TIMER_TRUE );
+        c->start( c, TIMER_START_EMBED );
+
+        for( i = 0; i < CQ_TEST_NUM; i++ ) {
+                seed = seed * 1103515245 + 12345;
+                //大部分在1s内，少数远在一小时之后，桶宽度按最早的定时器估计
+                intervals[i] = i % 100 == 0 ? 3600 * 1000 + seed % 1000 : 1 + seed % 1000;
+                t[i] = r;
+                t[i].type = SINGLE_SHOT;
+                t[i].interval = intervals[i];
+                t[i].param = &intervals[i];
+        }
+
+        assert_int_equal( c->push_batch( c, t, CQ_TEST_NUM, ids ), CQ_TEST_NUM );
+        //桶数随定时器个数加倍
+        c->get_stats( c, &stats );
+        assert_int_equal( stats.timers, CQ_TEST_NUM );
+        assert_true( stats.busy_slots > 16 );
+        assert_int_equal( c->del( c, ids[1] ), TIMER_TRUE );
+        assert_int_equal( c->del( c, ids[1] ), TIMER_FALSE );
+        //param是拷贝，mod之后回调收到的仍是原来的间隔
+        assert_int_equal( c->mod( c, ids[2], 1500 ), TIMER_TRUE );
+        //到期顺序与到期时间一致，mod过的最后到期
+        cq_fired_num = 0;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        now.tv_sec += 2;
+        assert_int_equal( c->process_expired( c, &now ), CQ_TEST_NUM - CQ_TEST_NUM / 100 - 1 );
+
+        for( i = 1; i < ( unsigned int )cq_fired_num - 1; i++ ) {
+                assert_true( cq_fired[i - 1] <= cq_fired[i] );
+        }
+
+        assert_int_equal( cq_fired[cq_fired_num - 1], intervals[2] );
+        //剩下的定时器少于桶数的一半时桶数减半
+        c->get_stats( c, &stats );
+        assert_int_equal( stats.timers, CQ_TEST_NUM / 100 );
+        assert_true( stats.busy_slots <= 32 );
+        now.tv_sec += 3600 + 1;
+        assert_int_equal( c->process_expired( c, &now ), CQ_TEST_NUM / 100 );
+        c->stop( c );
+        //以线程方式运行循环定时器，stop等待定时器线程退出
+        cq_fired_num = 0;
+        assert_int_not_equal( id = c->push( c, &r ), 0 );
+        c->start( c, TIMER_START_UNBLOCK );
+        usleep( 100 * 1000 );
+        c->stop( c );
+        assert_true( cq_fired_num >= 5 );
+        assert_int_equal( c->del( c, id ), TIMER_TRUE );
+        destroy_cq_timer_manager( c );
 }
 
-int main()
+int main( int argc, char **argv )
 {
+        //test_snapshot在另一个程序中恢复快照
+        if( argc == 4 && strcmp( argv[1], "--restore" ) == 0 ) {
+                return snapshot_restore_main( argv[2], argv[3] );
+        }
+
         p = create_timer_manager();
         p1 = create_mh_timer_manager();
 
@@ -88,7 +1324,24 @@ int main()
 
         UnitTest TESTS[] = {
                 unit_test( test_init ),
-                unit_test( test_add_and_del )
+                unit_test( test_add_and_del ),
+                unit_test( test_mh_push_and_del ),
+                unit_test( test_hierarchy_wheel ),
+                unit_test( test_submit_queue ),
+                unit_test( test_executor ),
+                unit_test( test_sharded ),
+                unit_test( test_embed ),
+                unit_test( test_tickless ),
+                unit_test( test_tickless_queue ),
+                unit_test( test_overrun ),
+                unit_test( test_clock ),
+                unit_test( test_slack ),
+                unit_test( test_batch ),
+                unit_test( test_stats ),
+                unit_test( test_trace ),
+                unit_test( test_shm ),
+                unit_test( test_snapshot ),
+                unit_test( test_calendar )
         };
         return run_tests( TESTS );
 }
@@ -0,0 +1,153 @@
+/**
+ * @file timer_trace.c
+ * @brief dump_trace写出的跟踪文件的解析工具
+ *
+ * 每个事件输出一行: 绝对时间(CLOCK_REALTIME) 距第一个事件的微秒数 分片 cpu 事件 id arg，
+ * 最后输出每种事件的个数、最大到期延迟和DIRECT回调的最长耗时
+ *
+ * 用法: timer_trace [-i id] [-s] 文件
+ *
+ * @version 0.1
+ * @date 2012-07-05
+ */
+
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_SOURCE	65536
+
+static const char *type_name[] = {
+        "?", "add", "del", "mod", "expire", "cb_start", "cb_end", "overrun", "cascade"
+};
+
+#define TYPE_NUM	( sizeof( type_name ) / sizeof( type_name[0] ) )
+
+///tsc差值换算成纳秒
+static inline double tsc_ns( const struct timer_trace_header *h, int64_t delta )
+{
+        return ( double )delta * 1e9 / ( double )h->tsc_hz;
+}
+
+static void usage( const char *name )
+{
+        fprintf( stderr, "usage: %s [-i id] [-s] file\n"
+                 "  -i  only print events of this timer id\n"
+                 "  -s  only print the summary\n", name );
+}
+
+static void print_event( const struct timer_trace_header *h, const struct timer_trace_event *e, uint64_t first )
+{
+        double real = ( double )h->realtime_base + tsc_ns( h, ( int64_t )( e->tsc - h->tsc_base ) );
+        time_t sec = ( time_t )( real / 1e9 );
+        struct tm tm;
+        char buf[32];
+
+        localtime_r( &sec, &tm );
+        strftime( buf, sizeof( buf ), "%H:%M:%S", &tm );
+        printf( "%s.%06ld %12.3f %3u %3u %-8s %10u %u\n", buf, ( long )( ( real - ( double )sec * 1e9 ) / 1000 ),
+                tsc_ns( h, ( int64_t )( e->tsc - first ) ) / 1000, e->source, e->cpu,
+                e->type < TYPE_NUM ? type_name[e->type] : "?", e->id, e->arg );
+}
+
+int main( int argc, char **argv )
+{
+        struct timer_trace_header h;
+        struct timer_trace_event e;
+        unsigned long long count[TYPE_NUM], n = 0, max_late = 0;
+        uint64_t first = 0, *cb_start, max_cb = 0;
+        unsigned long long filter = 0;
+        int summary = 0, opt;
+        FILE *fp;
+
+        while( ( opt = getopt( argc, argv, "i:sh" ) ) != -1 ) {
+                switch( opt ) {
+                        case 'i':
+                                filter = strtoull( optarg, NULL, 0 );
+                                break;
+                        case 's':
+                                summary = 1;
+                                break;
+                        default:
+                                usage( argv[0] );
+                                return opt == 'h' ? 0 : 1;
+                }
+        }
+
+        if( optind >= argc ) {
+                usage( argv[0] );
+                return 1;
+        }
+
+        if( ( fp = fopen( argv[optind], "rb" ) ) == NULL ) {
+                perror( "open trace file failed" );
+                return 1;
+        }
+
+        if( fread( &h, sizeof( h ), 1, fp ) != 1 || memcmp( h.magic, TIMER_TRACE_MAGIC, sizeof( h.magic ) ) != 0
+                        || h.version != TIMER_TRACE_VERSION || h.event_size != sizeof( struct timer_trace_event ) || h.tsc_hz == 0 ) {
+                fprintf( stderr, "%s is not a timer trace file\n", argv[optind] );
+                fclose( fp );
+                return 1;
+        }
+
+        ///每个分片的回调在同一个线程中顺序执行，按分片记下回调开始的时间
+        if( ( cb_start = calloc( MAX_SOURCE, sizeof( uint64_t ) ) ) == NULL ) {
+                perror( "malloc failed" );
+                fclose( fp );
+                return 1;
+        }
+
+        memset( count, 0, sizeof( count ) );
+
+        if( !summary ) {
+                printf( "%-15s %12s %3s %3s %-8s %10s %s\n", "time", "us", "src", "cpu", "event", "id", "arg" );
+        }
+
+        while( n < h.count && fread( &e, sizeof( e ), 1, fp ) == 1 ) {
+                if( n++ == 0 ) {
+                        first = e.tsc;
+                }
+
+                if( filter != 0 && e.id != filter ) {
+                        continue;
+                }
+
+                ++count[e.type < TYPE_NUM ? e.type : 0];
+
+                if( e.type == TIMER_TRACE_EXPIRE && e.arg > max_late ) {
+                        max_late = e.arg;
+                } else if( e.type == TIMER_TRACE_CB_START ) {
+                        cb_start[e.source] = e.tsc;
+                } else if( e.type == TIMER_TRACE_CB_END && cb_start[e.source] != 0 ) {
+                        if( e.tsc - cb_start[e.source] > max_cb ) {
+                                max_cb = e.tsc - cb_start[e.source];
+                        }
+
+                        cb_start[e.source] = 0;
+                }
+
+                if( !summary ) {
+                        print_event( &h, &e, first );
+                }
+        }
+
+        if( n < h.count ) {
+                fprintf( stderr, "truncated: %llu of %llu events\n", n, ( unsigned long long )h.count );
+        }
+
+        printf( "events %llu lost %llu tsc_hz %llu\n", n, ( unsigned long long )h.lost, ( unsigned long long )h.tsc_hz );
+
+        for( opt = 1; opt < ( int )TYPE_NUM; opt++ ) {
+                printf( "%s %llu\n", type_name[opt], count[opt] );
+        }
+
+        printf( "max lateness %llu us, max callback %.3f us\n", max_late, tsc_ns( &h, ( int64_t )max_cb ) / 1000 );
+        free( cb_start );
+        fclose( fp );
+        return 0;
+}